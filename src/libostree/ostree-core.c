@@ -28,6 +28,13 @@
 #include "ostree.h"
 #include "otutil.h"
 
+#ifdef HAVE_ZSTD
+#include "ostree-zstd-converter.h"
+#endif
+#ifdef HAVE_LZ4
+#include "ostree-lz4-converter.h"
+#endif
+
 #include <sys/types.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -389,6 +396,15 @@ ostree_raw_file_to_content_stream (GInputStream       *input,
   return ret;
 }
 
+/**
+ * ostree_content_stream_parse:
+ * @input: Content stream
+ * @input_length: Total length of @input, or 0 if unknown
+ *
+ * Read the file header from @input.  For regular files, @out_input
+ * is @input positioned at the start of the content.  If
+ * @input_length is 0, the size of @out_file_info is not set.
+ */
 gboolean
 ostree_content_stream_parse (GInputStream           *input,
                              guint64                 input_length,
@@ -415,7 +431,7 @@ ostree_content_stream_parse (GInputStream           *input,
                                 cancellable, error))
     goto out;
   archive_header_size = GUINT32_FROM_BE (archive_header_size);
-  if (archive_header_size > input_length)
+  if (input_length > 0 && archive_header_size > input_length)
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                    "File header size %u exceeds size %" G_GUINT64_FORMAT,
@@ -449,7 +465,7 @@ ostree_content_stream_parse (GInputStream           *input,
                                  out_xattrs ? &ret_xattrs : NULL,
                                  error))
     goto out;
-  if (ret_file_info)
+  if (ret_file_info && input_length > 0)
     g_file_info_set_size (ret_file_info, input_length - archive_header_size - 8);
   
   if (g_file_info_get_file_type (ret_file_info) == G_FILE_TYPE_REGULAR
@@ -996,6 +1012,302 @@ ostree_get_relative_pack_data_path (gboolean        is_meta,
   return get_pack_name (is_meta, FALSE, "objects/pack/", checksum);
 }
 
+char *
+ostree_get_static_delta_name (const char     *from,
+                              const char     *to)
+{
+  return g_strconcat (from, "-", to, NULL);
+}
+
+#define ROLLSUM_BLOCK_SIZE (512)
+
+static guint32
+rollsum_compute (const guchar  *buf,
+                 gsize          len,
+                 guint32       *out_a,
+                 guint32       *out_b)
+{
+  guint32 a = 0;
+  guint32 b = 0;
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    {
+      a += buf[i];
+      b += (len - i) * buf[i];
+    }
+
+  *out_a = a & 0xffff;
+  *out_b = b & 0xffff;
+  return (*out_b << 16) | *out_a;
+}
+
+static void
+append_copy_op (GByteArray   *ops,
+                guint64       offset,
+                guint32       len)
+{
+  guchar op = OSTREE_STATIC_DELTA_OP_COPY;
+  guint64 offset_be = GUINT64_TO_BE (offset);
+  guint32 len_be = GUINT32_TO_BE (len);
+
+  g_byte_array_append (ops, &op, 1);
+  g_byte_array_append (ops, (guchar*)&offset_be, 8);
+  g_byte_array_append (ops, (guchar*)&len_be, 4);
+}
+
+static void
+append_insert_op (GByteArray   *ops,
+                  const guchar *data,
+                  guint32       len)
+{
+  guchar op = OSTREE_STATIC_DELTA_OP_INSERT;
+  guint32 len_be = GUINT32_TO_BE (len);
+
+  g_byte_array_append (ops, &op, 1);
+  g_byte_array_append (ops, (guchar*)&len_be, 4);
+  g_byte_array_append (ops, data, len);
+}
+
+/**
+ * ostree_static_delta_compute_rollsum:
+ *
+ * Compute operations rebuilding @data from @base, in the format
+ * described for %OSTREE_STATIC_DELTA_ROLLSUM_FORMAT.  This is rsync
+ * style matching: index @base in fixed blocks by their weak rolling
+ * checksum, then slide a window over @data looking for blocks which
+ * also compare equal, extending each match forward.
+ *
+ * Returns: (transfer full): Operations, free with g_byte_array_free()
+ */
+GByteArray *
+ostree_static_delta_compute_rollsum (const guchar  *base,
+                                     gsize          base_len,
+                                     const guchar  *data,
+                                     gsize          data_len)
+{
+  const gsize block_size = ROLLSUM_BLOCK_SIZE;
+  GByteArray *ops;
+  GHashTable *blocks;
+  gsize offset;
+  gsize pos = 0;
+  gsize insert_start = 0;
+  gboolean have_sum = FALSE;
+  guint32 a = 0;
+  guint32 b = 0;
+
+  blocks = g_hash_table_new (NULL, NULL);
+  for (offset = 0; offset + block_size <= base_len; offset += block_size)
+    {
+      guint32 sum = rollsum_compute (base + offset, block_size, &a, &b);
+      if (!g_hash_table_lookup (blocks, GUINT_TO_POINTER (sum)))
+        g_hash_table_insert (blocks, GUINT_TO_POINTER (sum), GSIZE_TO_POINTER (offset + 1));
+    }
+
+  ops = g_byte_array_new ();
+
+  while (pos + block_size <= data_len)
+    {
+      gpointer match;
+
+      if (!have_sum)
+        {
+          (void) rollsum_compute (data + pos, block_size, &a, &b);
+          have_sum = TRUE;
+        }
+
+      match = g_hash_table_lookup (blocks, GUINT_TO_POINTER ((b << 16) | a));
+      if (match)
+        {
+          gsize base_offset = GPOINTER_TO_SIZE (match) - 1;
+
+          if (memcmp (base + base_offset, data + pos, block_size) == 0)
+            {
+              gsize match_len = block_size;
+
+              while (pos + match_len < data_len
+                     && base_offset + match_len < base_len
+                     && match_len < G_MAXUINT32
+                     && base[base_offset + match_len] == data[pos + match_len])
+                match_len++;
+
+              if (pos > insert_start)
+                append_insert_op (ops, data + insert_start, pos - insert_start);
+              append_copy_op (ops, base_offset, match_len);
+
+              pos += match_len;
+              insert_start = pos;
+              have_sum = FALSE;
+              continue;
+            }
+        }
+
+      if (pos + block_size < data_len)
+        {
+          guchar old_byte = data[pos];
+          guchar new_byte = data[pos + block_size];
+
+          a = (a - old_byte + new_byte) & 0xffff;
+          b = (b - block_size * old_byte + a) & 0xffff;
+        }
+      pos++;
+    }
+
+  if (data_len > insert_start)
+    append_insert_op (ops, data + insert_start, data_len - insert_start);
+
+  g_hash_table_unref (blocks);
+  return ops;
+}
+
+static void
+set_truncated_delta_error (GError **error)
+{
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+               "Truncated static delta operations");
+}
+
+/*
+ * Run @ops against @base, writing exactly @dest_len bytes to @dest.
+ * If @dest is %NULL, only check that they would.
+ */
+static gboolean
+rollsum_run_ops (const guchar   *base,
+                 gsize           base_len,
+                 const guchar   *ops,
+                 gsize           ops_len,
+                 guchar         *dest,
+                 gsize           dest_len,
+                 GError        **error)
+{
+  gboolean ret = FALSE;
+  gsize pos = 0;
+  gsize written = 0;
+
+  while (pos < ops_len)
+    {
+      guchar op = ops[pos++];
+      const guchar *src;
+      guint64 offset;
+      guint32 len;
+
+      if (op == OSTREE_STATIC_DELTA_OP_COPY)
+        {
+          if (ops_len - pos < 12)
+            {
+              set_truncated_delta_error (error);
+              goto out;
+            }
+          memcpy (&offset, ops + pos, 8);
+          offset = GUINT64_FROM_BE (offset);
+          memcpy (&len, ops + pos + 8, 4);
+          len = GUINT32_FROM_BE (len);
+          pos += 12;
+
+          if (offset > base_len || len > base_len - offset)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Invalid static delta copy of %u bytes at %" G_GUINT64_FORMAT,
+                           len, offset);
+              goto out;
+            }
+          src = base + offset;
+        }
+      else if (op == OSTREE_STATIC_DELTA_OP_INSERT)
+        {
+          if (ops_len - pos < 4)
+            {
+              set_truncated_delta_error (error);
+              goto out;
+            }
+          memcpy (&len, ops + pos, 4);
+          len = GUINT32_FROM_BE (len);
+          pos += 4;
+
+          if (len > ops_len - pos)
+            {
+              set_truncated_delta_error (error);
+              goto out;
+            }
+          src = ops + pos;
+          pos += len;
+        }
+      else
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Invalid static delta operation %u", (guint)op);
+          goto out;
+        }
+
+      if (len > dest_len - written)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Static delta operations rebuild more than the expected %" G_GSIZE_FORMAT " bytes",
+                       dest_len);
+          goto out;
+        }
+      if (dest)
+        memcpy (dest + written, src, len);
+      written += len;
+    }
+
+  if (written != dest_len)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Static delta operations rebuild %" G_GSIZE_FORMAT " bytes, expected %" G_GSIZE_FORMAT,
+                   written, dest_len);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * ostree_static_delta_apply_rollsum:
+ * @expected_len: Length of the rebuilt content, at most %OSTREE_ROLLSUM_MAX_SIZE
+ *
+ * Rebuild file content from @base using the operations @ops, as
+ * described for %OSTREE_STATIC_DELTA_ROLLSUM_FORMAT.  The operations
+ * are checked to produce exactly @expected_len bytes before anything
+ * is allocated.
+ */
+gboolean
+ostree_static_delta_apply_rollsum (const guchar   *base,
+                                   gsize           base_len,
+                                   const guchar   *ops,
+                                   gsize           ops_len,
+                                   gsize           expected_len,
+                                   guchar        **out_data,
+                                   gsize          *out_len,
+                                   GError        **error)
+{
+  gboolean ret = FALSE;
+  ot_lfree guchar *ret_data = NULL;
+
+  if (expected_len > OSTREE_ROLLSUM_MAX_SIZE)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Static delta content of %" G_GSIZE_FORMAT " bytes exceeds maximum %u",
+                   expected_len, OSTREE_ROLLSUM_MAX_SIZE);
+      goto out;
+    }
+
+  if (!rollsum_run_ops (base, base_len, ops, ops_len, NULL, expected_len, error))
+    goto out;
+
+  ret_data = g_malloc (MAX (expected_len, 1));
+  if (!rollsum_run_ops (base, base_len, ops, ops_len, ret_data, expected_len, error))
+    goto out;
+
+  ret = TRUE;
+  *out_len = expected_len;
+  ot_transfer_out_value (out_data, &ret_data);
+ out:
+  return ret;
+}
+
 gboolean
 ostree_file_header_parse (GVariant         *metadata,
                           GFileInfo       **out_file_info,
@@ -1406,138 +1718,1198 @@ ostree_read_pack_entry_raw (guchar        *pack_data,
   return ret;
 }
 
-gboolean
-ostree_parse_file_pack_entry (GVariant       *pack_entry,
-                              GInputStream  **out_input,
-                              GFileInfo     **out_info,
-                              GVariant      **out_xattrs,
-                              GCancellable   *cancellable,
-                              GError        **error)
+static void
+set_codec_unsupported_error (const char  *codec,
+                             GError     **error)
 {
-  gboolean ret = FALSE;
-  guchar entry_flags;
-  ot_lvariant GVariant *file_header = NULL;
-  ot_lvariant GVariant *pack_data = NULL;
-  ot_lobj GInputStream *memory_input = NULL;
-  ot_lobj GInputStream *ret_input = NULL;
-  ot_lobj GFileInfo *ret_info = NULL;
-  ot_lvariant GVariant *ret_xattrs = NULL;
+  /* Not G_IO_ERROR_NOT_SUPPORTED; pulls take that to mean the server
+   * lacks range requests.
+   */
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+               "Pack entry compression %s is not supported by this build", codec);
+}
 
-  g_variant_get_child (pack_entry, 1, "y", &entry_flags);
-  g_variant_get_child (pack_entry, 2, "@(uuuusa(ayay))", &file_header); 
-  g_variant_get_child (pack_entry, 3, "@ay", &pack_data);
+/**
+ * ostree_pack_entry_compressor_new:
+ * @entry_flags: One of the compression #OstreePackFileEntryFlag values
+ * @level: Codec specific compression level
+ * @dictionary: (allow-none): Trained zstd dictionary, of type "ay"
+ *
+ * Returns: (transfer full): A converter producing entry data in the
+ * format of @entry_flags, or %NULL if the codec is not supported or
+ * @level or @dictionary is invalid
+ */
+GConverter *
+ostree_pack_entry_compressor_new (guchar       entry_flags,
+                                  int          level,
+                                  GVariant    *dictionary,
+                                  GError     **error)
+{
+  if (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_GZIP)
+    {
+      if (level < -1 || level > 9)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Invalid gzip compression level %d", level);
+          return NULL;
+        }
+      return (GConverter*)g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, level);
+    }
+  else if (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_ZSTD)
+    {
+#ifdef HAVE_ZSTD
+      return ostree_zstd_converter_new_compressor (level, dictionary, error);
+#else
+      set_codec_unsupported_error ("zstd", error);
+#endif
+    }
+  else if (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_LZ4)
+    {
+#ifdef HAVE_LZ4
+      return ostree_lz4_converter_new_compressor (level, error);
+#else
+      set_codec_unsupported_error ("lz4", error);
+#endif
+    }
+  else
+    g_assert_not_reached ();
 
-  if (!ostree_file_header_parse (file_header, &ret_info, &ret_xattrs,
-                                 error))
-    goto out;
-  g_file_info_set_size (ret_info, g_variant_get_size (pack_data));
+  return NULL;
+}
+
+/*
+ * Read the metadata of the pack header at the start of @pack_data.
+ */
+static gboolean
+read_pack_header_metadata (guchar        *pack_data,
+                           guint64        pack_len,
+                           GVariant     **out_metadata,
+                           GError       **error)
+{
+  gboolean ret = FALSE;
+  guint32 header_len;
+  ot_lvariant GVariant *header = NULL;
+  ot_lvariant GVariant *ret_metadata = NULL;
 
-  if (g_file_info_get_file_type (ret_info) == G_FILE_TYPE_REGULAR)
+  if (pack_data == NULL || pack_len < 8)
     {
-      memory_input = ot_variant_read (pack_data);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Pack header is unavailable");
+      goto out;
+    }
 
-      if (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_GZIP)
-        {
-          ot_lobj GConverter *decompressor = NULL;
-
-          decompressor = (GConverter*)g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP);
-          ret_input = (GInputStream*)g_object_new (G_TYPE_CONVERTER_INPUT_STREAM,
-                                                   "converter", decompressor,
-                                                   "base-stream", memory_input,
-                                                   "close-base-stream", TRUE,
-                                                   NULL);
-        }
-      else
-        {
-          ret_input = g_object_ref (memory_input);
-        }
+  header_len = GUINT32_FROM_BE (*((guint32*)pack_data));
+  if (header_len > pack_len - 8)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Corrupted pack; out of range header length %u", header_len);
+      goto out;
     }
 
+  header = g_variant_new_from_data (G_VARIANT_TYPE ("(sa{sv}t)"), pack_data + 8, header_len,
+                                    FALSE, NULL, NULL);
+  g_variant_ref_sink (header);
+  ret_metadata = g_variant_get_child_value (header, 1);
+
   ret = TRUE;
-  ot_transfer_out_value (out_input, &ret_input);
-  ot_transfer_out_value (out_info, &ret_info);
-  ot_transfer_out_value (out_xattrs, &ret_xattrs);
+  ot_transfer_out_value (out_metadata, &ret_metadata);
  out:
   return ret;
 }
 
+/**
+ * ostree_read_pack_zstd_dictionary:
+ * @out_dictionary: (out) (transfer full): The zstd dictionary of the
+ * pack, ready for decompression, or %NULL if it has none
+ *
+ * Parsing the dictionary is costly; callers reading many entries of
+ * the same pack should do it once and pass the result to
+ * ostree_parse_file_pack_entry().
+ */
 gboolean
-ostree_pack_index_search (GVariant   *index,
-                          GVariant   *csum_v,
-                          OstreeObjectType objtype,
-                          guint64    *out_offset)
+ostree_read_pack_zstd_dictionary (guchar                 *pack_data,
+                                  guint64                 pack_len,
+                                  OstreeZstdDictionary  **out_dictionary,
+                                  GError                **error)
 {
   gboolean ret = FALSE;
-  gsize imax, imin;
-  gsize n;
-  guint32 target_objtype;
-  const guchar *csum;
-  ot_lvariant GVariant *index_contents = NULL;
-
-  csum = ostree_checksum_bytes_peek (csum_v);
-
-  index_contents = g_variant_get_child_value (index, 2);
-
-  target_objtype = (guint32) objtype;
+  OstreeZstdDictionary *ret_dictionary = NULL;
+  ot_lvariant GVariant *metadata = NULL;
+  ot_lvariant GVariant *dictionary = NULL;
 
-  n = g_variant_n_children (index_contents);
-
-  if (n == 0)
+  if (!read_pack_header_metadata (pack_data, pack_len, &metadata, error))
     goto out;
 
-  imax = n - 1;
-  imin = 0;
-  while (imax >= imin)
+  /* Without zstd support, entries needing the dictionary fail when read */
+#ifdef HAVE_ZSTD
+  if (g_variant_lookup (metadata, "zstd-dictionary", "@ay", &dictionary))
     {
-      GVariant *cur_csum_bytes;
-      guchar cur_objtype;
-      guint64 cur_offset;
-      gsize imid;
-      int c;
-
-      imid = (imin + imax) / 2;
-
-      g_variant_get_child (index_contents, imid, "(y@ayt)", &cur_objtype,
-                           &cur_csum_bytes, &cur_offset);      
-
-      c = ostree_cmp_checksum_bytes (ostree_checksum_bytes_peek (cur_csum_bytes), csum);
-      if (c == 0)
-        {
-          if (cur_objtype < target_objtype)
-            c = -1;
-          else if (cur_objtype > target_objtype)
-            c = 1;
-        }
-      g_variant_unref (cur_csum_bytes);
-
-      if (c < 0)
-        imin = imid + 1;
-      else if (c > 0)
-        {
-          if (imid == 0)
-            goto out;
-          imax = imid - 1;
-        }
-      else
-        {
-          if (out_offset)
-            *out_offset = GUINT64_FROM_BE (cur_offset);
-          ret = TRUE;
-          goto out;
-        } 
+      ret_dictionary = ostree_zstd_dictionary_new (dictionary, error);
+      if (!ret_dictionary)
+        goto out;
     }
+#endif
 
+  ret = TRUE;
+  *out_dictionary = ret_dictionary;
  out:
   return ret;
 }
 
+/**
+ * ostree_pack_entry_is_self_contained:
+ *
+ * Returns: %FALSE if the content of @pack_entry can only be read with
+ * other parts of its pack: the base of a delta, or the zstd dictionary
+ * in the pack header.
+ */
 gboolean
-ostree_validate_structureof_objtype (guchar    objtype,
-                                     GError   **error)
+ostree_pack_entry_is_self_contained (GVariant  *pack_entry)
 {
-  OstreeObjectType objtype_v = (OstreeObjectType) objtype;
-  if (objtype_v < OSTREE_OBJECT_TYPE_FILE 
-      || objtype_v > OSTREE_OBJECT_TYPE_COMMIT)
+  guchar entry_flags;
+
+  g_variant_get_child (pack_entry, 1, "y", &entry_flags);
+
+  if (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_DELTA)
+    return FALSE;
+#ifdef HAVE_ZSTD
+  if (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_ZSTD)
+    {
+      ot_lvariant GVariant *entry_data = NULL;
+
+      g_variant_get_child (pack_entry, 3, "@ay", &entry_data);
+      if (ostree_zstd_get_dictionary_id (g_variant_get_data (entry_data),
+                                         g_variant_get_size (entry_data)) != 0)
+        return FALSE;
+    }
+#endif
+  return TRUE;
+}
+
+/*
+ * Return a stream of the decompressed data of @pack_entry.
+ */
+static gboolean
+read_pack_entry_input (GVariant       *pack_entry,
+                       guchar         *pack_data,
+                       guint64         pack_len,
+                       OstreeZstdDictionary *zstd_dictionary,
+                       GInputStream  **out_input,
+                       GError        **error)
+{
+  gboolean ret = FALSE;
+  guchar entry_flags;
+  ot_lvariant GVariant *entry_data = NULL;
+  ot_lobj GConverter *decompressor = NULL;
+  ot_lobj GInputStream *memory_input = NULL;
+  ot_lobj GInputStream *ret_input = NULL;
+
+  g_variant_get_child (pack_entry, 1, "y", &entry_flags);
+  g_variant_get_child (pack_entry, 3, "@ay", &entry_data);
+
+  memory_input = ot_variant_read (entry_data);
+
+  if (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_GZIP)
+    decompressor = (GConverter*)g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+  else if (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_ZSTD)
+    {
+#ifdef HAVE_ZSTD
+      OstreeZstdDictionary *dictionary = NULL;
+
+      if (ostree_zstd_get_dictionary_id (g_variant_get_data (entry_data),
+                                         g_variant_get_size (entry_data)) != 0)
+        {
+          if (zstd_dictionary)
+            dictionary = ostree_zstd_dictionary_ref (zstd_dictionary);
+          else if (!ostree_read_pack_zstd_dictionary (pack_data, pack_len, &dictionary, error))
+            goto out;
+          if (!dictionary)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Pack entry needs a zstd dictionary, but the pack has none");
+              goto out;
+            }
+        }
+      decompressor = ostree_zstd_converter_new_decompressor (dictionary, error);
+      if (dictionary)
+        ostree_zstd_dictionary_unref (dictionary);
+      if (!decompressor)
+        goto out;
+#else
+      set_codec_unsupported_error ("zstd", error);
+      goto out;
+#endif
+    }
+  else if (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_LZ4)
+    {
+#ifdef HAVE_LZ4
+      decompressor = ostree_lz4_converter_new_decompressor (error);
+      if (!decompressor)
+        goto out;
+#else
+      set_codec_unsupported_error ("lz4", error);
+      goto out;
+#endif
+    }
+
+  if (decompressor)
+    ret_input = (GInputStream*)g_object_new (G_TYPE_CONVERTER_INPUT_STREAM,
+                                             "converter", decompressor,
+                                             "base-stream", memory_input,
+                                             "close-base-stream", TRUE,
+                                             NULL);
+  else
+    ret_input = g_object_ref (memory_input);
+
+  ret = TRUE;
+  ot_transfer_out_value (out_input, &ret_input);
+ out:
+  return ret;
+}
+
+static gboolean
+read_varint (const guchar  **inout_p,
+             const guchar   *end,
+             guint64        *out_value,
+             GError        **error)
+{
+  const guchar *p = *inout_p;
+  guint64 value = 0;
+  guint shift = 0;
+
+  while (TRUE)
+    {
+      if (p >= end || shift > 63)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Corrupted compact dirtree; invalid varint");
+          return FALSE;
+        }
+      value |= ((guint64)(*p & 0x7F)) << shift;
+      shift += 7;
+      if (!(*p++ & 0x80))
+        break;
+    }
+
+  *inout_p = p;
+  *out_value = value;
+  return TRUE;
+}
+
+static gboolean
+read_dictionary_index (const guchar  **inout_p,
+                       const guchar   *end,
+                       gsize           n_entries,
+                       guint64        *out_index,
+                       GError        **error)
+{
+  if (!read_varint (inout_p, end, out_index, error))
+    return FALSE;
+  if (*out_index >= n_entries)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Corrupted compact dirtree; out of range index %" G_GUINT64_FORMAT,
+                   *out_index);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/**
+ * ostree_expand_compact_dirtree:
+ * @compact: Dirtree in the compact form of version 1 meta packs
+ * @names: Dictionary of names from the pack header
+ * @checksums: Dictionary of checksums from the pack header
+ *
+ * Returns: (transfer full): The dirtree in canonical form, or %NULL
+ */
+GVariant *
+ostree_expand_compact_dirtree (GVariant       *compact,
+                               GVariant       *names,
+                               GVariant       *checksums,
+                               GError        **error)
+{
+  GVariant *ret = NULL;
+  const guchar *p = g_variant_get_data (compact);
+  const guchar *end = p + g_variant_get_size (compact);
+  const guchar *checksum_data = g_variant_get_data (checksums);
+  gsize n_names = g_variant_n_children (names);
+  gsize n_checksums = g_variant_get_size (checksums) / 32;
+  guint64 i, n;
+  GVariantBuilder files_builder;
+  GVariantBuilder dirs_builder;
+
+  g_variant_builder_init (&files_builder, G_VARIANT_TYPE ("a(say)"));
+  g_variant_builder_init (&dirs_builder, G_VARIANT_TYPE ("a(sayay)"));
+
+  if (!read_varint (&p, end, &n, error))
+    goto out;
+  for (i = 0; i < n; i++)
+    {
+      guint64 name_index, csum_index;
+      const char *name;
+
+      if (!read_dictionary_index (&p, end, n_names, &name_index, error)
+          || !read_dictionary_index (&p, end, n_checksums, &csum_index, error))
+        goto out;
+
+      g_variant_get_child (names, name_index, "&s", &name);
+      g_variant_builder_add (&files_builder, "(s@ay)", name,
+                             ot_gvariant_new_bytearray (checksum_data + csum_index * 32, 32));
+    }
+
+  if (!read_varint (&p, end, &n, error))
+    goto out;
+  for (i = 0; i < n; i++)
+    {
+      guint64 name_index, tree_index, meta_index;
+      const char *name;
+
+      if (!read_dictionary_index (&p, end, n_names, &name_index, error)
+          || !read_dictionary_index (&p, end, n_checksums, &tree_index, error)
+          || !read_dictionary_index (&p, end, n_checksums, &meta_index, error))
+        goto out;
+
+      g_variant_get_child (names, name_index, "&s", &name);
+      g_variant_builder_add (&dirs_builder, "(s@ay@ay)", name,
+                             ot_gvariant_new_bytearray (checksum_data + tree_index * 32, 32),
+                             ot_gvariant_new_bytearray (checksum_data + meta_index * 32, 32));
+    }
+
+  if (p != end)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Corrupted compact dirtree; trailing data");
+      goto out;
+    }
+
+  ret = g_variant_new ("(@a(say)@a(sayay))",
+                       g_variant_builder_end (&files_builder),
+                       g_variant_builder_end (&dirs_builder));
+  g_variant_ref_sink (ret);
+ out:
+  g_variant_builder_clear (&files_builder);
+  g_variant_builder_clear (&dirs_builder);
+  return ret;
+}
+
+/**
+ * ostree_parse_meta_pack_entry:
+ * @pack_data: Contents of the pack holding @pack_entry
+ * @out_metadata: (out): The metadata object in canonical form
+ *
+ * Compact dirtrees of version 1 meta packs are expanded using the
+ * dictionary in the pack header.
+ */
+gboolean
+ostree_parse_meta_pack_entry (GVariant       *pack_entry,
+                              guchar         *pack_data,
+                              guint64         pack_len,
+                              GVariant      **out_metadata,
+                              GError        **error)
+{
+  gboolean ret = FALSE;
+  guchar objtype_u8;
+  ot_lvariant GVariant *header_metadata = NULL;
+  ot_lvariant GVariant *names = NULL;
+  ot_lvariant GVariant *checksums = NULL;
+  ot_lvariant GVariant *ret_metadata = NULL;
+
+  g_variant_get_child (pack_entry, 0, "y", &objtype_u8);
+  g_variant_get_child (pack_entry, 2, "v", &ret_metadata);
+
+  if ((OstreeObjectType)objtype_u8 == OSTREE_OBJECT_TYPE_DIR_TREE
+      && g_variant_is_of_type (ret_metadata, G_VARIANT_TYPE ("ay")))
+    {
+      ot_lvariant GVariant *compact = ret_metadata;
+
+      ret_metadata = NULL;
+
+      if (!read_pack_header_metadata (pack_data, pack_len, &header_metadata, error))
+        goto out;
+      if (!g_variant_lookup (header_metadata, "names", "@as", &names)
+          || !g_variant_lookup (header_metadata, "checksums", "@ay", &checksums))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Compact dirtree in a pack without a dictionary");
+          goto out;
+        }
+
+      ret_metadata = ostree_expand_compact_dirtree (compact, names, checksums, error);
+      if (!ret_metadata)
+        goto out;
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_metadata, &ret_metadata);
+ out:
+  return ret;
+}
+
+static gboolean
+read_pack_entry_data (GVariant       *pack_entry,
+                      guchar         *pack_data,
+                      guint64         pack_len,
+                      OstreeZstdDictionary *zstd_dictionary,
+                      guint           depth,
+                      guchar        **out_data,
+                      gsize          *out_len,
+                      GCancellable   *cancellable,
+                      GError        **error);
+
+/*
+ * Rebuild the content of the delta entry @pack_entry, whose
+ * decompressed data is @delta of length @delta_len.
+ */
+static gboolean
+apply_pack_entry_delta (const guchar   *delta,
+                        gsize           delta_len,
+                        guchar         *pack_data,
+                        guint64         pack_len,
+                        OstreeZstdDictionary *zstd_dictionary,
+                        guint           depth,
+                        guchar        **out_data,
+                        gsize          *out_len,
+                        GCancellable   *cancellable,
+                        GError        **error)
+{
+  gboolean ret = FALSE;
+  guint64 base_offset;
+  guint64 content_len;
+  gsize base_len;
+  ot_lfree guchar *base_data = NULL;
+  ot_lvariant GVariant *base_entry = NULL;
+
+  if (pack_data == NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Delta pack entry without pack data");
+      goto out;
+    }
+  if (depth >= OSTREE_PACK_MAX_DELTA_DEPTH)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Pack delta chain exceeds maximum depth %u",
+                   OSTREE_PACK_MAX_DELTA_DEPTH);
+      goto out;
+    }
+  if (delta_len < 16)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Truncated pack delta entry");
+      goto out;
+    }
+
+  memcpy (&base_offset, delta, 8);
+  base_offset = GUINT64_FROM_BE (base_offset);
+  memcpy (&content_len, delta + 8, 8);
+  content_len = GUINT64_FROM_BE (content_len);
+  if (content_len > OSTREE_ROLLSUM_MAX_SIZE)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Pack delta entry of %" G_GUINT64_FORMAT " bytes exceeds maximum %u",
+                   content_len, OSTREE_ROLLSUM_MAX_SIZE);
+      goto out;
+    }
+
+  if (!ostree_read_pack_entry_raw (pack_data, pack_len, base_offset, FALSE, FALSE,
+                                   &base_entry, cancellable, error))
+    goto out;
+  if (!read_pack_entry_data (base_entry, pack_data, pack_len, zstd_dictionary, depth + 1,
+                             &base_data, &base_len, cancellable, error))
+    goto out;
+
+  if (!ostree_static_delta_apply_rollsum (base_data, base_len, delta + 16, delta_len - 16,
+                                          content_len, out_data, out_len, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/*
+ * Return the full content of a regular file @pack_entry, following
+ * delta entries back to their bases.
+ */
+static gboolean
+read_pack_entry_data (GVariant       *pack_entry,
+                      guchar         *pack_data,
+                      guint64         pack_len,
+                      OstreeZstdDictionary *zstd_dictionary,
+                      guint           depth,
+                      guchar        **out_data,
+                      gsize          *out_len,
+                      GCancellable   *cancellable,
+                      GError        **error)
+{
+  gboolean ret = FALSE;
+  guchar entry_flags;
+  gsize len;
+  ot_lobj GInputStream *input = NULL;
+  ot_lobj GOutputStream *data_out = NULL;
+  ot_lfree guchar *ret_data = NULL;
+
+  g_variant_get_child (pack_entry, 1, "y", &entry_flags);
+
+  if (!read_pack_entry_input (pack_entry, pack_data, pack_len, zstd_dictionary,
+                              &input, error))
+    goto out;
+
+  data_out = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  if (g_output_stream_splice (data_out, input, G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                              cancellable, error) < 0)
+    goto out;
+
+  len = g_memory_output_stream_get_data_size ((GMemoryOutputStream*)data_out);
+  ret_data = g_memory_output_stream_steal_data ((GMemoryOutputStream*)data_out);
+
+  if (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_DELTA)
+    {
+      if (!apply_pack_entry_delta (ret_data, len, pack_data, pack_len, zstd_dictionary, depth,
+                                   out_data, out_len, cancellable, error))
+        goto out;
+    }
+  else
+    {
+      *out_len = len;
+      ot_transfer_out_value (out_data, &ret_data);
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * ostree_parse_file_pack_entry:
+ * @pack_data: (allow-none): Contents of the pack holding @pack_entry,
+ * needed to rebuild delta entries and read its zstd dictionary
+ * @zstd_dictionary: (allow-none): Dictionary from
+ * ostree_read_pack_zstd_dictionary(); if %NULL, it is read from
+ * @pack_data when needed
+ */
+gboolean
+ostree_parse_file_pack_entry (GVariant       *pack_entry,
+                              guchar         *pack_data,
+                              guint64         pack_len,
+                              OstreeZstdDictionary *zstd_dictionary,
+                              GInputStream  **out_input,
+                              GFileInfo     **out_info,
+                              GVariant      **out_xattrs,
+                              GCancellable   *cancellable,
+                              GError        **error)
+{
+  gboolean ret = FALSE;
+  guchar entry_flags;
+  ot_lvariant GVariant *file_header = NULL;
+  ot_lvariant GVariant *entry_data = NULL;
+  ot_lobj GInputStream *ret_input = NULL;
+  ot_lobj GFileInfo *ret_info = NULL;
+  ot_lvariant GVariant *ret_xattrs = NULL;
+
+  g_variant_get_child (pack_entry, 1, "y", &entry_flags);
+  g_variant_get_child (pack_entry, 2, "@(uuuusa(ayay))", &file_header); 
+  g_variant_get_child (pack_entry, 3, "@ay", &entry_data);
+
+  if (!ostree_file_header_parse (file_header, &ret_info, &ret_xattrs,
+                                 error))
+    goto out;
+  g_file_info_set_size (ret_info, g_variant_get_size (entry_data));
+
+  if (g_file_info_get_file_type (ret_info) == G_FILE_TYPE_REGULAR
+      && (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_DELTA))
+    {
+      guchar *content;
+      gsize content_len;
+
+      if (!read_pack_entry_data (pack_entry, pack_data, pack_len, zstd_dictionary, 0,
+                                 &content, &content_len, cancellable, error))
+        goto out;
+
+      g_file_info_set_size (ret_info, content_len);
+      ret_input = g_memory_input_stream_new_from_data (content, content_len, g_free);
+    }
+  else if (g_file_info_get_file_type (ret_info) == G_FILE_TYPE_REGULAR)
+    {
+      if (!read_pack_entry_input (pack_entry, pack_data, pack_len, zstd_dictionary,
+                                  &ret_input, error))
+        goto out;
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_input, &ret_input);
+  ot_transfer_out_value (out_info, &ret_info);
+  ot_transfer_out_value (out_xattrs, &ret_xattrs);
+ out:
+  return ret;
+}
+
+static inline guint32
+read_be32 (const guchar *p)
+{
+  guint32 v;
+  memcpy (&v, p, 4);
+  return GUINT32_FROM_BE (v);
+}
+
+static inline guint64
+read_be64 (const guchar *p)
+{
+  guint64 v;
+  memcpy (&v, p, 8);
+  return GUINT64_FROM_BE (v);
+}
+
+static gboolean
+pack_index_is_v1 (GVariant *index)
+{
+  return g_variant_is_of_type (index, OSTREE_PACK_INDEX_V1_VARIANT_FORMAT);
+}
+
+/*
+ * Split a version 1 pack index blob into its component arrays.
+ * Returns %FALSE if the blob is truncated or inconsistent.
+ */
+static gboolean
+pack_index_v1_peek (const guchar  *blob,
+                    gsize          blob_len,
+                    guint64       *out_n_entries,
+                    const guchar **out_checksums,
+                    const guchar **out_objtypes,
+                    const guchar **out_offsets)
+{
+  guint64 n;
+
+  if (blob_len < OSTREE_PACK_INDEX_V1_FANOUT_SIZE)
+    return FALSE;
+
+  n = read_be32 (blob + (255 * 4));
+  if (blob_len != OSTREE_PACK_INDEX_V1_FANOUT_SIZE + n * (32 + 1 + 8))
+    return FALSE;
+
+  *out_n_entries = n;
+  *out_checksums = blob + OSTREE_PACK_INDEX_V1_FANOUT_SIZE;
+  *out_objtypes = *out_checksums + n * 32;
+  *out_offsets = *out_objtypes + n;
+  return TRUE;
+}
+
+static gboolean
+pack_index_v0_search (GVariant   *index,
+                      const guchar *csum,
+                      OstreeObjectType objtype,
+                      guint64    *out_offset)
+{
+  gboolean ret = FALSE;
+  gsize imax, imin;
+  gsize n;
+  guint32 target_objtype;
+  ot_lvariant GVariant *index_contents = NULL;
+
+  index_contents = g_variant_get_child_value (index, 2);
+
+  target_objtype = (guint32) objtype;
+
+  n = g_variant_n_children (index_contents);
+
+  if (n == 0)
+    goto out;
+
+  imax = n - 1;
+  imin = 0;
+  while (imax >= imin)
+    {
+      GVariant *cur_csum_bytes;
+      guchar cur_objtype;
+      guint64 cur_offset;
+      gsize imid;
+      int c;
+
+      imid = (imin + imax) / 2;
+
+      g_variant_get_child (index_contents, imid, "(y@ayt)", &cur_objtype,
+                           &cur_csum_bytes, &cur_offset);      
+
+      c = ostree_cmp_checksum_bytes (ostree_checksum_bytes_peek (cur_csum_bytes), csum);
+      if (c == 0)
+        {
+          if (cur_objtype < target_objtype)
+            c = -1;
+          else if (cur_objtype > target_objtype)
+            c = 1;
+        }
+      g_variant_unref (cur_csum_bytes);
+
+      if (c < 0)
+        imin = imid + 1;
+      else if (c > 0)
+        {
+          if (imid == 0)
+            goto out;
+          imax = imid - 1;
+        }
+      else
+        {
+          if (out_offset)
+            *out_offset = GUINT64_FROM_BE (cur_offset);
+          ret = TRUE;
+          goto out;
+        } 
+    }
+
+ out:
+  return ret;
+}
+
+static gboolean
+pack_index_v1_search (GVariant   *index,
+                      const guchar *csum,
+                      OstreeObjectType objtype,
+                      guint64    *out_offset)
+{
+  gboolean ret = FALSE;
+  const guchar *blob;
+  gsize blob_len;
+  guint64 n;
+  const guchar *checksums;
+  const guchar *objtypes;
+  const guchar *offsets;
+  guint64 imin, imax;
+  ot_lvariant GVariant *blob_v = NULL;
+
+  blob_v = g_variant_get_child_value (index, 2);
+  blob = g_variant_get_fixed_array (blob_v, &blob_len, 1);
+
+  if (!pack_index_v1_peek (blob, blob_len, &n, &checksums, &objtypes, &offsets))
+    goto out;
+
+  /* The fanout narrows the search to checksums with the same first byte */
+  imin = csum[0] > 0 ? read_be32 (blob + ((csum[0] - 1) * 4)) : 0;
+  imax = read_be32 (blob + (csum[0] * 4));
+  if (imax > n || imin > imax)
+    goto out;
+
+  while (imin < imax)
+    {
+      guint64 imid = imin + (imax - imin) / 2;
+      int c;
+
+      c = ostree_cmp_checksum_bytes (checksums + (imid * 32), csum);
+      if (c == 0)
+        c = (int)objtypes[imid] - (int)objtype;
+
+      if (c < 0)
+        imin = imid + 1;
+      else if (c > 0)
+        imax = imid;
+      else
+        {
+          if (out_offset)
+            *out_offset = read_be64 (offsets + (imid * 8));
+          ret = TRUE;
+          break;
+        }
+    }
+
+ out:
+  return ret;
+}
+
+gboolean
+ostree_pack_index_search (GVariant   *index,
+                          GVariant   *csum_v,
+                          OstreeObjectType objtype,
+                          guint64    *out_offset)
+{
+  const guchar *csum = ostree_checksum_bytes_peek (csum_v);
+
+  if (pack_index_is_v1 (index))
+    return pack_index_v1_search (index, csum, objtype, out_offset);
+  else
+    return pack_index_v0_search (index, csum, objtype, out_offset);
+}
+
+/**
+ * ostree_pack_index_iter_init:
+ * @iter: An iterator
+ * @index: A pack index variant, in either format
+ *
+ * Prepare @iter to walk over the entries of @index in order.  The
+ * caller must keep @index alive until ostree_pack_index_iter_clear().
+ */
+void
+ostree_pack_index_iter_init (OstreePackIndexIter *iter,
+                             GVariant            *index)
+{
+  memset (iter, 0, sizeof (*iter));
+
+  iter->contents = g_variant_get_child_value (index, 2);
+  if (pack_index_is_v1 (index))
+    {
+      gsize blob_len;
+
+      iter->blob = g_variant_get_fixed_array (iter->contents, &blob_len, 1);
+      if (!pack_index_v1_peek (iter->blob, blob_len, &iter->n_entries,
+                               &iter->checksums, &iter->objtypes, &iter->offsets))
+        iter->n_entries = 0;
+    }
+  else
+    {
+      iter->n_entries = g_variant_n_children (iter->contents);
+    }
+}
+
+/**
+ * ostree_pack_index_iter_next:
+ * @iter: An iterator
+ * @out_objtype: (out): Object type
+ * @out_csum: (out): Raw checksum, valid as long as the index
+ * @out_offset: (out): Offset into pack file, in host byte order
+ *
+ * Returns: %FALSE when there are no more entries
+ */
+gboolean
+ostree_pack_index_iter_next (OstreePackIndexIter  *iter,
+                             OstreeObjectType     *out_objtype,
+                             const guchar        **out_csum,
+                             guint64              *out_offset)
+{
+  guint64 i = iter->pos;
+
+  if (i >= iter->n_entries)
+    return FALSE;
+
+  if (iter->blob)
+    {
+      if (out_objtype)
+        *out_objtype = (OstreeObjectType) iter->objtypes[i];
+      if (out_csum)
+        *out_csum = iter->checksums + (i * 32);
+      if (out_offset)
+        *out_offset = read_be64 (iter->offsets + (i * 8));
+    }
+  else
+    {
+      guint8 objtype_u8;
+      guint64 offset;
+      ot_lvariant GVariant *csum_bytes = NULL;
+
+      g_variant_get_child (iter->contents, i, "(y@ayt)",
+                           &objtype_u8, &csum_bytes, &offset);
+      if (out_objtype)
+        *out_objtype = (OstreeObjectType) objtype_u8;
+      /* Points into the index data, which the caller keeps alive */
+      if (out_csum)
+        *out_csum = ostree_checksum_bytes_peek (csum_bytes);
+      if (out_offset)
+        *out_offset = GUINT64_FROM_BE (offset);
+    }
+
+  iter->pos++;
+  return TRUE;
+}
+
+void
+ostree_pack_index_iter_clear (OstreePackIndexIter *iter)
+{
+  g_clear_pointer (&iter->contents, (GDestroyNotify) g_variant_unref);
+}
+
+/**
+ * ostree_pack_index_to_v1:
+ * @index: A sorted pack index variant, in either format
+ *
+ * Returns: (transfer full): @index in the version 1 format
+ */
+GVariant *
+ostree_pack_index_to_v1 (GVariant *index)
+{
+  GVariant *ret;
+  OstreePackIndexIter iter;
+  OstreeObjectType objtype;
+  const guchar *csum;
+  guint64 offset;
+  guint64 i;
+  guint b;
+  guint32 total;
+  guint32 counts[256];
+  guchar *blob;
+  gsize blob_len;
+  guchar *checksums;
+  guchar *objtypes;
+  guchar *offsets;
+  ot_lvariant GVariant *metadata = NULL;
+
+  if (pack_index_is_v1 (index))
+    return g_variant_ref (index);
+
+  ostree_pack_index_iter_init (&iter, index);
+
+  blob_len = OSTREE_PACK_INDEX_V1_FANOUT_SIZE + iter.n_entries * (32 + 1 + 8);
+  blob = g_malloc0 (blob_len);
+  checksums = blob + OSTREE_PACK_INDEX_V1_FANOUT_SIZE;
+  objtypes = checksums + iter.n_entries * 32;
+  offsets = objtypes + iter.n_entries;
+
+  memset (counts, 0, sizeof (counts));
+  i = 0;
+  while (ostree_pack_index_iter_next (&iter, &objtype, &csum, &offset))
+    {
+      guint64 offset_be = GUINT64_TO_BE (offset);
+
+      memcpy (checksums + (i * 32), csum, 32);
+      objtypes[i] = (guchar) objtype;
+      memcpy (offsets + (i * 8), &offset_be, 8);
+      counts[csum[0]]++;
+      i++;
+    }
+  ostree_pack_index_iter_clear (&iter);
+
+  total = 0;
+  for (b = 0; b < 256; b++)
+    {
+      guint32 total_be;
+
+      total += counts[b];
+      total_be = GUINT32_TO_BE (total);
+      memcpy (blob + (b * 4), &total_be, 4);
+    }
+
+  metadata = g_variant_get_child_value (index, 1);
+  ret = g_variant_new ("(s@a{sv}@ay)", "OSTv1PACKINDEX", metadata,
+                       g_variant_new_from_data (G_VARIANT_TYPE ("ay"), blob, blob_len,
+                                                TRUE, g_free, blob));
+  return g_variant_ref_sink (ret);
+}
+
+/**
+ * ostree_map_pack_index:
+ * @path: Path to a pack index
+ * @trusted: Whether the data is trusted
+ * @out_variant: (out): The mapped index
+ *
+ * Memory-map the pack index at @path, which may be in either the
+ * version 0 or version 1 format; the type of @out_variant tells which.
+ */
+gboolean
+ostree_map_pack_index (GFile          *path,
+                       gboolean        trusted,
+                       GVariant      **out_variant,
+                       GError        **error)
+{
+  gboolean ret = FALSE;
+  const char *contents;
+  gsize len;
+  const GVariantType *type;
+  const char *expected_header;
+  const char *header;
+  GMappedFile *mfile = NULL;
+  ot_lvariant GVariant *ret_variant = NULL;
+
+  mfile = g_mapped_file_new (ot_gfile_get_path_cached (path), FALSE, error);
+  if (!mfile)
+    goto out;
+
+  contents = g_mapped_file_get_contents (mfile);
+  len = g_mapped_file_get_length (mfile);
+
+  /* The header string is serialized first, so we can peek at it */
+  if (len >= sizeof ("OSTv1PACKINDEX")
+      && memcmp (contents, "OSTv1PACKINDEX", sizeof ("OSTv1PACKINDEX")) == 0)
+    {
+      type = OSTREE_PACK_INDEX_V1_VARIANT_FORMAT;
+      expected_header = "OSTv1PACKINDEX";
+    }
+  else
+    {
+      type = OSTREE_PACK_INDEX_VARIANT_FORMAT;
+      expected_header = "OSTv0PACKINDEX";
+    }
+
+  ret_variant = g_variant_new_from_data (type, contents, len, trusted,
+                                         (GDestroyNotify) g_mapped_file_unref,
+                                         mfile);
+  mfile = NULL;
+  g_variant_ref_sink (ret_variant);
+
+  g_variant_get_child (ret_variant, 0, "&s", &header);
+  if (strcmp (header, expected_header) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid pack index '%s'",
+                   ot_gfile_get_path_cached (path));
+      goto out;
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_variant, &ret_variant);
+ out:
+  if (mfile)
+    g_mapped_file_unref (mfile);
+  return ret;
+}
+
+/**
+ * ostree_multi_pack_index_search:
+ * @index: A multi pack index variant
+ * @csum: Raw SHA256 checksum
+ * @objtype: Object type
+ * @out_pack_index: (out): Index of the pack in the metadata or data pack list
+ * @out_offset: (out): Offset of the object in that pack
+ *
+ * Returns: %TRUE if the object was found
+ */
+gboolean
+ostree_multi_pack_index_search (GVariant          *index,
+                                const guchar      *csum,
+                                OstreeObjectType   objtype,
+                                guint32           *out_pack_index,
+                                guint64           *out_offset)
+{
+  gboolean ret = FALSE;
+  const guchar *entries;
+  gsize entries_len;
+  gsize imin, imax;
+  ot_lvariant GVariant *entries_variant = NULL;
+
+  entries_variant = g_variant_get_child_value (index, 4);
+  entries = g_variant_get_fixed_array (entries_variant, &entries_len, 1);
+
+  imin = 0;
+  imax = entries_len / OSTREE_MULTI_PACK_INDEX_ENTRY_SIZE;
+  while (imin < imax)
+    {
+      gsize imid = imin + (imax - imin) / 2;
+      const guchar *entry = entries + (imid * OSTREE_MULTI_PACK_INDEX_ENTRY_SIZE);
+      int c;
+
+      c = ostree_cmp_checksum_bytes (entry, csum);
+      if (c == 0)
+        c = (int)entry[32] - (int)objtype;
+
+      if (c < 0)
+        imin = imid + 1;
+      else if (c > 0)
+        imax = imid;
+      else
+        {
+          if (out_pack_index)
+            *out_pack_index = read_be32 (entry + 36);
+          if (out_offset)
+            *out_offset = read_be64 (entry + 40);
+          ret = TRUE;
+          break;
+        }
+    }
+
+  return ret;
+}
+
+/*
+ * The bit positions for a checksum are simply successive big-endian
+ * 32 bit words of the SHA256 itself; it is already uniformly
+ * distributed, so there's no need to hash it again.
+ */
+static inline guint32
+pack_bloom_hash (const guchar *csum,
+                 guint         i)
+{
+  const guchar *p = csum + (i * 4);
+  return (((guint32)p[0]) << 24) | (((guint32)p[1]) << 16)
+    | (((guint32)p[2]) << 8) | ((guint32)p[3]);
+}
+
+/**
+ * ostree_pack_index_create_bloom:
+ * @index: A pack index variant
+ *
+ * Returns: (transfer full): A bloom filter for the superindex (see
+ * %OSTREE_PACK_SUPER_INDEX_VARIANT_FORMAT) covering every checksum in
+ * @index
+ */
+GVariant *
+ostree_pack_index_create_bloom (GVariant   *index)
+{
+  GVariant *ret;
+  OstreePackIndexIter iter;
+  const guchar *csum;
+  guchar *bloom_data;
+  gsize bloom_len;
+  guint64 n_bits;
+
+  ostree_pack_index_iter_init (&iter, index);
+
+  n_bits = MAX (iter.n_entries * OSTREE_PACK_BLOOM_BITS_PER_ENTRY, 64);
+  bloom_len = 2 + (n_bits + 7) / 8;
+  n_bits = (bloom_len - 2) * 8;
+
+  bloom_data = g_malloc0 (bloom_len);
+  bloom_data[0] = OSTREE_PACK_BLOOM_VERSION;
+  bloom_data[1] = OSTREE_PACK_BLOOM_N_HASHES;
+
+  while (ostree_pack_index_iter_next (&iter, NULL, &csum, NULL))
+    {
+      guint i;
+
+      for (i = 0; i < OSTREE_PACK_BLOOM_N_HASHES; i++)
+        {
+          guint32 bit = pack_bloom_hash (csum, i) % n_bits;
+          bloom_data[2 + (bit / 8)] |= (1 << (bit % 8));
+        }
+    }
+  ostree_pack_index_iter_clear (&iter);
+
+  ret = g_variant_new_from_data (G_VARIANT_TYPE ("ay"), bloom_data, bloom_len,
+                                 TRUE, g_free, bloom_data);
+  return g_variant_ref_sink (ret);
+}
+
+/**
+ * ostree_pack_bloom_maybe_contains:
+ * @bloom: A bloom filter from a pack superindex
+ * @csum: Raw SHA256 checksum
+ *
+ * Returns: %FALSE if @csum is definitely not in the pack described by
+ * @bloom, %TRUE if it may be.  Empty filters, filters from an unknown
+ * version, and malformed filters all answer %TRUE.
+ */
+gboolean
+ostree_pack_bloom_maybe_contains (GVariant      *bloom,
+                                  const guchar  *csum)
+{
+  const guchar *bloom_data;
+  gsize bloom_len;
+  guint64 n_bits;
+  guint n_hashes;
+  guint i;
+
+  bloom_data = g_variant_get_fixed_array (bloom, &bloom_len, 1);
+  if (bloom_len <= 2 || bloom_data[0] != OSTREE_PACK_BLOOM_VERSION)
+    return TRUE;
+
+  n_hashes = bloom_data[1];
+  if (n_hashes == 0 || n_hashes > 8)
+    return TRUE;
+
+  n_bits = (bloom_len - 2) * 8;
+  for (i = 0; i < n_hashes; i++)
+    {
+      guint32 bit = pack_bloom_hash (csum, i) % n_bits;
+      if ((bloom_data[2 + (bit / 8)] & (1 << (bit % 8))) == 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+gboolean
+ostree_validate_structureof_objtype (guchar    objtype,
+                                     GError   **error)
+{
+  OstreeObjectType objtype_v = (OstreeObjectType) objtype;
+  if (objtype_v < OSTREE_OBJECT_TYPE_FILE 
+      || objtype_v > OSTREE_OBJECT_TYPE_COMMIT)
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                    "Invalid object type '%u'", objtype);
@@ -1767,6 +3139,55 @@ ostree_validate_structureof_dirmeta (GVariant      *dirmeta,
   return ret;
 }
 
+static gboolean
+validate_pack_index_v1 (GVariant      *index,
+                        GError       **error)
+{
+  gboolean ret = FALSE;
+  const guchar *blob;
+  gsize blob_len;
+  guint64 n;
+  guint64 i;
+  guint32 prev;
+  const guchar *checksums;
+  const guchar *objtypes;
+  const guchar *offsets;
+  ot_lvariant GVariant *blob_v = NULL;
+
+  blob_v = g_variant_get_child_value (index, 2);
+  blob = g_variant_get_fixed_array (blob_v, &blob_len, 1);
+
+  if (!pack_index_v1_peek (blob, blob_len, &n, &checksums, &objtypes, &offsets))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Invalid pack index; truncated entries");
+      goto out;
+    }
+
+  prev = 0;
+  for (i = 0; i < 256; i++)
+    {
+      guint32 cur = read_be32 (blob + (i * 4));
+      if (cur < prev)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "Invalid pack index; fanout is not sorted");
+          goto out;
+        }
+      prev = cur;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      if (!ostree_validate_structureof_objtype (objtypes[i], error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 gboolean
 ostree_validate_structureof_pack_index (GVariant      *index,
                                         GError       **error)
@@ -1778,6 +3199,27 @@ ostree_validate_structureof_pack_index (GVariant      *index,
   ot_lvariant GVariant *csum_v = NULL;
   GVariantIter *content_iter = NULL;
 
+  if (pack_index_is_v1 (index))
+    {
+      if (!validate_variant (index, OSTREE_PACK_INDEX_V1_VARIANT_FORMAT, error))
+        goto out;
+
+      g_variant_get_child (index, 0, "&s", &header);
+
+      if (strcmp (header, "OSTv1PACKINDEX") != 0)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "Invalid pack index; doesn't match header");
+          goto out;
+        }
+
+      if (!validate_pack_index_v1 (index, error))
+        goto out;
+
+      ret = TRUE;
+      goto out;
+    }
+
   if (!validate_variant (index, OSTREE_PACK_INDEX_VARIANT_FORMAT, error))
     goto out;
 
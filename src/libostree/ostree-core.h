@@ -92,9 +92,22 @@ typedef enum {
  * a{sv} - Metadata
  * a(ayay) - metadata packs (pack file checksum, bloom filter)
  * a(ayay) - data packs (pack file checksum, bloom filter)
+ *
+ * Bloom filter (version 1)
+ * y - version
+ * y - number of hash functions k (at most 8)
+ * ay - bit array
+ *
+ * Bit positions for an object are the first k big-endian 32 bit
+ * words of its checksum, modulo the number of bits.  An empty bloom
+ * filter means the pack may contain anything.
  */
 #define OSTREE_PACK_SUPER_INDEX_VARIANT_FORMAT G_VARIANT_TYPE ("(sa{sv}a(ayay)a(ayay))")
 
+#define OSTREE_PACK_BLOOM_VERSION (1)
+#define OSTREE_PACK_BLOOM_N_HASHES (7)
+#define OSTREE_PACK_BLOOM_BITS_PER_ENTRY (10)
+
 /* Pack index
  * s - OSTv0PACKINDEX
  * a{sv} - Metadata
@@ -102,11 +115,55 @@ typedef enum {
  */
 #define OSTREE_PACK_INDEX_VARIANT_FORMAT G_VARIANT_TYPE ("(sa{sv}a(yayt))")
 
+/* Pack index (version 1)
+ * s - OSTv1PACKINDEX
+ * a{sv} - Metadata
+ * ay - entries
+ *
+ * The entries are sorted by (checksum, objtype), stored as:
+ *   256 big-endian guint32 - fanout; element i is the number of
+ *                            entries whose checksum starts with a byte <= i
+ *   n * 32 bytes - checksums
+ *   n bytes - objtypes
+ *   n big-endian guint64 - offsets into packfile
+ */
+#define OSTREE_PACK_INDEX_V1_VARIANT_FORMAT G_VARIANT_TYPE ("(sa{sv}ay)")
+
+#define OSTREE_PACK_INDEX_V1_FANOUT_SIZE (256 * 4)
+
+/* Multi pack index
+ * s - OSTv0MULTIPACKINDEX
+ * a{sv} - Metadata
+ * aay - metadata pack checksums, in superindex order
+ * aay - data pack checksums, in superindex order
+ * ay - entries
+ *
+ * The entries are fixed-width records sorted by (checksum, objtype):
+ *   32 bytes - object checksum
+ *   1 byte   - objtype
+ *   3 bytes  - padding
+ *   4 bytes  - big-endian index of the pack in the metadata pack list
+ *              for metadata objects, or in the data pack list otherwise
+ *   8 bytes  - big-endian offset into packfile
+ */
+#define OSTREE_MULTI_PACK_INDEX_VARIANT_FORMAT G_VARIANT_TYPE ("(sa{sv}aayaayay)")
+
+#define OSTREE_MULTI_PACK_INDEX_ENTRY_SIZE (48)
+
 typedef enum {
   OSTREE_PACK_FILE_ENTRY_FLAG_NONE = 0,
-  OSTREE_PACK_FILE_ENTRY_FLAG_GZIP = (1 << 0)
+  OSTREE_PACK_FILE_ENTRY_FLAG_GZIP = (1 << 0),
+  OSTREE_PACK_FILE_ENTRY_FLAG_DELTA = (1 << 1),
+  OSTREE_PACK_FILE_ENTRY_FLAG_ZSTD = (1 << 2),
+  OSTREE_PACK_FILE_ENTRY_FLAG_LZ4 = (1 << 3)
 } OstreePackFileEntryFlag;
 
+#define OSTREE_PACK_FILE_ENTRY_COMPRESSION_MASK \
+  (OSTREE_PACK_FILE_ENTRY_FLAG_GZIP | OSTREE_PACK_FILE_ENTRY_FLAG_ZSTD | OSTREE_PACK_FILE_ENTRY_FLAG_LZ4)
+
+/* Longest chain of delta entries a reader will follow */
+#define OSTREE_PACK_MAX_DELTA_DEPTH (8)
+
 /* Data Pack files
  * s - OSTv0PACKDATAFILE
  * a{sv} - Metadata
@@ -115,6 +172,16 @@ typedef enum {
  * Repeating pair of:
  * <padding to alignment of 8>
  * ( ayy(uuuusa(ayay))ay) ) - checksum, flags, file meta, data
+ *
+ * With OSTREE_PACK_FILE_ENTRY_FLAG_GZIP, the data is gzip compressed;
+ * likewise for OSTREE_PACK_FILE_ENTRY_FLAG_ZSTD and _LZ4 (frame format).
+ * A zstd frame may reference a dictionary, stored as "zstd-dictionary"
+ * (ay) in the pack metadata.
+ * With OSTREE_PACK_FILE_ENTRY_FLAG_DELTA, the (decompressed) data is
+ * the big-endian guint64 offset of a base entry in the same pack, then
+ * the big-endian guint64 length of the content, followed by operations
+ * as for OSTREE_STATIC_DELTA_ROLLSUM_FORMAT which rebuild the content
+ * from that of the base.
  */
 #define OSTREE_PACK_DATA_FILE_VARIANT_FORMAT G_VARIANT_TYPE ("(ayy(uuuusa(ayay))ay)")
 
@@ -126,9 +193,63 @@ typedef enum {
  * Repeating pair of:
  * <padding to alignment of 8>
  * ( yayv ) - objtype, checksum, data
+ *
+ * Version 1 (OSTv1PACKMETAFILE) adds a dictionary to the metadata:
+ *   names: as - filenames used in dirtrees, most frequent first
+ *   checksums: ay - concatenated 32 byte checksums used in dirtrees
+ * and a dirtree entry's data may be of type ay instead, holding
+ * unsigned LEB128 varints: the number of files, then a name and
+ * checksum index per file, then the number of directories, then a
+ * name, tree checksum and meta checksum index per directory.  Use
+ * ostree_parse_meta_pack_entry() to get the canonical dirtree back.
+ *
+ * Readers predating version 1 do not check the header string, so they
+ * fail on the unexpected ay dirtrees rather than with a clear version
+ * error; only serve version 1 packs to clients that understand them.
  */
 #define OSTREE_PACK_META_FILE_VARIANT_FORMAT G_VARIANT_TYPE ("(yayv)")
 
+/* Static delta superblock, stored as deltas/FROM-TO/superblock
+ * a{sv} - Metadata
+ * ay - from commit checksum
+ * ay - to commit checksum
+ * a(ayt) - parts: checksum of the compressed part file, uncompressed size
+ */
+#define OSTREE_STATIC_DELTA_SUPERBLOCK_FORMAT G_VARIANT_TYPE ("(a{sv}ayaya(ayt))")
+
+/* Static delta part, stored gzip compressed as deltas/FROM-TO/N
+ * a(yayyay) - objtype, checksum, encoding, payload
+ *
+ * For OSTREE_STATIC_DELTA_ENCODING_RAW, the payload is the serialized
+ * metadata object, or the content stream of a file object.
+ *
+ * For OSTREE_STATIC_DELTA_ENCODING_ROLLSUM, the payload is a serialized
+ * OSTREE_STATIC_DELTA_ROLLSUM_FORMAT, and the file content is rebuilt
+ * from the content of a base file object which must already exist.
+ */
+#define OSTREE_STATIC_DELTA_PART_FORMAT G_VARIANT_TYPE ("a(yayyay)")
+
+/* Rollsum encoded file object
+ * ay - base file object checksum
+ * ay - file header (OSTREE_FILE_HEADER_GVARIANT_FORMAT)
+ * t - length of the rebuilt content, big-endian
+ * ay - operations; a sequence of:
+ *   'c' <big-endian guint64 offset> <big-endian guint32 length> - copy from base
+ *   'i' <big-endian guint32 length> <data> - insert data
+ */
+#define OSTREE_STATIC_DELTA_ROLLSUM_FORMAT G_VARIANT_TYPE ("(ayaytay)")
+
+/* Largest file content a rollsum delta may rebuild */
+#define OSTREE_ROLLSUM_MAX_SIZE (64 * 1024 * 1024)
+
+typedef enum {
+  OSTREE_STATIC_DELTA_ENCODING_RAW = 0,
+  OSTREE_STATIC_DELTA_ENCODING_ROLLSUM = 1
+} OstreeStaticDeltaEncoding;
+
+#define OSTREE_STATIC_DELTA_OP_COPY 'c'
+#define OSTREE_STATIC_DELTA_OP_INSERT 'i'
+
 const GVariantType *ostree_metadata_variant_type (OstreeObjectType objtype);
 
 gboolean ostree_validate_checksum_string (const char *sha256,
@@ -183,6 +304,23 @@ char *ostree_get_relative_pack_index_path (gboolean        is_meta,
 char *ostree_get_relative_pack_data_path (gboolean        is_meta,
                                           const char     *checksum);
 
+char *ostree_get_static_delta_name (const char     *from,
+                                    const char     *to);
+
+GByteArray *ostree_static_delta_compute_rollsum (const guchar   *base,
+                                                gsize           base_len,
+                                                const guchar   *data,
+                                                gsize           data_len);
+
+gboolean ostree_static_delta_apply_rollsum (const guchar   *base,
+                                            gsize           base_len,
+                                            const guchar   *ops,
+                                            gsize           ops_len,
+                                            gsize           expected_len,
+                                            guchar        **out_data,
+                                            gsize          *out_len,
+                                            GError        **error);
+
 gboolean ostree_get_xattrs_for_file (GFile         *f,
                                      GVariant     **out_xattrs,
                                      GCancellable  *cancellable,
@@ -313,7 +451,35 @@ gboolean ostree_read_pack_entry_raw (guchar           *pack_data,
                                      GCancellable     *cancellable,
                                      GError          **error);
 
+GConverter *ostree_pack_entry_compressor_new (guchar       entry_flags,
+                                              int          level,
+                                              GVariant    *dictionary,
+                                              GError     **error);
+
+gboolean ostree_pack_entry_is_self_contained (GVariant  *pack_entry);
+
+typedef struct _OstreeZstdDictionary OstreeZstdDictionary;
+
+gboolean ostree_read_pack_zstd_dictionary (guchar                 *pack_data,
+                                           guint64                 pack_len,
+                                           OstreeZstdDictionary  **out_dictionary,
+                                           GError                **error);
+
+GVariant *ostree_expand_compact_dirtree (GVariant       *compact,
+                                         GVariant       *names,
+                                         GVariant       *checksums,
+                                         GError        **error);
+
+gboolean ostree_parse_meta_pack_entry (GVariant       *pack_entry,
+                                       guchar         *pack_data,
+                                       guint64         pack_len,
+                                       GVariant      **out_metadata,
+                                       GError        **error);
+
 gboolean ostree_parse_file_pack_entry (GVariant       *pack_entry,
+                                       guchar         *pack_data,
+                                       guint64         pack_len,
+                                       OstreeZstdDictionary *zstd_dictionary,
                                        GInputStream  **out_input,
                                        GFileInfo     **out_info,
                                        GVariant      **out_xattrs,
@@ -325,6 +491,45 @@ gboolean ostree_pack_index_search (GVariant            *index,
                                    OstreeObjectType    objtype,
                                    guint64            *out_offset);
 
+typedef struct {
+  /*< private >*/
+  GVariant *contents;
+  const guchar *blob;
+  const guchar *checksums;
+  const guchar *objtypes;
+  const guchar *offsets;
+  guint64 n_entries;
+  guint64 pos;
+} OstreePackIndexIter;
+
+void ostree_pack_index_iter_init (OstreePackIndexIter *iter,
+                                  GVariant            *index);
+
+gboolean ostree_pack_index_iter_next (OstreePackIndexIter  *iter,
+                                      OstreeObjectType     *out_objtype,
+                                      const guchar        **out_csum,
+                                      guint64              *out_offset);
+
+void ostree_pack_index_iter_clear (OstreePackIndexIter *iter);
+
+GVariant *ostree_pack_index_to_v1 (GVariant            *index);
+
+gboolean ostree_map_pack_index (GFile          *path,
+                                gboolean        trusted,
+                                GVariant      **out_variant,
+                                GError        **error);
+
+gboolean ostree_multi_pack_index_search (GVariant            *index,
+                                         const guchar        *csum,
+                                         OstreeObjectType     objtype,
+                                         guint32             *out_pack_index,
+                                         guint64             *out_offset);
+
+GVariant *ostree_pack_index_create_bloom (GVariant            *index);
+
+gboolean ostree_pack_bloom_maybe_contains (GVariant          *bloom,
+                                           const guchar      *csum);
+
 /** VALIDATION **/
 
 gboolean ostree_validate_structureof_objtype (guchar    objtype,
@@ -0,0 +1,308 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The OSTree Authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+#include <lz4frame.h>
+#include <lz4hc.h>
+#include <gio/gio.h>
+#include "ostree-lz4-converter.h"
+
+/* Largest amount of input compressed in one step */
+#define LZ4_CHUNK_SIZE (64*1024)
+
+static void ostree_lz4_converter_iface_init (GConverterIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (OstreeLz4Converter, ostree_lz4_converter, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+                                                ostree_lz4_converter_iface_init))
+
+struct _OstreeLz4ConverterPrivate {
+  gboolean compress;
+  LZ4F_preferences_t prefs;
+
+  LZ4F_cctx *cctx;
+  LZ4F_dctx *dctx;
+
+  /* Compressed output which did not fit in the caller's buffer */
+  GByteArray *pending;
+  gsize pending_pos;
+  gboolean started;
+  gboolean ended;
+};
+
+static void
+ostree_lz4_converter_finalize (GObject *object)
+{
+  OstreeLz4Converter *self = OSTREE_LZ4_CONVERTER (object);
+
+  if (self->priv->cctx)
+    LZ4F_freeCompressionContext (self->priv->cctx);
+  if (self->priv->dctx)
+    LZ4F_freeDecompressionContext (self->priv->dctx);
+  g_byte_array_unref (self->priv->pending);
+
+  G_OBJECT_CLASS (ostree_lz4_converter_parent_class)->finalize (object);
+}
+
+static void
+ostree_lz4_converter_class_init (OstreeLz4ConverterClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (OstreeLz4ConverterPrivate));
+
+  gobject_class->finalize = ostree_lz4_converter_finalize;
+}
+
+static void
+ostree_lz4_converter_init (OstreeLz4Converter *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+                                            OSTREE_TYPE_LZ4_CONVERTER,
+                                            OstreeLz4ConverterPrivate);
+  self->priv->pending = g_byte_array_new ();
+}
+
+static void
+ostree_lz4_converter_reset (GConverter *converter)
+{
+  OstreeLz4Converter *self = OSTREE_LZ4_CONVERTER (converter);
+
+  g_byte_array_set_size (self->priv->pending, 0);
+  self->priv->pending_pos = 0;
+  self->priv->started = FALSE;
+  self->priv->ended = FALSE;
+
+  if (self->priv->dctx)
+    LZ4F_resetDecompressionContext (self->priv->dctx);
+}
+
+static gboolean
+check_lz4_result (size_t    result,
+                  GError  **error)
+{
+  if (LZ4F_isError (result))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "lz4: %s", LZ4F_getErrorName (result));
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/*
+ * Append the output of compressing @inbuf, and the frame header and
+ * end mark as needed, to the pending buffer.
+ */
+static gboolean
+compress_to_pending (OstreeLz4Converter *self,
+                     const guchar       *inbuf,
+                     gsize               inbuf_size,
+                     gboolean            at_end,
+                     gboolean            flush,
+                     GError            **error)
+{
+  GByteArray *pending = self->priv->pending;
+  guint old_len;
+  size_t result;
+
+  if (!self->priv->started)
+    {
+      old_len = pending->len;
+      g_byte_array_set_size (pending, old_len + LZ4F_HEADER_SIZE_MAX);
+      result = LZ4F_compressBegin (self->priv->cctx, pending->data + old_len,
+                                   LZ4F_HEADER_SIZE_MAX, &self->priv->prefs);
+      if (!check_lz4_result (result, error))
+        return FALSE;
+      g_byte_array_set_size (pending, old_len + result);
+      self->priv->started = TRUE;
+    }
+
+  if (inbuf_size > 0)
+    {
+      size_t bound = LZ4F_compressBound (inbuf_size, &self->priv->prefs);
+
+      old_len = pending->len;
+      g_byte_array_set_size (pending, old_len + bound);
+      result = LZ4F_compressUpdate (self->priv->cctx, pending->data + old_len, bound,
+                                    inbuf, inbuf_size, NULL);
+      if (!check_lz4_result (result, error))
+        return FALSE;
+      g_byte_array_set_size (pending, old_len + result);
+    }
+
+  if (at_end || flush)
+    {
+      size_t bound = LZ4F_compressBound (0, &self->priv->prefs);
+
+      old_len = pending->len;
+      g_byte_array_set_size (pending, old_len + bound);
+      if (at_end)
+        result = LZ4F_compressEnd (self->priv->cctx, pending->data + old_len, bound, NULL);
+      else
+        result = LZ4F_flush (self->priv->cctx, pending->data + old_len, bound, NULL);
+      if (!check_lz4_result (result, error))
+        return FALSE;
+      g_byte_array_set_size (pending, old_len + result);
+      if (at_end)
+        self->priv->ended = TRUE;
+    }
+
+  return TRUE;
+}
+
+static GConverterResult
+ostree_lz4_converter_convert (GConverter *converter,
+                              const void *inbuf,
+                              gsize       inbuf_size,
+                              void       *outbuf,
+                              gsize       outbuf_size,
+                              GConverterFlags flags,
+                              gsize      *bytes_read,
+                              gsize      *bytes_written,
+                              GError    **error)
+{
+  OstreeLz4Converter *self = OSTREE_LZ4_CONVERTER (converter);
+  GByteArray *pending = self->priv->pending;
+  gsize in_size = 0;
+  gsize out_size;
+  gboolean flushed = FALSE;
+
+  if (!self->priv->compress)
+    {
+      size_t result;
+
+      in_size = inbuf_size;
+      out_size = outbuf_size;
+      result = LZ4F_decompress (self->priv->dctx, outbuf, &out_size,
+                                inbuf, &in_size, NULL);
+      if (!check_lz4_result (result, error))
+        return G_CONVERTER_ERROR;
+
+      *bytes_read = in_size;
+      *bytes_written = out_size;
+      if (result == 0)
+        return G_CONVERTER_FINISHED;
+    }
+  else
+    {
+      if (self->priv->pending_pos == pending->len && !self->priv->ended)
+        {
+          gboolean at_end;
+
+          g_byte_array_set_size (pending, 0);
+          self->priv->pending_pos = 0;
+
+          in_size = MIN (inbuf_size, LZ4_CHUNK_SIZE);
+          at_end = (flags & G_CONVERTER_INPUT_AT_END) && in_size == inbuf_size;
+          flushed = !at_end && (flags & G_CONVERTER_FLUSH) && in_size == inbuf_size;
+
+          if (!compress_to_pending (self, inbuf, in_size, at_end, flushed, error))
+            return G_CONVERTER_ERROR;
+        }
+
+      out_size = MIN (outbuf_size, pending->len - self->priv->pending_pos);
+      memcpy (outbuf, pending->data + self->priv->pending_pos, out_size);
+      self->priv->pending_pos += out_size;
+
+      *bytes_read = in_size;
+      *bytes_written = out_size;
+      if (self->priv->pending_pos == pending->len)
+        {
+          if (self->priv->ended)
+            return G_CONVERTER_FINISHED;
+          if (flushed)
+            return G_CONVERTER_FLUSHED;
+        }
+    }
+
+  if (in_size == 0 && out_size == 0)
+    {
+      if (outbuf_size == 0)
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                             "Need more output space");
+      else
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                             "Need more input");
+      return G_CONVERTER_ERROR;
+    }
+
+  return G_CONVERTER_CONVERTED;
+}
+
+static void
+ostree_lz4_converter_iface_init (GConverterIface *iface)
+{
+  iface->convert = ostree_lz4_converter_convert;
+  iface->reset = ostree_lz4_converter_reset;
+}
+
+/**
+ * ostree_lz4_converter_new_compressor:
+ * @level: lz4 compression level; values above 2 use lz4hc
+ *
+ * Returns: (transfer full): A new converter, or %NULL if @level is
+ * invalid
+ */
+GConverter *
+ostree_lz4_converter_new_compressor (int        level,
+                                     GError   **error)
+{
+  OstreeLz4Converter *self;
+
+  if (level > LZ4HC_CLEVEL_MAX)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid lz4 compression level %d", level);
+      return NULL;
+    }
+
+  self = g_object_new (OSTREE_TYPE_LZ4_CONVERTER, NULL);
+  self->priv->compress = TRUE;
+  self->priv->prefs.compressionLevel = level;
+  if (!check_lz4_result (LZ4F_createCompressionContext (&self->priv->cctx, LZ4F_VERSION),
+                         error))
+    {
+      g_object_unref (self);
+      return NULL;
+    }
+
+  return (GConverter*)self;
+}
+
+GConverter *
+ostree_lz4_converter_new_decompressor (GError   **error)
+{
+  OstreeLz4Converter *self;
+
+  self = g_object_new (OSTREE_TYPE_LZ4_CONVERTER, NULL);
+  self->priv->compress = FALSE;
+  if (!check_lz4_result (LZ4F_createDecompressionContext (&self->priv->dctx, LZ4F_VERSION),
+                         error))
+    {
+      g_object_unref (self);
+      return NULL;
+    }
+
+  return (GConverter*)self;
+}
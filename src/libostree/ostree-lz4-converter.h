@@ -0,0 +1,61 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The OSTree Authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __OSTREE_LZ4_CONVERTER_H__
+#define __OSTREE_LZ4_CONVERTER_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define OSTREE_TYPE_LZ4_CONVERTER         (ostree_lz4_converter_get_type ())
+#define OSTREE_LZ4_CONVERTER(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), OSTREE_TYPE_LZ4_CONVERTER, OstreeLz4Converter))
+#define OSTREE_LZ4_CONVERTER_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), OSTREE_TYPE_LZ4_CONVERTER, OstreeLz4ConverterClass))
+#define OSTREE_IS_LZ4_CONVERTER(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), OSTREE_TYPE_LZ4_CONVERTER))
+#define OSTREE_IS_LZ4_CONVERTER_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), OSTREE_TYPE_LZ4_CONVERTER))
+#define OSTREE_LZ4_CONVERTER_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), OSTREE_TYPE_LZ4_CONVERTER, OstreeLz4ConverterClass))
+
+typedef struct _OstreeLz4Converter         OstreeLz4Converter;
+typedef struct _OstreeLz4ConverterClass    OstreeLz4ConverterClass;
+typedef struct _OstreeLz4ConverterPrivate  OstreeLz4ConverterPrivate;
+
+struct _OstreeLz4Converter
+{
+  GObject parent_instance;
+
+  /*< private >*/
+  OstreeLz4ConverterPrivate *priv;
+};
+
+struct _OstreeLz4ConverterClass
+{
+  GObjectClass parent_class;
+};
+
+GType         ostree_lz4_converter_get_type         (void) G_GNUC_CONST;
+
+GConverter *  ostree_lz4_converter_new_compressor   (int           level,
+                                                     GError      **error);
+
+GConverter *  ostree_lz4_converter_new_decompressor (GError      **error);
+
+G_END_DECLS
+
+#endif /* __OSTREE_LZ4_CONVERTER_H__ */
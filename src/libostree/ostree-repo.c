@@ -27,12 +27,18 @@
 #include "ostree.h"
 #include "otutil.h"
 #include "ostree-repo-file-enumerator.h"
+#ifdef HAVE_ZSTD
+#include "ostree-zstd-converter.h"
+#endif
 
 #include <gio/gunixoutputstream.h>
 #include <gio/gunixinputstream.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <attr/xattr.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 
 #ifdef HAVE_LIBARCHIVE
 #include <archive.h>
@@ -40,6 +46,9 @@
 #include "ostree-libarchive-input-stream.h"
 #endif
 
+/* Bytes of parsed metadata objects kept by ostree_repo_load_variant() */
+#define OSTREE_REPO_DEFAULT_METADATA_CACHE_SIZE (16 * 1024 * 1024)
+
 struct OstreeRepo {
   GObject parent;
 
@@ -60,12 +69,40 @@ struct OstreeRepo {
 #endif
   GPtrArray *cached_meta_indexes;
   GPtrArray *cached_content_indexes;
+  GHashTable *cached_pack_blooms;
+  gboolean multi_pack_index_loaded;
+  GVariant *cached_multi_pack_index;
   GHashTable *cached_pack_index_mappings;
   GHashTable *cached_pack_data_mappings;
+  GHashTable *cached_pack_zstd_dictionaries;
 
   gboolean inited;
   gboolean in_transaction;
   GHashTable *loose_object_devino_hash;
+  GVariant *devino_cache;
+  GHashTable *txn_known_objects;
+  /* Set from worker threads; accessed with g_atomic_int_*() */
+  gboolean txn_objects_written;
+  gboolean tmpfile_unsupported;
+  gboolean checkout_reflink;
+  gboolean reflink_unsupported;
+
+  gboolean stat_cache_loaded;
+  GVariant *stat_cache;
+  GHashTable *stat_cache_old;
+  GHashTable *stat_cache_new;
+  guint stat_cache_hits;
+  guint stat_cache_misses;
+
+  guint checkout_n_files;
+  guint64 checkout_elapsed_usec;
+
+  GHashTable *metadata_cache;
+  GQueue metadata_cache_lru;
+  guint64 metadata_cache_size;
+  guint64 metadata_cache_max_size;
+  guint metadata_cache_hits;
+  guint metadata_cache_misses;
 
   GKeyFile *config;
   OstreeRepoMode mode;
@@ -88,6 +125,19 @@ repo_find_object (OstreeRepo           *self,
                   GCancellable         *cancellable,
                   GError             **error);
 
+static guint known_object_hash (gconstpointer v);
+static gboolean known_object_equal (gconstpointer a, gconstpointer b);
+static void metadata_cache_entry_free (gpointer data);
+
+static gboolean
+map_variant_file_check_header_string (GFile         *path,
+                                      const GVariantType  *variant_type,
+                                      const char    *expected_header,
+                                      gboolean       trusted,
+                                      GVariant     **out_variant,
+                                      GCancellable  *cancellable,
+                                      GError       **error);
+
 enum {
   PROP_0,
 
@@ -114,12 +164,21 @@ ostree_repo_finalize (GObject *object)
   g_clear_object (&self->config_file);
   if (self->loose_object_devino_hash)
     g_hash_table_destroy (self->loose_object_devino_hash);
+  g_clear_pointer (&self->devino_cache, (GDestroyNotify) g_variant_unref);
+  g_clear_pointer (&self->txn_known_objects, (GDestroyNotify) g_hash_table_unref);
+  g_hash_table_destroy (self->metadata_cache);
+  g_clear_pointer (&self->stat_cache_old, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&self->stat_cache_new, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&self->stat_cache, (GDestroyNotify) g_variant_unref);
   if (self->config)
     g_key_file_free (self->config);
   g_clear_pointer (&self->cached_meta_indexes, (GDestroyNotify) g_ptr_array_unref);
   g_clear_pointer (&self->cached_content_indexes, (GDestroyNotify) g_ptr_array_unref);
+  g_hash_table_destroy (self->cached_pack_blooms);
+  g_clear_pointer (&self->cached_multi_pack_index, (GDestroyNotify) g_variant_unref);
   g_hash_table_destroy (self->cached_pack_index_mappings);
   g_hash_table_destroy (self->cached_pack_data_mappings);
+  g_hash_table_destroy (self->cached_pack_zstd_dictionaries);
   g_mutex_clear (&self->cache_lock);
 
   G_OBJECT_CLASS (ostree_repo_parent_class)->finalize (object);
@@ -211,16 +270,37 @@ ostree_repo_class_init (OstreeRepoClass *klass)
                                                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
 }
 
+static void
+pack_zstd_dictionary_free (gpointer data)
+{
+#ifdef HAVE_ZSTD
+  if (data)
+    ostree_zstd_dictionary_unref (data);
+#endif
+}
+
 static void
 ostree_repo_init (OstreeRepo *self)
 {
   g_mutex_init (&self->cache_lock);
+  self->cached_pack_blooms = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free,
+                                                    (GDestroyNotify)g_variant_unref);
   self->cached_pack_index_mappings = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                             g_free,
                                                             (GDestroyNotify)g_variant_unref);
   self->cached_pack_data_mappings = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                            g_free,
                                                            (GDestroyNotify)g_mapped_file_unref);
+  /* Packs without a dictionary map to NULL */
+  self->cached_pack_zstd_dictionaries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                               g_free,
+                                                               pack_zstd_dictionary_free);
+  /* Keys point into the entries */
+  self->metadata_cache = g_hash_table_new_full (known_object_hash, known_object_equal,
+                                                NULL, metadata_cache_entry_free);
+  g_queue_init (&self->metadata_cache_lru);
+  self->metadata_cache_max_size = OSTREE_REPO_DEFAULT_METADATA_CACHE_SIZE;
 }
 
 OstreeRepo*
@@ -659,6 +739,7 @@ ostree_repo_check (OstreeRepo *self, GError **error)
   ot_lfree char *version = NULL;
   ot_lfree char *mode = NULL;
   ot_lfree char *parent_repo_path = NULL;
+  ot_lfree char *metadata_cache_size = NULL;
 
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
@@ -722,6 +803,28 @@ ostree_repo_check (OstreeRepo *self, GError **error)
                                        NULL, &parent_repo_path, error))
     goto out;
 
+  if (!keyfile_get_boolean_with_default (self->config, "core", "checkout-reflink",
+                                         FALSE, &self->checkout_reflink, error))
+    goto out;
+
+  if (!keyfile_get_value_with_default (self->config, "core", "metadata-cache-size",
+                                       NULL, &metadata_cache_size, error))
+    goto out;
+
+  if (metadata_cache_size)
+    {
+      char *endp;
+
+      self->metadata_cache_max_size = g_ascii_strtoull (metadata_cache_size, &endp, 10);
+      if (*endp != '\0' || endp == metadata_cache_size)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Invalid metadata-cache-size '%s' in repository configuration",
+                       metadata_cache_size);
+          goto out;
+        }
+    }
+
   if (parent_repo_path && parent_repo_path[0])
     {
       ot_lobj GFile *parent_repo_f = g_file_new_for_path (parent_repo_path);
@@ -797,21 +900,298 @@ ostree_repo_get_archive_content_path (OstreeRepo    *self,
   return g_file_resolve_relative_path (self->repodir, path);
 }
 
+/*
+ * Open an anonymous O_TMPFILE file in the temporary directory, to be
+ * linked into place by commit_loose_object_impl() once complete.
+ * @out_fd is -1 if the kernel or filesystem doesn't support this, in
+ * which case a named temporary file should be used instead.
+ */
+static gboolean
+open_object_tmpfile (OstreeRepo   *self,
+                     guint32       mode,
+                     int          *out_fd,
+                     GError      **error)
+{
+  gboolean ret = FALSE;
+  int fd = -1;
+
+#ifdef O_TMPFILE
+  if (!g_atomic_int_get (&self->tmpfile_unsupported))
+    {
+      /* Readable, in case it has to be copied to a named file */
+      fd = open (ot_gfile_get_path_cached (self->tmp_dir),
+                 O_TMPFILE | O_RDWR | O_CLOEXEC, mode & 07777);
+      if (fd < 0)
+        {
+          if (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)
+            g_atomic_int_set (&self->tmpfile_unsupported, TRUE);
+          else
+            {
+              ot_util_set_error_from_errno (error, errno);
+              goto out;
+            }
+        }
+    }
+#endif
+
+  ret = TRUE;
+  *out_fd = fd;
+ out:
+  return ret;
+}
+
+static gboolean
+set_xattrs_fd (int           fd,
+               GVariant     *xattrs,
+               GError      **error)
+{
+  gboolean ret = FALSE;
+  int i, n;
+
+  n = g_variant_n_children (xattrs);
+  for (i = 0; i < n; i++)
+    {
+      const guint8* name;
+      const guint8* value_data;
+      gsize value_len;
+      gboolean loop_err;
+      ot_lvariant GVariant *value = NULL;
+
+      g_variant_get_child (xattrs, i, "(^&ay@ay)",
+                           &name, &value);
+      value_data = g_variant_get_fixed_array (value, &value_len, 1);
+      
+      loop_err = fsetxattr (fd, (char*)name, (char*)value_data, value_len, 0) < 0;
+      if (loop_err)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/*
+ * Like ostree_create_temp_file_from_input(), but regular files are
+ * written to an O_TMPFILE descriptor returned in @out_fd when
+ * possible.  Otherwise @out_fd is -1 and @out_path is set.
+ */
+static gboolean
+create_object_tmpfile_from_input (OstreeRepo        *self,
+                                  OstreeObjectType   objtype,
+                                  GFileInfo         *finfo,
+                                  GVariant          *xattrs,
+                                  GInputStream      *input,
+                                  int               *out_fd,
+                                  GFile            **out_path,
+                                  GCancellable      *cancellable,
+                                  GError           **error)
+{
+  gboolean ret = FALSE;
+  int fd = -1;
+  guint32 mode;
+  ot_lobj GOutputStream *out = NULL;
+  ot_lobj GFile *ret_path = NULL;
+
+  if (finfo != NULL)
+    mode = g_file_info_get_attribute_uint32 (finfo, "unix::mode");
+  else
+    mode = S_IFREG | 0664;
+
+  if (S_ISREG (mode))
+    {
+      if (!open_object_tmpfile (self, mode, &fd, error))
+        goto out;
+    }
+
+  if (fd != -1)
+    {
+      out = g_unix_output_stream_new (fd, FALSE);
+      if (input)
+        {
+          if (g_output_stream_splice (out, input, 0, cancellable, error) < 0)
+            goto out;
+        }
+      if (!g_output_stream_close (out, cancellable, error))
+        goto out;
+
+      if (finfo != NULL)
+        {
+          guint32 uid = g_file_info_get_attribute_uint32 (finfo, "unix::uid");
+          guint32 gid = g_file_info_get_attribute_uint32 (finfo, "unix::gid");
+
+          if (fchown (fd, uid, gid) < 0)
+            {
+              ot_util_set_error_from_errno (error, errno);
+              g_prefix_error (error, "fchown(%u, %u) failed: ", uid, gid);
+              goto out;
+            }
+        }
+
+      if (fchmod (fd, mode & 07777) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "fchmod(%u) failed: ", mode);
+          goto out;
+        }
+
+      if (xattrs != NULL)
+        {
+          if (!set_xattrs_fd (fd, xattrs, error))
+            goto out;
+        }
+    }
+  else
+    {
+      if (!ostree_create_temp_file_from_input (self->tmp_dir,
+                                               ostree_object_type_to_string (objtype), NULL,
+                                               finfo, xattrs, input,
+                                               &ret_path,
+                                               cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+  *out_fd = fd;
+  fd = -1;
+  ot_transfer_out_value (out_path, &ret_path);
+ out:
+  if (fd != -1)
+    (void) close (fd);
+  return ret;
+}
+
+/*
+ * Copy the anonymous O_TMPFILE @fd, with its ownership, mode and
+ * xattrs, to a new named temporary file, for when it can't be linked
+ * into place through /proc.
+ */
+static gboolean
+copy_object_tmpfile_to_named (OstreeRepo     *self,
+                              int             fd,
+                              GFile         **out_path,
+                              GCancellable   *cancellable,
+                              GError        **error)
+{
+  gboolean ret = FALSE;
+  struct stat stbuf;
+  ssize_t names_len;
+  const char *path;
+  const char *name;
+  ot_lfree char *names = NULL;
+  ot_lobj GInputStream *input = NULL;
+  ot_lobj GOutputStream *out = NULL;
+  ot_lobj GFile *ret_path = NULL;
+
+  if (fstat (fd, &stbuf) < 0 || lseek (fd, 0, SEEK_SET) < 0)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+
+  if (!ostree_create_temp_regular_file (self->tmp_dir, "file", NULL,
+                                        &ret_path, &out, cancellable, error))
+    goto out;
+  path = ot_gfile_get_path_cached (ret_path);
+
+  input = g_unix_input_stream_new (fd, FALSE);
+  if (g_output_stream_splice (out, input, G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                              cancellable, error) < 0)
+    goto out;
+
+  if (lchown (path, stbuf.st_uid, stbuf.st_gid) < 0
+      || chmod (path, stbuf.st_mode & 07777) < 0)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+
+  names_len = flistxattr (fd, NULL, 0);
+  if (names_len < 0 && errno != ENOTSUP)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+  else if (names_len > 0)
+    {
+      names = g_malloc (names_len);
+      names_len = flistxattr (fd, names, names_len);
+      if (names_len < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+      for (name = names; name < names + names_len; name += strlen (name) + 1)
+        {
+          ssize_t value_len;
+          ot_lfree char *value = NULL;
+
+          value_len = fgetxattr (fd, name, NULL, 0);
+          if (value_len >= 0)
+            {
+              value = g_malloc (MAX (value_len, 1));
+              value_len = fgetxattr (fd, name, value, value_len);
+            }
+          if (value_len < 0
+              || lsetxattr (path, name, value, value_len, 0) < 0)
+            {
+              ot_util_set_error_from_errno (error, errno);
+              goto out;
+            }
+        }
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_path, &ret_path);
+ out:
+  if (ret_path)
+    (void) unlink (ot_gfile_get_path_cached (ret_path));
+  return ret;
+}
+
 static gboolean
 commit_loose_object_impl (OstreeRepo        *self,
                           GFile             *tempfile_path,
+                          int                tempfile_fd,
                           GFile             *dest,
                           GCancellable      *cancellable,
                           GError           **error)
 {
   gboolean ret = FALSE;
+  int result;
   ot_lobj GFile *parent = NULL;
+  ot_lobj GFile *named_tempfile_path = NULL;
 
   parent = g_file_get_parent (dest);
   if (!ot_gfile_ensure_directory (parent, FALSE, error))
     goto out;
   
-  if (link (ot_gfile_get_path_cached (tempfile_path), ot_gfile_get_path_cached (dest)) < 0)
+  if (tempfile_fd != -1)
+    {
+      ot_lfree char *fd_path = g_strdup_printf ("/proc/self/fd/%d", tempfile_fd);
+
+      result = linkat (AT_FDCWD, fd_path, AT_FDCWD, ot_gfile_get_path_cached (dest),
+                       AT_SYMLINK_FOLLOW);
+      /* /proc isn't mounted or linking through it is denied; use
+       * named temporary files from now on.
+       */
+      if (result < 0 && (errno == ENOENT || errno == EPERM))
+        {
+          g_atomic_int_set (&self->tmpfile_unsupported, TRUE);
+          if (!copy_object_tmpfile_to_named (self, tempfile_fd, &named_tempfile_path,
+                                             cancellable, error))
+            goto out;
+          tempfile_path = named_tempfile_path;
+          result = link (ot_gfile_get_path_cached (tempfile_path),
+                         ot_gfile_get_path_cached (dest));
+        }
+    }
+  else
+    result = link (ot_gfile_get_path_cached (tempfile_path), ot_gfile_get_path_cached (dest));
+  if (result < 0)
     {
       if (errno != EEXIST)
         {
@@ -822,17 +1202,27 @@ commit_loose_object_impl (OstreeRepo        *self,
         }
     }
 
-  (void) unlink (ot_gfile_get_path_cached (tempfile_path));
+  if (tempfile_path)
+    (void) unlink (ot_gfile_get_path_cached (tempfile_path));
+
+  /* Synced as a batch when the transaction is committed */
+  g_atomic_int_set (&self->txn_objects_written, TRUE);
+
   ret = TRUE;
  out:
   return ret;
 }
 
+static void
+devino_cache_note_object (OstreeRepo        *self,
+                          const char        *checksum);
+
 static gboolean
 commit_loose_object_trusted (OstreeRepo        *self,
                              const char        *checksum,
                              OstreeObjectType   objtype,
                              GFile             *tempfile_path,
+                             int                tempfile_fd,
                              GCancellable      *cancellable,
                              GError           **error)
 {
@@ -841,10 +1231,13 @@ commit_loose_object_trusted (OstreeRepo        *self,
 
   dest_file = ostree_repo_get_object_path (self, checksum, objtype);
 
-  if (!commit_loose_object_impl (self, tempfile_path, dest_file,
+  if (!commit_loose_object_impl (self, tempfile_path, tempfile_fd, dest_file,
                                  cancellable, error))
     goto out;
 
+  if (objtype == OSTREE_OBJECT_TYPE_FILE)
+    devino_cache_note_object (self, checksum);
+
   ret = TRUE;
  out:
   return ret;
@@ -855,6 +1248,92 @@ typedef enum {
   OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID = (1<<1)
 } OstreeRepoStageFlags;
 
+/*
+ * Objects known to exist during the current transaction, keyed by the
+ * binary checksum followed by the object type.  The value is nonzero
+ * if the object is stored loose rather than only packed.
+ */
+#define OSTREE_KNOWN_OBJECT_KEY_SIZE 33
+
+static guint
+known_object_hash (gconstpointer v)
+{
+  const guchar *key = v;
+  guint ret;
+
+  /* Checksums are already uniformly distributed */
+  memcpy (&ret, key, sizeof (ret));
+  return ret ^ key[32];
+}
+
+static gboolean
+known_object_equal (gconstpointer  a,
+                    gconstpointer  b)
+{
+  return memcmp (a, b, OSTREE_KNOWN_OBJECT_KEY_SIZE) == 0;
+}
+
+static void
+known_object_key_init (guchar           *key,
+                       OstreeObjectType  objtype,
+                       const char       *checksum)
+{
+  ot_lfree guchar *csum = NULL;
+
+  csum = ostree_checksum_to_bytes (checksum);
+  memcpy (key, csum, 32);
+  key[32] = (guchar) objtype;
+}
+
+static gboolean
+txn_known_object_lookup (OstreeRepo         *self,
+                         OstreeObjectType    objtype,
+                         const char         *checksum,
+                         gboolean            need_loose)
+{
+  gboolean ret = FALSE;
+  gpointer value;
+  guchar key[OSTREE_KNOWN_OBJECT_KEY_SIZE];
+
+  known_object_key_init (key, objtype, checksum);
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->txn_known_objects
+      && g_hash_table_lookup_extended (self->txn_known_objects, key, NULL, &value))
+    ret = GPOINTER_TO_INT (value) || !need_loose;
+  g_mutex_unlock (&self->cache_lock);
+
+  return ret;
+}
+
+static void
+txn_known_object_add (OstreeRepo         *self,
+                      OstreeObjectType    objtype,
+                      const char         *checksum,
+                      gboolean            is_loose)
+{
+  guchar *key;
+
+  key = g_malloc (OSTREE_KNOWN_OBJECT_KEY_SIZE);
+  known_object_key_init (key, objtype, checksum);
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->txn_known_objects
+      && (is_loose || !g_hash_table_lookup (self->txn_known_objects, key)))
+    g_hash_table_replace (self->txn_known_objects, key, GINT_TO_POINTER (is_loose));
+  else
+    g_free (key);
+  g_mutex_unlock (&self->cache_lock);
+}
+
+static void
+txn_known_objects_clear (OstreeRepo *self)
+{
+  g_mutex_lock (&self->cache_lock);
+  g_clear_pointer (&self->txn_known_objects, (GDestroyNotify) g_hash_table_unref);
+  g_mutex_unlock (&self->cache_lock);
+}
+
 static gboolean
 stage_object_internal (OstreeRepo         *self,
                        OstreeRepoStageFlags flags,
@@ -869,6 +1348,8 @@ stage_object_internal (OstreeRepo         *self,
  gboolean ret = FALSE;
   const char *actual_checksum;
   gboolean do_commit;
+  int temp_fd = -1;
+  int raw_temp_fd = -1;
   ot_lobj GFileInfo *temp_info = NULL;
   ot_lobj GFile *temp_file = NULL;
   ot_lobj GFile *raw_temp_file = NULL;
@@ -887,26 +1368,30 @@ stage_object_internal (OstreeRepo         *self,
         checksum_input = ostree_checksum_input_stream_new (input, checksum);
     }
 
+  /* Bare repositories store the raw file, which can be written
+   * directly from the stream even when its length isn't known.
+   */
   if (objtype == OSTREE_OBJECT_TYPE_FILE
-      && (flags & OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID) > 0)
+      && ((flags & OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID) > 0
+          || self->mode == OSTREE_REPO_MODE_BARE))
     {
       ot_lobj GInputStream *file_input = NULL;
       ot_lobj GFileInfo *file_info = NULL;
       ot_lvariant GVariant *xattrs = NULL;
 
       if (!ostree_content_stream_parse (checksum_input ? (GInputStream*)checksum_input : input,
-                                        file_object_length, FALSE,
+                                        (flags & OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID) ? file_object_length : 0,
+                                        FALSE,
                                         &file_input, &file_info, &xattrs,
                                         cancellable, error))
         goto out;
 
       if (ostree_repo_get_mode (self) == OSTREE_REPO_MODE_BARE)
         {
-          if (!ostree_create_temp_file_from_input (self->tmp_dir,
-                                                   ostree_object_type_to_string (objtype), NULL,
-                                                   file_info, xattrs, file_input,
-                                                   &temp_file,
-                                                   cancellable, error))
+          if (!create_object_tmpfile_from_input (self, objtype,
+                                                 file_info, xattrs, file_input,
+                                                 &temp_fd, &temp_file,
+                                                 cancellable, error))
             goto out;
           staged_raw_file = TRUE;
         }
@@ -919,11 +1404,10 @@ stage_object_internal (OstreeRepo         *self,
           file_meta = ostree_file_header_new (file_info, xattrs);
           file_meta_input = ot_variant_read (file_meta);
 
-          if (!ostree_create_temp_file_from_input (self->tmp_dir,
-                                                   ostree_object_type_to_string (objtype), NULL,
-                                                   NULL, NULL, file_meta_input,
-                                                   &temp_file,
-                                                   cancellable, error))
+          if (!create_object_tmpfile_from_input (self, objtype,
+                                                 NULL, NULL, file_meta_input,
+                                                 &temp_fd, &temp_file,
+                                                 cancellable, error))
             goto out;
 
           if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
@@ -932,22 +1416,37 @@ stage_object_internal (OstreeRepo         *self,
               guint32 src_mode;
               guint32 target_mode;
 
-              if (!ostree_create_temp_regular_file (self->tmp_dir,
-                                                    ostree_object_type_to_string (objtype), NULL,
-                                                    &raw_temp_file, &content_out,
-                                                    cancellable, error))
-                goto out;
-
               /* Don't make setuid files in the repository; all we want to preserve
                * is file type and permissions.
                */
               src_mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
               target_mode = src_mode & (S_IRWXU | S_IRWXG | S_IRWXO | S_IFMT);
-              
-              if (chmod (ot_gfile_get_path_cached (raw_temp_file), target_mode) < 0)
+
+              if (!open_object_tmpfile (self, target_mode, &raw_temp_fd, error))
+                goto out;
+
+              if (raw_temp_fd != -1)
                 {
-                  ot_util_set_error_from_errno (error, errno);
-                  goto out;
+                  if (fchmod (raw_temp_fd, target_mode & 07777) < 0)
+                    {
+                      ot_util_set_error_from_errno (error, errno);
+                      goto out;
+                    }
+                  content_out = g_unix_output_stream_new (raw_temp_fd, FALSE);
+                }
+              else
+                {
+                  if (!ostree_create_temp_regular_file (self->tmp_dir,
+                                                        ostree_object_type_to_string (objtype), NULL,
+                                                        &raw_temp_file, &content_out,
+                                                        cancellable, error))
+                    goto out;
+              
+                  if (chmod (ot_gfile_get_path_cached (raw_temp_file), target_mode) < 0)
+                    {
+                      ot_util_set_error_from_errno (error, errno);
+                      goto out;
+                    }
                 }
 
               if (g_output_stream_splice (content_out, file_input,
@@ -961,12 +1460,10 @@ stage_object_internal (OstreeRepo         *self,
     }
   else
     {
-      if (!ostree_create_temp_file_from_input (self->tmp_dir,
-                                               ostree_object_type_to_string (objtype), NULL,
-                                               NULL, NULL,
-                                               checksum_input ? (GInputStream*)checksum_input : input,
-                                               &temp_file,
-                                               cancellable, error))
+      if (!create_object_tmpfile_from_input (self, objtype, NULL, NULL,
+                                             checksum_input ? (GInputStream*)checksum_input : input,
+                                             &temp_fd, &temp_file,
+                                             cancellable, error))
         goto out;
     }
           
@@ -985,7 +1482,10 @@ stage_object_internal (OstreeRepo         *self,
         }
     }
           
-  if (!(flags & OSTREE_REPO_STAGE_FLAGS_STORE_IF_PACKED))
+  if (txn_known_object_lookup (self, objtype, actual_checksum,
+                               (flags & OSTREE_REPO_STAGE_FLAGS_STORE_IF_PACKED) > 0))
+    do_commit = FALSE;
+  else if (!(flags & OSTREE_REPO_STAGE_FLAGS_STORE_IF_PACKED))
     {
       gboolean have_obj;
           
@@ -994,56 +1494,36 @@ stage_object_internal (OstreeRepo         *self,
         goto out;
           
       do_commit = !have_obj;
+      if (have_obj)
+        txn_known_object_add (self, objtype, actual_checksum, FALSE);
     }
   else
     do_commit = TRUE;
 
   if (do_commit)
     {
-      /* Only do this if we *didn't* stage a bare file above */
-      if (!staged_raw_file
-          && objtype == OSTREE_OBJECT_TYPE_FILE && self->mode == OSTREE_REPO_MODE_BARE)
+      g_assert (staged_raw_file
+                || !(objtype == OSTREE_OBJECT_TYPE_FILE && self->mode == OSTREE_REPO_MODE_BARE));
+
+      /* Commit content first so the process is atomic */
+      if (staged_archive_file)
         {
-          ot_lobj GInputStream *file_input = NULL;
-          ot_lobj GFileInfo *file_info = NULL;
-          ot_lvariant GVariant *xattrs = NULL;
-              
-          if (!ostree_content_file_parse (temp_file, FALSE, &file_input,
-                                          &file_info, &xattrs,
-                                          cancellable, error))
-            goto out;
-              
-          if (!ostree_create_temp_file_from_input (self->tmp_dir,
-                                                   ostree_object_type_to_string (objtype), NULL,
-                                                   file_info, xattrs, file_input,
-                                                   &raw_temp_file,
-                                                   cancellable, error))
-            goto out;
+          ot_lobj GFile *archive_content_dest = NULL;
 
-          if (!commit_loose_object_trusted (self, actual_checksum, objtype, 
-                                            raw_temp_file, cancellable, error))
+          archive_content_dest = ostree_repo_get_archive_content_path (self, actual_checksum);
+                                                                   
+          if (!commit_loose_object_impl (self, raw_temp_file, raw_temp_fd,
+                                         archive_content_dest,
+                                         cancellable, error))
             goto out;
           g_clear_object (&raw_temp_file);
         }
-      else
-        {
-          /* Commit content first so the process is atomic */
-          if (staged_archive_file)
-            {
-              ot_lobj GFile *archive_content_dest = NULL;
+      if (!commit_loose_object_trusted (self, actual_checksum, objtype, 
+                                        temp_file, temp_fd, cancellable, error))
+        goto out;
+      g_clear_object (&temp_file);
 
-              archive_content_dest = ostree_repo_get_archive_content_path (self, actual_checksum);
-                                                                   
-              if (!commit_loose_object_impl (self, raw_temp_file, archive_content_dest,
-                                             cancellable, error))
-                goto out;
-              g_clear_object (&raw_temp_file);
-            }
-          if (!commit_loose_object_trusted (self, actual_checksum, objtype, 
-                                            temp_file, cancellable, error))
-            goto out;
-          g_clear_object (&temp_file);
-        }
+      txn_known_object_add (self, objtype, actual_checksum, TRUE);
     }
       
   if (checksum)
@@ -1056,6 +1536,10 @@ stage_object_internal (OstreeRepo         *self,
     (void) unlink (ot_gfile_get_path_cached (temp_file));
   if (raw_temp_file)
     (void) unlink (ot_gfile_get_path_cached (raw_temp_file));
+  if (temp_fd != -1)
+    (void) close (temp_fd);
+  if (raw_temp_fd != -1)
+    (void) close (raw_temp_fd);
   g_clear_pointer (&checksum, (GDestroyNotify) g_checksum_free);
   return ret;
 }
@@ -1084,6 +1568,14 @@ stage_object (OstreeRepo         *self,
 
   g_assert (expected_checksum || out_csum);
 
+  if (expected_checksum
+      && txn_known_object_lookup (self, objtype, expected_checksum,
+                                  (flags & OSTREE_REPO_STAGE_FLAGS_STORE_IF_PACKED) > 0))
+    {
+      ret = TRUE;
+      goto out;
+    }
+
   if (expected_checksum)
     {
       if (!(flags & OSTREE_REPO_STAGE_FLAGS_STORE_IF_PACKED))
@@ -1100,6 +1592,11 @@ stage_object (OstreeRepo         *self,
                                  cancellable, error))
             goto out;
         }
+
+      if (stored_path)
+        txn_known_object_add (self, objtype, expected_checksum, TRUE);
+      else if (pack_checksum)
+        txn_known_object_add (self, objtype, expected_checksum, FALSE);
     }
 
   if (stored_path == NULL && pack_checksum == NULL)
@@ -1201,12 +1698,6 @@ scan_loose_devino (OstreeRepo                     *self,
   ot_lptrarray GPtrArray *object_dirs = NULL;
   ot_lobj GFile *objdir = NULL;
 
-  if (self->parent_repo)
-    {
-      if (!scan_loose_devino (self->parent_repo, devino_cache, cancellable, error))
-        goto out;
-    }
-
   if (!get_loose_object_dirs (self, &object_dirs, cancellable, error))
     goto out;
 
@@ -1286,2094 +1777,4381 @@ scan_loose_devino (OstreeRepo                     *self,
   return ret;
 }
 
-static const char *
-devino_cache_lookup (OstreeRepo           *self,
-                     GFileInfo            *finfo)
+/*
+ * The dev/ino cache persists the mapping from (device, inode) of
+ * loose file objects (the .file in bare repositories, the .filecontent
+ * in archive ones) to checksums, so that preparing a transaction
+ * doesn't need to enumerate every object directory.
+ *
+ * s - OSTv0DEVINOCACHE
+ * a{sv} - Metadata
+ * ay - entries, sorted records of big-endian guint64 device,
+ *      big-endian guint64 inode, and the 32 byte checksum
+ *
+ * Entries can go stale when objects are deleted, so every hit is
+ * verified against the object itself.
+ */
+#define OSTREE_DEVINO_CACHE_VARIANT_FORMAT G_VARIANT_TYPE ("(sa{sv}ay)")
+#define OSTREE_DEVINO_CACHE_ENTRY_SIZE (48)
+
+static GFile *
+get_devino_cache_path (OstreeRepo   *self)
 {
-  OstreeDevIno dev_ino;
+  return g_file_get_child (self->repodir, "devino-cache");
+}
+
+static GFile *
+get_devino_object_path (OstreeRepo   *self,
+                        const char   *checksum)
+{
+  if (ostree_repo_get_mode (self) == OSTREE_REPO_MODE_ARCHIVE)
+    return ostree_repo_get_archive_content_path (self, checksum);
+  else
+    return ostree_repo_get_object_path (self, checksum, OSTREE_OBJECT_TYPE_FILE);
+}
+
+static void
+devino_cache_entry_init (guchar              *entry,
+                         const OstreeDevIno  *devino,
+                         const guchar        *csum)
+{
+  guint64 dev_be = GUINT64_TO_BE ((guint64) devino->dev);
+  guint64 ino_be = GUINT64_TO_BE ((guint64) devino->ino);
+
+  memcpy (entry, &dev_be, 8);
+  memcpy (entry + 8, &ino_be, 8);
+  if (csum)
+    memcpy (entry + 16, csum, 32);
+}
+
+static void
+devino_cache_note_object (OstreeRepo        *self,
+                          const char        *checksum)
+{
+  struct stat stbuf;
+  OstreeDevIno *key;
+  ot_lobj GFile *object_path = NULL;
 
   if (!self->loose_object_devino_hash)
-    return NULL;
+    return;
 
-  dev_ino.dev = g_file_info_get_attribute_uint32 (finfo, "unix::device");
-  dev_ino.ino = g_file_info_get_attribute_uint64 (finfo, "unix::inode");
-  return g_hash_table_lookup (self->loose_object_devino_hash, &dev_ino);
+  object_path = get_devino_object_path (self, checksum);
+  /* Archive repositories have no content file for e.g. symlinks */
+  if (lstat (ot_gfile_get_path_cached (object_path), &stbuf) < 0)
+    return;
+
+  key = g_new (OstreeDevIno, 1);
+  /* Match the width of GIO's unix::device */
+  key->dev = (guint32) stbuf.st_dev;
+  key->ino = stbuf.st_ino;
+  /* Objects may be staged from worker threads */
+  g_mutex_lock (&self->cache_lock);
+  g_hash_table_replace (self->loose_object_devino_hash, key, g_strdup (checksum));
+  g_mutex_unlock (&self->cache_lock);
 }
 
-gboolean
-ostree_repo_prepare_transaction (OstreeRepo     *self,
-                                 GCancellable   *cancellable,
-                                 GError        **error)
+static gboolean
+devino_cache_search (GVariant            *cache,
+                     const OstreeDevIno  *devino,
+                     guchar              *out_csum)
 {
   gboolean ret = FALSE;
+  const guchar *entries;
+  gsize entries_len;
+  gsize imin, imax;
+  guchar key[OSTREE_DEVINO_CACHE_ENTRY_SIZE];
+  ot_lvariant GVariant *entries_variant = NULL;
 
-  g_return_val_if_fail (self->in_transaction == FALSE, FALSE);
+  devino_cache_entry_init (key, devino, NULL);
 
-  self->in_transaction = TRUE;
+  entries_variant = g_variant_get_child_value (cache, 2);
+  entries = g_variant_get_fixed_array (entries_variant, &entries_len, 1);
 
-  if (!self->loose_object_devino_hash)
+  imin = 0;
+  imax = entries_len / OSTREE_DEVINO_CACHE_ENTRY_SIZE;
+  while (imin < imax)
     {
-      self->loose_object_devino_hash = g_hash_table_new_full (devino_hash, devino_equal, g_free, g_free);
+      gsize imid = imin + (imax - imin) / 2;
+      const guchar *entry = entries + (imid * OSTREE_DEVINO_CACHE_ENTRY_SIZE);
+      int c = memcmp (entry, key, 16);
+
+      if (c < 0)
+        imin = imid + 1;
+      else if (c > 0)
+        imax = imid;
+      else
+        {
+          memcpy (out_csum, entry + 16, 32);
+          ret = TRUE;
+          break;
+        }
     }
-  g_hash_table_remove_all (self->loose_object_devino_hash);
-  if (!scan_loose_devino (self, self->loose_object_devino_hash, cancellable, error))
-    goto out;
 
-  ret = TRUE;
- out:
   return ret;
 }
 
-gboolean      
-ostree_repo_commit_transaction (OstreeRepo     *self,
-                                GCancellable   *cancellable,
-                                GError        **error)
+static char *
+devino_cache_lookup_devino (OstreeRepo           *self,
+                            const OstreeDevIno   *devino)
 {
-  gboolean ret = FALSE;
+  char *ret = NULL;
+  guchar csum[32];
 
-  g_return_val_if_fail (self->in_transaction == TRUE, FALSE);
-
-  ret = TRUE;
-  /* out: */
-  self->in_transaction = FALSE;
   if (self->loose_object_devino_hash)
-    g_hash_table_remove_all (self->loose_object_devino_hash);
+    {
+      g_mutex_lock (&self->cache_lock);
+      ret = g_strdup (g_hash_table_lookup (self->loose_object_devino_hash, devino));
+      g_mutex_unlock (&self->cache_lock);
+    }
+
+  if (!ret && self->devino_cache && devino_cache_search (self->devino_cache, devino, csum))
+    ret = ostree_checksum_from_bytes (csum);
+
+  if (ret)
+    {
+      struct stat stbuf;
+      ot_lobj GFile *object_path = NULL;
+
+      object_path = get_devino_object_path (self, ret);
+      if (!(lstat (ot_gfile_get_path_cached (object_path), &stbuf) == 0
+            && (guint32) stbuf.st_dev == devino->dev
+            && stbuf.st_ino == devino->ino))
+        g_clear_pointer (&ret, g_free);
+    }
+
+  if (!ret && self->parent_repo)
+    ret = devino_cache_lookup_devino (self->parent_repo, devino);
 
   return ret;
 }
 
-gboolean
-ostree_repo_abort_transaction (OstreeRepo     *self,
-                               GCancellable   *cancellable,
-                               GError        **error)
+static char *
+devino_cache_lookup (OstreeRepo           *self,
+                     GFileInfo            *finfo)
 {
-  gboolean ret = FALSE;
-
-  self->in_transaction = FALSE;
-  if (self->loose_object_devino_hash)
-    g_hash_table_remove_all (self->loose_object_devino_hash);
+  OstreeDevIno dev_ino;
 
-  ret = TRUE;
-  return ret;
+  dev_ino.dev = g_file_info_get_attribute_uint32 (finfo, "unix::device");
+  dev_ino.ino = g_file_info_get_attribute_uint64 (finfo, "unix::inode");
+  return devino_cache_lookup_devino (self, &dev_ino);
 }
 
 static gboolean
-stage_metadata_object (OstreeRepo         *self,
-                       OstreeObjectType    type,
-                       GVariant           *variant,
-                       guchar            **out_csum,
-                       GCancellable       *cancellable,
-                       GError            **error)
+load_devino_cache (OstreeRepo      *self,
+                   GCancellable    *cancellable,
+                   GError         **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GInputStream *input = NULL;
+  ot_lobj GFile *cache_path = NULL;
 
-  input = ot_variant_read (variant);
-  
-  if (!stage_object (self, 0, type, input, 0, NULL,
-                     out_csum, cancellable, error))
-    goto out;
+  if (self->parent_repo)
+    {
+      if (!load_devino_cache (self->parent_repo, cancellable, error))
+        goto out;
+    }
+
+  if (!self->loose_object_devino_hash)
+    self->loose_object_devino_hash = g_hash_table_new_full (devino_hash, devino_equal, g_free, g_free);
+  g_hash_table_remove_all (self->loose_object_devino_hash);
+  g_clear_pointer (&self->devino_cache, (GDestroyNotify) g_variant_unref);
+
+  cache_path = get_devino_cache_path (self);
+  if (g_file_query_exists (cache_path, cancellable))
+    {
+      if (!map_variant_file_check_header_string (cache_path,
+                                                 OSTREE_DEVINO_CACHE_VARIANT_FORMAT,
+                                                 "OSTv0DEVINOCACHE", TRUE,
+                                                 &self->devino_cache,
+                                                 cancellable, error))
+        goto out;
+    }
+  else
+    {
+      /* No cache yet; do a full scan, which we'll save on commit */
+      if (!scan_loose_devino (self, self->loose_object_devino_hash, cancellable, error))
+        goto out;
+    }
 
   ret = TRUE;
  out:
   return ret;
 }
 
+static gint
+compare_devino_cache_entries (gconstpointer  a,
+                              gconstpointer  b)
+{
+  return memcmp (a, b, 16);
+}
+
+/*
+ * Merge the objects recorded during this transaction into the sorted
+ * on-disk cache; new entries win over old ones for the same dev/ino.
+ */
 static gboolean
-stage_directory_meta (OstreeRepo   *self,
-                      GFileInfo    *file_info,
-                      GVariant     *xattrs,
-                      guchar      **out_csum,
-                      GCancellable *cancellable,
-                      GError      **error)
+save_devino_cache (OstreeRepo      *self,
+                   GCancellable    *cancellable,
+                   GError         **error)
 {
   gboolean ret = FALSE;
-  ot_lvariant GVariant *dirmeta = NULL;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  const guchar *old_entries = NULL;
+  gsize old_len = 0;
+  gsize n_old, i_old, i_new;
+  GArray *new_entries = NULL;
+  GArray *merged = NULL;
+  ot_lobj GFile *cache_path = NULL;
+  ot_lvariant GVariant *old_entries_variant = NULL;
+  ot_lvariant GVariant *cache_variant = NULL;
 
-  if (g_cancellable_set_error_if_cancelled (cancellable, error))
-    return FALSE;
+  if (!self->loose_object_devino_hash
+      || g_hash_table_size (self->loose_object_devino_hash) == 0)
+    {
+      ret = TRUE;
+      goto out;
+    }
 
-  dirmeta = ostree_create_directory_metadata (file_info, xattrs);
-  
-  if (!stage_metadata_object (self, OSTREE_OBJECT_TYPE_DIR_META, 
-                              dirmeta, out_csum, cancellable, error))
+  new_entries = g_array_sized_new (FALSE, FALSE, OSTREE_DEVINO_CACHE_ENTRY_SIZE,
+                                   g_hash_table_size (self->loose_object_devino_hash));
+  g_hash_table_iter_init (&hash_iter, self->loose_object_devino_hash);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      guchar entry[OSTREE_DEVINO_CACHE_ENTRY_SIZE];
+      ot_lfree guchar *csum = ostree_checksum_to_bytes (value);
+
+      devino_cache_entry_init (entry, key, csum);
+      g_array_append_vals (new_entries, entry, 1);
+    }
+  g_array_sort (new_entries, compare_devino_cache_entries);
+
+  if (self->devino_cache)
+    {
+      old_entries_variant = g_variant_get_child_value (self->devino_cache, 2);
+      old_entries = g_variant_get_fixed_array (old_entries_variant, &old_len, 1);
+    }
+  n_old = old_len / OSTREE_DEVINO_CACHE_ENTRY_SIZE;
+
+  merged = g_array_sized_new (FALSE, FALSE, OSTREE_DEVINO_CACHE_ENTRY_SIZE,
+                              n_old + new_entries->len);
+  i_old = i_new = 0;
+  while (i_old < n_old || i_new < new_entries->len)
+    {
+      const guchar *old_entry = NULL;
+      const guchar *new_entry = NULL;
+      int c;
+
+      if (i_old < n_old)
+        old_entry = old_entries + (i_old * OSTREE_DEVINO_CACHE_ENTRY_SIZE);
+      if (i_new < new_entries->len)
+        new_entry = (guchar*)new_entries->data + (i_new * OSTREE_DEVINO_CACHE_ENTRY_SIZE);
+
+      if (!old_entry)
+        c = 1;
+      else if (!new_entry)
+        c = -1;
+      else
+        c = compare_devino_cache_entries (old_entry, new_entry);
+
+      if (c < 0)
+        {
+          g_array_append_vals (merged, old_entry, 1);
+          i_old++;
+        }
+      else
+        {
+          g_array_append_vals (merged, new_entry, 1);
+          i_new++;
+          if (c == 0)
+            i_old++;
+        }
+    }
+
+  cache_variant = g_variant_new ("(s@a{sv}@ay)", "OSTv0DEVINOCACHE",
+                                 g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0),
+                                 ot_gvariant_new_bytearray ((guchar*)merged->data,
+                                                            merged->len * OSTREE_DEVINO_CACHE_ENTRY_SIZE));
+  g_variant_ref_sink (cache_variant);
+
+  cache_path = get_devino_cache_path (self);
+  if (!ot_util_variant_save (cache_path, cache_variant, cancellable, error))
     goto out;
 
   ret = TRUE;
  out:
+  if (new_entries)
+    g_array_free (new_entries, TRUE);
+  if (merged)
+    g_array_free (merged, TRUE);
   return ret;
 }
 
-GFile *
-ostree_repo_get_object_path (OstreeRepo  *self,
-                             const char    *checksum,
-                             OstreeObjectType type)
-{
-  char *relpath;
-  GFile *ret;
+/*
+ * The stat cache remembers the content checksum of each regular file
+ * seen by the last commit that used it, keyed by its stat data, so
+ * that unchanged files don't need to be read again.
+ *
+ * s - OSTv0STATCACHE
+ * a{sv} - Metadata
+ * a(s(tttttttuuuay)ay) - (path, key, content checksum)
+ *
+ * The key is (device, inode, size, mtime, mtime nsec, ctime, ctime
+ * nsec, mode, uid, gid, SHA256 of xattrs), where mode and ownership
+ * are taken after the commit filter has been applied.
+ */
+#define OSTREE_STAT_CACHE_VARIANT_FORMAT G_VARIANT_TYPE ("(sa{sv}a(s(tttttttuuuay)ay))")
 
-  relpath = ostree_get_relative_object_path (checksum, type);
-  ret = g_file_resolve_relative_path (self->repodir, relpath);
-  g_free (relpath);
- 
-  return ret;
+static GFile *
+get_stat_cache_path (OstreeRepo   *self)
+{
+  return g_file_get_child (self->repodir, "stat-cache");
 }
 
-gboolean      
-ostree_repo_stage_object_trusted (OstreeRepo   *self,
-                                  OstreeObjectType objtype,
-                                  const char   *checksum,
-                                  gboolean          store_if_packed,
-                                  GInputStream     *object_input,
-                                  GCancellable *cancellable,
-                                  GError      **error)
+static void
+stat_cache_clear (OstreeRepo   *self)
 {
-  int flags = 0;
-  if (store_if_packed)
-    flags |= OSTREE_REPO_STAGE_FLAGS_STORE_IF_PACKED;
-  return stage_object (self, flags, objtype,
-                       object_input, 0, checksum, NULL,
-                       cancellable, error);
+  self->stat_cache_loaded = FALSE;
+  g_clear_pointer (&self->stat_cache_old, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&self->stat_cache_new, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&self->stat_cache, (GDestroyNotify) g_variant_unref);
 }
 
-gboolean
-ostree_repo_stage_object (OstreeRepo       *self,
-                          OstreeObjectType  objtype,
-                          const char       *expected_checksum,
-                          GInputStream     *object_input,
-                          GCancellable     *cancellable,
-                          GError          **error)
+static gboolean
+stat_cache_ensure_loaded (OstreeRepo      *self,
+                          GCancellable    *cancellable,
+                          GError         **error)
 {
   gboolean ret = FALSE;
-  ot_lfree guchar *actual_csum = NULL;
-  
-  if (!stage_object (self, 0, objtype, 
-                     object_input, 0, expected_checksum, &actual_csum,
-                     cancellable, error))
-    goto out;
+  ot_lobj GFile *cache_path = NULL;
+
+  if (self->stat_cache_loaded)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  /* Keys point into the mapped cache */
+  self->stat_cache_old = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                NULL, (GDestroyNotify) g_variant_unref);
+  self->stat_cache_new = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, (GDestroyNotify) g_variant_unref);
+
+  cache_path = get_stat_cache_path (self);
+  if (g_file_query_exists (cache_path, cancellable))
+    {
+      GVariantIter entries_iter;
+      GVariant *entry;
+      ot_lvariant GVariant *entries = NULL;
+
+      if (!map_variant_file_check_header_string (cache_path,
+                                                 OSTREE_STAT_CACHE_VARIANT_FORMAT,
+                                                 "OSTv0STATCACHE", TRUE,
+                                                 &self->stat_cache,
+                                                 cancellable, error))
+        goto out;
+
+      entries = g_variant_get_child_value (self->stat_cache, 2);
+      g_variant_iter_init (&entries_iter, entries);
+      while ((entry = g_variant_iter_next_value (&entries_iter)) != NULL)
+        {
+          const char *path;
+
+          g_variant_get_child (entry, 0, "&s", &path);
+          g_hash_table_replace (self->stat_cache_old, (char*)path, entry);
+        }
+    }
+
+  self->stat_cache_loaded = TRUE;
 
   ret = TRUE;
  out:
   return ret;
 }
 
-gboolean      
-ostree_repo_stage_file_object_trusted (OstreeRepo       *self,
-                                       const char       *checksum,
-                                       gboolean          store_if_packed,
-                                       GInputStream     *object_input,
-                                       guint64           length,
-                                       GCancellable     *cancellable,
-                                       GError          **error)
+static GVariant *
+stat_cache_key_new (struct stat     *stbuf,
+                    GFileInfo       *file_info,
+                    GVariant        *xattrs)
 {
-  int flags = OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID;
-  if (store_if_packed)
-    flags |= OSTREE_REPO_STAGE_FLAGS_STORE_IF_PACKED;
-  return stage_object (self, flags, OSTREE_OBJECT_TYPE_FILE,
-                       object_input, length, checksum, NULL,
-                       cancellable, error);
+  GVariant *ret;
+  GChecksum *xattrs_checksum;
+  guint8 xattrs_digest[32];
+  gsize digest_len = sizeof (xattrs_digest);
+
+  xattrs_checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  if (xattrs)
+    g_checksum_update (xattrs_checksum, g_variant_get_data (xattrs),
+                       g_variant_get_size (xattrs));
+  g_checksum_get_digest (xattrs_checksum, xattrs_digest, &digest_len);
+  g_checksum_free (xattrs_checksum);
+
+  ret = g_variant_new ("(tttttttuuu@ay)",
+                       (guint64) stbuf->st_dev, (guint64) stbuf->st_ino,
+                       (guint64) stbuf->st_size,
+                       (guint64) stbuf->st_mtim.tv_sec, (guint64) stbuf->st_mtim.tv_nsec,
+                       (guint64) stbuf->st_ctim.tv_sec, (guint64) stbuf->st_ctim.tv_nsec,
+                       g_file_info_get_attribute_uint32 (file_info, "unix::mode"),
+                       g_file_info_get_attribute_uint32 (file_info, "unix::uid"),
+                       g_file_info_get_attribute_uint32 (file_info, "unix::gid"),
+                       ot_gvariant_new_bytearray (xattrs_digest, sizeof (xattrs_digest)));
+  return g_variant_ref_sink (ret);
 }
 
-gboolean
-ostree_repo_stage_file_object (OstreeRepo       *self,
-                               const char       *expected_checksum,
-                               GInputStream     *object_input,
-                               guint64           length,
-                               GCancellable     *cancellable,
-                               GError          **error)
+static void
+stat_cache_insert (OstreeRepo     *self,
+                   const char     *path,
+                   GVariant       *key,
+                   const char     *checksum)
 {
-  gboolean ret = FALSE;
-  int flags = OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID;
-  ot_lfree guchar *actual_csum = NULL;
-  
-  if (!stage_object (self, flags, OSTREE_OBJECT_TYPE_FILE, 
-                     object_input, length, expected_checksum, &actual_csum,
-                     cancellable, error))
-    goto out;
-
-  ret = TRUE;
- out:
-  return ret;
-}
+  GVariant *entry;
 
-static GVariant *
-create_empty_gvariant_dict (void)
-{
-  GVariantBuilder builder;
-  g_variant_builder_init (&builder, G_VARIANT_TYPE("a{sv}"));
-  return g_variant_builder_end (&builder);
+  entry = g_variant_new ("(s@(tttttttuuuay)@ay)", path, key,
+                         ostree_checksum_to_bytes_v (checksum));
+  g_hash_table_replace (self->stat_cache_new, g_strdup (path),
+                        g_variant_ref_sink (entry));
 }
 
+/*
+ * Look up @path in the stat cache.  On a hit, @out_checksum is the
+ * content checksum.  On a miss, @out_key (if not %NULL) should be
+ * passed to stat_cache_insert() once the checksum is known.
+ * @out_xattrs holds the xattrs read for the key, if any.
+ */
 static gboolean
-enumerate_refs_recurse (OstreeRepo    *repo,
-                        GFile         *base,
-                        GFile         *dir,
-                        GHashTable    *refs,
-                        GCancellable  *cancellable,
-                        GError       **error)
+stat_cache_lookup (OstreeRepo                *self,
+                   GFile                     *path,
+                   GFileInfo                 *file_info,
+                   OstreeRepoCommitModifier  *modifier,
+                   GVariant                 **out_key,
+                   GVariant                 **out_xattrs,
+                   char                     **out_checksum,
+                   GCancellable              *cancellable,
+                   GError                   **error)
 {
   gboolean ret = FALSE;
-  GError *temp_error = NULL;
-  ot_lobj GFileInfo *file_info = NULL;
-  ot_lobj GFileEnumerator *enumerator = NULL;
-  ot_lobj GFile *child = NULL;
+  const char *pathstr;
+  struct stat stbuf;
+  GVariant *entry;
+  ot_lvariant GVariant *ret_key = NULL;
+  ot_lvariant GVariant *ret_xattrs = NULL;
+  ot_lfree char *ret_checksum = NULL;
 
-  enumerator = g_file_enumerate_children (dir, OSTREE_GIO_FAST_QUERYINFO,
-                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                          cancellable, error);
-  if (!enumerator)
+  if (!stat_cache_ensure_loaded (self, cancellable, error))
     goto out;
 
-  while ((file_info = g_file_enumerator_next_file (enumerator, cancellable, &temp_error)) != NULL)
+  pathstr = ot_gfile_get_path_cached (path);
+  if (lstat (pathstr, &stbuf) < 0)
     {
-      g_clear_object (&child);
-      child = g_file_get_child (dir, g_file_info_get_name (file_info));
-      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
-        {
-          if (!enumerate_refs_recurse (repo, base, child, refs, cancellable, error))
-            goto out;
-        }
-      else if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
-        {
-          char *contents;
-          gsize len;
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
 
-          if (!g_file_load_contents (child, cancellable, &contents, &len, NULL, error))
-            goto out;
+  if (!modifier->skip_xattrs)
+    {
+      if (!ostree_get_xattrs_for_file (path, &ret_xattrs, cancellable, error))
+        goto out;
+    }
 
-          g_strchomp (contents);
+  ret_key = stat_cache_key_new (&stbuf, file_info, ret_xattrs);
 
-          g_hash_table_insert (refs, g_file_get_relative_path (base, child), contents);
+  entry = g_hash_table_lookup (self->stat_cache_old, pathstr);
+  if (entry)
+    {
+      ot_lvariant GVariant *old_key = NULL;
+      ot_lvariant GVariant *csum_v = NULL;
+
+      old_key = g_variant_get_child_value (entry, 1);
+      csum_v = g_variant_get_child_value (entry, 2);
+      if (g_variant_equal (old_key, ret_key)
+          && g_variant_n_children (csum_v) == 32)
+        {
+          gboolean have_obj;
+          ot_lfree char *checksum = NULL;
+
+          /* The object may have been pruned since */
+          checksum = ostree_checksum_from_bytes_v (csum_v);
+          if (!ostree_repo_has_object (self, OSTREE_OBJECT_TYPE_FILE, checksum,
+                                       &have_obj, cancellable, error))
+            goto out;
+          if (have_obj)
+            ot_transfer_out_value (&ret_checksum, &checksum);
         }
+    }
 
-      g_clear_object (&file_info);
+  if (ret_checksum)
+    {
+      self->stat_cache_hits++;
+      stat_cache_insert (self, pathstr, ret_key, ret_checksum);
+      g_clear_pointer (&ret_key, (GDestroyNotify) g_variant_unref);
     }
-  if (temp_error != NULL)
+  else
     {
-      g_propagate_error (error, temp_error);
-      goto out;
+      self->stat_cache_misses++;
+      /* Like git's "racily clean" entries, a file modified within the
+       * timestamp granularity could change again without its stat data
+       * changing; don't cache it.
+       */
+      if (stbuf.st_mtim.tv_sec >= time (NULL) - 1
+          || stbuf.st_ctim.tv_sec >= time (NULL) - 1)
+        g_clear_pointer (&ret_key, (GDestroyNotify) g_variant_unref);
     }
 
   ret = TRUE;
+  ot_transfer_out_value (out_key, &ret_key);
+  ot_transfer_out_value (out_xattrs, &ret_xattrs);
+  ot_transfer_out_value (out_checksum, &ret_checksum);
  out:
   return ret;
 }
 
-gboolean
-ostree_repo_list_all_refs (OstreeRepo       *repo,
-                           GHashTable      **out_all_refs,
-                           GCancellable     *cancellable,
-                           GError          **error)
+static gboolean
+save_stat_cache (OstreeRepo      *self,
+                 GCancellable    *cancellable,
+                 GError         **error)
 {
   gboolean ret = FALSE;
-  ot_lhash GHashTable *ret_all_refs = NULL;
-  ot_lobj GFile *heads_dir = NULL;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  ot_lobj GFile *cache_path = NULL;
+  ot_lvariant GVariant *cache_variant = NULL;
+  GVariantBuilder *entries_builder = NULL;
 
-  ret_all_refs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  if (!self->stat_cache_loaded)
+    {
+      ret = TRUE;
+      goto out;
+    }
 
-  heads_dir = g_file_resolve_relative_path (ostree_repo_get_path (repo), "refs/heads");
-  if (!enumerate_refs_recurse (repo, heads_dir, heads_dir, ret_all_refs, cancellable, error))
+  entries_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(s(tttttttuuuay)ay)"));
+  g_hash_table_iter_init (&hash_iter, self->stat_cache_new);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    g_variant_builder_add_value (entries_builder, (GVariant*)value);
+
+  cache_variant = g_variant_new ("(s@a{sv}@a(s(tttttttuuuay)ay))", "OSTv0STATCACHE",
+                                 g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0),
+                                 g_variant_builder_end (entries_builder));
+  g_variant_ref_sink (cache_variant);
+
+  cache_path = get_stat_cache_path (self);
+  if (!ot_util_variant_save (cache_path, cache_variant, cancellable, error))
     goto out;
 
   ret = TRUE;
-  ot_transfer_out_value (out_all_refs, &ret_all_refs);
  out:
+  if (entries_builder)
+    g_variant_builder_unref (entries_builder);
   return ret;
 }
 
-static gboolean
-write_ref_summary (OstreeRepo      *self,
-                   GCancellable    *cancellable,
-                   GError         **error)
+/**
+ * ostree_repo_get_stat_cache_stats:
+ * @self: Repo
+ * @out_hits: (out): Number of files whose checksum came from the stat cache
+ * @out_misses: (out): Number of files which had to be read
+ *
+ * Counts are for the current (or most recently committed) transaction.
+ */
+void
+ostree_repo_get_stat_cache_stats (OstreeRepo     *self,
+                                  guint          *out_hits,
+                                  guint          *out_misses)
+{
+  if (out_hits)
+    *out_hits = self->stat_cache_hits;
+  if (out_misses)
+    *out_misses = self->stat_cache_misses;
+}
+
+gboolean
+ostree_repo_prepare_transaction (OstreeRepo     *self,
+                                 GCancellable   *cancellable,
+                                 GError        **error)
 {
   gboolean ret = FALSE;
-  GHashTableIter hash_iter;
-  gpointer key, value;
-  gsize bytes_written;
-  ot_lhash GHashTable *all_refs = NULL;
-  ot_lobj GFile *summary_path = NULL;
-  ot_lobj GOutputStream *out = NULL;
-  ot_lfree char *buf = NULL;
 
-  if (!ostree_repo_list_all_refs (self, &all_refs, cancellable, error))
-    goto out;
+  if (self->in_transaction)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "A transaction is already in progress");
+      goto out;
+    }
 
-  summary_path = g_file_resolve_relative_path (ostree_repo_get_path (self),
-                                               "refs/summary");
+  self->in_transaction = TRUE;
 
-  out = (GOutputStream*) g_file_replace (summary_path, NULL, FALSE, 0, cancellable, error);
-  if (!out)
-    goto out;
-  
-  g_hash_table_iter_init (&hash_iter, all_refs);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
-    {
-      const char *name = key;
-      const char *sha256 = value;
+  self->stat_cache_hits = 0;
+  self->stat_cache_misses = 0;
 
-      g_free (buf);
-      buf = g_strdup_printf ("%s %s\n", sha256, name);
-      if (!g_output_stream_write_all (out, buf, strlen (buf), &bytes_written, cancellable, error))
-        goto out;
-    }
+  g_mutex_lock (&self->cache_lock);
+  g_clear_pointer (&self->txn_known_objects, (GDestroyNotify) g_hash_table_unref);
+  self->txn_known_objects = g_hash_table_new_full (known_object_hash, known_object_equal,
+                                                   g_free, NULL);
+  g_mutex_unlock (&self->cache_lock);
 
-  if (!g_output_stream_close (out, cancellable, error))
-    goto out;
+  if (!load_devino_cache (self, cancellable, error))
+    {
+      txn_known_objects_clear (self);
+      self->in_transaction = FALSE;
+      goto out;
+    }
 
   ret = TRUE;
  out:
   return ret;
 }
 
-gboolean      
-ostree_repo_write_ref (OstreeRepo  *self,
-                       const char  *remote,
-                       const char  *name,
-                       const char  *rev,
-                       GError     **error)
+/*
+ * Objects are written without any per-file fsync(); instead flush
+ * the whole filesystem once, so that a committed transaction survives
+ * a crash.
+ */
+static gboolean
+sync_transaction_objects (OstreeRepo     *self,
+                          GCancellable   *cancellable,
+                          GError        **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GFile *dir = NULL;
+  int fd = -1;
 
-  if (remote == NULL)
-    dir = g_object_ref (self->local_heads_dir);
-  else
+  if (!g_atomic_int_get (&self->txn_objects_written))
     {
-      dir = g_file_get_child (self->remote_heads_dir, remote);
-
-      if (!ot_gfile_ensure_directory (dir, FALSE, error))
-        goto out;
+      ret = TRUE;
+      goto out;
     }
 
-  if (!write_checksum_file (dir, name, rev, error))
-    goto out;
-
-  if (self->mode == OSTREE_REPO_MODE_ARCHIVE)
+#ifdef HAVE_SYNCFS
+  fd = open (ot_gfile_get_path_cached (self->objects_dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
     {
-      if (!write_ref_summary (self, NULL, error))
-        goto out;
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+  if (syncfs (fd) < 0)
+    {
+      if (errno != ENOSYS)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+      sync ();
     }
+#else
+  sync ();
+#endif
+
+  g_atomic_int_set (&self->txn_objects_written, FALSE);
 
   ret = TRUE;
  out:
+  if (fd != -1)
+    (void) close (fd);
   return ret;
 }
 
-gboolean
-ostree_repo_stage_commit (OstreeRepo *self,
-                          const char   *branch,
-                          const char   *parent,
-                          const char   *subject,
-                          const char   *body,
-                          GVariant     *metadata,
-                          GVariant     *related_objects,
-                          const char   *root_contents_checksum,
-                          const char   *root_metadata_checksum,
-                          char        **out_commit,
-                          GCancellable *cancellable,
-                          GError      **error)
+gboolean      
+ostree_repo_commit_transaction (OstreeRepo     *self,
+                                GCancellable   *cancellable,
+                                GError        **error)
 {
   gboolean ret = FALSE;
-  ot_lfree char *ret_commit = NULL;
-  ot_lvariant GVariant *commit = NULL;
-  ot_lfree guchar *commit_csum = NULL;
-  GDateTime *now = NULL;
 
-  g_return_val_if_fail (branch != NULL, FALSE);
-  g_return_val_if_fail (subject != NULL, FALSE);
-  g_return_val_if_fail (root_contents_checksum != NULL, FALSE);
-  g_return_val_if_fail (root_metadata_checksum != NULL, FALSE);
+  g_return_val_if_fail (self->in_transaction == TRUE, FALSE);
 
-  now = g_date_time_new_now_utc ();
-  commit = g_variant_new ("(@a{sv}@ay@a(say)sst@ay@ay)",
-                          metadata ? metadata : create_empty_gvariant_dict (),
-                          parent ? ostree_checksum_to_bytes_v (parent) : ot_gvariant_new_bytearray (NULL, 0),
-                          related_objects ? related_objects : g_variant_new_array (G_VARIANT_TYPE ("(say)"), NULL, 0),
-                          subject, body ? body : "",
-                          GUINT64_TO_BE (g_date_time_to_unix (now)),
-                          ostree_checksum_to_bytes_v (root_contents_checksum),
-                          ostree_checksum_to_bytes_v (root_metadata_checksum));
-  g_variant_ref_sink (commit);
-  if (!stage_metadata_object (self, OSTREE_OBJECT_TYPE_COMMIT,
-                              commit, &commit_csum, cancellable, error))
+  if (!sync_transaction_objects (self, cancellable, error))
     goto out;
 
-  ret_commit = ostree_checksum_from_bytes (commit_csum);
+  if (!save_devino_cache (self, cancellable, error))
+    goto out;
+
+  if (!save_stat_cache (self, cancellable, error))
+    goto out;
 
   ret = TRUE;
-  ot_transfer_out_value(out_commit, &ret_commit);
  out:
-  if (now)
-    g_date_time_unref (now);
+  self->in_transaction = FALSE;
+  if (self->loose_object_devino_hash)
+    g_hash_table_remove_all (self->loose_object_devino_hash);
+  g_clear_pointer (&self->devino_cache, (GDestroyNotify) g_variant_unref);
+  txn_known_objects_clear (self);
+  stat_cache_clear (self);
+
   return ret;
 }
 
-static gboolean
-list_files_in_dir_matching (GFile                  *dir,
-                            const char             *prefix,
-                            const char             *suffix,
-                            GPtrArray             **out_files,
-                            GCancellable           *cancellable,
-                            GError                **error)
+gboolean
+ostree_repo_abort_transaction (OstreeRepo     *self,
+                               GCancellable   *cancellable,
+                               GError        **error)
 {
   gboolean ret = FALSE;
-  GError *temp_error = NULL;
-  ot_lobj GFileEnumerator *enumerator = NULL;
-  ot_lobj GFileInfo *file_info = NULL;
-  ot_lptrarray GPtrArray *ret_files = NULL;
-
-  g_return_val_if_fail (prefix != NULL || suffix != NULL, FALSE);
 
-  ret_files = g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
+  self->in_transaction = FALSE;
+  g_atomic_int_set (&self->txn_objects_written, FALSE);
+  if (self->loose_object_devino_hash)
+    g_hash_table_remove_all (self->loose_object_devino_hash);
+  g_clear_pointer (&self->devino_cache, (GDestroyNotify) g_variant_unref);
+  txn_known_objects_clear (self);
+  stat_cache_clear (self);
 
-  enumerator = g_file_enumerate_children (dir, OSTREE_GIO_FAST_QUERYINFO, 
-                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                          cancellable, 
-                                          error);
-  if (!enumerator)
-    goto out;
-  
-  while ((file_info = g_file_enumerator_next_file (enumerator, cancellable, &temp_error)) != NULL)
-    {
-      const char *name;
-      guint32 type;
-
-      name = g_file_info_get_attribute_byte_string (file_info, "standard::name"); 
-      type = g_file_info_get_attribute_uint32 (file_info, "standard::type");
-
-      if (type != G_FILE_TYPE_REGULAR)
-        goto loop_next;
+  ret = TRUE;
+  return ret;
+}
 
-      if (prefix)
-        {
-          if (!g_str_has_prefix (name, prefix))
-            goto loop_next;
-        }
-      if (suffix)
-        {
-          if (!g_str_has_suffix (name, suffix))
-            goto loop_next;
-        }
+static gboolean
+stage_metadata_object (OstreeRepo         *self,
+                       OstreeObjectType    type,
+                       GVariant           *variant,
+                       guchar            **out_csum,
+                       GCancellable       *cancellable,
+                       GError            **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GInputStream *input = NULL;
 
-      g_ptr_array_add (ret_files, g_file_get_child (dir, name));
-      
-    loop_next:
-      g_clear_object (&file_info);
-    }
-  if (temp_error != NULL)
-    {
-      g_propagate_error (error, temp_error);
-      goto out;
-    }
-  if (!g_file_enumerator_close (enumerator, cancellable, error))
+  input = ot_variant_read (variant);
+  
+  if (!stage_object (self, 0, type, input, 0, NULL,
+                     out_csum, cancellable, error))
     goto out;
 
   ret = TRUE;
-  ot_transfer_out_value (out_files, &ret_files);
  out:
   return ret;
 }
 
 static gboolean
-map_variant_file_check_header_string (GFile         *path,
-                                      const GVariantType  *variant_type,
-                                      const char    *expected_header,
-                                      gboolean       trusted,
-                                      GVariant     **out_variant,
-                                      GCancellable  *cancellable,
-                                      GError       **error)
+stage_directory_meta (OstreeRepo   *self,
+                      GFileInfo    *file_info,
+                      GVariant     *xattrs,
+                      guchar      **out_csum,
+                      GCancellable *cancellable,
+                      GError      **error)
 {
   gboolean ret = FALSE;
-  const char *header;
-  ot_lvariant GVariant *ret_variant = NULL;
-
-  if (!ot_util_variant_map (path, variant_type, trusted, &ret_variant, error))
-    goto out;
+  ot_lvariant GVariant *dirmeta = NULL;
 
-  g_variant_get_child (ret_variant, 0, "&s", &header);
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
 
-  if (strcmp (header, expected_header) != 0)
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "Invalid variant file '%s', expected header '%s'",
-                   ot_gfile_get_path_cached (path),
-                   expected_header);
-      goto out;
-    }
+  dirmeta = ostree_create_directory_metadata (file_info, xattrs);
+  
+  if (!stage_metadata_object (self, OSTREE_OBJECT_TYPE_DIR_META, 
+                              dirmeta, out_csum, cancellable, error))
+    goto out;
 
   ret = TRUE;
-  ot_transfer_out_value (out_variant, &ret_variant);
  out:
   return ret;
 }
 
-
-static char *
-get_checksum_from_pack_name (const char *name)
+GFile *
+ostree_repo_get_object_path (OstreeRepo  *self,
+                             const char    *checksum,
+                             OstreeObjectType type)
 {
-  const char *dash;
-  const char *dot;
+  char *relpath;
+  GFile *ret;
 
-  dash = strchr (name, '-');
-  g_assert (dash);
-  dot = strrchr (name, '.');
-  g_assert (dot);
+  relpath = ostree_get_relative_object_path (checksum, type);
+  ret = g_file_resolve_relative_path (self->repodir, relpath);
+  g_free (relpath);
+ 
+  return ret;
+}
 
-  g_assert_cmpint (dot - (dash + 1), ==, 64);
-  
-  return g_strndup (dash + 1, 64);
+gboolean      
+ostree_repo_stage_object_trusted (OstreeRepo   *self,
+                                  OstreeObjectType objtype,
+                                  const char   *checksum,
+                                  gboolean          store_if_packed,
+                                  GInputStream     *object_input,
+                                  GCancellable *cancellable,
+                                  GError      **error)
+{
+  int flags = 0;
+  if (store_if_packed)
+    flags |= OSTREE_REPO_STAGE_FLAGS_STORE_IF_PACKED;
+  return stage_object (self, flags, objtype,
+                       object_input, 0, checksum, NULL,
+                       cancellable, error);
 }
 
-static gboolean
-list_pack_indexes_from_dir (OstreeRepo              *self,
-                            gboolean                 is_meta,
-                            GPtrArray              **out_indexes,
-                            GCancellable            *cancellable,
-                            GError                 **error)
+gboolean
+ostree_repo_stage_object (OstreeRepo       *self,
+                          OstreeObjectType  objtype,
+                          const char       *expected_checksum,
+                          GInputStream     *object_input,
+                          GCancellable     *cancellable,
+                          GError          **error)
 {
   gboolean ret = FALSE;
-  guint i;
-  ot_lptrarray GPtrArray *index_files = NULL;
-  ot_lptrarray GPtrArray *ret_indexes = NULL;
-
-  if (!list_files_in_dir_matching (self->pack_dir,
-                                   is_meta ? "ostmetapack-" : "ostdatapack-", ".index",
-                                   &index_files, 
-                                   cancellable, error))
+  ot_lfree guchar *actual_csum = NULL;
+  
+  if (!stage_object (self, 0, objtype, 
+                     object_input, 0, expected_checksum, &actual_csum,
+                     cancellable, error))
     goto out;
 
-  ret_indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free);
-  for (i = 0; i < index_files->len; i++)
-    {
-      GFile *index_path = index_files->pdata[i];
-      const char *basename = ot_gfile_get_basename_cached (index_path);
-      g_ptr_array_add (ret_indexes, get_checksum_from_pack_name (basename));
-    }
-
   ret = TRUE;
-  ot_transfer_out_value (out_indexes, &ret_indexes);
  out:
   return ret;
 }
 
-static gboolean
-list_pack_checksums_from_superindex_file (GFile         *superindex_path,
-                                          GPtrArray    **out_meta_indexes,
-                                          GPtrArray    **out_data_indexes,
-                                          GCancellable  *cancellable,
-                                          GError       **error)
+gboolean      
+ostree_repo_stage_file_object_trusted (OstreeRepo       *self,
+                                       const char       *checksum,
+                                       gboolean          store_if_packed,
+                                       GInputStream     *object_input,
+                                       guint64           length,
+                                       GCancellable     *cancellable,
+                                       GError          **error)
 {
-  gboolean ret = FALSE;
-  const char *magic;
-  ot_lptrarray GPtrArray *ret_meta_indexes = NULL;
-  ot_lptrarray GPtrArray *ret_data_indexes = NULL;
-  ot_lvariant GVariant *superindex_variant = NULL;
-  ot_lvariant GVariant *checksum = NULL;
-  ot_lvariant GVariant *bloom = NULL;
-  GVariantIter *meta_variant_iter = NULL;
-  GVariantIter *data_variant_iter = NULL;
+  int flags = OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID;
+  if (store_if_packed)
+    flags |= OSTREE_REPO_STAGE_FLAGS_STORE_IF_PACKED;
+  return stage_object (self, flags, OSTREE_OBJECT_TYPE_FILE,
+                       object_input, length, checksum, NULL,
+                       cancellable, error);
+}
 
-  if (!ot_util_variant_map (superindex_path, OSTREE_PACK_SUPER_INDEX_VARIANT_FORMAT,
-                            TRUE, &superindex_variant, error))
-    goto out;
-  
-  g_variant_get (superindex_variant, "(&s@a{sv}a(ayay)a(ayay))",
-                 &magic, NULL, &meta_variant_iter, &data_variant_iter);
+gboolean
+ostree_repo_stage_file_object (OstreeRepo       *self,
+                               const char       *expected_checksum,
+                               GInputStream     *object_input,
+                               guint64           length,
+                               GCancellable     *cancellable,
+                               GError          **error)
+{
+  gboolean ret = FALSE;
+  int flags = OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID;
+  ot_lfree guchar *actual_csum = NULL;
   
-  if (strcmp (magic, "OSTv0SUPERPACKINDEX") != 0)
-    {
-      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                           "Invalid header in super pack index");
-      goto out;
-    }
-
-  ret_meta_indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free); 
-  while (g_variant_iter_loop (meta_variant_iter, "(@ay@ay)",
-                              &checksum, &bloom))
-    g_ptr_array_add (ret_meta_indexes, ostree_checksum_from_bytes_v (checksum));
-  checksum = NULL;
-  bloom = NULL;
-
-  ret_data_indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free); 
-  while (g_variant_iter_loop (data_variant_iter, "(@ay@ay)",
-                              &checksum, &bloom))
-    g_ptr_array_add (ret_data_indexes, ostree_checksum_from_bytes_v (checksum));
-  checksum = NULL;
-  bloom = NULL;
+  if (!stage_object (self, flags, OSTREE_OBJECT_TYPE_FILE, 
+                     object_input, length, expected_checksum, &actual_csum,
+                     cancellable, error))
+    goto out;
 
   ret = TRUE;
-  ot_transfer_out_value (out_meta_indexes, &ret_meta_indexes);
-  ot_transfer_out_value (out_data_indexes, &ret_data_indexes);
  out:
-  if (meta_variant_iter)
-    g_variant_iter_free (meta_variant_iter);
-  if (data_variant_iter)
-    g_variant_iter_free (data_variant_iter);
   return ret;
 }
 
+/**
+ * ostree_repo_stage_file_object_from_raw:
+ * @self: Repo
+ * @checksum: Content checksum
+ * @file_info: Metadata for the file
+ * @xattrs: (allow-none): Extended attributes
+ * @raw_path: Temporary file holding the raw content
+ *
+ * Store the regular file content object @checksum, whose raw file
+ * content has already been written to @raw_path.  The file must live
+ * in the repository's temporary directory; it is consumed (moved into
+ * place or unlinked).  The caller is responsible for having verified
+ * @checksum.
+ */
 gboolean
-ostree_repo_list_pack_indexes (OstreeRepo              *self,
-                               GPtrArray              **out_meta_indexes,
-                               GPtrArray              **out_data_indexes,
-                               GCancellable            *cancellable,
-                               GError                 **error)
+ostree_repo_stage_file_object_from_raw (OstreeRepo       *self,
+                                        const char       *checksum,
+                                        GFileInfo        *file_info,
+                                        GVariant         *xattrs,
+                                        GFile            *raw_path,
+                                        GCancellable     *cancellable,
+                                        GError          **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GFile *superindex_path = NULL;
-  ot_lptrarray GPtrArray *ret_meta_indexes = NULL;
-  ot_lptrarray GPtrArray *ret_data_indexes = NULL;
+  gboolean have_obj;
+  guint32 mode;
+  int fd = -1;
+  int meta_fd = -1;
+  gboolean raw_consumed = FALSE;
+  ot_lobj GFile *meta_temp_file = NULL;
 
-  g_mutex_lock (&self->cache_lock);
-  if (self->cached_meta_indexes)
-    {
-      ret_meta_indexes = g_ptr_array_ref (self->cached_meta_indexes);
-      ret_data_indexes = g_ptr_array_ref (self->cached_content_indexes);
+  g_return_val_if_fail (self->in_transaction, FALSE);
+  g_return_val_if_fail (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR, FALSE);
+
+  if (txn_known_object_lookup (self, OSTREE_OBJECT_TYPE_FILE, checksum, FALSE))
+    have_obj = TRUE;
+  else if (!ostree_repo_has_object (self, OSTREE_OBJECT_TYPE_FILE, checksum, &have_obj,
+                                    cancellable, error))
+    goto out;
+
+  if (have_obj)
+    {
+      ret = TRUE;
+      goto out;
     }
-  else
+
+  mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
+
+  if (self->mode == OSTREE_REPO_MODE_BARE)
     {
-      superindex_path = g_file_get_child (self->pack_dir, "index");
+      guint32 uid = g_file_info_get_attribute_uint32 (file_info, "unix::uid");
+      guint32 gid = g_file_info_get_attribute_uint32 (file_info, "unix::gid");
 
-      if (g_file_query_exists (superindex_path, cancellable))
+      fd = open (ot_gfile_get_path_cached (raw_path), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
         {
-          if (!list_pack_checksums_from_superindex_file (superindex_path, &ret_meta_indexes,
-                                                         &ret_data_indexes,
-                                                         cancellable, error))
-            goto out;
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
         }
-      else
+
+      if (fchown (fd, uid, gid) < 0)
         {
-          ret_meta_indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free); 
-          ret_data_indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free); 
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "fchown(%u, %u) failed: ", uid, gid);
+          goto out;
         }
 
-      self->cached_meta_indexes = g_ptr_array_ref (ret_meta_indexes);
-      self->cached_content_indexes = g_ptr_array_ref (ret_data_indexes);
+      if (fchmod (fd, mode & 07777) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "fchmod(%u) failed: ", mode);
+          goto out;
+        }
+
+      if (xattrs != NULL)
+        {
+          if (!set_xattrs_fd (fd, xattrs, error))
+            goto out;
+        }
+
+      if (!commit_loose_object_trusted (self, checksum, OSTREE_OBJECT_TYPE_FILE,
+                                        raw_path, -1, cancellable, error))
+        goto out;
+      raw_consumed = TRUE;
     }
+  else
+    {
+      ot_lvariant GVariant *file_meta = NULL;
+      ot_lobj GInputStream *file_meta_input = NULL;
+      ot_lobj GFile *archive_content_dest = NULL;
 
-  ret = TRUE;
-  ot_transfer_out_value (out_meta_indexes, &ret_meta_indexes);
-  ot_transfer_out_value (out_data_indexes, &ret_data_indexes);
- out:
-  g_mutex_unlock (&self->cache_lock);
-  return ret;
-}
+      /* As for staging from a stream, only file type and permissions
+       * are preserved on the content file.
+       */
+      if (chmod (ot_gfile_get_path_cached (raw_path), mode & (S_IRWXU | S_IRWXG | S_IRWXO)) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
 
-static gboolean
-create_index_bloom (OstreeRepo          *self,
-                    const char          *pack_checksum,
-                    GVariant           **out_bloom,
-                    GCancellable        *cancellable,
-                    GError             **error)
-{
-  gboolean ret = FALSE;
-  ot_lvariant GVariant *ret_bloom;
+      file_meta = ostree_file_header_new (file_info, xattrs);
+      file_meta_input = ot_variant_read (file_meta);
+
+      if (!create_object_tmpfile_from_input (self, OSTREE_OBJECT_TYPE_FILE,
+                                             NULL, NULL, file_meta_input,
+                                             &meta_fd, &meta_temp_file,
+                                             cancellable, error))
+        goto out;
+
+      /* Commit content first so the process is atomic */
+      archive_content_dest = ostree_repo_get_archive_content_path (self, checksum);
+      if (!commit_loose_object_impl (self, raw_path, -1, archive_content_dest,
+                                     cancellable, error))
+        goto out;
+      raw_consumed = TRUE;
 
-  /* TODO - define and compute bloom filter */
+      if (!commit_loose_object_trusted (self, checksum, OSTREE_OBJECT_TYPE_FILE,
+                                        meta_temp_file, meta_fd, cancellable, error))
+        goto out;
+      g_clear_object (&meta_temp_file);
+    }
 
-  ret_bloom = ot_gvariant_new_bytearray (NULL, 0);
-  g_variant_ref_sink (ret_bloom);
+  txn_known_object_add (self, OSTREE_OBJECT_TYPE_FILE, checksum, TRUE);
 
   ret = TRUE;
-  ot_transfer_out_value (out_bloom, &ret_bloom);
-  /* out: */
+ out:
+  if (!raw_consumed)
+    (void) unlink (ot_gfile_get_path_cached (raw_path));
+  if (meta_temp_file)
+    (void) unlink (ot_gfile_get_path_cached (meta_temp_file));
+  if (fd != -1)
+    (void) close (fd);
+  if (meta_fd != -1)
+    (void) close (meta_fd);
   return ret;
 }
 
 static gboolean
-append_index_builder (OstreeRepo           *self,
-                      GPtrArray            *indexes,
-                      GVariantBuilder      *builder,
-                      GCancellable         *cancellable,
-                      GError              **error)
+stage_static_delta_rollsum (OstreeRepo       *self,
+                            const char       *checksum,
+                            GVariant         *payload,
+                            GCancellable     *cancellable,
+                            GError          **error)
 {
   gboolean ret = FALSE;
-  guint i;
+  gsize payload_len;
+  gsize base_len;
+  gsize new_len;
+  gsize header_len;
+  gsize ops_len;
+  const guchar *payload_data;
+  const guchar *header_data;
+  const guchar *ops_data;
+  guint64 length;
+  guint64 expected_len;
+  gboolean have_base;
+  ot_lfree guchar *base_data = NULL;
+  ot_lfree guchar *new_data = NULL;
+  ot_lfree char *base_checksum = NULL;
+  ot_lvariant GVariant *rollsum = NULL;
+  ot_lvariant GVariant *base_csum_v = NULL;
+  ot_lvariant GVariant *header_v = NULL;
+  ot_lvariant GVariant *ops_v = NULL;
+  ot_lvariant GVariant *file_header = NULL;
+  ot_lvariant GVariant *xattrs = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
+  ot_lobj GInputStream *content_input = NULL;
+  ot_lobj GInputStream *object_input = NULL;
 
-  for (i = 0; i < indexes->len; i++)
+  payload_data = g_variant_get_fixed_array (payload, &payload_len, 1);
+  rollsum = g_variant_new_from_data (OSTREE_STATIC_DELTA_ROLLSUM_FORMAT,
+                                     payload_data, payload_len, FALSE, NULL, NULL);
+  g_variant_ref_sink (rollsum);
+
+  g_variant_get (rollsum, "(@ay@ayt@ay)", &base_csum_v, &header_v, &expected_len, &ops_v);
+  expected_len = GUINT64_FROM_BE (expected_len);
+  if (!ostree_validate_structureof_csum_v (base_csum_v, error))
+    goto out;
+  if (expected_len > OSTREE_ROLLSUM_MAX_SIZE)
     {
-      const char *pack_checksum = indexes->pdata[i];
-      ot_lvariant GVariant *bloom = NULL;
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Rollsum object %s of %" G_GUINT64_FORMAT " bytes exceeds maximum %u",
+                   checksum, expected_len, OSTREE_ROLLSUM_MAX_SIZE);
+      goto out;
+    }
+  base_checksum = ostree_checksum_from_bytes_v (base_csum_v);
 
-      if (!create_index_bloom (self, pack_checksum, &bloom, cancellable, error))
-        goto out;
+  header_data = g_variant_get_fixed_array (header_v, &header_len, 1);
+  file_header = g_variant_new_from_data (OSTREE_FILE_HEADER_GVARIANT_FORMAT,
+                                         header_data, header_len, FALSE, NULL, NULL);
+  g_variant_ref_sink (file_header);
+  if (!ostree_file_header_parse (file_header, &file_info, &xattrs, error))
+    goto out;
 
-      g_variant_builder_add (builder,
-                             "(@ay@ay)",
-                             ostree_checksum_to_bytes_v (pack_checksum),
-                             bloom);
+  if (!ostree_repo_has_object (self, OSTREE_OBJECT_TYPE_FILE, base_checksum,
+                               &have_base, cancellable, error))
+    goto out;
+  if (!have_base)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "Base object %s of %s is missing", base_checksum, checksum);
+      goto out;
     }
 
+  if (!ostree_repo_load_file_content (self, base_checksum, &base_data, &base_len,
+                                      NULL, NULL, cancellable, error))
+    goto out;
+
+  ops_data = g_variant_get_fixed_array (ops_v, &ops_len, 1);
+  if (!ostree_static_delta_apply_rollsum (base_data, base_len, ops_data, ops_len,
+                                          expected_len, &new_data, &new_len, error))
+    goto out;
+
+  g_file_info_set_size (file_info, new_len);
+  content_input = g_memory_input_stream_new_from_data (new_data, new_len, g_free);
+  new_data = NULL;
+
+  if (!ostree_raw_file_to_content_stream (content_input, file_info, xattrs,
+                                          &object_input, &length,
+                                          cancellable, error))
+    goto out;
+
+  if (!ostree_repo_stage_file_object (self, checksum, object_input, length,
+                                      cancellable, error))
+    goto out;
+
   ret = TRUE;
  out:
   return ret;
 }
 
 /**
- * Regenerate the pack superindex file based on the set of pack
- * indexes currently in the filesystem.
+ * ostree_repo_stage_static_delta_part:
+ * @self: Repo
+ * @part: A decompressed %OSTREE_STATIC_DELTA_PART_FORMAT variant
+ *
+ * Stage every object in @part, verifying each against its checksum.
+ * Rollsum encoded file objects require their base object to exist;
+ * if it does not, the error is %G_IO_ERROR_NOT_FOUND.
  */
 gboolean
-ostree_repo_regenerate_pack_index (OstreeRepo       *self,
-                                   GCancellable     *cancellable,
-                                   GError          **error)
+ostree_repo_stage_static_delta_part (OstreeRepo       *self,
+                                     GVariant         *part,
+                                     GCancellable     *cancellable,
+                                     GError          **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GFile *superindex_path = NULL;
-  ot_lptrarray GPtrArray *pack_indexes = NULL;
-  ot_lvariant GVariant *superindex_variant = NULL;
-  GVariantBuilder *meta_index_content_builder = NULL;
-  GVariantBuilder *data_index_content_builder = NULL;
+  guint i, n;
 
-  g_clear_pointer (&self->cached_meta_indexes, (GDestroyNotify) g_ptr_array_unref);
-  g_clear_pointer (&self->cached_content_indexes, (GDestroyNotify) g_ptr_array_unref);
+  n = g_variant_n_children (part);
+  for (i = 0; i < n; i++)
+    {
+      guchar objtype_u8;
+      guchar encoding;
+      OstreeObjectType objtype;
+      const guchar *payload_data;
+      gsize payload_len;
+      ot_lvariant GVariant *csum_v = NULL;
+      ot_lvariant GVariant *payload = NULL;
+      ot_lfree char *checksum = NULL;
+      ot_lobj GInputStream *object_input = NULL;
 
-  superindex_path = g_file_get_child (self->pack_dir, "index");
+      g_variant_get_child (part, i, "(y@ayy@ay)",
+                           &objtype_u8, &csum_v, &encoding, &payload);
 
-  g_clear_pointer (&pack_indexes, (GDestroyNotify) g_ptr_array_unref);
-  if (!list_pack_indexes_from_dir (self, TRUE, &pack_indexes,
-                                   cancellable, error))
-    goto out;
-  meta_index_content_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ayay)"));
-  if (!append_index_builder (self, pack_indexes, meta_index_content_builder,
-                             cancellable, error))
-    goto out;
+      if (!ostree_validate_structureof_objtype (objtype_u8, error))
+        goto out;
+      if (!ostree_validate_structureof_csum_v (csum_v, error))
+        goto out;
 
-  g_clear_pointer (&pack_indexes, (GDestroyNotify) g_ptr_array_unref);
-  if (!list_pack_indexes_from_dir (self, FALSE, &pack_indexes,
-                                   cancellable, error))
-    goto out;
-  data_index_content_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ayay)"));
-  if (!append_index_builder (self, pack_indexes, data_index_content_builder,
-                             cancellable, error))
-    goto out;
+      objtype = (OstreeObjectType) objtype_u8;
+      checksum = ostree_checksum_from_bytes_v (csum_v);
 
-  superindex_variant = g_variant_new ("(s@a{sv}@a(ayay)@a(ayay))",
-                                      "OSTv0SUPERPACKINDEX",
-                                      g_variant_new_array (G_VARIANT_TYPE ("{sv}"),
-                                                           NULL, 0),
-                                      g_variant_builder_end (meta_index_content_builder),
-                                      g_variant_builder_end (data_index_content_builder));
-  g_variant_ref_sink (superindex_variant);
+      if (encoding == OSTREE_STATIC_DELTA_ENCODING_RAW)
+        {
+          payload_data = g_variant_get_fixed_array (payload, &payload_len, 1);
+          object_input = g_memory_input_stream_new_from_data (payload_data, payload_len, NULL);
 
-  if (!ot_util_variant_save (superindex_path, superindex_variant,
-                             cancellable, error))
-    goto out;
+          if (objtype == OSTREE_OBJECT_TYPE_FILE)
+            {
+              if (!ostree_repo_stage_file_object (self, checksum, object_input, payload_len,
+                                                  cancellable, error))
+                goto out;
+            }
+          else
+            {
+              if (!ostree_repo_stage_object (self, objtype, checksum, object_input,
+                                             cancellable, error))
+                goto out;
+            }
+        }
+      else if (encoding == OSTREE_STATIC_DELTA_ENCODING_ROLLSUM
+               && objtype == OSTREE_OBJECT_TYPE_FILE)
+        {
+          if (!stage_static_delta_rollsum (self, checksum, payload,
+                                           cancellable, error))
+            goto out;
+        }
+      else
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Invalid static delta encoding %u for object %s",
+                       (guint)encoding, checksum);
+          goto out;
+        }
+    }
 
   ret = TRUE;
  out:
-  if (meta_index_content_builder)
-    g_variant_builder_unref (meta_index_content_builder);
-  if (data_index_content_builder)
-    g_variant_builder_unref (data_index_content_builder);
-  return ret;
-}
-
-static GFile *
-get_pack_index_path (GFile            *parent,
-                     gboolean          is_meta,
-                     const char       *checksum)
-{
-  char *path = ostree_get_pack_index_name (is_meta, checksum);
-  GFile *ret = g_file_resolve_relative_path (parent, path);
-  g_free (path);
   return ret;
 }
 
-static GFile *
-get_pack_data_path (GFile            *parent,
-                    gboolean          is_meta,
-                    const char       *checksum)
+static GVariant *
+create_empty_gvariant_dict (void)
 {
-  char *path = ostree_get_pack_data_name (is_meta, checksum);
-  GFile *ret = g_file_resolve_relative_path (parent, path);
-  g_free (path);
-  return ret;
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE("a{sv}"));
+  return g_variant_builder_end (&builder);
 }
 
-gboolean
-ostree_repo_add_pack_file (OstreeRepo       *self,
-                           const char       *pack_checksum,
-                           gboolean          is_meta,
-                           GFile            *index_path,
-                           GFile            *data_path,
-                           GCancellable     *cancellable,
-                           GError          **error)
+static gboolean
+enumerate_refs_recurse (OstreeRepo    *repo,
+                        GFile         *base,
+                        GFile         *dir,
+                        GHashTable    *refs,
+                        GCancellable  *cancellable,
+                        GError       **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GFile *pack_index_path = NULL;
-  ot_lobj GFile *pack_data_path = NULL;
+  GError *temp_error = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
+  ot_lobj GFileEnumerator *enumerator = NULL;
+  ot_lobj GFile *child = NULL;
 
-  if (!ot_gfile_ensure_directory (self->pack_dir, FALSE, error))
+  enumerator = g_file_enumerate_children (dir, OSTREE_GIO_FAST_QUERYINFO,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          cancellable, error);
+  if (!enumerator)
     goto out;
 
-  pack_data_path = get_pack_data_path (self->pack_dir, is_meta, pack_checksum);
-  if (!ot_gfile_rename (data_path, pack_data_path, cancellable, error))
-    goto out;
+  while ((file_info = g_file_enumerator_next_file (enumerator, cancellable, &temp_error)) != NULL)
+    {
+      g_clear_object (&child);
+      child = g_file_get_child (dir, g_file_info_get_name (file_info));
+      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
+        {
+          if (!enumerate_refs_recurse (repo, base, child, refs, cancellable, error))
+            goto out;
+        }
+      else if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
+        {
+          char *contents;
+          gsize len;
 
-  pack_index_path = get_pack_index_path (self->pack_dir, is_meta, pack_checksum);
-  if (!ot_gfile_rename (index_path, pack_index_path, cancellable, error))
-    goto out;
+          if (!g_file_load_contents (child, cancellable, &contents, &len, NULL, error))
+            goto out;
+
+          g_strchomp (contents);
+
+          g_hash_table_insert (refs, g_file_get_relative_path (base, child), contents);
+        }
+
+      g_clear_object (&file_info);
+    }
+  if (temp_error != NULL)
+    {
+      g_propagate_error (error, temp_error);
+      goto out;
+    }
 
   ret = TRUE;
  out:
   return ret;
 }
 
-static gboolean
-ensure_remote_cache_dir (OstreeRepo       *self,
-                         const char       *remote_name,
-                         GFile           **out_cache_dir,
-                         GCancellable     *cancellable,
-                         GError          **error)
+gboolean
+ostree_repo_list_all_refs (OstreeRepo       *repo,
+                           GHashTable      **out_all_refs,
+                           GCancellable     *cancellable,
+                           GError          **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GFile *ret_cache_dir = NULL;
+  ot_lhash GHashTable *ret_all_refs = NULL;
+  ot_lobj GFile *heads_dir = NULL;
 
-  ret_cache_dir = g_file_get_child (self->remote_cache_dir, remote_name);
-  
-  if (!ot_gfile_ensure_directory (ret_cache_dir, FALSE, error))
+  ret_all_refs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  heads_dir = g_file_resolve_relative_path (ostree_repo_get_path (repo), "refs/heads");
+  if (!enumerate_refs_recurse (repo, heads_dir, heads_dir, ret_all_refs, cancellable, error))
     goto out;
 
   ret = TRUE;
-  ot_transfer_out_value (out_cache_dir, &ret_cache_dir);
+  ot_transfer_out_value (out_all_refs, &ret_all_refs);
  out:
   return ret;
 }
 
 static gboolean
-delete_no_longer_referenced (OstreeRepo                   *self,
-                             GFile                        *cache_path,
-                             const char                   *prefix,
-                             const char                   *suffix,
-                             GHashTable                   *new_files,
-                             GPtrArray                    *inout_cached,
-                             GCancellable                 *cancellable,
-                             GError                      **error)
+write_ref_summary (OstreeRepo      *self,
+                   GCancellable    *cancellable,
+                   GError         **error)
 {
   gboolean ret = FALSE;
-  guint i;
-  ot_lptrarray GPtrArray *current_files = NULL;
-  ot_lfree char *pack_checksum = NULL;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  gsize bytes_written;
+  ot_lhash GHashTable *all_refs = NULL;
+  ot_lobj GFile *summary_path = NULL;
+  ot_lobj GOutputStream *out = NULL;
+  ot_lfree char *buf = NULL;
 
-  if (!list_files_in_dir_matching (cache_path,
-                                   prefix, suffix,
-                                   &current_files, 
-                                   cancellable, error))
+  if (!ostree_repo_list_all_refs (self, &all_refs, cancellable, error))
     goto out;
-  for (i = 0; i < current_files->len; i++)
-    {
-      GFile *file = current_files->pdata[i];
-      
-      g_free (pack_checksum);
-      pack_checksum = get_checksum_from_pack_name (ot_gfile_get_basename_cached (file));
-      
-      if (!g_hash_table_lookup (new_files, pack_checksum))
-        {
-          if (!ot_gfile_unlink (file, cancellable, error))
-            goto out;
-        }
-      
-      if (inout_cached)
-        {
-          g_ptr_array_add (inout_cached, pack_checksum);
-          pack_checksum = NULL; /* transfer ownership */
-        }
-    }
-  ret = TRUE;
- out:
-  return ret;
-}
 
-static void
-gather_uncached (GHashTable   *new_files,
-                 GPtrArray    *cached,
-                 GPtrArray    *inout_uncached)
-{
-  guint i;
-  GHashTableIter hash_iter;
-  gpointer key, value;
+  summary_path = g_file_resolve_relative_path (ostree_repo_get_path (self),
+                                               "refs/summary");
 
-  g_hash_table_iter_init (&hash_iter, new_files);
+  out = (GOutputStream*) g_file_replace (summary_path, NULL, FALSE, 0, cancellable, error);
+  if (!out)
+    goto out;
+  
+  g_hash_table_iter_init (&hash_iter, all_refs);
   while (g_hash_table_iter_next (&hash_iter, &key, &value))
     {
-      const char *cur_pack_checksum = key;
-      gboolean found = FALSE;
+      const char *name = key;
+      const char *sha256 = value;
 
-      for (i = 0; i < cached->len; i++)
-        {
-          const char *checksum = cached->pdata[i];
-          if (strcmp (cur_pack_checksum, checksum) == 0)
-            {
-              found = TRUE;
-              break;
-            }
-        }
-      
-      if (!found)
-        g_ptr_array_add (inout_uncached, g_strdup (cur_pack_checksum));
+      g_free (buf);
+      buf = g_strdup_printf ("%s %s\n", sha256, name);
+      if (!g_output_stream_write_all (out, buf, strlen (buf), &bytes_written, cancellable, error))
+        goto out;
     }
-}
-
-/**
- * Take a pack superindex file @superindex_path, and clean up any
- * no-longer-referenced pack files in the lookaside cache for
- * @remote_name.  The updated index file will also be saved into the
- * cache.
- *
- * Upon successful return, @out_cached_indexes will hold checksum
- * strings for indexes which are already in the cache, and
- * @out_uncached_indexes will hold strings for those which are not.
- */
-gboolean
-ostree_repo_resync_cached_remote_pack_indexes (OstreeRepo       *self,
-                                               const char       *remote_name,
-                                               GFile            *superindex_path,
-                                               GPtrArray       **out_cached_meta_indexes,
-                                               GPtrArray       **out_cached_data_indexes,
-                                               GPtrArray       **out_uncached_meta_indexes,
-                                               GPtrArray       **out_uncached_data_indexes,
-                                               GCancellable     *cancellable,
-                                               GError          **error)
-{
-  gboolean ret = FALSE;
-  ot_lvariant GVariant *superindex_variant = NULL;
-  ot_lobj GFile *cache_path = NULL;
-  ot_lobj GFile *superindex_cache_path = NULL;
-  ot_lptrarray GPtrArray *meta_index_files = NULL;
-  ot_lptrarray GPtrArray *data_index_files = NULL;
-  ot_lptrarray GPtrArray *meta_data_files = NULL;
-  ot_lptrarray GPtrArray *data_data_files = NULL;
-  ot_lhash GHashTable *new_pack_meta_indexes = NULL;
-  ot_lhash GHashTable *new_pack_data_indexes = NULL;
-  ot_lptrarray GPtrArray *ret_cached_meta_indexes = NULL;
-  ot_lptrarray GPtrArray *ret_cached_data_indexes = NULL;
-  ot_lptrarray GPtrArray *ret_uncached_meta_indexes = NULL;
-  ot_lptrarray GPtrArray *ret_uncached_data_indexes = NULL;
-  ot_lvariant GVariant *csum_bytes = NULL;
-  ot_lvariant GVariant *bloom = NULL;
-  ot_lfree char *pack_checksum = NULL;
-  GVariantIter *superindex_contents_iter = NULL;
-
-  if (!ensure_remote_cache_dir (self, remote_name, &cache_path, cancellable, error))
-    goto out;
-
-  ret_cached_meta_indexes = g_ptr_array_new_with_free_func (g_free);
-  ret_cached_data_indexes = g_ptr_array_new_with_free_func (g_free);
-  ret_uncached_meta_indexes = g_ptr_array_new_with_free_func (g_free);
-  ret_uncached_data_indexes = g_ptr_array_new_with_free_func (g_free);
 
-  if (!ot_util_variant_map (superindex_path, OSTREE_PACK_SUPER_INDEX_VARIANT_FORMAT,
-                            FALSE, &superindex_variant, error))
+  if (!g_output_stream_close (out, cancellable, error))
     goto out;
 
-  if (!ostree_validate_structureof_pack_superindex (superindex_variant, error))
-    goto out;
+  ret = TRUE;
+ out:
+  return ret;
+}
 
-  new_pack_meta_indexes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-  new_pack_data_indexes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+gboolean      
+ostree_repo_write_ref (OstreeRepo  *self,
+                       const char  *remote,
+                       const char  *name,
+                       const char  *rev,
+                       GError     **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *dir = NULL;
 
-  g_variant_get_child (superindex_variant, 2, "a(ayay)",
-                       &superindex_contents_iter);
-  while (g_variant_iter_loop (superindex_contents_iter,
-                              "(@ay@ay)", &csum_bytes, &bloom))
+  if (remote == NULL)
+    dir = g_object_ref (self->local_heads_dir);
+  else
     {
-      pack_checksum = ostree_checksum_from_bytes_v (csum_bytes);
-      g_hash_table_insert (new_pack_meta_indexes, pack_checksum, pack_checksum);
-      pack_checksum = NULL; /* transfer ownership */
-    }
-  g_variant_iter_free (superindex_contents_iter);
+      dir = g_file_get_child (self->remote_heads_dir, remote);
 
-  g_variant_get_child (superindex_variant, 3, "a(ayay)",
-                       &superindex_contents_iter);
-  while (g_variant_iter_loop (superindex_contents_iter,
-                              "(@ay@ay)", &csum_bytes, &bloom))
-    {
-      pack_checksum = ostree_checksum_from_bytes_v (csum_bytes);
-      g_hash_table_insert (new_pack_data_indexes, pack_checksum, pack_checksum);
-      pack_checksum = NULL; /* transfer ownership */
+      if (!ot_gfile_ensure_directory (dir, FALSE, error))
+        goto out;
     }
 
-  if (!delete_no_longer_referenced (self, cache_path,
-                                    "ostmetapack-", ".index",
-                                    new_pack_meta_indexes,
-                                    ret_cached_meta_indexes,
-                                    cancellable, error))
-    goto out;
-
-  if (!delete_no_longer_referenced (self, cache_path,
-                                    "ostdatapack-", ".index",
-                                    new_pack_data_indexes,
-                                    ret_cached_data_indexes,
-                                    cancellable, error))
-    goto out;
-
-  gather_uncached (new_pack_meta_indexes, ret_cached_meta_indexes, ret_uncached_meta_indexes);
-  gather_uncached (new_pack_data_indexes, ret_cached_data_indexes, ret_uncached_data_indexes);
-  
-  superindex_cache_path = g_file_get_child (cache_path, "index");
-  if (!ot_util_variant_save (superindex_cache_path, superindex_variant, cancellable, error))
+  if (!write_checksum_file (dir, name, rev, error))
     goto out;
 
-  /* Now also delete stale pack files */
+  if (self->mode == OSTREE_REPO_MODE_ARCHIVE)
+    {
+      if (!write_ref_summary (self, NULL, error))
+        goto out;
+    }
 
-  if (!delete_no_longer_referenced (self, cache_path,
-                                    "ostmetapack-", ".data",
-                                    new_pack_meta_indexes, NULL,
-                                    cancellable, error))
-    goto out;
-  if (!delete_no_longer_referenced (self, cache_path,
-                                    "ostdatapack-", ".data",
-                                    new_pack_data_indexes, NULL,
-                                    cancellable, error))
-    goto out;
-      
   ret = TRUE;
-  ot_transfer_out_value (out_cached_meta_indexes, &ret_cached_meta_indexes);
-  ot_transfer_out_value (out_cached_data_indexes, &ret_cached_data_indexes);
-  ot_transfer_out_value (out_uncached_meta_indexes, &ret_uncached_meta_indexes);
-  ot_transfer_out_value (out_uncached_data_indexes, &ret_uncached_data_indexes);
  out:
-  if (superindex_contents_iter)
-    g_variant_iter_free (superindex_contents_iter);
   return ret;
 }
 
 gboolean
-ostree_repo_clean_cached_remote_pack_data (OstreeRepo       *self,
-                                           const char       *remote_name,
-                                           GCancellable     *cancellable,
-                                           GError          **error)
+ostree_repo_stage_commit (OstreeRepo *self,
+                          const char   *branch,
+                          const char   *parent,
+                          const char   *subject,
+                          const char   *body,
+                          GVariant     *metadata,
+                          GVariant     *related_objects,
+                          const char   *root_contents_checksum,
+                          const char   *root_metadata_checksum,
+                          char        **out_commit,
+                          GCancellable *cancellable,
+                          GError      **error)
 {
   gboolean ret = FALSE;
-  guint i;
-  ot_lobj GFile *cache_path = NULL;
-  ot_lptrarray GPtrArray *data_files = NULL;
+  ot_lfree char *ret_commit = NULL;
+  ot_lvariant GVariant *commit = NULL;
+  ot_lfree guchar *commit_csum = NULL;
+  GDateTime *now = NULL;
 
-  if (!ensure_remote_cache_dir (self, remote_name, &cache_path, cancellable, error))
-    goto out;
+  g_return_val_if_fail (branch != NULL, FALSE);
+  g_return_val_if_fail (subject != NULL, FALSE);
+  g_return_val_if_fail (root_contents_checksum != NULL, FALSE);
+  g_return_val_if_fail (root_metadata_checksum != NULL, FALSE);
 
-  if (!list_files_in_dir_matching (cache_path,
-                                   "ostmetapack-", ".data",
-                                   &data_files, 
-                                   cancellable, error))
+  now = g_date_time_new_now_utc ();
+  commit = g_variant_new ("(@a{sv}@ay@a(say)sst@ay@ay)",
+                          metadata ? metadata : create_empty_gvariant_dict (),
+                          parent ? ostree_checksum_to_bytes_v (parent) : ot_gvariant_new_bytearray (NULL, 0),
+                          related_objects ? related_objects : g_variant_new_array (G_VARIANT_TYPE ("(say)"), NULL, 0),
+                          subject, body ? body : "",
+                          GUINT64_TO_BE (g_date_time_to_unix (now)),
+                          ostree_checksum_to_bytes_v (root_contents_checksum),
+                          ostree_checksum_to_bytes_v (root_metadata_checksum));
+  g_variant_ref_sink (commit);
+  if (!stage_metadata_object (self, OSTREE_OBJECT_TYPE_COMMIT,
+                              commit, &commit_csum, cancellable, error))
     goto out;
-  for (i = 0; i < data_files->len; i++)
-    {
-      GFile *data_file = data_files->pdata[i];
-      
-      if (!ot_gfile_unlink (data_file, cancellable, error))
-        goto out;
-    }
 
-  g_clear_pointer (&data_files, (GDestroyNotify) g_ptr_array_unref);
-  if (!list_files_in_dir_matching (cache_path,
-                                   "ostdatapack-", ".data",
-                                   &data_files, 
-                                   cancellable, error))
-    goto out;
-  for (i = 0; i < data_files->len; i++)
-    {
-      GFile *data_file = data_files->pdata[i];
-      
-      if (!ot_gfile_unlink (data_file, cancellable, error))
-        goto out;
-    }
+  ret_commit = ostree_checksum_from_bytes (commit_csum);
 
   ret = TRUE;
+  ot_transfer_out_value(out_commit, &ret_commit);
  out:
+  if (now)
+    g_date_time_unref (now);
   return ret;
 }
 
-/**
- * Load the index for pack @pack_checksum from cache directory for
- * @remote_name.
- */
-gboolean
-ostree_repo_map_cached_remote_pack_index (OstreeRepo       *self,
-                                          const char       *remote_name,
-                                          const char       *pack_checksum,
-                                          gboolean          is_meta,
-                                          GVariant        **out_variant,
-                                          GCancellable     *cancellable,
-                                          GError          **error)
+static gboolean
+list_files_in_dir_matching (GFile                  *dir,
+                            const char             *prefix,
+                            const char             *suffix,
+                            GPtrArray             **out_files,
+                            GCancellable           *cancellable,
+                            GError                **error)
 {
   gboolean ret = FALSE;
-  ot_lvariant GVariant *ret_variant = NULL;
-  ot_lobj GFile *cache_dir = NULL;
-  ot_lobj GFile *cached_pack_path = NULL;
+  GError *temp_error = NULL;
+  ot_lobj GFileEnumerator *enumerator = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
+  ot_lptrarray GPtrArray *ret_files = NULL;
 
-  if (!ensure_remote_cache_dir (self, remote_name, &cache_dir,
-                                cancellable, error))
+  g_return_val_if_fail (prefix != NULL || suffix != NULL, FALSE);
+
+  ret_files = g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
+
+  enumerator = g_file_enumerate_children (dir, OSTREE_GIO_FAST_QUERYINFO, 
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          cancellable, 
+                                          error);
+  if (!enumerator)
     goto out;
+  
+  while ((file_info = g_file_enumerator_next_file (enumerator, cancellable, &temp_error)) != NULL)
+    {
+      const char *name;
+      guint32 type;
 
-  cached_pack_path = get_pack_index_path (cache_dir, is_meta, pack_checksum);
-  if (!ot_util_variant_map (cached_pack_path, OSTREE_PACK_INDEX_VARIANT_FORMAT,
-                            FALSE, &ret_variant, error))
+      name = g_file_info_get_attribute_byte_string (file_info, "standard::name"); 
+      type = g_file_info_get_attribute_uint32 (file_info, "standard::type");
+
+      if (type != G_FILE_TYPE_REGULAR)
+        goto loop_next;
+
+      if (prefix)
+        {
+          if (!g_str_has_prefix (name, prefix))
+            goto loop_next;
+        }
+      if (suffix)
+        {
+          if (!g_str_has_suffix (name, suffix))
+            goto loop_next;
+        }
+
+      g_ptr_array_add (ret_files, g_file_get_child (dir, name));
+      
+    loop_next:
+      g_clear_object (&file_info);
+    }
+  if (temp_error != NULL)
+    {
+      g_propagate_error (error, temp_error);
+      goto out;
+    }
+  if (!g_file_enumerator_close (enumerator, cancellable, error))
     goto out;
 
   ret = TRUE;
-  ot_transfer_out_value (out_variant, &ret_variant);
+  ot_transfer_out_value (out_files, &ret_files);
  out:
   return ret;
 }
 
-/**
- * The variable @cached_path should refer to a file containing a pack
- * index.  It will be validated and added to the cache directory for
- * @remote_name.
- */
-gboolean
-ostree_repo_add_cached_remote_pack_index (OstreeRepo       *self,
-                                          const char       *remote_name,
-                                          const char       *pack_checksum,
-                                          gboolean          is_meta,
-                                          GFile            *cached_path,
-                                          GCancellable     *cancellable,
-                                          GError          **error)
+static gboolean
+map_variant_file_check_header_string (GFile         *path,
+                                      const GVariantType  *variant_type,
+                                      const char    *expected_header,
+                                      gboolean       trusted,
+                                      GVariant     **out_variant,
+                                      GCancellable  *cancellable,
+                                      GError       **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GFile *cachedir = NULL;
-  ot_lobj GFile *target_path = NULL;
-  ot_lvariant GVariant *input_index_variant = NULL;
-  ot_lvariant GVariant *output_index_variant = NULL;
+  const char *header;
+  ot_lvariant GVariant *ret_variant = NULL;
 
-  if (!map_variant_file_check_header_string (cached_path,
-                                             OSTREE_PACK_INDEX_VARIANT_FORMAT,
-                                             "OSTv0PACKINDEX",
-                                             FALSE, &input_index_variant,
-                                             cancellable, error))
+  if (!ot_util_variant_map (path, variant_type, trusted, &ret_variant, error))
     goto out;
 
-  if (!ostree_validate_structureof_pack_index (input_index_variant, error))
-    goto out;
+  g_variant_get_child (ret_variant, 0, "&s", &header);
 
-  output_index_variant = g_variant_get_normal_form (input_index_variant);
-  
-  if (!ensure_remote_cache_dir (self, remote_name, &cachedir, cancellable, error))
-    goto out;
-  
-  target_path = get_pack_index_path (cachedir, is_meta, pack_checksum);
-  if (!ot_util_variant_save (target_path, output_index_variant, cancellable, error))
-    goto out;
+  if (strcmp (header, expected_header) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid variant file '%s', expected header '%s'",
+                   ot_gfile_get_path_cached (path),
+                   expected_header);
+      goto out;
+    }
 
   ret = TRUE;
+  ot_transfer_out_value (out_variant, &ret_variant);
  out:
   return ret;
 }
 
-/**
- * Check for availability of the pack index pointing to @pack_checksum
- * in the lookaside cache for @remote_name.  If not found, then the
- * output parameter @out_cached_path will be %NULL.
- */
-gboolean
-ostree_repo_get_cached_remote_pack_data (OstreeRepo       *self,
-                                         const char       *remote_name,
-                                         const char       *pack_checksum,
-                                         gboolean          is_meta,
-                                         GFile           **out_cached_path,
-                                         GCancellable     *cancellable,
-                                         GError          **error)
+
+static char *
+get_checksum_from_pack_name (const char *name)
+{
+  const char *dash;
+  const char *dot;
+
+  dash = strchr (name, '-');
+  g_assert (dash);
+  dot = strrchr (name, '.');
+  g_assert (dot);
+
+  g_assert_cmpint (dot - (dash + 1), ==, 64);
+  
+  return g_strndup (dash + 1, 64);
+}
+
+static gboolean
+list_pack_indexes_from_dir (OstreeRepo              *self,
+                            gboolean                 is_meta,
+                            GPtrArray              **out_indexes,
+                            GCancellable            *cancellable,
+                            GError                 **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GFile *cache_dir = NULL;
-  ot_lobj GFile *cached_pack_path = NULL;
-  ot_lobj GFile *ret_cached_path = NULL;
+  guint i;
+  ot_lptrarray GPtrArray *index_files = NULL;
+  ot_lptrarray GPtrArray *ret_indexes = NULL;
 
-  if (!ensure_remote_cache_dir (self, remote_name, &cache_dir,
-                                cancellable, error))
+  if (!list_files_in_dir_matching (self->pack_dir,
+                                   is_meta ? "ostmetapack-" : "ostdatapack-", ".index",
+                                   &index_files, 
+                                   cancellable, error))
     goto out;
 
-  cached_pack_path = get_pack_data_path (cache_dir, is_meta, pack_checksum);
-  if (g_file_query_exists (cached_pack_path, cancellable))
+  ret_indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free);
+  for (i = 0; i < index_files->len; i++)
     {
-      ret_cached_path = cached_pack_path;
-      cached_pack_path = NULL;
+      GFile *index_path = index_files->pdata[i];
+      const char *basename = ot_gfile_get_basename_cached (index_path);
+      g_ptr_array_add (ret_indexes, get_checksum_from_pack_name (basename));
     }
 
   ret = TRUE;
-  ot_transfer_out_value (out_cached_path, &ret_cached_path);
+  ot_transfer_out_value (out_indexes, &ret_indexes);
  out:
   return ret;
 }
 
-/**
- * Add file @cached_path into the cache for given @remote_name.  If
- * @cached_path is %NULL, delete the cached pack data (if any).
- *
- * <note>
- *   This unlinks @cached_path.
- * </note>
- */
-gboolean
-ostree_repo_take_cached_remote_pack_data (OstreeRepo       *self,
-                                          const char       *remote_name,
-                                          const char       *pack_checksum,
-                                          gboolean          is_meta,
-                                          GFile            *cached_path,
-                                          GCancellable     *cancellable,
-                                          GError          **error)
+static gboolean
+list_pack_checksums_from_superindex_file (GFile         *superindex_path,
+                                          GPtrArray    **out_meta_indexes,
+                                          GPtrArray    **out_data_indexes,
+                                          GHashTable    *inout_blooms,
+                                          GCancellable  *cancellable,
+                                          GError       **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GFile *cachedir = NULL;
-  ot_lobj GFile *target_path = NULL;
+  const char *magic;
+  ot_lptrarray GPtrArray *ret_meta_indexes = NULL;
+  ot_lptrarray GPtrArray *ret_data_indexes = NULL;
+  ot_lvariant GVariant *superindex_variant = NULL;
+  ot_lvariant GVariant *checksum = NULL;
+  ot_lvariant GVariant *bloom = NULL;
+  GVariantIter *meta_variant_iter = NULL;
+  GVariantIter *data_variant_iter = NULL;
 
-  if (!ensure_remote_cache_dir (self, remote_name, &cachedir, cancellable, error))
+  if (!ot_util_variant_map (superindex_path, OSTREE_PACK_SUPER_INDEX_VARIANT_FORMAT,
+                            TRUE, &superindex_variant, error))
     goto out;
+  
+  g_variant_get (superindex_variant, "(&s@a{sv}a(ayay)a(ayay))",
+                 &magic, NULL, &meta_variant_iter, &data_variant_iter);
+  
+  if (strcmp (magic, "OSTv0SUPERPACKINDEX") != 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Invalid header in super pack index");
+      goto out;
+    }
 
-  target_path = get_pack_data_path (cachedir, is_meta, pack_checksum);
-  if (cached_path)
+  ret_meta_indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free); 
+  while (g_variant_iter_loop (meta_variant_iter, "(@ay@ay)",
+                              &checksum, &bloom))
     {
-      if (!ot_gfile_rename (cached_path, target_path, cancellable, error))
-        goto out;
+      char *pack_checksum = ostree_checksum_from_bytes_v (checksum);
+      g_ptr_array_add (ret_meta_indexes, pack_checksum);
+      if (inout_blooms)
+        g_hash_table_replace (inout_blooms, g_strdup (pack_checksum),
+                              g_variant_ref (bloom));
     }
-  else
+  checksum = NULL;
+  bloom = NULL;
+
+  ret_data_indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free); 
+  while (g_variant_iter_loop (data_variant_iter, "(@ay@ay)",
+                              &checksum, &bloom))
     {
-      (void) ot_gfile_unlink (target_path, cancellable, NULL);
+      char *pack_checksum = ostree_checksum_from_bytes_v (checksum);
+      g_ptr_array_add (ret_data_indexes, pack_checksum);
+      if (inout_blooms)
+        g_hash_table_replace (inout_blooms, g_strdup (pack_checksum),
+                              g_variant_ref (bloom));
     }
+  checksum = NULL;
+  bloom = NULL;
 
   ret = TRUE;
+  ot_transfer_out_value (out_meta_indexes, &ret_meta_indexes);
+  ot_transfer_out_value (out_data_indexes, &ret_data_indexes);
  out:
+  if (meta_variant_iter)
+    g_variant_iter_free (meta_variant_iter);
+  if (data_variant_iter)
+    g_variant_iter_free (data_variant_iter);
   return ret;
 }
 
-static GVariant *
-create_tree_variant_from_hashes (GHashTable            *file_checksums,
-                                 GHashTable            *dir_contents_checksums,
-                                 GHashTable            *dir_metadata_checksums)
+gboolean
+ostree_repo_list_pack_indexes (OstreeRepo              *self,
+                               GPtrArray              **out_meta_indexes,
+                               GPtrArray              **out_data_indexes,
+                               GCancellable            *cancellable,
+                               GError                 **error)
 {
-  GHashTableIter hash_iter;
-  gpointer key, value;
-  GVariantBuilder files_builder;
-  GVariantBuilder dirs_builder;
-  GSList *sorted_filenames = NULL;
-  GSList *iter;
-  GVariant *serialized_tree;
-
-  g_variant_builder_init (&files_builder, G_VARIANT_TYPE ("a(say)"));
-  g_variant_builder_init (&dirs_builder, G_VARIANT_TYPE ("a(sayay)"));
+  gboolean ret = FALSE;
+  ot_lobj GFile *superindex_path = NULL;
+  ot_lptrarray GPtrArray *ret_meta_indexes = NULL;
+  ot_lptrarray GPtrArray *ret_data_indexes = NULL;
 
-  g_hash_table_iter_init (&hash_iter, file_checksums);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+  g_mutex_lock (&self->cache_lock);
+  if (self->cached_meta_indexes)
     {
-      const char *name = key;
-      sorted_filenames = g_slist_prepend (sorted_filenames, (char*)name);
+      ret_meta_indexes = g_ptr_array_ref (self->cached_meta_indexes);
+      ret_data_indexes = g_ptr_array_ref (self->cached_content_indexes);
     }
-
-  sorted_filenames = g_slist_sort (sorted_filenames, (GCompareFunc)strcmp);
-
-  for (iter = sorted_filenames; iter; iter = iter->next)
+  else
     {
-      const char *name = iter->data;
-      const char *value;
+      superindex_path = g_file_get_child (self->pack_dir, "index");
 
-      value = g_hash_table_lookup (file_checksums, name);
-      g_variant_builder_add (&files_builder, "(s@ay)", name,
-                             ostree_checksum_to_bytes_v (value));
-    }
-  
-  g_slist_free (sorted_filenames);
-  sorted_filenames = NULL;
+      if (g_file_query_exists (superindex_path, cancellable))
+        {
+          if (!list_pack_checksums_from_superindex_file (superindex_path, &ret_meta_indexes,
+                                                         &ret_data_indexes,
+                                                         self->cached_pack_blooms,
+                                                         cancellable, error))
+            goto out;
+        }
+      else
+        {
+          ret_meta_indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free); 
+          ret_data_indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free); 
+        }
 
-  g_hash_table_iter_init (&hash_iter, dir_metadata_checksums);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
-    {
-      const char *name = key;
-      sorted_filenames = g_slist_prepend (sorted_filenames, (char*)name);
+      self->cached_meta_indexes = g_ptr_array_ref (ret_meta_indexes);
+      self->cached_content_indexes = g_ptr_array_ref (ret_data_indexes);
     }
 
-  sorted_filenames = g_slist_sort (sorted_filenames, (GCompareFunc)strcmp);
-
-  for (iter = sorted_filenames; iter; iter = iter->next)
-    {
-      const char *name = iter->data;
-      const char *content_checksum;
-      const char *meta_checksum;
-
-      content_checksum = g_hash_table_lookup (dir_contents_checksums, name);
-      meta_checksum = g_hash_table_lookup (dir_metadata_checksums, name);
-
-      g_variant_builder_add (&dirs_builder, "(s@ay@ay)",
-                             name,
-                             ostree_checksum_to_bytes_v (content_checksum),
-                             ostree_checksum_to_bytes_v (meta_checksum));
-    }
+  ret = TRUE;
+  ot_transfer_out_value (out_meta_indexes, &ret_meta_indexes);
+  ot_transfer_out_value (out_data_indexes, &ret_data_indexes);
+ out:
+  g_mutex_unlock (&self->cache_lock);
+  return ret;
+}
 
-  g_slist_free (sorted_filenames);
-  sorted_filenames = NULL;
+/*
+ * Returns: (transfer full): The bloom filter for @pack_checksum
+ * from the superindex, or %NULL if none is known.
+ */
+static GVariant *
+get_cached_pack_bloom (OstreeRepo          *self,
+                       const char          *pack_checksum)
+{
+  GVariant *ret;
 
-  serialized_tree = g_variant_new ("(@a(say)@a(sayay))",
-                                   g_variant_builder_end (&files_builder),
-                                   g_variant_builder_end (&dirs_builder));
-  g_variant_ref_sink (serialized_tree);
+  g_mutex_lock (&self->cache_lock);
+  ret = g_hash_table_lookup (self->cached_pack_blooms, pack_checksum);
+  if (ret)
+    g_variant_ref (ret);
+  g_mutex_unlock (&self->cache_lock);
 
-  return serialized_tree;
+  return ret;
 }
 
-static GFileInfo *
-create_modified_file_info (GFileInfo               *info,
-                           OstreeRepoCommitModifier *modifier)
+static gboolean
+create_index_bloom (OstreeRepo          *self,
+                    const char          *pack_checksum,
+                    gboolean             is_meta,
+                    GVariant           **out_bloom,
+                    GCancellable        *cancellable,
+                    GError             **error)
 {
-  GFileInfo *ret;
+  gboolean ret = FALSE;
+  ot_lvariant GVariant *index_variant = NULL;
+  ot_lvariant GVariant *ret_bloom = NULL;
 
-  if (!modifier)
-    return (GFileInfo*)g_object_ref (info);
+  if (!ostree_repo_load_pack_index (self, pack_checksum, is_meta, &index_variant,
+                                    cancellable, error))
+    goto out;
 
-  ret = g_file_info_dup (info);
-  
+  ret_bloom = ostree_pack_index_create_bloom (index_variant);
+
+  ret = TRUE;
+  ot_transfer_out_value (out_bloom, &ret_bloom);
+ out:
   return ret;
 }
 
-static OstreeRepoCommitFilterResult
-apply_commit_filter (OstreeRepo            *self,
-                     OstreeRepoCommitModifier *modifier,
-                     GPtrArray                *path,
-                     GFileInfo                *file_info,
-                     GFileInfo               **out_modified_info)
+static gboolean
+append_index_builder (OstreeRepo           *self,
+                      GPtrArray            *indexes,
+                      gboolean              is_meta,
+                      GVariantBuilder      *builder,
+                      GCancellable         *cancellable,
+                      GError              **error)
 {
-  GString *path_buf;
+  gboolean ret = FALSE;
   guint i;
-  OstreeRepoCommitFilterResult result;
-  GFileInfo *modified_info;
-  
-  if (modifier == NULL || modifier->filter == NULL)
+
+  for (i = 0; i < indexes->len; i++)
     {
-      *out_modified_info = g_object_ref (file_info);
-      return OSTREE_REPO_COMMIT_FILTER_ALLOW;
-    }
+      const char *pack_checksum = indexes->pdata[i];
+      ot_lvariant GVariant *bloom = NULL;
 
-  path_buf = g_string_new ("");
+      if (!create_index_bloom (self, pack_checksum, is_meta, &bloom,
+                               cancellable, error))
+        goto out;
 
-  if (path->len == 0)
-    g_string_append_c (path_buf, '/');
-  else
-    {
-      for (i = 0; i < path->len; i++)
-        {
-          const char *elt = path->pdata[i];
-          
-          g_string_append_c (path_buf, '/');
-          g_string_append (path_buf, elt);
-        }
+      g_variant_builder_add (builder,
+                             "(@ay@ay)",
+                             ostree_checksum_to_bytes_v (pack_checksum),
+                             bloom);
     }
 
-  modified_info = g_file_info_dup (file_info);
-  result = modifier->filter (self, path_buf->str, modified_info, modifier->user_data);
-  *out_modified_info = modified_info;
+  ret = TRUE;
+ out:
+  return ret;
+}
 
-  g_string_free (path_buf, TRUE);
-  return result;
+static gint
+compare_multi_index_entries (gconstpointer  a,
+                             gconstpointer  b)
+{
+  /* Checksum followed by objtype */
+  return memcmp (a, b, 33);
 }
 
 static gboolean
-stage_directory_to_mtree_internal (OstreeRepo           *self,
-                                   GFile                *dir,
-                                   OstreeMutableTree    *mtree,
-                                   OstreeRepoCommitModifier *modifier,
-                                   GPtrArray             *path,
-                                   GCancellable         *cancellable,
-                                   GError              **error)
+append_multi_index_entries (OstreeRepo           *self,
+                            GPtrArray            *indexes,
+                            gboolean              is_meta,
+                            GVariantBuilder      *checksums_builder,
+                            GArray               *entries,
+                            GCancellable         *cancellable,
+                            GError              **error)
 {
   gboolean ret = FALSE;
-  GError *temp_error = NULL;
-  gboolean repo_dir_was_empty = FALSE;
-  OstreeRepoCommitFilterResult filter_result;
-  ot_lobj OstreeRepoFile *repo_dir = NULL;
-  ot_lobj GFileEnumerator *dir_enum = NULL;
-  ot_lobj GFileInfo *child_info = NULL;
-
-  /* We can only reuse checksums directly if there's no modifier */
-  if (OSTREE_IS_REPO_FILE (dir) && modifier == NULL)
-    repo_dir = (OstreeRepoFile*)g_object_ref (dir);
+  guint i;
 
-  if (repo_dir)
+  for (i = 0; i < indexes->len; i++)
     {
-      if (!ostree_repo_file_ensure_resolved (repo_dir, error))
+      const char *pack_checksum = indexes->pdata[i];
+      OstreePackIndexIter index_iter;
+      OstreeObjectType objtype;
+      const guchar *csum;
+      guint64 offset;
+      guint32 pack_index_be;
+      ot_lvariant GVariant *index_variant = NULL;
+
+      if (!ostree_repo_load_pack_index (self, pack_checksum, is_meta, &index_variant,
+                                        cancellable, error))
         goto out;
 
-      ostree_mutable_tree_set_metadata_checksum (mtree, ostree_repo_file_get_checksum (repo_dir));
-      repo_dir_was_empty = 
-        g_hash_table_size (ostree_mutable_tree_get_files (mtree)) == 0
-        && g_hash_table_size (ostree_mutable_tree_get_subdirs (mtree)) == 0;
+      g_variant_builder_add (checksums_builder, "@ay",
+                             ostree_checksum_to_bytes_v (pack_checksum));
 
-      filter_result = OSTREE_REPO_COMMIT_FILTER_ALLOW;
+      pack_index_be = GUINT32_TO_BE (i);
+      ostree_pack_index_iter_init (&index_iter, index_variant);
+      while (ostree_pack_index_iter_next (&index_iter, &objtype, &csum, &offset))
+        {
+          guchar entry[OSTREE_MULTI_PACK_INDEX_ENTRY_SIZE];
+          guint64 offset_be = GUINT64_TO_BE (offset);
+
+          memset (entry, 0, sizeof (entry));
+          memcpy (entry, csum, 32);
+          entry[32] = (guchar) objtype;
+          memcpy (entry + 36, &pack_index_be, 4);
+          memcpy (entry + 40, &offset_be, 8);
+          g_array_append_vals (entries, entry, 1);
+        }
+      ostree_pack_index_iter_clear (&index_iter);
     }
-  else
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+write_multi_pack_index (OstreeRepo       *self,
+                        GPtrArray        *meta_pack_indexes,
+                        GPtrArray        *data_pack_indexes,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *multi_index_path = NULL;
+  ot_lvariant GVariant *multi_index_variant = NULL;
+  GArray *entries = NULL;
+  GVariantBuilder *meta_checksums_builder = NULL;
+  GVariantBuilder *data_checksums_builder = NULL;
+
+  entries = g_array_new (FALSE, FALSE, OSTREE_MULTI_PACK_INDEX_ENTRY_SIZE);
+
+  meta_checksums_builder = g_variant_builder_new (G_VARIANT_TYPE ("aay"));
+  if (!append_multi_index_entries (self, meta_pack_indexes, TRUE, meta_checksums_builder,
+                                   entries, cancellable, error))
+    goto out;
+
+  data_checksums_builder = g_variant_builder_new (G_VARIANT_TYPE ("aay"));
+  if (!append_multi_index_entries (self, data_pack_indexes, FALSE, data_checksums_builder,
+                                   entries, cancellable, error))
+    goto out;
+
+  g_array_sort (entries, compare_multi_index_entries);
+
+  multi_index_variant = g_variant_new ("(s@a{sv}@aay@aay@ay)",
+                                       "OSTv0MULTIPACKINDEX",
+                                       g_variant_new_array (G_VARIANT_TYPE ("{sv}"),
+                                                            NULL, 0),
+                                       g_variant_builder_end (meta_checksums_builder),
+                                       g_variant_builder_end (data_checksums_builder),
+                                       ot_gvariant_new_bytearray ((guchar*)entries->data,
+                                                                  entries->len * OSTREE_MULTI_PACK_INDEX_ENTRY_SIZE));
+  g_variant_ref_sink (multi_index_variant);
+
+  multi_index_path = g_file_get_child (self->pack_dir, "multi-index");
+  if (!ot_util_variant_save (multi_index_path, multi_index_variant,
+                             cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (entries)
+    g_array_free (entries, TRUE);
+  if (meta_checksums_builder)
+    g_variant_builder_unref (meta_checksums_builder);
+  if (data_checksums_builder)
+    g_variant_builder_unref (data_checksums_builder);
+  return ret;
+}
+
+/**
+ * Regenerate the pack superindex file based on the set of pack
+ * indexes currently in the filesystem.
+ */
+gboolean
+ostree_repo_regenerate_pack_index (OstreeRepo       *self,
+                                   GCancellable     *cancellable,
+                                   GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *superindex_path = NULL;
+  ot_lptrarray GPtrArray *meta_pack_indexes = NULL;
+  ot_lptrarray GPtrArray *data_pack_indexes = NULL;
+  ot_lvariant GVariant *superindex_variant = NULL;
+  GVariantBuilder *meta_index_content_builder = NULL;
+  GVariantBuilder *data_index_content_builder = NULL;
+
+  g_mutex_lock (&self->cache_lock);
+  g_clear_pointer (&self->cached_meta_indexes, (GDestroyNotify) g_ptr_array_unref);
+  g_clear_pointer (&self->cached_content_indexes, (GDestroyNotify) g_ptr_array_unref);
+  g_hash_table_remove_all (self->cached_pack_blooms);
+  g_clear_pointer (&self->cached_multi_pack_index, (GDestroyNotify) g_variant_unref);
+  self->multi_pack_index_loaded = FALSE;
+  g_mutex_unlock (&self->cache_lock);
+
+  superindex_path = g_file_get_child (self->pack_dir, "index");
+
+  if (!list_pack_indexes_from_dir (self, TRUE, &meta_pack_indexes,
+                                   cancellable, error))
+    goto out;
+  meta_index_content_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ayay)"));
+  if (!append_index_builder (self, meta_pack_indexes, TRUE, meta_index_content_builder,
+                             cancellable, error))
+    goto out;
+
+  if (!list_pack_indexes_from_dir (self, FALSE, &data_pack_indexes,
+                                   cancellable, error))
+    goto out;
+  data_index_content_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ayay)"));
+  if (!append_index_builder (self, data_pack_indexes, FALSE, data_index_content_builder,
+                             cancellable, error))
+    goto out;
+
+  superindex_variant = g_variant_new ("(s@a{sv}@a(ayay)@a(ayay))",
+                                      "OSTv0SUPERPACKINDEX",
+                                      g_variant_new_array (G_VARIANT_TYPE ("{sv}"),
+                                                           NULL, 0),
+                                      g_variant_builder_end (meta_index_content_builder),
+                                      g_variant_builder_end (data_index_content_builder));
+  g_variant_ref_sink (superindex_variant);
+
+  if (!ot_util_variant_save (superindex_path, superindex_variant,
+                             cancellable, error))
+    goto out;
+
+  if (!write_multi_pack_index (self, meta_pack_indexes, data_pack_indexes,
+                               cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (meta_index_content_builder)
+    g_variant_builder_unref (meta_index_content_builder);
+  if (data_index_content_builder)
+    g_variant_builder_unref (data_index_content_builder);
+  return ret;
+}
+
+static GFile *
+get_pack_index_path (GFile            *parent,
+                     gboolean          is_meta,
+                     const char       *checksum)
+{
+  char *path = ostree_get_pack_index_name (is_meta, checksum);
+  GFile *ret = g_file_resolve_relative_path (parent, path);
+  g_free (path);
+  return ret;
+}
+
+static GFile *
+get_pack_data_path (GFile            *parent,
+                    gboolean          is_meta,
+                    const char       *checksum)
+{
+  char *path = ostree_get_pack_data_name (is_meta, checksum);
+  GFile *ret = g_file_resolve_relative_path (parent, path);
+  g_free (path);
+  return ret;
+}
+
+gboolean
+ostree_repo_add_pack_file (OstreeRepo       *self,
+                           const char       *pack_checksum,
+                           gboolean          is_meta,
+                           GFile            *index_path,
+                           GFile            *data_path,
+                           GCancellable     *cancellable,
+                           GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *pack_index_path = NULL;
+  ot_lobj GFile *pack_data_path = NULL;
+
+  if (!ot_gfile_ensure_directory (self->pack_dir, FALSE, error))
+    goto out;
+
+  pack_data_path = get_pack_data_path (self->pack_dir, is_meta, pack_checksum);
+  if (!ot_gfile_rename (data_path, pack_data_path, cancellable, error))
+    goto out;
+
+  pack_index_path = get_pack_index_path (self->pack_dir, is_meta, pack_checksum);
+  if (!ot_gfile_rename (index_path, pack_index_path, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+ensure_remote_cache_dir (OstreeRepo       *self,
+                         const char       *remote_name,
+                         GFile           **out_cache_dir,
+                         GCancellable     *cancellable,
+                         GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *ret_cache_dir = NULL;
+
+  ret_cache_dir = g_file_get_child (self->remote_cache_dir, remote_name);
+  
+  if (!ot_gfile_ensure_directory (ret_cache_dir, FALSE, error))
+    goto out;
+
+  ret = TRUE;
+  ot_transfer_out_value (out_cache_dir, &ret_cache_dir);
+ out:
+  return ret;
+}
+
+static gboolean
+delete_no_longer_referenced (OstreeRepo                   *self,
+                             GFile                        *cache_path,
+                             const char                   *prefix,
+                             const char                   *suffix,
+                             GHashTable                   *new_files,
+                             GPtrArray                    *inout_cached,
+                             GCancellable                 *cancellable,
+                             GError                      **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+  ot_lptrarray GPtrArray *current_files = NULL;
+  ot_lfree char *pack_checksum = NULL;
+
+  if (!list_files_in_dir_matching (cache_path,
+                                   prefix, suffix,
+                                   &current_files, 
+                                   cancellable, error))
+    goto out;
+  for (i = 0; i < current_files->len; i++)
+    {
+      GFile *file = current_files->pdata[i];
+      
+      g_free (pack_checksum);
+      pack_checksum = get_checksum_from_pack_name (ot_gfile_get_basename_cached (file));
+      
+      if (!g_hash_table_lookup (new_files, pack_checksum))
+        {
+          if (!ot_gfile_unlink (file, cancellable, error))
+            goto out;
+        }
+      
+      if (inout_cached)
+        {
+          g_ptr_array_add (inout_cached, pack_checksum);
+          pack_checksum = NULL; /* transfer ownership */
+        }
+    }
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+gather_uncached (GHashTable   *new_files,
+                 GPtrArray    *cached,
+                 GPtrArray    *inout_uncached)
+{
+  guint i;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&hash_iter, new_files);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      const char *cur_pack_checksum = key;
+      gboolean found = FALSE;
+
+      for (i = 0; i < cached->len; i++)
+        {
+          const char *checksum = cached->pdata[i];
+          if (strcmp (cur_pack_checksum, checksum) == 0)
+            {
+              found = TRUE;
+              break;
+            }
+        }
+      
+      if (!found)
+        g_ptr_array_add (inout_uncached, g_strdup (cur_pack_checksum));
+    }
+}
+
+/**
+ * Take a pack superindex file @superindex_path, and clean up any
+ * no-longer-referenced pack files in the lookaside cache for
+ * @remote_name.  The updated index file will also be saved into the
+ * cache.
+ *
+ * Upon successful return, @out_cached_indexes will hold checksum
+ * strings for indexes which are already in the cache, and
+ * @out_uncached_indexes will hold strings for those which are not.
+ */
+gboolean
+ostree_repo_resync_cached_remote_pack_indexes (OstreeRepo       *self,
+                                               const char       *remote_name,
+                                               GFile            *superindex_path,
+                                               GPtrArray       **out_cached_meta_indexes,
+                                               GPtrArray       **out_cached_data_indexes,
+                                               GPtrArray       **out_uncached_meta_indexes,
+                                               GPtrArray       **out_uncached_data_indexes,
+                                               GCancellable     *cancellable,
+                                               GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lvariant GVariant *superindex_variant = NULL;
+  ot_lobj GFile *cache_path = NULL;
+  ot_lobj GFile *superindex_cache_path = NULL;
+  ot_lptrarray GPtrArray *meta_index_files = NULL;
+  ot_lptrarray GPtrArray *data_index_files = NULL;
+  ot_lptrarray GPtrArray *meta_data_files = NULL;
+  ot_lptrarray GPtrArray *data_data_files = NULL;
+  ot_lhash GHashTable *new_pack_meta_indexes = NULL;
+  ot_lhash GHashTable *new_pack_data_indexes = NULL;
+  ot_lptrarray GPtrArray *ret_cached_meta_indexes = NULL;
+  ot_lptrarray GPtrArray *ret_cached_data_indexes = NULL;
+  ot_lptrarray GPtrArray *ret_uncached_meta_indexes = NULL;
+  ot_lptrarray GPtrArray *ret_uncached_data_indexes = NULL;
+  ot_lvariant GVariant *csum_bytes = NULL;
+  ot_lvariant GVariant *bloom = NULL;
+  ot_lfree char *pack_checksum = NULL;
+  GVariantIter *superindex_contents_iter = NULL;
+
+  if (!ensure_remote_cache_dir (self, remote_name, &cache_path, cancellable, error))
+    goto out;
+
+  ret_cached_meta_indexes = g_ptr_array_new_with_free_func (g_free);
+  ret_cached_data_indexes = g_ptr_array_new_with_free_func (g_free);
+  ret_uncached_meta_indexes = g_ptr_array_new_with_free_func (g_free);
+  ret_uncached_data_indexes = g_ptr_array_new_with_free_func (g_free);
+
+  if (!ot_util_variant_map (superindex_path, OSTREE_PACK_SUPER_INDEX_VARIANT_FORMAT,
+                            FALSE, &superindex_variant, error))
+    goto out;
+
+  if (!ostree_validate_structureof_pack_superindex (superindex_variant, error))
+    goto out;
+
+  new_pack_meta_indexes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  new_pack_data_indexes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  g_variant_get_child (superindex_variant, 2, "a(ayay)",
+                       &superindex_contents_iter);
+  while (g_variant_iter_loop (superindex_contents_iter,
+                              "(@ay@ay)", &csum_bytes, &bloom))
+    {
+      pack_checksum = ostree_checksum_from_bytes_v (csum_bytes);
+      g_hash_table_insert (new_pack_meta_indexes, pack_checksum, pack_checksum);
+      pack_checksum = NULL; /* transfer ownership */
+    }
+  g_variant_iter_free (superindex_contents_iter);
+
+  g_variant_get_child (superindex_variant, 3, "a(ayay)",
+                       &superindex_contents_iter);
+  while (g_variant_iter_loop (superindex_contents_iter,
+                              "(@ay@ay)", &csum_bytes, &bloom))
+    {
+      pack_checksum = ostree_checksum_from_bytes_v (csum_bytes);
+      g_hash_table_insert (new_pack_data_indexes, pack_checksum, pack_checksum);
+      pack_checksum = NULL; /* transfer ownership */
+    }
+
+  if (!delete_no_longer_referenced (self, cache_path,
+                                    "ostmetapack-", ".index",
+                                    new_pack_meta_indexes,
+                                    ret_cached_meta_indexes,
+                                    cancellable, error))
+    goto out;
+
+  if (!delete_no_longer_referenced (self, cache_path,
+                                    "ostdatapack-", ".index",
+                                    new_pack_data_indexes,
+                                    ret_cached_data_indexes,
+                                    cancellable, error))
+    goto out;
+
+  gather_uncached (new_pack_meta_indexes, ret_cached_meta_indexes, ret_uncached_meta_indexes);
+  gather_uncached (new_pack_data_indexes, ret_cached_data_indexes, ret_uncached_data_indexes);
+  
+  superindex_cache_path = g_file_get_child (cache_path, "index");
+  if (!ot_util_variant_save (superindex_cache_path, superindex_variant, cancellable, error))
+    goto out;
+
+  /* Now also delete stale pack files */
+
+  if (!delete_no_longer_referenced (self, cache_path,
+                                    "ostmetapack-", ".data",
+                                    new_pack_meta_indexes, NULL,
+                                    cancellable, error))
+    goto out;
+  if (!delete_no_longer_referenced (self, cache_path,
+                                    "ostdatapack-", ".data",
+                                    new_pack_data_indexes, NULL,
+                                    cancellable, error))
+    goto out;
+      
+  ret = TRUE;
+  ot_transfer_out_value (out_cached_meta_indexes, &ret_cached_meta_indexes);
+  ot_transfer_out_value (out_cached_data_indexes, &ret_cached_data_indexes);
+  ot_transfer_out_value (out_uncached_meta_indexes, &ret_uncached_meta_indexes);
+  ot_transfer_out_value (out_uncached_data_indexes, &ret_uncached_data_indexes);
+ out:
+  if (superindex_contents_iter)
+    g_variant_iter_free (superindex_contents_iter);
+  return ret;
+}
+
+gboolean
+ostree_repo_clean_cached_remote_pack_data (OstreeRepo       *self,
+                                           const char       *remote_name,
+                                           GCancellable     *cancellable,
+                                           GError          **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+  ot_lobj GFile *cache_path = NULL;
+  ot_lptrarray GPtrArray *data_files = NULL;
+
+  if (!ensure_remote_cache_dir (self, remote_name, &cache_path, cancellable, error))
+    goto out;
+
+  if (!list_files_in_dir_matching (cache_path,
+                                   "ostmetapack-", ".data",
+                                   &data_files, 
+                                   cancellable, error))
+    goto out;
+  for (i = 0; i < data_files->len; i++)
+    {
+      GFile *data_file = data_files->pdata[i];
+      
+      if (!ot_gfile_unlink (data_file, cancellable, error))
+        goto out;
+    }
+
+  g_clear_pointer (&data_files, (GDestroyNotify) g_ptr_array_unref);
+  if (!list_files_in_dir_matching (cache_path,
+                                   "ostdatapack-", ".data",
+                                   &data_files, 
+                                   cancellable, error))
+    goto out;
+  for (i = 0; i < data_files->len; i++)
+    {
+      GFile *data_file = data_files->pdata[i];
+      
+      if (!ot_gfile_unlink (data_file, cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * Load the index for pack @pack_checksum from cache directory for
+ * @remote_name.
+ */
+gboolean
+ostree_repo_map_cached_remote_pack_index (OstreeRepo       *self,
+                                          const char       *remote_name,
+                                          const char       *pack_checksum,
+                                          gboolean          is_meta,
+                                          GVariant        **out_variant,
+                                          GCancellable     *cancellable,
+                                          GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lvariant GVariant *ret_variant = NULL;
+  ot_lobj GFile *cache_dir = NULL;
+  ot_lobj GFile *cached_pack_path = NULL;
+
+  if (!ensure_remote_cache_dir (self, remote_name, &cache_dir,
+                                cancellable, error))
+    goto out;
+
+  cached_pack_path = get_pack_index_path (cache_dir, is_meta, pack_checksum);
+  if (!ostree_map_pack_index (cached_pack_path, FALSE, &ret_variant, error))
+    goto out;
+
+  ret = TRUE;
+  ot_transfer_out_value (out_variant, &ret_variant);
+ out:
+  return ret;
+}
+
+/**
+ * The variable @cached_path should refer to a file containing a pack
+ * index.  It will be validated and added to the cache directory for
+ * @remote_name.
+ */
+gboolean
+ostree_repo_add_cached_remote_pack_index (OstreeRepo       *self,
+                                          const char       *remote_name,
+                                          const char       *pack_checksum,
+                                          gboolean          is_meta,
+                                          GFile            *cached_path,
+                                          GCancellable     *cancellable,
+                                          GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *cachedir = NULL;
+  ot_lobj GFile *target_path = NULL;
+  ot_lvariant GVariant *input_index_variant = NULL;
+  ot_lvariant GVariant *output_index_variant = NULL;
+
+  if (!ostree_map_pack_index (cached_path, FALSE, &input_index_variant, error))
+    goto out;
+
+  if (!ostree_validate_structureof_pack_index (input_index_variant, error))
+    goto out;
+
+  output_index_variant = g_variant_get_normal_form (input_index_variant);
+  
+  if (!ensure_remote_cache_dir (self, remote_name, &cachedir, cancellable, error))
+    goto out;
+  
+  target_path = get_pack_index_path (cachedir, is_meta, pack_checksum);
+  if (!ot_util_variant_save (target_path, output_index_variant, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * Check for availability of the pack index pointing to @pack_checksum
+ * in the lookaside cache for @remote_name.  If not found, then the
+ * output parameter @out_cached_path will be %NULL.
+ */
+gboolean
+ostree_repo_get_cached_remote_pack_data (OstreeRepo       *self,
+                                         const char       *remote_name,
+                                         const char       *pack_checksum,
+                                         gboolean          is_meta,
+                                         GFile           **out_cached_path,
+                                         GCancellable     *cancellable,
+                                         GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *cache_dir = NULL;
+  ot_lobj GFile *cached_pack_path = NULL;
+  ot_lobj GFile *ret_cached_path = NULL;
+
+  if (!ensure_remote_cache_dir (self, remote_name, &cache_dir,
+                                cancellable, error))
+    goto out;
+
+  cached_pack_path = get_pack_data_path (cache_dir, is_meta, pack_checksum);
+  if (g_file_query_exists (cached_pack_path, cancellable))
+    {
+      ret_cached_path = cached_pack_path;
+      cached_pack_path = NULL;
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_cached_path, &ret_cached_path);
+ out:
+  return ret;
+}
+
+/**
+ * Add file @cached_path into the cache for given @remote_name.  If
+ * @cached_path is %NULL, delete the cached pack data (if any).
+ *
+ * <note>
+ *   This unlinks @cached_path.
+ * </note>
+ */
+gboolean
+ostree_repo_take_cached_remote_pack_data (OstreeRepo       *self,
+                                          const char       *remote_name,
+                                          const char       *pack_checksum,
+                                          gboolean          is_meta,
+                                          GFile            *cached_path,
+                                          GCancellable     *cancellable,
+                                          GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *cachedir = NULL;
+  ot_lobj GFile *target_path = NULL;
+
+  if (!ensure_remote_cache_dir (self, remote_name, &cachedir, cancellable, error))
+    goto out;
+
+  target_path = get_pack_data_path (cachedir, is_meta, pack_checksum);
+  if (cached_path)
+    {
+      if (!ot_gfile_rename (cached_path, target_path, cancellable, error))
+        goto out;
+    }
+  else
+    {
+      (void) ot_gfile_unlink (target_path, cancellable, NULL);
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static GVariant *
+create_tree_variant_from_hashes (GHashTable            *file_checksums,
+                                 GHashTable            *dir_contents_checksums,
+                                 GHashTable            *dir_metadata_checksums)
+{
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  GVariantBuilder files_builder;
+  GVariantBuilder dirs_builder;
+  GSList *sorted_filenames = NULL;
+  GSList *iter;
+  GVariant *serialized_tree;
+
+  g_variant_builder_init (&files_builder, G_VARIANT_TYPE ("a(say)"));
+  g_variant_builder_init (&dirs_builder, G_VARIANT_TYPE ("a(sayay)"));
+
+  g_hash_table_iter_init (&hash_iter, file_checksums);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      const char *name = key;
+      sorted_filenames = g_slist_prepend (sorted_filenames, (char*)name);
+    }
+
+  sorted_filenames = g_slist_sort (sorted_filenames, (GCompareFunc)strcmp);
+
+  for (iter = sorted_filenames; iter; iter = iter->next)
+    {
+      const char *name = iter->data;
+      const char *value;
+
+      value = g_hash_table_lookup (file_checksums, name);
+      g_variant_builder_add (&files_builder, "(s@ay)", name,
+                             ostree_checksum_to_bytes_v (value));
+    }
+  
+  g_slist_free (sorted_filenames);
+  sorted_filenames = NULL;
+
+  g_hash_table_iter_init (&hash_iter, dir_metadata_checksums);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      const char *name = key;
+      sorted_filenames = g_slist_prepend (sorted_filenames, (char*)name);
+    }
+
+  sorted_filenames = g_slist_sort (sorted_filenames, (GCompareFunc)strcmp);
+
+  for (iter = sorted_filenames; iter; iter = iter->next)
+    {
+      const char *name = iter->data;
+      const char *content_checksum;
+      const char *meta_checksum;
+
+      content_checksum = g_hash_table_lookup (dir_contents_checksums, name);
+      meta_checksum = g_hash_table_lookup (dir_metadata_checksums, name);
+
+      g_variant_builder_add (&dirs_builder, "(s@ay@ay)",
+                             name,
+                             ostree_checksum_to_bytes_v (content_checksum),
+                             ostree_checksum_to_bytes_v (meta_checksum));
+    }
+
+  g_slist_free (sorted_filenames);
+  sorted_filenames = NULL;
+
+  serialized_tree = g_variant_new ("(@a(say)@a(sayay))",
+                                   g_variant_builder_end (&files_builder),
+                                   g_variant_builder_end (&dirs_builder));
+  g_variant_ref_sink (serialized_tree);
+
+  return serialized_tree;
+}
+
+static GFileInfo *
+create_modified_file_info (GFileInfo               *info,
+                           OstreeRepoCommitModifier *modifier)
+{
+  GFileInfo *ret;
+
+  if (!modifier)
+    return (GFileInfo*)g_object_ref (info);
+
+  ret = g_file_info_dup (info);
+  
+  return ret;
+}
+
+static OstreeRepoCommitFilterResult
+apply_commit_filter (OstreeRepo            *self,
+                     OstreeRepoCommitModifier *modifier,
+                     GPtrArray                *path,
+                     GFileInfo                *file_info,
+                     GFileInfo               **out_modified_info)
+{
+  GString *path_buf;
+  guint i;
+  OstreeRepoCommitFilterResult result;
+  GFileInfo *modified_info;
+  
+  if (modifier == NULL || modifier->filter == NULL)
+    {
+      *out_modified_info = g_object_ref (file_info);
+      return OSTREE_REPO_COMMIT_FILTER_ALLOW;
+    }
+
+  path_buf = g_string_new ("");
+
+  if (path->len == 0)
+    g_string_append_c (path_buf, '/');
+  else
+    {
+      for (i = 0; i < path->len; i++)
+        {
+          const char *elt = path->pdata[i];
+          
+          g_string_append_c (path_buf, '/');
+          g_string_append (path_buf, elt);
+        }
+    }
+
+  modified_info = g_file_info_dup (file_info);
+  result = modifier->filter (self, path_buf->str, modified_info, modifier->user_data);
+  *out_modified_info = modified_info;
+
+  g_string_free (path_buf, TRUE);
+  return result;
+}
+
+/*
+ * A file to be staged as a content object, and then added to @mtree
+ * under @name.  Jobs run on any thread, but are applied to the
+ * mutable tree only from the thread doing the enumeration.
+ */
+typedef struct {
+  OstreeMutableTree *mtree;
+  char *name;
+  GFile *path;
+  GFileInfo *file_info;
+  GVariant *xattrs;
+  GVariant *stat_cache_key;
+
+  gboolean success;
+  char *checksum;
+  GError *error;
+} StageFileJob;
+
+typedef struct {
+  OstreeRepo *repo;
+  OstreeRepoCommitModifier *modifier;
+  GCancellable *cancellable;
+
+  GThreadPool *pool;
+  GAsyncQueue *completed;
+  guint n_pending;
+  guint max_pending;
+  volatile gint failed;
+} StageFilePool;
+
+static StageFileJob *
+stage_file_job_new (OstreeMutableTree  *mtree,
+                    const char         *name,
+                    GFile              *path,
+                    GFileInfo          *file_info,
+                    GVariant           *xattrs,
+                    GVariant           *stat_cache_key)
+{
+  StageFileJob *job = g_new0 (StageFileJob, 1);
+
+  job->mtree = g_object_ref (mtree);
+  job->name = g_strdup (name);
+  job->path = g_object_ref (path);
+  job->file_info = g_object_ref (file_info);
+  job->xattrs = xattrs ? g_variant_ref (xattrs) : NULL;
+  job->stat_cache_key = stat_cache_key ? g_variant_ref (stat_cache_key) : NULL;
+
+  return job;
+}
+
+static void
+stage_file_job_free (StageFileJob  *job)
+{
+  g_object_unref (job->mtree);
+  g_free (job->name);
+  g_object_unref (job->path);
+  g_object_unref (job->file_info);
+  if (job->xattrs)
+    g_variant_unref (job->xattrs);
+  if (job->stat_cache_key)
+    g_variant_unref (job->stat_cache_key);
+  g_free (job->checksum);
+  g_clear_error (&job->error);
+  g_free (job);
+}
+
+static gboolean
+stage_file_job_run (OstreeRepo                *self,
+                    OstreeRepoCommitModifier  *modifier,
+                    StageFileJob              *job,
+                    GCancellable              *cancellable,
+                    GError                   **error)
+{
+  gboolean ret = FALSE;
+  guint64 file_obj_length;
+  ot_lobj GInputStream *file_input = NULL;
+  ot_lobj GInputStream *file_object_input = NULL;
+  ot_lfree guchar *child_file_csum = NULL;
+
+  if (g_file_info_get_file_type (job->file_info) == G_FILE_TYPE_REGULAR)
+    {
+      file_input = (GInputStream*)g_file_read (job->path, cancellable, error);
+      if (!file_input)
+        goto out;
+    }
+
+  if (!job->xattrs && !(modifier && modifier->skip_xattrs))
+    {
+      if (!ostree_get_xattrs_for_file (job->path, &job->xattrs, cancellable, error))
+        goto out;
+    }
+
+  if (!ostree_raw_file_to_content_stream (file_input,
+                                          job->file_info, job->xattrs,
+                                          &file_object_input, &file_obj_length,
+                                          cancellable, error))
+    goto out;
+  if (!stage_object (self, OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID,
+                     OSTREE_OBJECT_TYPE_FILE, file_object_input, file_obj_length,
+                     NULL, &child_file_csum, cancellable, error))
+    goto out;
+
+  job->checksum = ostree_checksum_from_bytes (child_file_csum);
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+stage_file_job_apply (OstreeRepo     *self,
+                      StageFileJob   *job,
+                      GError        **error)
+{
+  gboolean ret = FALSE;
+
+  if (!ostree_mutable_tree_replace_file (job->mtree, job->name, job->checksum,
+                                         error))
+    goto out;
+
+  if (job->stat_cache_key)
+    stat_cache_insert (self, ot_gfile_get_path_cached (job->path),
+                       job->stat_cache_key, job->checksum);
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+stage_file_pool_thread (gpointer   data,
+                        gpointer   user_data)
+{
+  StageFileJob *job = data;
+  StageFilePool *pool = user_data;
+
+  /* Once anything has failed, just hand the remaining jobs back */
+  if (!g_atomic_int_get (&pool->failed))
+    {
+      job->success = stage_file_job_run (pool->repo, pool->modifier, job,
+                                         pool->cancellable, &job->error);
+      if (!job->success)
+        g_atomic_int_set (&pool->failed, 1);
+    }
+
+  g_async_queue_push (pool->completed, job);
+}
+
+static StageFilePool *
+stage_file_pool_new (OstreeRepo                *self,
+                     OstreeRepoCommitModifier  *modifier,
+                     guint                      n_workers,
+                     GCancellable              *cancellable,
+                     GError                   **error)
+{
+  StageFilePool *ret = NULL;
+  StageFilePool *pool = g_new0 (StageFilePool, 1);
+
+  pool->repo = self;
+  pool->modifier = modifier;
+  pool->cancellable = cancellable;
+  pool->completed = g_async_queue_new ();
+  /* Bound the number of open mtree/file references */
+  pool->max_pending = n_workers * 16;
+
+  /* Paths of shared directories are cached lazily; do it before
+   * any worker can race on it.
+   */
+  (void) ot_gfile_get_path_cached (self->tmp_dir);
+  (void) ot_gfile_get_path_cached (self->repodir);
+
+  pool->pool = g_thread_pool_new (stage_file_pool_thread, pool,
+                                  n_workers, FALSE, error);
+  if (!pool->pool)
+    goto out;
+
+  ret = pool;
+  pool = NULL;
+ out:
+  if (pool)
+    {
+      g_async_queue_unref (pool->completed);
+      g_free (pool);
+    }
+  return ret;
+}
+
+static gboolean
+stage_file_pool_complete_one (StageFilePool  *pool,
+                              GError        **error)
+{
+  gboolean ret = FALSE;
+  StageFileJob *job;
+
+  job = g_async_queue_pop (pool->completed);
+  pool->n_pending--;
+
+  if (job->error)
+    {
+      g_propagate_error (error, job->error);
+      job->error = NULL;
+      goto out;
+    }
+
+  /* Jobs skipped after a failure are dropped; the failed one is
+   * still in the queue.
+   */
+  if (job->success)
+    {
+      if (!stage_file_job_apply (pool->repo, job, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  if (!ret)
+    g_atomic_int_set (&pool->failed, 1);
+  stage_file_job_free (job);
+  return ret;
+}
+
+static gboolean
+stage_file_pool_push (StageFilePool  *pool,
+                      StageFileJob   *job,
+                      GError        **error)
+{
+  gboolean ret = FALSE;
+
+  if (!g_thread_pool_push (pool->pool, job, error))
+    {
+      stage_file_job_free (job);
+      goto out;
+    }
+  pool->n_pending++;
+
+  while (pool->n_pending > pool->max_pending)
+    {
+      if (!stage_file_pool_complete_one (pool, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+stage_file_pool_drain (StageFilePool  *pool,
+                       GError        **error)
+{
+  gboolean ret = FALSE;
+
+  while (pool->n_pending > 0)
+    {
+      if (!stage_file_pool_complete_one (pool, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+stage_file_pool_free (StageFilePool  *pool)
+{
+  StageFileJob *job;
+
+  g_atomic_int_set (&pool->failed, 1);
+  g_thread_pool_free (pool->pool, FALSE, TRUE);
+  while ((job = g_async_queue_try_pop (pool->completed)) != NULL)
+    stage_file_job_free (job);
+  g_async_queue_unref (pool->completed);
+  g_free (pool);
+}
+
+static guint
+get_n_online_cpus (void)
+{
+  long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return n_cpus > 0 ? (guint) n_cpus : 1;
+}
+
+static gboolean
+stage_directory_to_mtree_internal (OstreeRepo           *self,
+                                   GFile                *dir,
+                                   OstreeMutableTree    *mtree,
+                                   OstreeRepoCommitModifier *modifier,
+                                   GPtrArray             *path,
+                                   StageFilePool         *pool,
+                                   GCancellable         *cancellable,
+                                   GError              **error)
+{
+  gboolean ret = FALSE;
+  GError *temp_error = NULL;
+  gboolean repo_dir_was_empty = FALSE;
+  OstreeRepoCommitFilterResult filter_result;
+  ot_lobj OstreeRepoFile *repo_dir = NULL;
+  ot_lobj GFileEnumerator *dir_enum = NULL;
+  ot_lobj GFileInfo *child_info = NULL;
+
+  /* We can only reuse checksums directly if there's no modifier */
+  if (OSTREE_IS_REPO_FILE (dir) && modifier == NULL)
+    repo_dir = (OstreeRepoFile*)g_object_ref (dir);
+
+  if (repo_dir)
+    {
+      if (!ostree_repo_file_ensure_resolved (repo_dir, error))
+        goto out;
+
+      ostree_mutable_tree_set_metadata_checksum (mtree, ostree_repo_file_get_checksum (repo_dir));
+      repo_dir_was_empty = 
+        g_hash_table_size (ostree_mutable_tree_get_files (mtree)) == 0
+        && g_hash_table_size (ostree_mutable_tree_get_subdirs (mtree)) == 0;
+
+      filter_result = OSTREE_REPO_COMMIT_FILTER_ALLOW;
+    }
+  else
+    {
+      ot_lobj GFileInfo *modified_info = NULL;
+      ot_lvariant GVariant *xattrs = NULL;
+      ot_lfree guchar *child_file_csum = NULL;
+      ot_lfree char *tmp_checksum = NULL;
+
+      child_info = g_file_query_info (dir, OSTREE_GIO_FAST_QUERYINFO,
+                                      G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                      cancellable, error);
+      if (!child_info)
+        goto out;
+      
+      filter_result = apply_commit_filter (self, modifier, path, child_info, &modified_info);
+
+      if (filter_result == OSTREE_REPO_COMMIT_FILTER_ALLOW)
+        {
+          if (!(modifier && modifier->skip_xattrs))
+            {
+              if (!ostree_get_xattrs_for_file (dir, &xattrs, cancellable, error))
+                goto out;
+            }
+          
+          if (!stage_directory_meta (self, modified_info, xattrs, &child_file_csum,
+                                     cancellable, error))
+            goto out;
+          
+          g_free (tmp_checksum);
+          tmp_checksum = ostree_checksum_from_bytes (child_file_csum);
+          ostree_mutable_tree_set_metadata_checksum (mtree, tmp_checksum);
+        }
+
+      g_clear_object (&child_info);
+    }
+
+  if (filter_result == OSTREE_REPO_COMMIT_FILTER_ALLOW)
+    {
+      dir_enum = g_file_enumerate_children ((GFile*)dir, OSTREE_GIO_FAST_QUERYINFO, 
+                                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                            cancellable, 
+                                            error);
+      if (!dir_enum)
+        goto out;
+
+      while ((child_info = g_file_enumerator_next_file (dir_enum, cancellable, &temp_error)) != NULL)
+        {
+          ot_lobj GFileInfo *modified_info = NULL;
+          ot_lobj GFile *child = NULL;
+          ot_lobj OstreeMutableTree *child_mtree = NULL;
+          const char *name = g_file_info_get_name (child_info);
+
+          g_ptr_array_add (path, (char*)name);
+          filter_result = apply_commit_filter (self, modifier, path, child_info, &modified_info);
+
+          if (filter_result == OSTREE_REPO_COMMIT_FILTER_ALLOW)
+            {
+              child = g_file_get_child (dir, name);
+
+              if (g_file_info_get_file_type (child_info) == G_FILE_TYPE_DIRECTORY)
+                {
+                  if (!ostree_mutable_tree_ensure_dir (mtree, name, &child_mtree, error))
+                    goto out;
+
+                  if (!stage_directory_to_mtree_internal (self, child, child_mtree,
+                                                          modifier, path, pool,
+                                                          cancellable, error))
+                    goto out;
+                }
+              else if (repo_dir)
+                {
+                  if (!ostree_mutable_tree_replace_file (mtree, name, 
+                                                         ostree_repo_file_get_checksum ((OstreeRepoFile*) child),
+                                                         error))
+                    goto out;
+                }
+              else
+                {
+                  ot_lfree char *loose_checksum = NULL;
+                  ot_lvariant GVariant *xattrs = NULL;
+                  ot_lvariant GVariant *stat_cache_key = NULL;
+                  StageFileJob *job;
+
+                  loose_checksum = devino_cache_lookup (self, child_info);
+
+                  if (!loose_checksum && modifier && modifier->use_stat_cache
+                      && g_file_info_get_file_type (modified_info) == G_FILE_TYPE_REGULAR)
+                    {
+                      if (!stat_cache_lookup (self, child, modified_info, modifier,
+                                              &stat_cache_key, &xattrs, &loose_checksum,
+                                              cancellable, error))
+                        goto out;
+                    }
+
+                  if (loose_checksum)
+                    {
+                      if (!ostree_mutable_tree_replace_file (mtree, name, loose_checksum,
+                                                             error))
+                        goto out;
+                    }
+                  else
+                    {
+                      job = stage_file_job_new (mtree, name, child, modified_info,
+                                                xattrs, stat_cache_key);
+                      if (pool)
+                        {
+                          if (!stage_file_pool_push (pool, job, error))
+                            goto out;
+                        }
+                      else
+                        {
+                          gboolean staged;
+
+                          staged = stage_file_job_run (self, modifier, job, cancellable, error)
+                            && stage_file_job_apply (self, job, error);
+                          stage_file_job_free (job);
+                          if (!staged)
+                            goto out;
+                        }
+                    }
+                }
+
+              g_ptr_array_remove_index (path, path->len - 1);
+            }
+
+          g_clear_object (&child_info);
+        }
+      if (temp_error != NULL)
+        {
+          g_propagate_error (error, temp_error);
+          goto out;
+        }
+    }
+
+  if (repo_dir && repo_dir_was_empty)
+    ostree_mutable_tree_set_contents_checksum (mtree, ostree_repo_file_tree_get_content_checksum (repo_dir));
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+gboolean
+ostree_repo_stage_directory_to_mtree (OstreeRepo           *self,
+                                      GFile                *dir,
+                                      OstreeMutableTree    *mtree,
+                                      OstreeRepoCommitModifier *modifier,
+                                      GCancellable         *cancellable,
+                                      GError              **error)
+{
+  gboolean ret = FALSE;
+  guint n_workers;
+  GPtrArray *path = NULL;
+  StageFilePool *pool = NULL;
+
+  if (modifier && modifier->n_workers > 0)
+    n_workers = modifier->n_workers;
+  else
+    n_workers = get_n_online_cpus ();
+
+  /* Files are checksummed and written by the pool, while the
+   * mutable tree is only ever modified from this thread.  Since
+   * trees are serialized in sorted order, the result is identical
+   * to staging serially.
+   */
+  if (n_workers > 1 && !OSTREE_IS_REPO_FILE (dir))
+    {
+      pool = stage_file_pool_new (self, modifier, n_workers, cancellable, error);
+      if (!pool)
+        goto out;
+    }
+
+  path = g_ptr_array_new ();
+  if (!stage_directory_to_mtree_internal (self, dir, mtree, modifier, path, pool,
+                                          cancellable, error))
+    goto out;
+
+  if (pool)
+    {
+      if (!stage_file_pool_drain (pool, error))
+        goto out;
+    }
+  
+  ret = TRUE;
+ out:
+  if (pool)
+    stage_file_pool_free (pool);
+  if (path)
+    g_ptr_array_free (path, TRUE);
+  return ret;
+}
+
+gboolean
+ostree_repo_stage_mtree (OstreeRepo           *self,
+                         OstreeMutableTree    *mtree,
+                         char                **out_contents_checksum,
+                         GCancellable         *cancellable,
+                         GError              **error)
+{
+  gboolean ret = FALSE;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  const char *existing_checksum;
+  ot_lfree char *ret_contents_checksum = NULL;
+  ot_lhash GHashTable *dir_metadata_checksums = NULL;
+  ot_lhash GHashTable *dir_contents_checksums = NULL;
+  ot_lvariant GVariant *serialized_tree = NULL;
+  ot_lfree guchar *contents_csum = NULL;
+
+  existing_checksum = ostree_mutable_tree_get_contents_checksum (mtree);
+  if (existing_checksum)
+    {
+      ret_contents_checksum = g_strdup (existing_checksum);
+    }
+  else
+    {
+      dir_contents_checksums = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      (GDestroyNotify)g_free, (GDestroyNotify)g_free);
+      dir_metadata_checksums = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      (GDestroyNotify)g_free, (GDestroyNotify)g_free);
+      
+      g_hash_table_iter_init (&hash_iter, ostree_mutable_tree_get_subdirs (mtree));
+      while (g_hash_table_iter_next (&hash_iter, &key, &value))
+        {
+          const char *name = key;
+          const char *metadata_checksum;
+          OstreeMutableTree *child_dir = value;
+          char *child_dir_contents_checksum;
+
+          if (!ostree_repo_stage_mtree (self, child_dir, &child_dir_contents_checksum,
+                                        cancellable, error))
+            goto out;
+      
+          g_assert (child_dir_contents_checksum);
+          g_hash_table_replace (dir_contents_checksums, g_strdup (name),
+                                child_dir_contents_checksum); /* Transfer ownership */
+          metadata_checksum = ostree_mutable_tree_get_metadata_checksum (child_dir);
+          g_assert (metadata_checksum);
+          g_hash_table_replace (dir_metadata_checksums, g_strdup (name),
+                                g_strdup (metadata_checksum));
+        }
+    
+      serialized_tree = create_tree_variant_from_hashes (ostree_mutable_tree_get_files (mtree),
+                                                         dir_contents_checksums,
+                                                         dir_metadata_checksums);
+      
+      if (!stage_metadata_object (self, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                  serialized_tree, &contents_csum,
+                                  cancellable, error))
+        goto out;
+      ret_contents_checksum = ostree_checksum_from_bytes (contents_csum);
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value(out_contents_checksum, &ret_contents_checksum);
+ out:
+  return ret;
+}
+
+#ifdef HAVE_LIBARCHIVE
+
+static void
+propagate_libarchive_error (GError      **error,
+                            struct archive *a)
+{
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+               "%s", archive_error_string (a));
+}
+
+static GFileInfo *
+file_info_from_archive_entry_and_modifier (struct archive_entry  *entry,
+                                           OstreeRepoCommitModifier *modifier)
+{
+  GFileInfo *info = g_file_info_new ();
+  GFileInfo *modified_info = NULL;
+  const struct stat *st;
+  guint32 file_type;
+
+  st = archive_entry_stat (entry);
+
+  file_type = ot_gfile_type_for_mode (st->st_mode);
+  g_file_info_set_attribute_boolean (info, "standard::is-symlink", S_ISLNK (st->st_mode));
+  g_file_info_set_attribute_uint32 (info, "standard::type", file_type);
+  g_file_info_set_attribute_uint32 (info, "unix::uid", st->st_uid);
+  g_file_info_set_attribute_uint32 (info, "unix::gid", st->st_gid);
+  g_file_info_set_attribute_uint32 (info, "unix::mode", st->st_mode);
+
+  if (file_type == G_FILE_TYPE_REGULAR)
+    {
+      g_file_info_set_attribute_uint64 (info, "standard::size", st->st_size);
+    }
+  else if (file_type == G_FILE_TYPE_SYMBOLIC_LINK)
+    {
+      g_file_info_set_attribute_byte_string (info, "standard::symlink-target", archive_entry_symlink (entry));
+    }
+  else if (file_type == G_FILE_TYPE_SPECIAL)
+    {
+      g_file_info_set_attribute_uint32 (info, "unix::rdev", st->st_rdev);
+    }
+
+  modified_info = create_modified_file_info (info, modifier);
+
+  g_object_unref (info);
+  
+  return modified_info;
+}
+
+static gboolean
+import_libarchive_entry_file (OstreeRepo           *self,
+                              struct archive       *a,
+                              struct archive_entry *entry,
+                              GFileInfo            *file_info,
+                              guchar              **out_csum,
+                              GCancellable         *cancellable,
+                              GError              **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GInputStream *file_object_input = NULL;
+  ot_lobj GInputStream *archive_stream = NULL;
+  guint64 length;
+  
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
+
+  if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
+    archive_stream = ostree_libarchive_input_stream_new (a);
+  
+  if (!ostree_raw_file_to_content_stream (archive_stream, file_info, NULL,
+                                          &file_object_input, &length, cancellable, error))
+    goto out;
+  
+  if (!stage_object (self, OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID, OSTREE_OBJECT_TYPE_FILE,
+                     file_object_input, length, NULL, out_csum,
+                     cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+stage_libarchive_entry_to_mtree (OstreeRepo           *self,
+                                 OstreeMutableTree    *root,
+                                 struct archive       *a,
+                                 struct archive_entry *entry,
+                                 OstreeRepoCommitModifier *modifier,
+                                 const guchar         *tmp_dir_csum,
+                                 GCancellable         *cancellable,
+                                 GError              **error)
+{
+  gboolean ret = FALSE;
+  const char *pathname;
+  const char *hardlink;
+  const char *basename;
+  ot_lobj GFileInfo *file_info = NULL;
+  ot_lptrarray GPtrArray *split_path = NULL;
+  ot_lptrarray GPtrArray *hardlink_split_path = NULL;
+  ot_lobj OstreeMutableTree *subdir = NULL;
+  ot_lobj OstreeMutableTree *parent = NULL;
+  ot_lobj OstreeMutableTree *hardlink_source_parent = NULL;
+  ot_lfree char *hardlink_source_checksum = NULL;
+  ot_lobj OstreeMutableTree *hardlink_source_subdir = NULL;
+  ot_lfree guchar *tmp_csum = NULL;
+  ot_lfree char *tmp_checksum = NULL;
+
+  pathname = archive_entry_pathname (entry); 
+      
+  if (!ot_util_path_split_validate (pathname, &split_path, error))
+    goto out;
+
+  if (split_path->len == 0)
+    {
+      parent = NULL;
+      basename = NULL;
+    }
+  else
+    {
+      if (tmp_dir_csum)
+        {
+          g_free (tmp_checksum);
+          tmp_checksum = ostree_checksum_from_bytes (tmp_dir_csum);
+          if (!ostree_mutable_tree_ensure_parent_dirs (root, split_path,
+                                                       tmp_checksum,
+                                                       &parent,
+                                                       error))
+            goto out;
+        }
+      else
+        {
+          if (!ostree_mutable_tree_walk (root, split_path, 0, &parent, error))
+            goto out;
+        }
+      basename = (char*)split_path->pdata[split_path->len-1];
+    }
+
+  hardlink = archive_entry_hardlink (entry);
+  if (hardlink)
+    {
+      const char *hardlink_basename;
+      
+      g_assert (parent != NULL);
+
+      if (!ot_util_path_split_validate (hardlink, &hardlink_split_path, error))
+        goto out;
+      if (hardlink_split_path->len == 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Invalid hardlink path %s", hardlink);
+          goto out;
+        }
+      
+      hardlink_basename = hardlink_split_path->pdata[hardlink_split_path->len - 1];
+      
+      if (!ostree_mutable_tree_walk (root, hardlink_split_path, 0, &hardlink_source_parent, error))
+        goto out;
+      
+      if (!ostree_mutable_tree_lookup (hardlink_source_parent, hardlink_basename,
+                                       &hardlink_source_checksum,
+                                       &hardlink_source_subdir,
+                                       error))
+        {
+              g_prefix_error (error, "While resolving hardlink target: ");
+              goto out;
+        }
+      
+      if (hardlink_source_subdir)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Hardlink %s refers to directory %s",
+                       pathname, hardlink);
+          goto out;
+        }
+      g_assert (hardlink_source_checksum);
+      
+      if (!ostree_mutable_tree_replace_file (parent,
+                                             basename,
+                                             hardlink_source_checksum,
+                                             error))
+        goto out;
+    }
+  else
+    {
+      file_info = file_info_from_archive_entry_and_modifier (entry, modifier);
+
+      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_UNKNOWN)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Unsupported file for import: %s", pathname);
+          goto out;
+        }
+
+      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
+        {
+
+          if (!stage_directory_meta (self, file_info, NULL, &tmp_csum, cancellable, error))
+            goto out;
+
+          if (parent == NULL)
+            {
+              subdir = g_object_ref (root);
+            }
+          else
+            {
+              if (!ostree_mutable_tree_ensure_dir (parent, basename, &subdir, error))
+                goto out;
+            }
+
+          g_free (tmp_checksum);
+          tmp_checksum = ostree_checksum_from_bytes (tmp_csum);
+          ostree_mutable_tree_set_metadata_checksum (subdir, tmp_checksum);
+        }
+      else 
+        {
+          if (parent == NULL)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Can't import file as root");
+              goto out;
+            }
+
+          if (!import_libarchive_entry_file (self, a, entry, file_info, &tmp_csum, cancellable, error))
+            goto out;
+          
+          g_free (tmp_checksum);
+          tmp_checksum = ostree_checksum_from_bytes (tmp_csum);
+          if (!ostree_mutable_tree_replace_file (parent, basename,
+                                                 tmp_checksum,
+                                                 error))
+            goto out;
+        }
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+#endif
+                          
+gboolean
+ostree_repo_stage_archive_to_mtree (OstreeRepo                *self,
+                                    GFile                     *archive_f,
+                                    OstreeMutableTree         *root,
+                                    OstreeRepoCommitModifier  *modifier,
+                                    gboolean                   autocreate_parents,
+                                    GCancellable             *cancellable,
+                                    GError                  **error)
+{
+#ifdef HAVE_LIBARCHIVE
+  gboolean ret = FALSE;
+  struct archive *a = NULL;
+  struct archive_entry *entry;
+  int r;
+  ot_lobj GFileInfo *tmp_dir_info = NULL;
+  ot_lfree guchar *tmp_csum = NULL;
+
+  a = archive_read_new ();
+  archive_read_support_compression_all (a);
+  archive_read_support_format_all (a);
+  if (archive_read_open_filename (a, ot_gfile_get_path_cached (archive_f), 8192) != ARCHIVE_OK)
+    {
+      propagate_libarchive_error (error, a);
+      goto out;
+    }
+
+  while (TRUE)
+    {
+      r = archive_read_next_header (a, &entry);
+      if (r == ARCHIVE_EOF)
+        break;
+      else if (r != ARCHIVE_OK)
+        {
+          propagate_libarchive_error (error, a);
+          goto out;
+        }
+
+      if (autocreate_parents && !tmp_csum)
+        {
+          tmp_dir_info = g_file_info_new ();
+          
+          g_file_info_set_attribute_uint32 (tmp_dir_info, "unix::uid", archive_entry_uid (entry));
+          g_file_info_set_attribute_uint32 (tmp_dir_info, "unix::gid", archive_entry_gid (entry));
+          g_file_info_set_attribute_uint32 (tmp_dir_info, "unix::mode", 0755 | S_IFDIR);
+          
+          if (!stage_directory_meta (self, tmp_dir_info, NULL, &tmp_csum, cancellable, error))
+            goto out;
+        }
+
+      if (!stage_libarchive_entry_to_mtree (self, root, a,
+                                            entry, modifier,
+                                            autocreate_parents ? tmp_csum : NULL,
+                                            cancellable, error))
+        goto out;
+    }
+  if (archive_read_close (a) != ARCHIVE_OK)
+    {
+      propagate_libarchive_error (error, a);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  if (a)
+    (void)archive_read_close (a);
+  return ret;
+#else
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+               "This version of ostree is not compiled with libarchive support");
+  return FALSE;
+#endif
+}
+
+OstreeRepoCommitModifier *
+ostree_repo_commit_modifier_new (void)
+{
+  OstreeRepoCommitModifier *modifier = g_new0 (OstreeRepoCommitModifier, 1);
+
+  modifier->refcount = 1;
+
+  return modifier;
+}
+
+void
+ostree_repo_commit_modifier_unref (OstreeRepoCommitModifier *modifier)
+{
+  if (!modifier)
+    return;
+  if (!g_atomic_int_dec_and_test (&modifier->refcount))
+    return;
+
+  g_free (modifier);
+  return;
+}
+
+static gboolean
+list_loose_object_dir (OstreeRepo             *self,
+                       GFile                  *dir,
+                       GHashTable             *inout_objects,
+                       GCancellable           *cancellable,
+                       GError                **error)
+{
+  gboolean ret = FALSE;
+  GError *temp_error = NULL;
+  const char *dirname = NULL;
+  const char *dot = NULL;
+  ot_lobj GFileEnumerator *enumerator = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
+  GString *checksum = NULL;
+
+  dirname = ot_gfile_get_basename_cached (dir);
+
+  /* We're only querying name */
+  enumerator = g_file_enumerate_children (dir, "standard::name,standard::type", 
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          cancellable, 
+                                          error);
+  if (!enumerator)
+    goto out;
+  
+  while ((file_info = g_file_enumerator_next_file (enumerator, cancellable, &temp_error)) != NULL)
     {
-      ot_lobj GFileInfo *modified_info = NULL;
-      ot_lvariant GVariant *xattrs = NULL;
-      ot_lfree guchar *child_file_csum = NULL;
-      ot_lfree char *tmp_checksum = NULL;
+      const char *name;
+      guint32 type;
+      OstreeObjectType objtype;
+
+      name = g_file_info_get_attribute_byte_string (file_info, "standard::name"); 
+      type = g_file_info_get_attribute_uint32 (file_info, "standard::type");
+
+      if (type == G_FILE_TYPE_DIRECTORY)
+        goto loop_next;
+      
+      if (g_str_has_suffix (name, ".file"))
+        objtype = OSTREE_OBJECT_TYPE_FILE;
+      else if (g_str_has_suffix (name, ".dirtree"))
+        objtype = OSTREE_OBJECT_TYPE_DIR_TREE;
+      else if (g_str_has_suffix (name, ".dirmeta"))
+        objtype = OSTREE_OBJECT_TYPE_DIR_META;
+      else if (g_str_has_suffix (name, ".commit"))
+        objtype = OSTREE_OBJECT_TYPE_COMMIT;
+      else
+        goto loop_next;
+          
+      dot = strrchr (name, '.');
+      g_assert (dot);
+
+      if ((dot - name) == 62)
+        {
+          GVariant *key, *value;
+
+          if (checksum)
+            g_string_free (checksum, TRUE);
+          checksum = g_string_new (dirname);
+          g_string_append_len (checksum, name, 62);
+          
+          key = ostree_object_name_serialize (checksum->str, objtype);
+          value = g_variant_new ("(b@as)",
+                                 TRUE, g_variant_new_strv (NULL, 0));
+          /* transfer ownership */
+          g_hash_table_replace (inout_objects, key,
+                                g_variant_ref_sink (value));
+        }
+    loop_next:
+      g_clear_object (&file_info);
+    }
+  if (temp_error != NULL)
+    {
+      g_propagate_error (error, temp_error);
+      goto out;
+    }
+  if (!g_file_enumerator_close (enumerator, NULL, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (checksum)
+    g_string_free (checksum, TRUE);
+  return ret;
+}
+
+static gboolean
+list_loose_objects (OstreeRepo                     *self,
+                    GHashTable                     *inout_objects,
+                    GCancellable                   *cancellable,
+                    GError                        **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+  ot_lptrarray GPtrArray *object_dirs = NULL;
+  ot_lobj GFile *objdir = NULL;
+
+  if (!get_loose_object_dirs (self, &object_dirs, cancellable, error))
+    goto out;
+
+  for (i = 0; i < object_dirs->len; i++)
+    {
+      GFile *objdir = object_dirs->pdata[i];
+      if (!list_loose_object_dir (self, objdir, inout_objects, cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+gboolean
+ostree_repo_load_pack_index (OstreeRepo    *self,
+                             const char    *pack_checksum, 
+                             gboolean       is_meta,
+                             GVariant     **out_variant,
+                             GCancellable  *cancellable,
+                             GError       **error)
+{
+  gboolean ret = FALSE;
+  ot_lvariant GVariant *ret_variant = NULL;
+  ot_lobj GFile *path = NULL;
+  
+  g_mutex_lock (&self->cache_lock);
+
+  ret_variant = g_hash_table_lookup (self->cached_pack_index_mappings, pack_checksum);
+  if (ret_variant)
+    {
+      g_variant_ref (ret_variant);
+    }
+  else
+    {
+      path = get_pack_index_path (self->pack_dir, is_meta, pack_checksum);
+      if (!ostree_map_pack_index (path, TRUE, &ret_variant, error))
+        goto out;
+      g_hash_table_insert (self->cached_pack_index_mappings, g_strdup (pack_checksum),
+                           g_variant_ref (ret_variant));
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_variant, &ret_variant);
+ out:
+  g_mutex_unlock (&self->cache_lock);
+  return ret;
+}
+
+/**
+ * @sha256: Checksum of pack file
+ * @out_data: (out): Pointer to pack file data
+ *
+ * Ensure that the given pack file is mapped into
+ * memory.
+ */
+gboolean
+ostree_repo_map_pack_file (OstreeRepo    *self,
+                           const char    *pack_checksum,
+                           gboolean       is_meta,
+                           guchar       **out_data,
+                           guint64       *out_len,
+                           GCancellable  *cancellable,
+                           GError       **error)
+{
+  gboolean ret = FALSE;
+  gpointer ret_data;
+  guint64 ret_len;
+  GMappedFile *map = NULL;
+  ot_lobj GFile *path = NULL;
+
+  g_mutex_lock (&self->cache_lock);
+
+  map = g_hash_table_lookup (self->cached_pack_data_mappings, pack_checksum);
+  if (map == NULL)
+    {
+      path = get_pack_data_path (self->pack_dir, is_meta, pack_checksum);
+
+      map = g_mapped_file_new (ot_gfile_get_path_cached (path), FALSE, error);
+      if (!map)
+        goto out;
+
+      g_hash_table_insert (self->cached_pack_data_mappings, g_strdup (pack_checksum), map);
+      ret_data = g_mapped_file_get_contents (map);
+    }
+
+  ret_data = g_mapped_file_get_contents (map);
+  ret_len = (guint64)g_mapped_file_get_length (map);
+
+  ret = TRUE;
+  if (out_data)
+    *out_data = ret_data;
+  if (out_len)
+    *out_len = ret_len;
+ out:
+  g_mutex_unlock (&self->cache_lock);
+  return ret;
+}
+
+/*
+ * Return the zstd dictionary of the mapped pack @pack_checksum,
+ * parsing it only on first use.  The result is owned by @self.
+ */
+static gboolean
+get_pack_zstd_dictionary (OstreeRepo             *self,
+                          const char             *pack_checksum,
+                          guchar                 *pack_data,
+                          guint64                 pack_len,
+                          OstreeZstdDictionary  **out_dictionary,
+                          GError                **error)
+{
+  gboolean ret = FALSE;
+  gpointer ret_dictionary;
+
+  g_mutex_lock (&self->cache_lock);
+
+  if (!g_hash_table_lookup_extended (self->cached_pack_zstd_dictionaries, pack_checksum,
+                                     NULL, &ret_dictionary))
+    {
+      OstreeZstdDictionary *dictionary;
+
+      if (!ostree_read_pack_zstd_dictionary (pack_data, pack_len, &dictionary, error))
+        goto out;
+      g_hash_table_insert (self->cached_pack_zstd_dictionaries, g_strdup (pack_checksum),
+                           dictionary);
+      ret_dictionary = dictionary;
+    }
+
+  ret = TRUE;
+  *out_dictionary = ret_dictionary;
+ out:
+  g_mutex_unlock (&self->cache_lock);
+  return ret;
+}
+
+gboolean
+ostree_repo_load_file (OstreeRepo         *self,
+                       const char         *checksum,
+                       GInputStream      **out_input,
+                       GFileInfo         **out_file_info,
+                       GVariant          **out_xattrs,
+                       GCancellable       *cancellable,
+                       GError            **error)
+{
+  gboolean ret = FALSE;
+  guchar *pack_data;
+  guint64 pack_len;
+  guint64 pack_offset;
+  OstreeZstdDictionary *zstd_dictionary;
+  ot_lvariant GVariant *packed_object = NULL;
+  ot_lvariant GVariant *file_data = NULL;
+  ot_lobj GFile *loose_path = NULL;
+  ot_lobj GFileInfo *content_loose_info = NULL;
+  ot_lfree char *pack_checksum = NULL;
+  ot_lobj GInputStream *ret_input = NULL;
+  ot_lobj GFileInfo *ret_file_info = NULL;
+  ot_lvariant GVariant *ret_xattrs = NULL;
 
-      child_info = g_file_query_info (dir, OSTREE_GIO_FAST_QUERYINFO,
-                                      G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                      cancellable, error);
-      if (!child_info)
-        goto out;
-      
-      filter_result = apply_commit_filter (self, modifier, path, child_info, &modified_info);
+  if (!repo_find_object (self, OSTREE_OBJECT_TYPE_FILE,
+                         checksum, FALSE, &loose_path,
+                         &pack_checksum, &pack_offset,
+                         cancellable, error))
+    goto out;
 
-      if (filter_result == OSTREE_REPO_COMMIT_FILTER_ALLOW)
+  if (loose_path)
+    {
+      if (ostree_repo_get_mode (self) == OSTREE_REPO_MODE_ARCHIVE)
         {
-          if (!(modifier && modifier->skip_xattrs))
+          ot_lvariant GVariant *archive_meta = NULL;
+
+          if (!ot_util_variant_map (loose_path, OSTREE_FILE_HEADER_GVARIANT_FORMAT,
+                                    TRUE, &archive_meta, error))
+            goto out;
+
+          if (!ostree_file_header_parse (archive_meta, &ret_file_info, &ret_xattrs,
+                                         error))
+            goto out;
+
+          if (g_file_info_get_file_type (ret_file_info) == G_FILE_TYPE_REGULAR)
             {
-              if (!ostree_get_xattrs_for_file (dir, &xattrs, cancellable, error))
+              ot_lobj GFile *archive_content_path = NULL;
+              ot_lobj GFileInfo *content_info = NULL;
+
+              archive_content_path = ostree_repo_get_archive_content_path (self, checksum);
+              content_info = g_file_query_info (archive_content_path, OSTREE_GIO_FAST_QUERYINFO,
+                                                G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                                cancellable, error);
+              if (!content_info)
                 goto out;
+
+              if (out_input)
+                {
+                  ret_input = (GInputStream*)g_file_read (archive_content_path, cancellable, error);
+                  if (!ret_input)
+                    goto out;
+                }
+              g_file_info_set_size (ret_file_info, g_file_info_get_size (content_info));
             }
-          
-          if (!stage_directory_meta (self, modified_info, xattrs, &child_file_csum,
-                                     cancellable, error))
-            goto out;
-          
-          g_free (tmp_checksum);
-          tmp_checksum = ostree_checksum_from_bytes (child_file_csum);
-          ostree_mutable_tree_set_metadata_checksum (mtree, tmp_checksum);
         }
+      else
+        {
+          ret_file_info = g_file_query_info (loose_path, OSTREE_GIO_FAST_QUERYINFO,
+                                             G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                             cancellable, error);
+          if (!ret_file_info)
+            goto out;
 
-      g_clear_object (&child_info);
+          if (out_xattrs)
+            {
+              if (!ostree_get_xattrs_for_file (loose_path, &ret_xattrs,
+                                               cancellable, error))
+                goto out;
+            }
+
+          if (out_input && g_file_info_get_file_type (ret_file_info) == G_FILE_TYPE_REGULAR)
+            {
+              ret_input = (GInputStream*) g_file_read (loose_path, cancellable, error);
+              if (!ret_input)
+                {
+                  g_prefix_error (error, "Error opening loose file object %s: ", ot_gfile_get_path_cached (loose_path));
+                  goto out;
+                }
+            }
+        }
     }
+  else if (pack_checksum)
+    {
+      if (!ostree_repo_map_pack_file (self, pack_checksum, FALSE,
+                                      &pack_data, &pack_len,
+                                      cancellable, error))
+        goto out;
 
-  if (filter_result == OSTREE_REPO_COMMIT_FILTER_ALLOW)
+      if (!ostree_read_pack_entry_raw (pack_data, pack_len,
+                                       pack_offset, TRUE, FALSE,
+                                       &packed_object, cancellable, error))
+        goto out;
+
+      if (!get_pack_zstd_dictionary (self, pack_checksum, pack_data, pack_len,
+                                     &zstd_dictionary, error))
+        goto out;
+
+      if (!ostree_parse_file_pack_entry (packed_object, pack_data, pack_len, zstd_dictionary,
+                                         out_input ? &ret_input : NULL,
+                                         out_file_info ? &ret_file_info : NULL,
+                                         out_xattrs ? &ret_xattrs : NULL,
+                                         cancellable, error))
+        goto out;
+    }
+  else if (self->parent_repo)
     {
-      dir_enum = g_file_enumerate_children ((GFile*)dir, OSTREE_GIO_FAST_QUERYINFO, 
-                                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                            cancellable, 
-                                            error);
-      if (!dir_enum)
+      if (!ostree_repo_load_file (self->parent_repo, checksum, 
+                                  out_input ? &ret_input : NULL,
+                                  out_file_info ? &ret_file_info : NULL,
+                                  out_xattrs ? &ret_xattrs : NULL,
+                                  cancellable, error))
         goto out;
+    }
+  else
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "Couldn't find file object '%s'", checksum);
+      goto out;
+    }
 
-      while ((child_info = g_file_enumerator_next_file (dir_enum, cancellable, &temp_error)) != NULL)
-        {
-          ot_lobj GFileInfo *modified_info = NULL;
-          ot_lobj GFile *child = NULL;
-          ot_lobj OstreeMutableTree *child_mtree = NULL;
-          const char *name = g_file_info_get_name (child_info);
+  ret = TRUE;
+  ot_transfer_out_value (out_input, &ret_input);
+  ot_transfer_out_value (out_file_info, &ret_file_info);
+  ot_transfer_out_value (out_xattrs, &ret_xattrs);
+ out:
+  return ret;
+}
 
-          g_ptr_array_add (path, (char*)name);
-          filter_result = apply_commit_filter (self, modifier, path, child_info, &modified_info);
+/**
+ * ostree_repo_load_file_content:
+ * @self: Repo
+ * @checksum: Checksum of a regular file object
+ * @out_data: (out): Contents of the file
+ * @out_len: (out): Length of @out_data
+ * @out_file_info: (out) (allow-none): File information
+ * @out_xattrs: (out) (allow-none): Extended attributes
+ *
+ * Load the whole content of the regular file object @checksum into
+ * memory.
+ */
+gboolean
+ostree_repo_load_file_content (OstreeRepo         *self,
+                               const char         *checksum,
+                               guchar            **out_data,
+                               gsize              *out_len,
+                               GFileInfo         **out_file_info,
+                               GVariant          **out_xattrs,
+                               GCancellable       *cancellable,
+                               GError            **error)
+{
+  gboolean ret = FALSE;
+  gsize len;
+  gsize bytes_read;
+  ot_lfree guchar *ret_data = NULL;
+  ot_lobj GInputStream *input = NULL;
+  ot_lobj GFileInfo *ret_file_info = NULL;
+  ot_lvariant GVariant *ret_xattrs = NULL;
 
-          if (filter_result == OSTREE_REPO_COMMIT_FILTER_ALLOW)
-            {
-              child = g_file_get_child (dir, name);
+  if (!ostree_repo_load_file (self, checksum, &input, &ret_file_info, &ret_xattrs,
+                              cancellable, error))
+    goto out;
 
-              if (g_file_info_get_file_type (child_info) == G_FILE_TYPE_DIRECTORY)
-                {
-                  if (!ostree_mutable_tree_ensure_dir (mtree, name, &child_mtree, error))
-                    goto out;
+  if (g_file_info_get_file_type (ret_file_info) != G_FILE_TYPE_REGULAR)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Object %s is not a regular file", checksum);
+      goto out;
+    }
 
-                  if (!stage_directory_to_mtree_internal (self, child, child_mtree,
-                                                          modifier, path, cancellable, error))
-                    goto out;
-                }
-              else if (repo_dir)
-                {
-                  if (!ostree_mutable_tree_replace_file (mtree, name, 
-                                                         ostree_repo_file_get_checksum ((OstreeRepoFile*) child),
-                                                         error))
-                    goto out;
-                }
-              else
-                {
-                  guint64 file_obj_length;
-                  const char *loose_checksum;
-                  ot_lobj GInputStream *file_input = NULL;
-                  ot_lvariant GVariant *xattrs = NULL;
-                  ot_lobj GInputStream *file_object_input = NULL;
-                  ot_lfree guchar *child_file_csum = NULL;
-                  ot_lfree char *tmp_checksum = NULL;
+  len = g_file_info_get_size (ret_file_info);
+  ret_data = g_malloc (MAX (len, 1));
+  if (!g_input_stream_read_all (input, ret_data, len, &bytes_read,
+                                cancellable, error))
+    goto out;
+  if (bytes_read != len)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Short read of object %s", checksum);
+      goto out;
+    }
 
-                  loose_checksum = devino_cache_lookup (self, child_info);
+  ret = TRUE;
+  ot_transfer_out_value (out_data, &ret_data);
+  *out_len = len;
+  ot_transfer_out_value (out_file_info, &ret_file_info);
+  ot_transfer_out_value (out_xattrs, &ret_xattrs);
+ out:
+  return ret;
+}
 
-                  if (loose_checksum)
-                    {
-                      if (!ostree_mutable_tree_replace_file (mtree, name, loose_checksum,
-                                                             error))
-                        goto out;
-                    }
-                  else
-                    {
-                     if (g_file_info_get_file_type (modified_info) == G_FILE_TYPE_REGULAR)
-                        {
-                          file_input = (GInputStream*)g_file_read (child, cancellable, error);
-                          if (!file_input)
-                            goto out;
-                        }
+static gboolean
+list_objects_in_index (OstreeRepo                     *self,
+                       const char                     *pack_checksum,
+                       gboolean                        is_meta,
+                       GHashTable                     *inout_objects,
+                       GCancellable                   *cancellable,
+                       GError                        **error)
+{
+  gboolean ret = FALSE;
+  OstreeObjectType objtype;
+  const guchar *csum;
+  ot_lobj GFile *index_path = NULL;
+  ot_lvariant GVariant *index_variant = NULL;
+  ot_lfree char *checksum = NULL;
+  OstreePackIndexIter index_iter;
 
-                      if (!(modifier && modifier->skip_xattrs))
-                        {
-                          g_clear_pointer (&xattrs, (GDestroyNotify) g_variant_unref);
-                          if (!ostree_get_xattrs_for_file (child, &xattrs, cancellable, error))
-                            goto out;
-                        }
+  index_path = get_pack_index_path (self->pack_dir, is_meta, pack_checksum);
 
-                      if (!ostree_raw_file_to_content_stream (file_input,
-                                                              modified_info, xattrs,
-                                                              &file_object_input, &file_obj_length,
-                                                              cancellable, error))
-                        goto out;
-                      if (!stage_object (self, OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID,
-                                         OSTREE_OBJECT_TYPE_FILE, file_object_input, file_obj_length,
-                                         NULL, &child_file_csum, cancellable, error))
-                        goto out;
+  if (!ostree_repo_load_pack_index (self, pack_checksum, is_meta, 
+                                    &index_variant, cancellable, error))
+    goto out;
 
-                      g_free (tmp_checksum);
-                      tmp_checksum = ostree_checksum_from_bytes (child_file_csum);
-                      if (!ostree_mutable_tree_replace_file (mtree, name, tmp_checksum,
-                                                             error))
-                        goto out;
-                    }
-                }
+  ostree_pack_index_iter_init (&index_iter, index_variant);
 
-              g_ptr_array_remove_index (path, path->len - 1);
-            }
+  while (ostree_pack_index_iter_next (&index_iter, &objtype, &csum, NULL))
+    {
+      GVariant *obj_key;
+      GVariant *objdata;
+      GVariantBuilder pack_contents_builder;
+      gboolean is_loose;
 
-          g_clear_object (&child_info);
+      g_variant_builder_init (&pack_contents_builder,
+                              G_VARIANT_TYPE_STRING_ARRAY);
+      
+      g_free (checksum);
+      checksum = ostree_checksum_from_bytes (csum);
+      obj_key = ostree_object_name_serialize (checksum, objtype);
+      ot_util_variant_take_ref (obj_key);
+
+      objdata = g_hash_table_lookup (inout_objects, obj_key);
+      if (!objdata)
+        {
+          is_loose = FALSE;
         }
-      if (temp_error != NULL)
+      else
         {
-          g_propagate_error (error, temp_error);
-          goto out;
+          GVariantIter *current_packs_iter;
+          const char *current_pack_checksum;
+
+          g_variant_get (objdata, "(bas)", &is_loose, &current_packs_iter);
+
+          while (g_variant_iter_loop (current_packs_iter, "&s", &current_pack_checksum))
+            {
+              g_variant_builder_add (&pack_contents_builder, "s", current_pack_checksum);
+            }
+          g_variant_iter_free (current_packs_iter);
         }
+      g_variant_builder_add (&pack_contents_builder, "s", pack_checksum);
+      objdata = g_variant_new ("(b@as)", is_loose,
+                               g_variant_builder_end (&pack_contents_builder));
+      g_variant_ref_sink (objdata);
+      g_hash_table_replace (inout_objects, obj_key, objdata);
     }
-
-  if (repo_dir && repo_dir_was_empty)
-    ostree_mutable_tree_set_contents_checksum (mtree, ostree_repo_file_tree_get_content_checksum (repo_dir));
+  ostree_pack_index_iter_clear (&index_iter);
 
   ret = TRUE;
  out:
   return ret;
 }
 
-gboolean
-ostree_repo_stage_directory_to_mtree (OstreeRepo           *self,
-                                      GFile                *dir,
-                                      OstreeMutableTree    *mtree,
-                                      OstreeRepoCommitModifier *modifier,
-                                      GCancellable         *cancellable,
-                                      GError              **error)
+static gboolean
+list_packed_objects (OstreeRepo                     *self,
+                     GHashTable                     *inout_objects,
+                     GCancellable                   *cancellable,
+                     GError                        **error)
 {
   gboolean ret = FALSE;
-  GPtrArray *path = NULL;
+  guint i;
+  ot_lptrarray GPtrArray *meta_index_checksums = NULL;
+  ot_lptrarray GPtrArray *data_index_checksums = NULL;
 
-  path = g_ptr_array_new ();
-  if (!stage_directory_to_mtree_internal (self, dir, mtree, modifier, path, cancellable, error))
+  if (!ostree_repo_list_pack_indexes (self, &meta_index_checksums, &data_index_checksums,
+                                      cancellable, error))
     goto out;
-  
-  ret = TRUE;
- out:
-  if (path)
-    g_ptr_array_free (path, TRUE);
-  return ret;
-}
-
-gboolean
-ostree_repo_stage_mtree (OstreeRepo           *self,
-                         OstreeMutableTree    *mtree,
-                         char                **out_contents_checksum,
-                         GCancellable         *cancellable,
-                         GError              **error)
-{
-  gboolean ret = FALSE;
-  GHashTableIter hash_iter;
-  gpointer key, value;
-  const char *existing_checksum;
-  ot_lfree char *ret_contents_checksum = NULL;
-  ot_lhash GHashTable *dir_metadata_checksums = NULL;
-  ot_lhash GHashTable *dir_contents_checksums = NULL;
-  ot_lvariant GVariant *serialized_tree = NULL;
-  ot_lfree guchar *contents_csum = NULL;
 
-  existing_checksum = ostree_mutable_tree_get_contents_checksum (mtree);
-  if (existing_checksum)
+  for (i = 0; i < meta_index_checksums->len; i++)
     {
-      ret_contents_checksum = g_strdup (existing_checksum);
+      const char *checksum = meta_index_checksums->pdata[i];
+      if (!list_objects_in_index (self, checksum, TRUE, inout_objects, cancellable, error))
+        goto out;
     }
-  else
+  
+  for (i = 0; i < data_index_checksums->len; i++)
     {
-      dir_contents_checksums = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                      (GDestroyNotify)g_free, (GDestroyNotify)g_free);
-      dir_metadata_checksums = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                      (GDestroyNotify)g_free, (GDestroyNotify)g_free);
-      
-      g_hash_table_iter_init (&hash_iter, ostree_mutable_tree_get_subdirs (mtree));
-      while (g_hash_table_iter_next (&hash_iter, &key, &value))
-        {
-          const char *name = key;
-          const char *metadata_checksum;
-          OstreeMutableTree *child_dir = value;
-          char *child_dir_contents_checksum;
-
-          if (!ostree_repo_stage_mtree (self, child_dir, &child_dir_contents_checksum,
-                                        cancellable, error))
-            goto out;
-      
-          g_assert (child_dir_contents_checksum);
-          g_hash_table_replace (dir_contents_checksums, g_strdup (name),
-                                child_dir_contents_checksum); /* Transfer ownership */
-          metadata_checksum = ostree_mutable_tree_get_metadata_checksum (child_dir);
-          g_assert (metadata_checksum);
-          g_hash_table_replace (dir_metadata_checksums, g_strdup (name),
-                                g_strdup (metadata_checksum));
-        }
-    
-      serialized_tree = create_tree_variant_from_hashes (ostree_mutable_tree_get_files (mtree),
-                                                         dir_contents_checksums,
-                                                         dir_metadata_checksums);
-      
-      if (!stage_metadata_object (self, OSTREE_OBJECT_TYPE_DIR_TREE,
-                                  serialized_tree, &contents_csum,
-                                  cancellable, error))
+      const char *checksum = data_index_checksums->pdata[i];
+      if (!list_objects_in_index (self, checksum, FALSE, inout_objects, cancellable, error))
         goto out;
-      ret_contents_checksum = ostree_checksum_from_bytes (contents_csum);
     }
 
   ret = TRUE;
-  ot_transfer_out_value(out_contents_checksum, &ret_contents_checksum);
  out:
   return ret;
 }
 
-#ifdef HAVE_LIBARCHIVE
-
-static void
-propagate_libarchive_error (GError      **error,
-                            struct archive *a)
-{
-  g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-               "%s", archive_error_string (a));
-}
-
-static GFileInfo *
-file_info_from_archive_entry_and_modifier (struct archive_entry  *entry,
-                                           OstreeRepoCommitModifier *modifier)
+static gboolean
+multi_pack_index_matches (GVariant          *multi_index,
+                          guint              child,
+                          GPtrArray         *pack_checksums)
 {
-  GFileInfo *info = g_file_info_new ();
-  GFileInfo *modified_info = NULL;
-  const struct stat *st;
-  guint32 file_type;
-
-  st = archive_entry_stat (entry);
+  guint i;
+  ot_lvariant GVariant *checksums = NULL;
 
-  file_type = ot_gfile_type_for_mode (st->st_mode);
-  g_file_info_set_attribute_boolean (info, "standard::is-symlink", S_ISLNK (st->st_mode));
-  g_file_info_set_attribute_uint32 (info, "standard::type", file_type);
-  g_file_info_set_attribute_uint32 (info, "unix::uid", st->st_uid);
-  g_file_info_set_attribute_uint32 (info, "unix::gid", st->st_gid);
-  g_file_info_set_attribute_uint32 (info, "unix::mode", st->st_mode);
+  checksums = g_variant_get_child_value (multi_index, child);
+  if (g_variant_n_children (checksums) != pack_checksums->len)
+    return FALSE;
 
-  if (file_type == G_FILE_TYPE_REGULAR)
-    {
-      g_file_info_set_attribute_uint64 (info, "standard::size", st->st_size);
-    }
-  else if (file_type == G_FILE_TYPE_SYMBOLIC_LINK)
+  for (i = 0; i < pack_checksums->len; i++)
     {
-      g_file_info_set_attribute_byte_string (info, "standard::symlink-target", archive_entry_symlink (entry));
+      ot_lvariant GVariant *csum_v = NULL;
+      ot_lfree char *checksum = NULL;
+
+      csum_v = g_variant_get_child_value (checksums, i);
+      if (g_variant_n_children (csum_v) != 32)
+        return FALSE;
+      checksum = ostree_checksum_from_bytes_v (csum_v);
+      if (strcmp (checksum, pack_checksums->pdata[i]) != 0)
+        return FALSE;
     }
-  else if (file_type == G_FILE_TYPE_SPECIAL)
+
+  return TRUE;
+}
+
+/*
+ * Map objects/pack/multi-index.  If it doesn't exist, or is out of
+ * date with respect to the superindex, @out_variant will be %NULL.
+ */
+static gboolean
+load_multi_pack_index (OstreeRepo        *self,
+                       GPtrArray         *meta_indexes,
+                       GPtrArray         *data_indexes,
+                       GVariant         **out_variant,
+                       GCancellable      *cancellable,
+                       GError           **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *multi_index_path = NULL;
+  ot_lvariant GVariant *ret_variant = NULL;
+
+  multi_index_path = g_file_get_child (self->pack_dir, "multi-index");
+  if (g_file_query_exists (multi_index_path, cancellable))
     {
-      g_file_info_set_attribute_uint32 (info, "unix::rdev", st->st_rdev);
-    }
+      if (!map_variant_file_check_header_string (multi_index_path,
+                                                 OSTREE_MULTI_PACK_INDEX_VARIANT_FORMAT,
+                                                 "OSTv0MULTIPACKINDEX", TRUE,
+                                                 &ret_variant,
+                                                 cancellable, error))
+        goto out;
 
-  modified_info = create_modified_file_info (info, modifier);
+      if (!(multi_pack_index_matches (ret_variant, 2, meta_indexes)
+            && multi_pack_index_matches (ret_variant, 3, data_indexes)))
+        g_clear_pointer (&ret_variant, (GDestroyNotify) g_variant_unref);
+    }
 
-  g_object_unref (info);
-  
-  return modified_info;
+  ret = TRUE;
+  ot_transfer_out_value (out_variant, &ret_variant);
+ out:
+  return ret;
 }
 
 static gboolean
-import_libarchive_entry_file (OstreeRepo           *self,
-                              struct archive       *a,
-                              struct archive_entry *entry,
-                              GFileInfo            *file_info,
-                              guchar              **out_csum,
-                              GCancellable         *cancellable,
-                              GError              **error)
+get_multi_pack_index (OstreeRepo        *self,
+                      GVariant         **out_variant,
+                      GCancellable      *cancellable,
+                      GError           **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GInputStream *file_object_input = NULL;
-  ot_lobj GInputStream *archive_stream = NULL;
-  guint64 length;
-  
-  if (g_cancellable_set_error_if_cancelled (cancellable, error))
-    return FALSE;
+  ot_lptrarray GPtrArray *meta_indexes = NULL;
+  ot_lptrarray GPtrArray *data_indexes = NULL;
+  ot_lvariant GVariant *ret_variant = NULL;
 
-  if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
-    archive_stream = ostree_libarchive_input_stream_new (a);
-  
-  if (!ostree_raw_file_to_content_stream (archive_stream, file_info, NULL,
-                                          &file_object_input, &length, cancellable, error))
-    goto out;
-  
-  if (!stage_object (self, OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID, OSTREE_OBJECT_TYPE_FILE,
-                     file_object_input, length, NULL, out_csum,
-                     cancellable, error))
+  if (!ostree_repo_list_pack_indexes (self, &meta_indexes, &data_indexes,
+                                      cancellable, error))
     goto out;
 
+  g_mutex_lock (&self->cache_lock);
+  if (!self->multi_pack_index_loaded)
+    {
+      if (!load_multi_pack_index (self, meta_indexes, data_indexes,
+                                  &self->cached_multi_pack_index,
+                                  cancellable, error))
+        {
+          g_mutex_unlock (&self->cache_lock);
+          goto out;
+        }
+      self->multi_pack_index_loaded = TRUE;
+    }
+  if (self->cached_multi_pack_index)
+    ret_variant = g_variant_ref (self->cached_multi_pack_index);
+  g_mutex_unlock (&self->cache_lock);
+
   ret = TRUE;
+  ot_transfer_out_value (out_variant, &ret_variant);
  out:
   return ret;
 }
 
 static gboolean
-stage_libarchive_entry_to_mtree (OstreeRepo           *self,
-                                 OstreeMutableTree    *root,
-                                 struct archive       *a,
-                                 struct archive_entry *entry,
-                                 OstreeRepoCommitModifier *modifier,
-                                 const guchar         *tmp_dir_csum,
-                                 GCancellable         *cancellable,
-                                 GError              **error)
+find_object_in_packs (OstreeRepo        *self,
+                      const char        *checksum,
+                      OstreeObjectType   objtype,
+                      char             **out_pack_checksum,
+                      guint64           *out_pack_offset,
+                      GCancellable      *cancellable,
+                      GError           **error)
 {
   gboolean ret = FALSE;
-  const char *pathname;
-  const char *hardlink;
-  const char *basename;
-  ot_lobj GFileInfo *file_info = NULL;
-  ot_lptrarray GPtrArray *split_path = NULL;
-  ot_lptrarray GPtrArray *hardlink_split_path = NULL;
-  ot_lobj OstreeMutableTree *subdir = NULL;
-  ot_lobj OstreeMutableTree *parent = NULL;
-  ot_lobj OstreeMutableTree *hardlink_source_parent = NULL;
-  ot_lfree char *hardlink_source_checksum = NULL;
-  ot_lobj OstreeMutableTree *hardlink_source_subdir = NULL;
-  ot_lfree guchar *tmp_csum = NULL;
-  ot_lfree char *tmp_checksum = NULL;
+  guint i;
+  guint64 ret_pack_offset = 0;
+  gboolean is_meta;
+  const guchar *csum;
+  ot_lptrarray GPtrArray *index_checksums = NULL;
+  ot_lfree char *ret_pack_checksum = NULL;
+  ot_lvariant GVariant *csum_bytes = NULL;
+  ot_lvariant GVariant *index_variant = NULL;
+  ot_lvariant GVariant *multi_index = NULL;
 
-  pathname = archive_entry_pathname (entry); 
-      
-  if (!ot_util_path_split_validate (pathname, &split_path, error))
-    goto out;
+  csum_bytes = ostree_checksum_to_bytes_v (checksum);
+  csum = ostree_checksum_bytes_peek (csum_bytes);
 
-  if (split_path->len == 0)
+  is_meta = OSTREE_OBJECT_TYPE_IS_META (objtype);
+
+  if (is_meta)
     {
-      parent = NULL;
-      basename = NULL;
+      if (!ostree_repo_list_pack_indexes (self, &index_checksums, NULL,
+                                          cancellable, error))
+        goto out;
     }
   else
     {
-      if (tmp_dir_csum)
+      if (!ostree_repo_list_pack_indexes (self, NULL, &index_checksums,
+                                          cancellable, error))
+        goto out;
+    }
+
+  if (!get_multi_pack_index (self, &multi_index, cancellable, error))
+    goto out;
+
+  if (multi_index)
+    {
+      guint32 pack_index;
+      guint64 offset;
+
+      if (ostree_multi_pack_index_search (multi_index, csum, objtype,
+                                          &pack_index, &offset)
+          && pack_index < index_checksums->len)
         {
-          g_free (tmp_checksum);
-          tmp_checksum = ostree_checksum_from_bytes (tmp_dir_csum);
-          if (!ostree_mutable_tree_ensure_parent_dirs (root, split_path,
-                                                       tmp_checksum,
-                                                       &parent,
-                                                       error))
-            goto out;
+          ret_pack_checksum = g_strdup (index_checksums->pdata[pack_index]);
+          ret_pack_offset = offset;
         }
-      else
+    }
+  else
+    {
+      for (i = 0; i < index_checksums->len; i++)
         {
-          if (!ostree_mutable_tree_walk (root, split_path, 0, &parent, error))
+          const char *pack_checksum = index_checksums->pdata[i];
+          guint64 offset;
+          ot_lvariant GVariant *bloom = NULL;
+
+          bloom = get_cached_pack_bloom (self, pack_checksum);
+          if (bloom && !ostree_pack_bloom_maybe_contains (bloom, csum))
+            continue;
+
+          g_clear_pointer (&index_variant, (GDestroyNotify) g_variant_unref);
+          if (!ostree_repo_load_pack_index (self, pack_checksum, is_meta, &index_variant,
+                                            cancellable, error))
             goto out;
+
+          if (!ostree_pack_index_search (index_variant, csum_bytes, objtype, &offset))
+            continue;
+
+          ret_pack_checksum = g_strdup (pack_checksum);
+          ret_pack_offset = offset;
+          break;
         }
-      basename = (char*)split_path->pdata[split_path->len-1];
     }
 
-  hardlink = archive_entry_hardlink (entry);
-  if (hardlink)
-    {
-      const char *hardlink_basename;
-      
-      g_assert (parent != NULL);
+  ret = TRUE;
+  ot_transfer_out_value (out_pack_checksum, &ret_pack_checksum);
+  if (out_pack_offset)
+    *out_pack_offset = ret_pack_offset;
+ out:
+  return ret;
+}
 
-      if (!ot_util_path_split_validate (hardlink, &hardlink_split_path, error))
-        goto out;
-      if (hardlink_split_path->len == 0)
-        {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "Invalid hardlink path %s", hardlink);
-          goto out;
-        }
-      
-      hardlink_basename = hardlink_split_path->pdata[hardlink_split_path->len - 1];
-      
-      if (!ostree_mutable_tree_walk (root, hardlink_split_path, 0, &hardlink_source_parent, error))
-        goto out;
-      
-      if (!ostree_mutable_tree_lookup (hardlink_source_parent, hardlink_basename,
-                                       &hardlink_source_checksum,
-                                       &hardlink_source_subdir,
-                                       error))
+static gboolean      
+repo_find_object (OstreeRepo           *self,
+                  OstreeObjectType      objtype,
+                  const char           *checksum,
+                  gboolean              lookup_all,
+                  GFile               **out_stored_path,
+                  char                **out_pack_checksum,
+                  guint64              *out_pack_offset,
+                  GCancellable         *cancellable,
+                  GError             **error)
+{
+  gboolean ret = FALSE;
+  guint64 ret_pack_offset = 0;
+  struct stat stbuf;
+  ot_lobj GFile *object_path = NULL;
+  ot_lobj GFile *ret_stored_path = NULL;
+  ot_lfree char *ret_pack_checksum = NULL;
+
+  /* Look up metadata in packs first, but content loose first.  We
+   * want to find loose content since that's preferable for
+   * hardlinking scenarios.
+   *
+   * Metadata is much more efficient packed.
+   */
+  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+    {
+      if (out_pack_checksum)
         {
-              g_prefix_error (error, "While resolving hardlink target: ");
-              goto out;
+          if (!find_object_in_packs (self, checksum, objtype,
+                                     &ret_pack_checksum, &ret_pack_offset,
+                                     cancellable, error))
+            goto out;
         }
-      
-      if (hardlink_source_subdir)
+      if (!ret_pack_checksum || lookup_all)
         {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "Hardlink %s refers to directory %s",
-                       pathname, hardlink);
-          goto out;
+          object_path = ostree_repo_get_object_path (self, checksum, objtype);
+  
+          if (lstat (ot_gfile_get_path_cached (object_path), &stbuf) == 0)
+            {
+              ret_stored_path = object_path;
+              object_path = NULL;
+            }
+          else
+            {
+              g_clear_object (&object_path);
+            }
         }
-      g_assert (hardlink_source_checksum);
-      
-      if (!ostree_mutable_tree_replace_file (parent,
-                                             basename,
-                                             hardlink_source_checksum,
-                                             error))
-        goto out;
     }
   else
     {
-      file_info = file_info_from_archive_entry_and_modifier (entry, modifier);
-
-      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_UNKNOWN)
-        {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "Unsupported file for import: %s", pathname);
-          goto out;
-        }
-
-      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
+      if (out_stored_path)
         {
-
-          if (!stage_directory_meta (self, file_info, NULL, &tmp_csum, cancellable, error))
-            goto out;
-
-          if (parent == NULL)
+          object_path = ostree_repo_get_object_path (self, checksum, objtype);
+  
+          if (lstat (ot_gfile_get_path_cached (object_path), &stbuf) == 0)
             {
-              subdir = g_object_ref (root);
+              ret_stored_path = object_path;
+              object_path = NULL;
             }
           else
             {
-              if (!ostree_mutable_tree_ensure_dir (parent, basename, &subdir, error))
-                goto out;
+              g_clear_object (&object_path);
             }
-
-          g_free (tmp_checksum);
-          tmp_checksum = ostree_checksum_from_bytes (tmp_csum);
-          ostree_mutable_tree_set_metadata_checksum (subdir, tmp_checksum);
         }
-      else 
+      if (!ret_stored_path || lookup_all)
         {
-          if (parent == NULL)
+          if (out_pack_checksum)
             {
-              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                           "Can't import file as root");
-              goto out;
+              if (!find_object_in_packs (self, checksum, objtype,
+                                         &ret_pack_checksum, &ret_pack_offset,
+                                         cancellable, error))
+                goto out;
             }
-
-          if (!import_libarchive_entry_file (self, a, entry, file_info, &tmp_csum, cancellable, error))
-            goto out;
-          
-          g_free (tmp_checksum);
-          tmp_checksum = ostree_checksum_from_bytes (tmp_csum);
-          if (!ostree_mutable_tree_replace_file (parent, basename,
-                                                 tmp_checksum,
-                                                 error))
-            goto out;
         }
     }
-
+  
   ret = TRUE;
- out:
+  ot_transfer_out_value (out_stored_path, &ret_stored_path);
+  ot_transfer_out_value (out_pack_checksum, &ret_pack_checksum);
+  if (out_pack_offset)
+    *out_pack_offset = ret_pack_offset;
+out:
   return ret;
 }
-#endif
-                          
+
 gboolean
-ostree_repo_stage_archive_to_mtree (OstreeRepo                *self,
-                                    GFile                     *archive_f,
-                                    OstreeMutableTree         *root,
-                                    OstreeRepoCommitModifier  *modifier,
-                                    gboolean                   autocreate_parents,
-                                    GCancellable             *cancellable,
-                                    GError                  **error)
+ostree_repo_has_object (OstreeRepo           *self,
+                        OstreeObjectType      objtype,
+                        const char           *checksum,
+                        gboolean             *out_have_object,
+                        GCancellable         *cancellable,
+                        GError              **error)
 {
-#ifdef HAVE_LIBARCHIVE
   gboolean ret = FALSE;
-  struct archive *a = NULL;
-  struct archive_entry *entry;
-  int r;
-  ot_lobj GFileInfo *tmp_dir_info = NULL;
-  ot_lfree guchar *tmp_csum = NULL;
-
-  a = archive_read_new ();
-  archive_read_support_compression_all (a);
-  archive_read_support_format_all (a);
-  if (archive_read_open_filename (a, ot_gfile_get_path_cached (archive_f), 8192) != ARCHIVE_OK)
-    {
-      propagate_libarchive_error (error, a);
-      goto out;
-    }
+  gboolean ret_have_object;
+  ot_lobj GFile *loose_path = NULL;
+  ot_lfree char *pack_checksum = NULL;
 
-  while (TRUE)
-    {
-      r = archive_read_next_header (a, &entry);
-      if (r == ARCHIVE_EOF)
-        break;
-      else if (r != ARCHIVE_OK)
-        {
-          propagate_libarchive_error (error, a);
-          goto out;
-        }
+  if (!repo_find_object (self, objtype, checksum, FALSE,
+                         &loose_path,
+                         &pack_checksum, NULL,
+                         cancellable, error))
+    goto out;
 
-      if (autocreate_parents && !tmp_csum)
-        {
-          tmp_dir_info = g_file_info_new ();
-          
-          g_file_info_set_attribute_uint32 (tmp_dir_info, "unix::uid", archive_entry_uid (entry));
-          g_file_info_set_attribute_uint32 (tmp_dir_info, "unix::gid", archive_entry_gid (entry));
-          g_file_info_set_attribute_uint32 (tmp_dir_info, "unix::mode", 0755 | S_IFDIR);
-          
-          if (!stage_directory_meta (self, tmp_dir_info, NULL, &tmp_csum, cancellable, error))
-            goto out;
-        }
+  ret_have_object = (loose_path != NULL) || (pack_checksum != NULL);
 
-      if (!stage_libarchive_entry_to_mtree (self, root, a,
-                                            entry, modifier,
-                                            autocreate_parents ? tmp_csum : NULL,
-                                            cancellable, error))
-        goto out;
-    }
-  if (archive_read_close (a) != ARCHIVE_OK)
+  if (!ret_have_object && self->parent_repo)
     {
-      propagate_libarchive_error (error, a);
-      goto out;
+      if (!ostree_repo_has_object (self->parent_repo, objtype, checksum,
+                                   &ret_have_object, cancellable, error))
+        goto out;
     }
-
+                                
   ret = TRUE;
+  if (out_have_object)
+    *out_have_object = ret_have_object;
  out:
-  if (a)
-    (void)archive_read_close (a);
   return ret;
-#else
-  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
-               "This version of ostree is not compiled with libarchive support");
-  return FALSE;
-#endif
 }
 
-OstreeRepoCommitModifier *
-ostree_repo_commit_modifier_new (void)
-{
-  OstreeRepoCommitModifier *modifier = g_new0 (OstreeRepoCommitModifier, 1);
-
-  modifier->refcount = 1;
-
-  return modifier;
-}
+/*
+ * A least-recently-used cache of metadata objects, keyed like
+ * txn_known_objects.  The most recently used entry is at the head of
+ * metadata_cache_lru.
+ */
+typedef struct {
+  guchar key[OSTREE_KNOWN_OBJECT_KEY_SIZE];
+  GVariant *variant;
+  gsize size;
+  GList link;
+} MetadataCacheEntry;
 
-void
-ostree_repo_commit_modifier_unref (OstreeRepoCommitModifier *modifier)
+static void
+metadata_cache_entry_free (gpointer data)
 {
-  if (!modifier)
-    return;
-  if (!g_atomic_int_dec_and_test (&modifier->refcount))
-    return;
+  MetadataCacheEntry *entry = data;
 
-  g_free (modifier);
-  return;
+  g_variant_unref (entry->variant);
+  g_free (entry);
 }
 
-static gboolean
-list_loose_object_dir (OstreeRepo             *self,
-                       GFile                  *dir,
-                       GHashTable             *inout_objects,
-                       GCancellable           *cancellable,
-                       GError                **error)
+static GVariant *
+metadata_cache_lookup (OstreeRepo         *self,
+                       const guchar       *key)
 {
-  gboolean ret = FALSE;
-  GError *temp_error = NULL;
-  const char *dirname = NULL;
-  const char *dot = NULL;
-  ot_lobj GFileEnumerator *enumerator = NULL;
-  ot_lobj GFileInfo *file_info = NULL;
-  GString *checksum = NULL;
+  GVariant *ret = NULL;
+  MetadataCacheEntry *entry;
 
-  dirname = ot_gfile_get_basename_cached (dir);
+  if (self->metadata_cache_max_size == 0)
+    return NULL;
 
-  /* We're only querying name */
-  enumerator = g_file_enumerate_children (dir, "standard::name,standard::type", 
-                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                          cancellable, 
-                                          error);
-  if (!enumerator)
-    goto out;
-  
-  while ((file_info = g_file_enumerator_next_file (enumerator, cancellable, &temp_error)) != NULL)
+  g_mutex_lock (&self->cache_lock);
+  entry = g_hash_table_lookup (self->metadata_cache, key);
+  if (entry)
     {
-      const char *name;
-      guint32 type;
-      OstreeObjectType objtype;
+      g_queue_unlink (&self->metadata_cache_lru, &entry->link);
+      g_queue_push_head_link (&self->metadata_cache_lru, &entry->link);
+      ret = g_variant_ref (entry->variant);
+      self->metadata_cache_hits++;
+    }
+  else
+    self->metadata_cache_misses++;
+  g_mutex_unlock (&self->cache_lock);
 
-      name = g_file_info_get_attribute_byte_string (file_info, "standard::name"); 
-      type = g_file_info_get_attribute_uint32 (file_info, "standard::type");
+  return ret;
+}
 
-      if (type == G_FILE_TYPE_DIRECTORY)
-        goto loop_next;
-      
-      if (g_str_has_suffix (name, ".file"))
-        objtype = OSTREE_OBJECT_TYPE_FILE;
-      else if (g_str_has_suffix (name, ".dirtree"))
-        objtype = OSTREE_OBJECT_TYPE_DIR_TREE;
-      else if (g_str_has_suffix (name, ".dirmeta"))
-        objtype = OSTREE_OBJECT_TYPE_DIR_META;
-      else if (g_str_has_suffix (name, ".commit"))
-        objtype = OSTREE_OBJECT_TYPE_COMMIT;
-      else
-        goto loop_next;
-          
-      dot = strrchr (name, '.');
-      g_assert (dot);
+static void
+metadata_cache_insert (OstreeRepo         *self,
+                       const guchar       *key,
+                       GVariant           *variant)
+{
+  MetadataCacheEntry *entry;
+  gsize size = sizeof (MetadataCacheEntry) + g_variant_get_size (variant);
 
-      if ((dot - name) == 62)
-        {
-          GVariant *key, *value;
+  if (size > self->metadata_cache_max_size)
+    return;
 
-          if (checksum)
-            g_string_free (checksum, TRUE);
-          checksum = g_string_new (dirname);
-          g_string_append_len (checksum, name, 62);
-          
-          key = ostree_object_name_serialize (checksum->str, objtype);
-          value = g_variant_new ("(b@as)",
-                                 TRUE, g_variant_new_strv (NULL, 0));
-          /* transfer ownership */
-          g_hash_table_replace (inout_objects, key,
-                                g_variant_ref_sink (value));
-        }
-    loop_next:
-      g_clear_object (&file_info);
+  entry = g_new0 (MetadataCacheEntry, 1);
+  memcpy (entry->key, key, OSTREE_KNOWN_OBJECT_KEY_SIZE);
+  entry->variant = g_variant_ref (variant);
+  entry->size = size;
+  entry->link.data = entry;
+
+  g_mutex_lock (&self->cache_lock);
+  /* Another thread may have loaded it meanwhile */
+  if (g_hash_table_lookup (self->metadata_cache, key))
+    {
+      metadata_cache_entry_free (entry);
     }
-  if (temp_error != NULL)
+  else
     {
-      g_propagate_error (error, temp_error);
-      goto out;
+      g_hash_table_insert (self->metadata_cache, entry->key, entry);
+      g_queue_push_head_link (&self->metadata_cache_lru, &entry->link);
+      self->metadata_cache_size += size;
+
+      while (self->metadata_cache_size > self->metadata_cache_max_size)
+        {
+          GList *oldest = g_queue_pop_tail_link (&self->metadata_cache_lru);
+          MetadataCacheEntry *old_entry = oldest->data;
+
+          self->metadata_cache_size -= old_entry->size;
+          g_hash_table_remove (self->metadata_cache, old_entry->key);
+        }
     }
-  if (!g_file_enumerator_close (enumerator, NULL, error))
-    goto out;
+  g_mutex_unlock (&self->cache_lock);
+}
 
-  ret = TRUE;
- out:
-  if (checksum)
-    g_string_free (checksum, TRUE);
-  return ret;
+/**
+ * ostree_repo_get_metadata_cache_stats:
+ * @self: Repo
+ * @out_hits: (out): Number of metadata loads served from memory
+ * @out_misses: (out): Number of metadata loads which read the repository
+ *
+ * Parsed metadata objects are cached up to the size in bytes given by
+ * the "metadata-cache-size" key in the [core] section of the
+ * repository configuration; 0 disables the cache.
+ */
+void
+ostree_repo_get_metadata_cache_stats (OstreeRepo     *self,
+                                      guint          *out_hits,
+                                      guint          *out_misses)
+{
+  g_mutex_lock (&self->cache_lock);
+  if (out_hits)
+    *out_hits = self->metadata_cache_hits;
+  if (out_misses)
+    *out_misses = self->metadata_cache_misses;
+  g_mutex_unlock (&self->cache_lock);
 }
 
-static gboolean
-list_loose_objects (OstreeRepo                     *self,
-                    GHashTable                     *inout_objects,
-                    GCancellable                   *cancellable,
-                    GError                        **error)
+gboolean
+ostree_repo_load_variant_c (OstreeRepo          *self,
+                            OstreeObjectType     objtype,
+                            const guchar        *csum, 
+                            GVariant           **out_variant,
+                            GError             **error)
 {
   gboolean ret = FALSE;
-  guint i;
-  ot_lptrarray GPtrArray *object_dirs = NULL;
-  ot_lobj GFile *objdir = NULL;
+  ot_lfree char *checksum = NULL;
 
-  if (!get_loose_object_dirs (self, &object_dirs, cancellable, error))
-    goto out;
+  checksum = ostree_checksum_from_bytes (csum);
 
-  for (i = 0; i < object_dirs->len; i++)
-    {
-      GFile *objdir = object_dirs->pdata[i];
-      if (!list_loose_object_dir (self, objdir, inout_objects, cancellable, error))
-        goto out;
-    }
+  if (!ostree_repo_load_variant (self, objtype, checksum, out_variant, error))
+    goto out;
 
   ret = TRUE;
  out:
@@ -3381,971 +6159,1301 @@ list_loose_objects (OstreeRepo                     *self,
 }
 
 gboolean
-ostree_repo_load_pack_index (OstreeRepo    *self,
-                             const char    *pack_checksum, 
-                             gboolean       is_meta,
-                             GVariant     **out_variant,
-                             GCancellable  *cancellable,
-                             GError       **error)
+ostree_repo_load_variant (OstreeRepo  *self,
+                          OstreeObjectType  objtype,
+                          const char    *sha256, 
+                          GVariant     **out_variant,
+                          GError       **error)
 {
   gboolean ret = FALSE;
+  guchar *pack_data;
+  guint64 pack_len;
+  guint64 object_offset;
+  GCancellable *cancellable = NULL;
+  guchar key[OSTREE_KNOWN_OBJECT_KEY_SIZE];
+  ot_lobj GFile *object_path = NULL;
+  ot_lvariant GVariant *packed_object = NULL;
   ot_lvariant GVariant *ret_variant = NULL;
-  ot_lobj GFile *path = NULL;
-  
-  g_mutex_lock (&self->cache_lock);
+  ot_lfree char *pack_checksum = NULL;
 
-  ret_variant = g_hash_table_lookup (self->cached_pack_index_mappings, pack_checksum);
+  g_return_val_if_fail (OSTREE_OBJECT_TYPE_IS_META (objtype), FALSE);
+
+  known_object_key_init (key, objtype, sha256);
+  ret_variant = metadata_cache_lookup (self, key);
   if (ret_variant)
     {
-      g_variant_ref (ret_variant);
+      ret = TRUE;
+      ot_transfer_out_value (out_variant, &ret_variant);
+      goto out;
     }
-  else
+
+  if (!repo_find_object (self, objtype, sha256, FALSE,
+                         &object_path, &pack_checksum, &object_offset,
+                         cancellable, error))
+    goto out;
+
+  if (pack_checksum != NULL)
     {
-      path = get_pack_index_path (self->pack_dir, is_meta, pack_checksum);
-      if (!map_variant_file_check_header_string (path,
-                                                 OSTREE_PACK_INDEX_VARIANT_FORMAT,
-                                                 "OSTv0PACKINDEX", TRUE,
-                                                 &ret_variant,
-                                                 cancellable, error))
+      if (!ostree_repo_map_pack_file (self, pack_checksum, TRUE, &pack_data, &pack_len,
+                                      cancellable, error))
         goto out;
-      g_hash_table_insert (self->cached_pack_index_mappings, g_strdup (pack_checksum),
-                           g_variant_ref (ret_variant));
+      
+      if (!ostree_read_pack_entry_raw (pack_data, pack_len, object_offset,
+                                       TRUE, TRUE, &packed_object, cancellable, error))
+        goto out;
+
+      if (!ostree_parse_meta_pack_entry (packed_object, pack_data, pack_len,
+                                         &ret_variant, error))
+        goto out;
+    }
+  else if (object_path != NULL)
+    {
+      if (!ot_util_variant_map (object_path, ostree_metadata_variant_type (objtype),
+                                TRUE, &ret_variant, error))
+        goto out;
+    }
+  else if (self->parent_repo)
+    {
+      if (!ostree_repo_load_variant (self->parent_repo, objtype, sha256, &ret_variant, error))
+        goto out;
+    }
+  else
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No such metadata object %s.%s",
+                   sha256, ostree_object_type_to_string (objtype));
+      goto out;
     }
 
+  metadata_cache_insert (self, key, ret_variant);
+
   ret = TRUE;
   ot_transfer_out_value (out_variant, &ret_variant);
  out:
-  g_mutex_unlock (&self->cache_lock);
   return ret;
 }
 
 /**
- * @sha256: Checksum of pack file
- * @out_data: (out): Pointer to pack file data
+ * ostree_repo_list_objects:
+ * @self:
+ * @flags:
+ * @out_objects: (out): Map of serialized object name to variant data
+ * @cancellable:
+ * @error:
  *
- * Ensure that the given pack file is mapped into
- * memory.
- */
+ * This function synchronously enumerates all objects in the
+ * repository, returning data in @out_objects.  @out_objects
+ * maps from keys returned by ostree_object_name_serialize()
+ * to #GVariant values of type %OSTREE_REPO_LIST_OBJECTS_VARIANT_TYPE.
+ *
+ * Returns: %TRUE on success, %FALSE on error, and @error will be set
+ */ 
 gboolean
-ostree_repo_map_pack_file (OstreeRepo    *self,
-                           const char    *pack_checksum,
-                           gboolean       is_meta,
-                           guchar       **out_data,
-                           guint64       *out_len,
-                           GCancellable  *cancellable,
-                           GError       **error)
+ostree_repo_list_objects (OstreeRepo                  *self,
+                          OstreeRepoListObjectsFlags   flags,
+                          GHashTable                 **out_objects,
+                          GCancellable                *cancellable,
+                          GError                     **error)
 {
   gboolean ret = FALSE;
-  gpointer ret_data;
-  guint64 ret_len;
-  GMappedFile *map = NULL;
-  ot_lobj GFile *path = NULL;
+  ot_lhash GHashTable *ret_objects = NULL;
 
-  g_mutex_lock (&self->cache_lock);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  g_return_val_if_fail (self->inited, FALSE);
+  
+  ret_objects = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
+                                       (GDestroyNotify) g_variant_unref,
+                                       (GDestroyNotify) g_variant_unref);
 
-  map = g_hash_table_lookup (self->cached_pack_data_mappings, pack_checksum);
-  if (map == NULL)
+  if (flags & OSTREE_REPO_LIST_OBJECTS_ALL)
+    flags |= (OSTREE_REPO_LIST_OBJECTS_LOOSE | OSTREE_REPO_LIST_OBJECTS_PACKED);
+
+  if (flags & OSTREE_REPO_LIST_OBJECTS_LOOSE)
     {
-      path = get_pack_data_path (self->pack_dir, is_meta, pack_checksum);
+      if (!list_loose_objects (self, ret_objects, cancellable, error))
+        goto out;
+      if (self->parent_repo)
+        {
+          if (!list_loose_objects (self->parent_repo, ret_objects, cancellable, error))
+            goto out;
+        }
+    }
 
-      map = g_mapped_file_new (ot_gfile_get_path_cached (path), FALSE, error);
-      if (!map)
+  if (flags & OSTREE_REPO_LIST_OBJECTS_PACKED)
+    {
+      if (!list_packed_objects (self, ret_objects, cancellable, error))
         goto out;
-
-      g_hash_table_insert (self->cached_pack_data_mappings, g_strdup (pack_checksum), map);
-      ret_data = g_mapped_file_get_contents (map);
+      if (self->parent_repo)
+        {
+          if (!list_packed_objects (self->parent_repo, ret_objects, cancellable, error))
+            goto out;
+        }
     }
 
-  ret_data = g_mapped_file_get_contents (map);
-  ret_len = (guint64)g_mapped_file_get_length (map);
-
   ret = TRUE;
-  if (out_data)
-    *out_data = ret_data;
-  if (out_len)
-    *out_len = ret_len;
+  ot_transfer_out_value (out_objects, &ret_objects);
  out:
-  g_mutex_unlock (&self->cache_lock);
   return ret;
 }
 
-gboolean
-ostree_repo_load_file (OstreeRepo         *self,
-                       const char         *checksum,
-                       GInputStream      **out_input,
-                       GFileInfo         **out_file_info,
-                       GVariant          **out_xattrs,
-                       GCancellable       *cancellable,
-                       GError            **error)
+static gboolean
+checkout_file_from_input (GFile          *file,
+                          OstreeRepoCheckoutMode mode,
+                          OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                          GFileInfo      *finfo,
+                          GVariant       *xattrs,
+                          GInputStream   *input,
+                          GCancellable   *cancellable,
+                          GError        **error)
 {
   gboolean ret = FALSE;
-  guchar *pack_data;
-  guint64 pack_len;
-  guint64 pack_offset;
-  ot_lvariant GVariant *packed_object = NULL;
-  ot_lvariant GVariant *file_data = NULL;
-  ot_lobj GFile *loose_path = NULL;
-  ot_lobj GFileInfo *content_loose_info = NULL;
-  ot_lfree char *pack_checksum = NULL;
-  ot_lobj GInputStream *ret_input = NULL;
-  ot_lobj GFileInfo *ret_file_info = NULL;
-  ot_lvariant GVariant *ret_xattrs = NULL;
-
-  if (!repo_find_object (self, OSTREE_OBJECT_TYPE_FILE,
-                         checksum, FALSE, &loose_path,
-                         &pack_checksum, &pack_offset,
-                         cancellable, error))
-    goto out;
+  GError *temp_error = NULL;
+  ot_lobj GFile *dir = NULL;
+  ot_lobj GFile *temp_file = NULL;
+  ot_lobj GFileInfo *temp_info = NULL;
 
-  if (loose_path)
+  if (mode == OSTREE_REPO_CHECKOUT_MODE_USER)
     {
-      if (ostree_repo_get_mode (self) == OSTREE_REPO_MODE_ARCHIVE)
-        {
-          ot_lvariant GVariant *archive_meta = NULL;
-
-          if (!ot_util_variant_map (loose_path, OSTREE_FILE_HEADER_GVARIANT_FORMAT,
-                                    TRUE, &archive_meta, error))
-            goto out;
+      temp_info = g_file_info_dup (finfo);
+      
+      g_file_info_set_attribute_uint32 (temp_info, "unix::uid", geteuid ());
+      g_file_info_set_attribute_uint32 (temp_info, "unix::gid", getegid ());
 
-          if (!ostree_file_header_parse (archive_meta, &ret_file_info, &ret_xattrs,
-                                         error))
-            goto out;
+      xattrs = NULL;
+    }
 
-          if (g_file_info_get_file_type (ret_file_info) == G_FILE_TYPE_REGULAR)
+  if (overwrite_mode == OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES)
+    {
+      if (g_file_info_get_file_type (temp_info ? temp_info : finfo) == G_FILE_TYPE_DIRECTORY)
+        {
+          if (!ostree_create_file_from_input (file, temp_info ? temp_info : finfo,
+                                              xattrs, input,
+                                              cancellable, &temp_error))
             {
-              ot_lobj GFile *archive_content_path = NULL;
-              ot_lobj GFileInfo *content_info = NULL;
-
-              archive_content_path = ostree_repo_get_archive_content_path (self, checksum);
-              content_info = g_file_query_info (archive_content_path, OSTREE_GIO_FAST_QUERYINFO,
-                                                G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                                cancellable, error);
-              if (!content_info)
-                goto out;
-
-              if (out_input)
+              if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_EXISTS))
                 {
-                  ret_input = (GInputStream*)g_file_read (archive_content_path, cancellable, error);
-                  if (!ret_input)
-                    goto out;
+                  g_clear_error (&temp_error);
+                }
+              else
+                {
+                  g_propagate_error (error, temp_error);
+                  goto out;
                 }
-              g_file_info_set_size (ret_file_info, g_file_info_get_size (content_info));
             }
         }
       else
         {
-          ret_file_info = g_file_query_info (loose_path, OSTREE_GIO_FAST_QUERYINFO,
-                                             G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                             cancellable, error);
-          if (!ret_file_info)
+          dir = g_file_get_parent (file);
+          if (!ostree_create_temp_file_from_input (dir, NULL, "checkout",
+                                                   temp_info ? temp_info : finfo,
+                                                   xattrs, input, &temp_file, 
+                                                   cancellable, error))
             goto out;
-
-          if (out_xattrs)
-            {
-              if (!ostree_get_xattrs_for_file (loose_path, &ret_xattrs,
-                                               cancellable, error))
-                goto out;
-            }
-
-          if (out_input && g_file_info_get_file_type (ret_file_info) == G_FILE_TYPE_REGULAR)
+          
+          if (rename (ot_gfile_get_path_cached (temp_file), ot_gfile_get_path_cached (file)) < 0)
             {
-              ret_input = (GInputStream*) g_file_read (loose_path, cancellable, error);
-              if (!ret_input)
-                {
-                  g_prefix_error (error, "Error opening loose file object %s: ", ot_gfile_get_path_cached (loose_path));
-                  goto out;
-                }
+              ot_util_set_error_from_errno (error, errno);
+              goto out;
             }
         }
     }
-  else if (pack_checksum)
+  else
     {
-      if (!ostree_repo_map_pack_file (self, pack_checksum, FALSE,
-                                      &pack_data, &pack_len,
-                                      cancellable, error))
+      if (!ostree_create_file_from_input (file, temp_info ? temp_info : finfo,
+                                          xattrs, input, cancellable, error))
         goto out;
+    }
 
-      if (!ostree_read_pack_entry_raw (pack_data, pack_len,
-                                       pack_offset, TRUE, FALSE,
-                                       &packed_object, cancellable, error))
-        goto out;
+  ret = TRUE;
+ out:
+  return ret;
+}
 
-      if (!ostree_parse_file_pack_entry (packed_object,
-                                         out_input ? &ret_input : NULL,
-                                         out_file_info ? &ret_file_info : NULL,
-                                         out_xattrs ? &ret_xattrs : NULL,
-                                         cancellable, error))
-        goto out;
-    }
-  else if (self->parent_repo)
+static gboolean
+checkout_file_hardlink (OstreeRepo                  *self,
+                        OstreeRepoCheckoutMode    mode,
+                        OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                        GFile                    *source,
+                        GFile                    *destination,
+                        gboolean                 *out_was_supported,
+                        GCancellable             *cancellable,
+                        GError                  **error)
+{
+  gboolean ret = FALSE;
+  gboolean ret_was_supported = FALSE;
+  ot_lobj GFile *dir = NULL;
+
+  if (link (ot_gfile_get_path_cached (source), ot_gfile_get_path_cached (destination)) != -1)
+    ret_was_supported = TRUE;
+  else if (errno == EMLINK || errno == EXDEV)
     {
-      if (!ostree_repo_load_file (self->parent_repo, checksum, 
-                                  out_input ? &ret_input : NULL,
-                                  out_file_info ? &ret_file_info : NULL,
-                                  out_xattrs ? &ret_xattrs : NULL,
-                                  cancellable, error))
-        goto out;
+      /* EMLINK and EXDEV shouldn't be fatal; we just can't do the
+       * optimization of hardlinking instead of copying.
+       */
+      ret_was_supported = FALSE;
+    }
+  else if (errno == EEXIST && overwrite_mode == OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES)
+    { 
+      /* Idiocy, from man rename(2)
+       *
+       * "If oldpath and newpath are existing hard links referring to
+       * the same file, then rename() does nothing, and returns a
+       * success status."
+       *
+       * So we can't make this atomic.  
+       */
+      (void) unlink (ot_gfile_get_path_cached (destination));
+      if (link (ot_gfile_get_path_cached (source), ot_gfile_get_path_cached (destination)) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
     }
   else
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
-                   "Couldn't find file object '%s'", checksum);
+      ot_util_set_error_from_errno (error, errno);
       goto out;
     }
 
   ret = TRUE;
-  ot_transfer_out_value (out_input, &ret_input);
-  ot_transfer_out_value (out_file_info, &ret_file_info);
-  ot_transfer_out_value (out_xattrs, &ret_xattrs);
+  if (out_was_supported)
+    *out_was_supported = ret_was_supported;
+ out:
+  return ret;
+}
+
+static gboolean
+find_loose_for_checkout (OstreeRepo             *self,
+                         const char             *checksum,
+                         GFile                 **out_loose_path,
+                         GCancellable           *cancellable,
+                         GError                **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *path = NULL;
+  struct stat stbuf;
+
+  do
+    {
+      if (self->mode == OSTREE_REPO_MODE_BARE)
+        path = ostree_repo_get_object_path (self, checksum, OSTREE_OBJECT_TYPE_FILE);
+      else
+        path = ostree_repo_get_archive_content_path (self, checksum);
+
+      if (lstat (ot_gfile_get_path_cached (path), &stbuf) < 0)
+        {
+          if (errno != ENOENT)
+            {
+              ot_util_set_error_from_errno (error, errno);
+              goto out;
+            }
+          self = self->parent_repo;
+        }
+      else if (S_ISLNK (stbuf.st_mode))
+        {
+          /* Don't check out symbolic links via hardlink; it's very easy
+           * to hit the maximum number of hardlinks to an inode this way,
+           * especially since right now we have a lot of symbolic links to
+           * busybox.
+           *
+           * fs/ext4/ext4.h:#define EXT4_LINK_MAX		65000
+           */
+          self = self->parent_repo;
+        }
+      else
+        break;
+
+      g_clear_object (&path);
+    } while (self != NULL);
+
+  ret = TRUE;
+  ot_transfer_out_value (out_loose_path, &path);
  out:
   return ret;
 }
 
+/*
+ * Create @destination from @src_fd's data, sharing extents where the
+ * filesystem supports it.  If @src_length is negative, all of @src_fd
+ * is cloned with FICLONE; otherwise @src_length bytes at @src_offset
+ * are copied with copy_file_range(), which reflinks when it can.  If
+ * neither is possible here, @out_was_supported is %FALSE and nothing
+ * is created.
+ */
 static gboolean
-list_objects_in_index (OstreeRepo                     *self,
-                       const char                     *pack_checksum,
-                       gboolean                        is_meta,
-                       GHashTable                     *inout_objects,
-                       GCancellable                   *cancellable,
-                       GError                        **error)
+checkout_file_reflink (OstreeRepo                  *self,
+                       OstreeRepoCheckoutMode    mode,
+                       OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                       GFileInfo                *file_info,
+                       GVariant                 *xattrs,
+                       int                       src_fd,
+                       guint64                   src_offset,
+                       gint64                    src_length,
+                       GFile                    *destination,
+                       gboolean                 *out_was_supported,
+                       GCancellable             *cancellable,
+                       GError                  **error)
 {
   gboolean ret = FALSE;
-  guint8 objtype_u8;
-  guint64 offset;
-  ot_lobj GFile *index_path = NULL;
-  ot_lvariant GVariant *index_variant = NULL;
-  ot_lvariant GVariant *contents = NULL;
-  ot_lvariant GVariant *csum_bytes = NULL;
-  ot_lfree char *checksum = NULL;
-  GVariantIter content_iter;
-
-  index_path = get_pack_index_path (self->pack_dir, is_meta, pack_checksum);
+  gboolean ret_was_supported = FALSE;
+  int fd = -1;
+  guint32 file_mode;
+  const char *write_path = NULL;
+  ot_lobj GFile *dir = NULL;
+  ot_lfree char *tmp_path = NULL;
 
-  if (!ostree_repo_load_pack_index (self, pack_checksum, is_meta, 
-                                    &index_variant, cancellable, error))
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
     goto out;
 
-  contents = g_variant_get_child_value (index_variant, 2);
-  g_variant_iter_init (&content_iter, contents);
-
-  while (g_variant_iter_loop (&content_iter, "(y@ayt)", &objtype_u8, &csum_bytes, &offset))
+  if (overwrite_mode == OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES)
     {
-      GVariant *obj_key;
-      GVariant *objdata;
-      OstreeObjectType objtype;
-      GVariantBuilder pack_contents_builder;
-      gboolean is_loose;
-
-      objtype = (OstreeObjectType) objtype_u8;
-      offset = GUINT64_FROM_BE (offset);
-
-      g_variant_builder_init (&pack_contents_builder,
-                              G_VARIANT_TYPE_STRING_ARRAY);
-      
-      g_free (checksum);
-      checksum = ostree_checksum_from_bytes_v (csum_bytes);
-      obj_key = ostree_object_name_serialize (checksum, objtype);
-      ot_util_variant_take_ref (obj_key);
+      dir = g_file_get_parent (destination);
+      tmp_path = g_build_filename (ot_gfile_get_path_cached (dir), "checkout-XXXXXX", NULL);
+      fd = g_mkstemp_full (tmp_path, O_WRONLY | O_CLOEXEC, 0600);
+      write_path = tmp_path;
+    }
+  else
+    {
+      write_path = ot_gfile_get_path_cached (destination);
+      fd = open (write_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    }
+  if (fd < 0)
+    {
+      write_path = NULL;
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
 
-      objdata = g_hash_table_lookup (inout_objects, obj_key);
-      if (!objdata)
-        {
-          is_loose = FALSE;
-        }
+  if (src_length < 0)
+    {
+#ifdef FICLONE
+      if (ioctl (fd, FICLONE, src_fd) == 0)
+        ret_was_supported = TRUE;
+      else if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV || errno == EINVAL)
+        g_atomic_int_set (&self->reflink_unsupported, TRUE);
       else
         {
-          GVariantIter *current_packs_iter;
-          const char *current_pack_checksum;
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+#endif
+    }
+  else
+    {
+#ifdef HAVE_COPY_FILE_RANGE
+      loff_t offset = src_offset;
+      guint64 remaining = src_length;
 
-          g_variant_get (objdata, "(bas)", &is_loose, &current_packs_iter);
+      ret_was_supported = TRUE;
+      while (remaining > 0)
+        {
+          ssize_t bytes_copied = copy_file_range (src_fd, &offset, fd, NULL, remaining, 0);
 
-          while (g_variant_iter_loop (current_packs_iter, "&s", &current_pack_checksum))
+          if (bytes_copied < 0)
             {
-              g_variant_builder_add (&pack_contents_builder, "s", current_pack_checksum);
+              if (errno == EINTR)
+                continue;
+              if (remaining == (guint64)src_length
+                  && (errno == ENOSYS || errno == EOPNOTSUPP || errno == EXDEV || errno == EINVAL))
+                {
+                  ret_was_supported = FALSE;
+                  break;
+                }
+              ot_util_set_error_from_errno (error, errno);
+              goto out;
             }
-          g_variant_iter_free (current_packs_iter);
+          else if (bytes_copied == 0)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Unexpected end of file copying pack data");
+              goto out;
+            }
+          remaining -= bytes_copied;
         }
-      g_variant_builder_add (&pack_contents_builder, "s", pack_checksum);
-      objdata = g_variant_new ("(b@as)", is_loose,
-                               g_variant_builder_end (&pack_contents_builder));
-      g_variant_ref_sink (objdata);
-      g_hash_table_replace (inout_objects, obj_key, objdata);
+#endif
     }
 
-  ret = TRUE;
- out:
-  return ret;
-}
-
-static gboolean
-list_packed_objects (OstreeRepo                     *self,
-                     GHashTable                     *inout_objects,
-                     GCancellable                   *cancellable,
-                     GError                        **error)
-{
-  gboolean ret = FALSE;
-  guint i;
-  ot_lptrarray GPtrArray *meta_index_checksums = NULL;
-  ot_lptrarray GPtrArray *data_index_checksums = NULL;
-
-  if (!ostree_repo_list_pack_indexes (self, &meta_index_checksums, &data_index_checksums,
-                                      cancellable, error))
-    goto out;
-
-  for (i = 0; i < meta_index_checksums->len; i++)
-    {
-      const char *checksum = meta_index_checksums->pdata[i];
-      if (!list_objects_in_index (self, checksum, TRUE, inout_objects, cancellable, error))
-        goto out;
-    }
-  
-  for (i = 0; i < data_index_checksums->len; i++)
+  if (!ret_was_supported)
     {
-      const char *checksum = data_index_checksums->pdata[i];
-      if (!list_objects_in_index (self, checksum, FALSE, inout_objects, cancellable, error))
-        goto out;
+      ret = TRUE;
+      goto out;
     }
 
-  ret = TRUE;
- out:
-  return ret;
-}
-
-static gboolean
-find_object_in_packs (OstreeRepo        *self,
-                      const char        *checksum,
-                      OstreeObjectType   objtype,
-                      char             **out_pack_checksum,
-                      guint64           *out_pack_offset,
-                      GCancellable      *cancellable,
-                      GError           **error)
-{
-  gboolean ret = FALSE;
-  guint i;
-  guint64 ret_pack_offset = 0;
-  gboolean is_meta;
-  ot_lptrarray GPtrArray *index_checksums = NULL;
-  ot_lfree char *ret_pack_checksum = NULL;
-  ot_lvariant GVariant *csum_bytes = NULL;
-  ot_lvariant GVariant *index_variant = NULL;
+  file_mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
 
-  csum_bytes = ostree_checksum_to_bytes_v (checksum);
+  if (mode != OSTREE_REPO_CHECKOUT_MODE_USER)
+    {
+      guint32 uid = g_file_info_get_attribute_uint32 (file_info, "unix::uid");
+      guint32 gid = g_file_info_get_attribute_uint32 (file_info, "unix::gid");
 
-  is_meta = OSTREE_OBJECT_TYPE_IS_META (objtype);
+      if (fchown (fd, uid, gid) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "fchown(%u, %u) failed: ", uid, gid);
+          goto out;
+        }
+    }
 
-  if (is_meta)
+  if (fchmod (fd, file_mode & 07777) < 0)
     {
-      if (!ostree_repo_list_pack_indexes (self, &index_checksums, NULL,
-                                          cancellable, error))
-        goto out;
+      ot_util_set_error_from_errno (error, errno);
+      g_prefix_error (error, "fchmod(%u) failed: ", file_mode);
+      goto out;
     }
-  else
+
+  if (mode != OSTREE_REPO_CHECKOUT_MODE_USER && xattrs != NULL)
     {
-      if (!ostree_repo_list_pack_indexes (self, NULL, &index_checksums,
-                                          cancellable, error))
+      if (!set_xattrs_fd (fd, xattrs, error))
         goto out;
     }
 
-  for (i = 0; i < index_checksums->len; i++)
+  if (close (fd) < 0)
     {
-      const char *pack_checksum = index_checksums->pdata[i];
-      guint64 offset;
-
-      g_clear_pointer (&index_variant, (GDestroyNotify) g_variant_unref);
-      if (!ostree_repo_load_pack_index (self, pack_checksum, is_meta, &index_variant,
-                                        cancellable, error))
-        goto out;
-
-      if (!ostree_pack_index_search (index_variant, csum_bytes, objtype, &offset))
-        continue;
+      fd = -1;
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+  fd = -1;
 
-      ret_pack_checksum = g_strdup (pack_checksum);
-      ret_pack_offset = offset;
-      break;
+  if (tmp_path)
+    {
+      if (rename (tmp_path, ot_gfile_get_path_cached (destination)) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
     }
+  write_path = NULL;
 
   ret = TRUE;
-  ot_transfer_out_value (out_pack_checksum, &ret_pack_checksum);
-  if (out_pack_offset)
-    *out_pack_offset = ret_pack_offset;
+  if (out_was_supported)
+    *out_was_supported = ret_was_supported;
  out:
+  if (fd != -1)
+    (void) close (fd);
+  /* Remove a partial or unused file */
+  if (write_path && (!ret || !ret_was_supported))
+    (void) unlink (write_path);
   return ret;
 }
 
-static gboolean      
-repo_find_object (OstreeRepo           *self,
-                  OstreeObjectType      objtype,
-                  const char           *checksum,
-                  gboolean              lookup_all,
-                  GFile               **out_stored_path,
-                  char                **out_pack_checksum,
-                  guint64              *out_pack_offset,
-                  GCancellable         *cancellable,
-                  GError             **error)
+/*
+ * Try to check out the regular file @checksum by reflinking it from
+ * the repository; see checkout_file_reflink().  Compressed pack
+ * entries are not supported.
+ */
+static gboolean
+checkout_file_try_reflink (OstreeRepo                  *self,
+                           OstreeRepoCheckoutMode    mode,
+                           OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                           const char               *checksum,
+                           GFile                    *loose_path,
+                           GFileInfo                *source_info,
+                           GFile                    *destination,
+                           gboolean                 *out_was_supported,
+                           GCancellable             *cancellable,
+                           GError                  **error)
 {
   gboolean ret = FALSE;
-  guint64 ret_pack_offset = 0;
-  struct stat stbuf;
-  ot_lobj GFile *object_path = NULL;
-  ot_lobj GFile *ret_stored_path = NULL;
-  ot_lfree char *ret_pack_checksum = NULL;
+  gboolean ret_was_supported = FALSE;
+  int src_fd = -1;
+  guint64 pack_offset;
+  guchar *pack_data;
+  guint64 pack_len;
+  ot_lobj GFile *found_loose_path = NULL;
+  ot_lobj GFile *pack_path = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
+  ot_lvariant GVariant *xattrs = NULL;
+  ot_lvariant GVariant *packed_object = NULL;
+  ot_lvariant GVariant *file_header = NULL;
+  ot_lvariant GVariant *file_data = NULL;
+  ot_lfree char *pack_checksum = NULL;
 
-  /* Look up metadata in packs first, but content loose first.  We
-   * want to find loose content since that's preferable for
-   * hardlinking scenarios.
-   *
-   * Metadata is much more efficient packed.
-   */
-  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+  if (loose_path)
     {
-      if (out_pack_checksum)
+      if (g_atomic_int_get (&self->reflink_unsupported))
         {
-          if (!find_object_in_packs (self, checksum, objtype,
-                                     &ret_pack_checksum, &ret_pack_offset,
-                                     cancellable, error))
+          ret = TRUE;
+          goto out;
+        }
+
+      if (mode != OSTREE_REPO_CHECKOUT_MODE_USER)
+        {
+          if (!ostree_repo_load_file (self, checksum, NULL, NULL, &xattrs,
+                                      cancellable, error))
             goto out;
         }
-      if (!ret_pack_checksum || lookup_all)
+
+      src_fd = open (ot_gfile_get_path_cached (loose_path), O_RDONLY | O_CLOEXEC);
+      if (src_fd < 0)
         {
-          object_path = ostree_repo_get_object_path (self, checksum, objtype);
-  
-          if (lstat (ot_gfile_get_path_cached (object_path), &stbuf) == 0)
-            {
-              ret_stored_path = object_path;
-              object_path = NULL;
-            }
-          else
-            {
-              g_clear_object (&object_path);
-            }
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
         }
+
+      if (!checkout_file_reflink (self, mode, overwrite_mode, source_info, xattrs,
+                                  src_fd, 0, -1, destination, &ret_was_supported,
+                                  cancellable, error))
+        goto out;
     }
   else
     {
-      if (out_stored_path)
+      guchar entry_flags;
+      gsize data_len;
+      gconstpointer data;
+
+      if (!repo_find_object (self, OSTREE_OBJECT_TYPE_FILE, checksum, FALSE,
+                             &found_loose_path, &pack_checksum, &pack_offset,
+                             cancellable, error))
+        goto out;
+      if (found_loose_path || !pack_checksum)
         {
-          object_path = ostree_repo_get_object_path (self, checksum, objtype);
-  
-          if (lstat (ot_gfile_get_path_cached (object_path), &stbuf) == 0)
-            {
-              ret_stored_path = object_path;
-              object_path = NULL;
-            }
-          else
-            {
-              g_clear_object (&object_path);
-            }
+          ret = TRUE;
+          goto out;
+        }
+
+      if (!ostree_repo_map_pack_file (self, pack_checksum, FALSE,
+                                      &pack_data, &pack_len,
+                                      cancellable, error))
+        goto out;
+
+      if (!ostree_read_pack_entry_raw (pack_data, pack_len, pack_offset, TRUE, FALSE,
+                                       &packed_object, cancellable, error))
+        goto out;
+
+      g_variant_get_child (packed_object, 1, "y", &entry_flags);
+      if (entry_flags & (OSTREE_PACK_FILE_ENTRY_COMPRESSION_MASK | OSTREE_PACK_FILE_ENTRY_FLAG_DELTA))
+        {
+          ret = TRUE;
+          goto out;
         }
-      if (!ret_stored_path || lookup_all)
+
+      g_variant_get_child (packed_object, 2, "@(uuuusa(ayay))", &file_header);
+      g_variant_get_child (packed_object, 3, "@ay", &file_data);
+
+      if (!ostree_file_header_parse (file_header, &file_info, &xattrs, error))
+        goto out;
+
+      data_len = g_variant_get_size (file_data);
+      data = data_len > 0 ? g_variant_get_data (file_data) : NULL;
+
+      pack_path = get_pack_data_path (self->pack_dir, FALSE, pack_checksum);
+      src_fd = open (ot_gfile_get_path_cached (pack_path), O_RDONLY | O_CLOEXEC);
+      if (src_fd < 0)
         {
-          if (out_pack_checksum)
-            {
-              if (!find_object_in_packs (self, checksum, objtype,
-                                         &ret_pack_checksum, &ret_pack_offset,
-                                         cancellable, error))
-                goto out;
-            }
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
         }
+
+      /* The entry data points into the mapped pack */
+      if (!checkout_file_reflink (self, mode, overwrite_mode, source_info, xattrs, src_fd,
+                                  data ? (guint64)((const guchar*)data - pack_data) : 0,
+                                  data_len, destination, &ret_was_supported,
+                                  cancellable, error))
+        goto out;
     }
-  
+
   ret = TRUE;
-  ot_transfer_out_value (out_stored_path, &ret_stored_path);
-  ot_transfer_out_value (out_pack_checksum, &ret_pack_checksum);
-  if (out_pack_offset)
-    *out_pack_offset = ret_pack_offset;
-out:
+  if (out_was_supported)
+    *out_was_supported = ret_was_supported;
+ out:
+  if (src_fd != -1)
+    (void) close (src_fd);
   return ret;
 }
 
-gboolean
-ostree_repo_has_object (OstreeRepo           *self,
-                        OstreeObjectType      objtype,
-                        const char           *checksum,
-                        gboolean             *out_have_object,
-                        GCancellable         *cancellable,
-                        GError              **error)
+static gboolean
+checkout_one_file (OstreeRepo                  *self,
+                   OstreeRepoCheckoutMode    mode,
+                   OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                   OstreeRepoFile           *source,
+                   GFileInfo                *source_info,
+                   GFile                    *destination,
+                   GCancellable             *cancellable,
+                   GError                  **error)
 {
   gboolean ret = FALSE;
-  gboolean ret_have_object;
+  const char *checksum;
+  gboolean can_hardlink;
+  gboolean try_reflink;
+  gboolean hardlink_supported = FALSE;
+  gboolean reflink_supported = FALSE;
   ot_lobj GFile *loose_path = NULL;
-  ot_lfree char *pack_checksum = NULL;
+  ot_lobj GInputStream *input = NULL;
+  ot_lvariant GVariant *xattrs = NULL;
 
-  if (!repo_find_object (self, objtype, checksum, FALSE,
-                         &loose_path,
-                         &pack_checksum, NULL,
-                         cancellable, error))
-    goto out;
+  /* Hack to avoid trying to create device files as a user */
+  if (mode == OSTREE_REPO_CHECKOUT_MODE_USER
+      && g_file_info_get_file_type (source_info) == G_FILE_TYPE_SPECIAL)
+    {
+      ret = TRUE;
+      goto out;
+    }
 
-  ret_have_object = (loose_path != NULL) || (pack_checksum != NULL);
+  checksum = ostree_repo_file_get_checksum (source);
 
-  if (!ret_have_object && self->parent_repo)
+  can_hardlink = ((self->mode == OSTREE_REPO_MODE_BARE
+                   && mode == OSTREE_REPO_CHECKOUT_MODE_NONE)
+                  || (self->mode == OSTREE_REPO_MODE_ARCHIVE
+                      && mode == OSTREE_REPO_CHECKOUT_MODE_USER));
+  /* Loose regular files hold just the content, so they can be cloned
+   * for any checkout mode.
+   */
+  try_reflink = (self->checkout_reflink
+                 && g_file_info_get_file_type (source_info) == G_FILE_TYPE_REGULAR);
+
+  if (can_hardlink || try_reflink)
     {
-      if (!ostree_repo_has_object (self->parent_repo, objtype, checksum,
-                                   &ret_have_object, cancellable, error))
+      if (!find_loose_for_checkout (self, checksum, &loose_path,
+                                    cancellable, error))
         goto out;
     }
-                                
+
+  if (loose_path && can_hardlink)
+    {
+      /* If we found one, try hardlinking */
+      if (!checkout_file_hardlink (self, mode, overwrite_mode, loose_path,
+                                   destination, &hardlink_supported,
+                                   cancellable, error))
+        goto out;
+    }
+
+  if (!hardlink_supported && try_reflink)
+    {
+      if (!checkout_file_try_reflink (self, mode, overwrite_mode, checksum, loose_path,
+                                      source_info, destination, &reflink_supported,
+                                      cancellable, error))
+        goto out;
+    }
+
+  /* Fall back to copy if there's no loose object, or we couldn't link */
+  if (!hardlink_supported && !reflink_supported)
+    {
+      if (!ostree_repo_load_file (self, checksum, &input, NULL, &xattrs,
+                                  cancellable, error))
+        goto out;
+
+      if (!checkout_file_from_input (destination, mode, overwrite_mode,
+                                     source_info, xattrs, 
+                                     input, cancellable, error))
+        goto out;
+    }
+
   ret = TRUE;
-  if (out_have_object)
-    *out_have_object = ret_have_object;
  out:
   return ret;
 }
 
-gboolean
-ostree_repo_load_variant_c (OstreeRepo          *self,
-                            OstreeObjectType     objtype,
-                            const guchar        *csum, 
-                            GVariant           **out_variant,
-                            GError             **error)
-{
-  gboolean ret = FALSE;
-  ot_lfree char *checksum = NULL;
+/*
+ * Checkouts are driven from a single thread, which creates
+ * directories as it walks the tree and queues the files in each
+ * batch, sorted by where their objects live, to a fixed number of
+ * workers.  The number of files queued at once is bounded.
+ */
+#define CHECKOUT_BATCH_SIZE 1024
+#define CHECKOUT_MAX_OUTSTANDING_PER_WORKER 4
 
-  checksum = ostree_checksum_from_bytes (csum);
+typedef struct {
+  OstreeRepoFile           *source;
+  GFileInfo                *source_info;
+  GFile                    *destination;
 
-  if (!ostree_repo_load_variant (self, objtype, checksum, out_variant, error))
-    goto out;
+  /* Loose objects sort by inode, then packed ones by offset */
+  guint64                   sort_major;
+  guint64                   sort_minor;
+} CheckoutFileItem;
 
-  ret = TRUE;
- out:
-  return ret;
+typedef struct {
+  OstreeRepo               *repo;
+  OstreeRepoCheckoutMode    mode;
+  OstreeRepoCheckoutOverwriteMode    overwrite_mode;
+  GCancellable             *cancellable;
+
+  GThreadPool              *pool;
+  GPtrArray                *batch;
+
+  GMutex                    lock;
+  GCond                     cond;
+  guint                     n_outstanding;
+  guint                     max_outstanding;
+  guint                     n_files;
+  GError                   *error;
+
+  gint64                    start_time;
+} CheckoutScheduler;
+
+static void
+checkout_file_item_free (CheckoutFileItem  *item)
+{
+  /* Items handed to the pool are cleared from the batch */
+  if (!item)
+    return;
+  g_object_unref (item->source);
+  g_object_unref (item->source_info);
+  g_object_unref (item->destination);
+  g_free (item);
 }
 
-gboolean
-ostree_repo_load_variant (OstreeRepo  *self,
-                          OstreeObjectType  objtype,
-                          const char    *sha256, 
-                          GVariant     **out_variant,
-                          GError       **error)
+static int
+compare_checkout_file_items (gconstpointer  a,
+                             gconstpointer  b)
+{
+  const CheckoutFileItem *item_a = *((CheckoutFileItem**)a);
+  const CheckoutFileItem *item_b = *((CheckoutFileItem**)b);
+
+  if (item_a->sort_major != item_b->sort_major)
+    return item_a->sort_major < item_b->sort_major ? -1 : 1;
+  if (item_a->sort_minor != item_b->sort_minor)
+    return item_a->sort_minor < item_b->sort_minor ? -1 : 1;
+  return 0;
+}
+
+static gboolean
+checkout_file_item_locate (OstreeRepo         *self,
+                           CheckoutFileItem   *item,
+                           GCancellable       *cancellable,
+                           GError            **error)
 {
   gboolean ret = FALSE;
-  guchar *pack_data;
-  guint64 pack_len;
-  guint64 object_offset;
-  GCancellable *cancellable = NULL;
-  ot_lobj GFile *object_path = NULL;
-  ot_lvariant GVariant *packed_object = NULL;
-  ot_lvariant GVariant *ret_variant = NULL;
+  guint64 pack_offset;
+  struct stat stbuf;
+  ot_lobj GFile *stored_path = NULL;
   ot_lfree char *pack_checksum = NULL;
 
-  g_return_val_if_fail (OSTREE_OBJECT_TYPE_IS_META (objtype), FALSE);
+  if (g_file_info_get_file_type (item->source_info) == G_FILE_TYPE_SPECIAL)
+    {
+      ret = TRUE;
+      goto out;
+    }
 
-  if (!repo_find_object (self, objtype, sha256, FALSE,
-                         &object_path, &pack_checksum, &object_offset,
+  if (!repo_find_object (self, OSTREE_OBJECT_TYPE_FILE,
+                         ostree_repo_file_get_checksum (item->source), FALSE,
+                         &stored_path, &pack_checksum, &pack_offset,
                          cancellable, error))
     goto out;
 
-  if (pack_checksum != NULL)
-    {
-      if (!ostree_repo_map_pack_file (self, pack_checksum, TRUE, &pack_data, &pack_len,
-                                      cancellable, error))
-        goto out;
-      
-      if (!ostree_read_pack_entry_raw (pack_data, pack_len, object_offset,
-                                       TRUE, TRUE, &packed_object, cancellable, error))
-        goto out;
-
-      g_variant_get_child (packed_object, 2, "v", &ret_variant);
-    }
-  else if (object_path != NULL)
-    {
-      if (!ot_util_variant_map (object_path, ostree_metadata_variant_type (objtype),
-                                TRUE, &ret_variant, error))
-        goto out;
-    }
-  else if (self->parent_repo)
+  if (stored_path)
     {
-      if (!ostree_repo_load_variant (self->parent_repo, objtype, sha256, &ret_variant, error))
-        goto out;
+      if (lstat (ot_gfile_get_path_cached (stored_path), &stbuf) == 0)
+        item->sort_minor = stbuf.st_ino;
     }
-  else
+  else if (pack_checksum)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No such metadata object %s.%s",
-                   sha256, ostree_object_type_to_string (objtype));
-      goto out;
+      item->sort_major = (guint64)g_str_hash (pack_checksum) + 1;
+      item->sort_minor = pack_offset;
     }
 
   ret = TRUE;
-  ot_transfer_out_value (out_variant, &ret_variant);
  out:
   return ret;
 }
 
-/**
- * ostree_repo_list_objects:
- * @self:
- * @flags:
- * @out_objects: (out): Map of serialized object name to variant data
- * @cancellable:
- * @error:
- *
- * This function synchronously enumerates all objects in the
- * repository, returning data in @out_objects.  @out_objects
- * maps from keys returned by ostree_object_name_serialize()
- * to #GVariant values of type %OSTREE_REPO_LIST_OBJECTS_VARIANT_TYPE.
- *
- * Returns: %TRUE on success, %FALSE on error, and @error will be set
- */ 
-gboolean
-ostree_repo_list_objects (OstreeRepo                  *self,
-                          OstreeRepoListObjectsFlags   flags,
-                          GHashTable                 **out_objects,
-                          GCancellable                *cancellable,
-                          GError                     **error)
+static void
+checkout_scheduler_thread (gpointer   data,
+                           gpointer   user_data)
 {
-  gboolean ret = FALSE;
-  ot_lhash GHashTable *ret_objects = NULL;
+  CheckoutFileItem *item = data;
+  CheckoutScheduler *sched = user_data;
+  gboolean failed;
+  GError *local_error = NULL;
 
-  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
-  g_return_val_if_fail (self->inited, FALSE);
-  
-  ret_objects = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
-                                       (GDestroyNotify) g_variant_unref,
-                                       (GDestroyNotify) g_variant_unref);
+  g_mutex_lock (&sched->lock);
+  failed = sched->error != NULL;
+  g_mutex_unlock (&sched->lock);
 
-  if (flags & OSTREE_REPO_LIST_OBJECTS_ALL)
-    flags |= (OSTREE_REPO_LIST_OBJECTS_LOOSE | OSTREE_REPO_LIST_OBJECTS_PACKED);
+  if (!failed)
+    (void) checkout_one_file (sched->repo, sched->mode, sched->overwrite_mode,
+                              item->source, item->source_info, item->destination,
+                              sched->cancellable, &local_error);
 
-  if (flags & OSTREE_REPO_LIST_OBJECTS_LOOSE)
+  g_mutex_lock (&sched->lock);
+  if (local_error)
     {
-      if (!list_loose_objects (self, ret_objects, cancellable, error))
-        goto out;
-      if (self->parent_repo)
-        {
-          if (!list_loose_objects (self->parent_repo, ret_objects, cancellable, error))
-            goto out;
-        }
+      if (!sched->error)
+        sched->error = local_error;
+      else
+        g_clear_error (&local_error);
     }
+  else if (!failed)
+    sched->n_files++;
+  sched->n_outstanding--;
+  g_cond_signal (&sched->cond);
+  g_mutex_unlock (&sched->lock);
 
-  if (flags & OSTREE_REPO_LIST_OBJECTS_PACKED)
+  checkout_file_item_free (item);
+}
+
+static gboolean
+checkout_scheduler_flush (CheckoutScheduler  *sched,
+                          GError            **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+
+  g_ptr_array_sort (sched->batch, compare_checkout_file_items);
+
+  for (i = 0; i < sched->batch->len; i++)
     {
-      if (!list_packed_objects (self, ret_objects, cancellable, error))
-        goto out;
-      if (self->parent_repo)
+      CheckoutFileItem *item = sched->batch->pdata[i];
+      gboolean failed;
+
+      g_mutex_lock (&sched->lock);
+      while (sched->n_outstanding >= sched->max_outstanding)
+        g_cond_wait (&sched->cond, &sched->lock);
+      failed = sched->error != NULL;
+      if (!failed)
+        sched->n_outstanding++;
+      g_mutex_unlock (&sched->lock);
+
+      if (failed)
+        break;
+
+      sched->batch->pdata[i] = NULL;
+      if (!g_thread_pool_push (sched->pool, item, error))
         {
-          if (!list_packed_objects (self->parent_repo, ret_objects, cancellable, error))
-            goto out;
+          checkout_file_item_free (item);
+          g_mutex_lock (&sched->lock);
+          sched->n_outstanding--;
+          g_mutex_unlock (&sched->lock);
+          goto out;
         }
     }
 
   ret = TRUE;
-  ot_transfer_out_value (out_objects, &ret_objects);
+ out:
+  g_ptr_array_set_size (sched->batch, 0);
+  return ret;
+}
+
+static gboolean
+checkout_scheduler_failed (CheckoutScheduler  *sched)
+{
+  gboolean ret;
+
+  g_mutex_lock (&sched->lock);
+  ret = sched->error != NULL;
+  g_mutex_unlock (&sched->lock);
+
+  return ret;
+}
+
+static gboolean
+checkout_scheduler_queue (CheckoutScheduler        *sched,
+                          OstreeRepoFile           *source,
+                          GFileInfo                *source_info,
+                          GFile                    *destination,
+                          GError                  **error)
+{
+  gboolean ret = FALSE;
+  CheckoutFileItem *item = g_new0 (CheckoutFileItem, 1);
+
+  item->source = g_object_ref (source);
+  item->source_info = g_object_ref (source_info);
+  item->destination = g_object_ref (destination);
+  g_ptr_array_add (sched->batch, item);
+
+  if (!checkout_file_item_locate (sched->repo, item, sched->cancellable, error))
+    goto out;
+
+  if (sched->batch->len >= CHECKOUT_BATCH_SIZE)
+    {
+      if (!checkout_scheduler_flush (sched, error))
+        goto out;
+    }
+
+  ret = TRUE;
  out:
   return ret;
 }
 
+/*
+ * Hardlink everything in @reference_dir, a checkout of a tree
+ * identical to @source, into the existing directory @destination.
+ * Only the reference checkout is read, not the tree objects; @source
+ * is used for files which cannot be linked, which are queued as
+ * usual.  If @reference_dir is gone, @out_linked is %FALSE and
+ * nothing is done.
+ */
 static gboolean
-checkout_file_from_input (GFile          *file,
-                          OstreeRepoCheckoutMode mode,
-                          OstreeRepoCheckoutOverwriteMode    overwrite_mode,
-                          GFileInfo      *finfo,
-                          GVariant       *xattrs,
-                          GInputStream   *input,
-                          GCancellable   *cancellable,
-                          GError        **error)
+checkout_link_unchanged_tree (CheckoutScheduler  *sched,
+                              GFile              *destination,
+                              OstreeRepoFile     *source,
+                              GFile              *reference_dir,
+                              gboolean           *out_linked,
+                              GError            **error)
 {
   gboolean ret = FALSE;
+  guint n_linked = 0;
   GError *temp_error = NULL;
-  ot_lobj GFile *dir = NULL;
-  ot_lobj GFile *temp_file = NULL;
-  ot_lobj GFileInfo *temp_info = NULL;
+  GCancellable *cancellable = sched->cancellable;
+  ot_lobj GFileEnumerator *dir_enum = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
 
-  if (mode == OSTREE_REPO_CHECKOUT_MODE_USER)
+  dir_enum = g_file_enumerate_children (reference_dir, OSTREE_GIO_FAST_QUERYINFO,
+                                        G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                        cancellable, &temp_error);
+  if (!dir_enum)
     {
-      temp_info = g_file_info_dup (finfo);
-      
-      g_file_info_set_attribute_uint32 (temp_info, "unix::uid", geteuid ());
-      g_file_info_set_attribute_uint32 (temp_info, "unix::gid", getegid ());
-
-      xattrs = NULL;
+      if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)
+          || g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY))
+        {
+          g_clear_error (&temp_error);
+          ret = TRUE;
+          if (out_linked)
+            *out_linked = FALSE;
+        }
+      else
+        g_propagate_error (error, temp_error);
+      goto out;
     }
 
-  if (overwrite_mode == OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES)
+  while ((file_info = g_file_enumerator_next_file (dir_enum, cancellable, &temp_error)) != NULL)
     {
-      if (g_file_info_get_file_type (temp_info ? temp_info : finfo) == G_FILE_TYPE_DIRECTORY)
+      const char *name;
+      ot_lobj GFile *ref_child = NULL;
+      ot_lobj GFile *dest_child = NULL;
+      ot_lobj GFile *src_child = NULL;
+
+      if (checkout_scheduler_failed (sched))
+        break;
+
+      name = g_file_info_get_name (file_info);
+      ref_child = g_file_get_child (reference_dir, name);
+      dest_child = g_file_get_child (destination, name);
+      src_child = g_file_get_child ((GFile*)source, name);
+
+      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
         {
-          if (!ostree_create_file_from_input (file, temp_info ? temp_info : finfo,
-                                              xattrs, input,
-                                              cancellable, &temp_error))
+          ot_lvariant GVariant *xattrs = NULL;
+
+          if (sched->mode != OSTREE_REPO_CHECKOUT_MODE_USER)
             {
-              if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_EXISTS))
-                {
-                  g_clear_error (&temp_error);
-                }
-              else
-                {
-                  g_propagate_error (error, temp_error);
-                  goto out;
-                }
+              if (!ostree_get_xattrs_for_file (ref_child, &xattrs, cancellable, error))
+                goto out;
             }
-        }
-      else
-        {
-          dir = g_file_get_parent (file);
-          if (!ostree_create_temp_file_from_input (dir, NULL, "checkout",
-                                                   temp_info ? temp_info : finfo,
-                                                   xattrs, input, &temp_file, 
-                                                   cancellable, error))
+
+          if (!checkout_file_from_input (dest_child, sched->mode, sched->overwrite_mode,
+                                         file_info, xattrs, NULL,
+                                         cancellable, error))
             goto out;
-          
-          if (rename (ot_gfile_get_path_cached (temp_file), ot_gfile_get_path_cached (file)) < 0)
-            {
-              ot_util_set_error_from_errno (error, errno);
-              goto out;
-            }
-        }
-    }
-  else
-    {
-      if (!ostree_create_file_from_input (file, temp_info ? temp_info : finfo,
-                                          xattrs, input, cancellable, error))
-        goto out;
-    }
 
-  ret = TRUE;
- out:
-  return ret;
-}
+          if (!checkout_link_unchanged_tree (sched, dest_child, (OstreeRepoFile*)src_child,
+                                             ref_child, NULL, error))
+            goto out;
+        }
+      else if (link (ot_gfile_get_path_cached (ref_child),
+                     ot_gfile_get_path_cached (dest_child)) == 0)
+        n_linked++;
+      else if (errno == EEXIST || errno == EMLINK || errno == EXDEV)
+        {
+          ot_lobj GFileInfo *src_info = NULL;
 
-static gboolean
-checkout_file_hardlink (OstreeRepo                  *self,
-                        OstreeRepoCheckoutMode    mode,
-                        OstreeRepoCheckoutOverwriteMode    overwrite_mode,
-                        GFile                    *source,
-                        GFile                    *destination,
-                        gboolean                 *out_was_supported,
-                        GCancellable             *cancellable,
-                        GError                  **error)
-{
-  gboolean ret = FALSE;
-  gboolean ret_was_supported = FALSE;
-  ot_lobj GFile *dir = NULL;
+          src_info = g_file_query_info (src_child, OSTREE_GIO_FAST_QUERYINFO,
+                                        G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                        cancellable, error);
+          if (!src_info)
+            goto out;
 
-  if (link (ot_gfile_get_path_cached (source), ot_gfile_get_path_cached (destination)) != -1)
-    ret_was_supported = TRUE;
-  else if (errno == EMLINK || errno == EXDEV)
-    {
-      /* EMLINK and EXDEV shouldn't be fatal; we just can't do the
-       * optimization of hardlinking instead of copying.
-       */
-      ret_was_supported = FALSE;
-    }
-  else if (errno == EEXIST && overwrite_mode == OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES)
-    { 
-      /* Idiocy, from man rename(2)
-       *
-       * "If oldpath and newpath are existing hard links referring to
-       * the same file, then rename() does nothing, and returns a
-       * success status."
-       *
-       * So we can't make this atomic.  
-       */
-      (void) unlink (ot_gfile_get_path_cached (destination));
-      if (link (ot_gfile_get_path_cached (source), ot_gfile_get_path_cached (destination)) < 0)
+          if (!checkout_scheduler_queue (sched, (OstreeRepoFile*)src_child, src_info,
+                                         dest_child, error))
+            goto out;
+        }
+      else
         {
           ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "Linking %s from reference: ", name);
           goto out;
         }
+
+      g_clear_object (&file_info);
     }
-  else
+  if (temp_error != NULL)
     {
-      ot_util_set_error_from_errno (error, errno);
+      g_propagate_error (error, temp_error);
       goto out;
     }
 
+  g_mutex_lock (&sched->lock);
+  sched->n_files += n_linked;
+  g_mutex_unlock (&sched->lock);
+
   ret = TRUE;
-  if (out_was_supported)
-    *out_was_supported = ret_was_supported;
+  if (out_linked)
+    *out_linked = TRUE;
  out:
   return ret;
 }
 
+/*
+ * Check out @source to @destination.  If @reference is non-%NULL, it
+ * is the directory of another commit checked out at @reference_dir;
+ * files of directories identical to it are hardlinked from there.
+ */
 static gboolean
-find_loose_for_checkout (OstreeRepo             *self,
-                         const char             *checksum,
-                         GFile                 **out_loose_path,
-                         GCancellable           *cancellable,
-                         GError                **error)
+checkout_tree_walk (CheckoutScheduler        *sched,
+                    GFile                    *destination,
+                    OstreeRepoFile           *source,
+                    GFileInfo                *source_info,
+                    GFile                    *reference_dir,
+                    OstreeRepoFile           *reference,
+                    GError                  **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GFile *path = NULL;
-  struct stat stbuf;
+  gboolean linked = FALSE;
+  GError *temp_error = NULL;
+  GCancellable *cancellable = sched->cancellable;
+  ot_lvariant GVariant *xattrs = NULL;
+  ot_lobj GFileEnumerator *dir_enum = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
 
-  do
+  if (!ostree_repo_file_get_xattrs (source, &xattrs, NULL, error))
+    goto out;
+
+  if (!checkout_file_from_input (destination, sched->mode, sched->overwrite_mode,
+                                 source_info, xattrs, NULL,
+                                 cancellable, error))
+    goto out;
+
+  if (reference != NULL)
     {
-      if (self->mode == OSTREE_REPO_MODE_BARE)
-        path = ostree_repo_get_object_path (self, checksum, OSTREE_OBJECT_TYPE_FILE);
-      else
-        path = ostree_repo_get_archive_content_path (self, checksum);
+      if (!ostree_repo_file_ensure_resolved (source, error))
+        goto out;
+      if (!ostree_repo_file_ensure_resolved (reference, error))
+        goto out;
 
-      if (lstat (ot_gfile_get_path_cached (path), &stbuf) < 0)
+      /* The content checksum covers subdirectories too */
+      if (strcmp (ostree_repo_file_tree_get_content_checksum (source),
+                  ostree_repo_file_tree_get_content_checksum (reference)) == 0
+          && strcmp (ostree_repo_file_get_checksum (source),
+                     ostree_repo_file_get_checksum (reference)) == 0)
         {
-          if (errno != ENOENT)
+          if (!checkout_link_unchanged_tree (sched, destination, source, reference_dir,
+                                             &linked, error))
+            goto out;
+          if (linked)
             {
-              ot_util_set_error_from_errno (error, errno);
+              ret = TRUE;
               goto out;
             }
-          self = self->parent_repo;
         }
-      else if (S_ISLNK (stbuf.st_mode))
+    }
+
+  dir_enum = g_file_enumerate_children ((GFile*)source,
+                                        OSTREE_GIO_FAST_QUERYINFO, 
+                                        G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                        cancellable, 
+                                        error);
+  if (!dir_enum)
+    goto out;
+
+  while ((file_info = g_file_enumerator_next_file (dir_enum, cancellable, &temp_error)) != NULL)
+    {
+      const char *name;
+      ot_lobj GFile *dest_path = NULL;
+      ot_lobj GFile *src_child = NULL;
+
+      if (checkout_scheduler_failed (sched))
+        break;
+
+      name = g_file_info_get_name (file_info);
+      dest_path = g_file_get_child (destination, name);
+      src_child = g_file_get_child ((GFile*)source, name);
+
+      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
         {
-          /* Don't check out symbolic links via hardlink; it's very easy
-           * to hit the maximum number of hardlinks to an inode this way,
-           * especially since right now we have a lot of symbolic links to
-           * busybox.
-           *
-           * fs/ext4/ext4.h:#define EXT4_LINK_MAX		65000
-           */
-          self = self->parent_repo;
+          gboolean ref_is_dir = FALSE;
+          ot_lobj GFile *ref_dir_child = NULL;
+          ot_lobj GFile *ref_child = NULL;
+
+          if (reference != NULL
+              && ostree_repo_file_tree_find_child (reference, name, &ref_is_dir, NULL) >= 0
+              && ref_is_dir)
+            {
+              ref_dir_child = g_file_get_child (reference_dir, name);
+              ref_child = g_file_get_child ((GFile*)reference, name);
+            }
+
+          if (!checkout_tree_walk (sched, dest_path, (OstreeRepoFile*)src_child, file_info,
+                                   ref_dir_child, (OstreeRepoFile*)ref_child, error))
+            goto out;
         }
       else
-        break;
+        {
+          if (!checkout_scheduler_queue (sched, (OstreeRepoFile*)src_child, file_info,
+                                         dest_path, error))
+            goto out;
+        }
 
-      g_clear_object (&path);
-    } while (self != NULL);
+      g_clear_object (&file_info);
+    }
+  if (temp_error != NULL)
+    {
+      g_propagate_error (error, temp_error);
+      goto out;
+    }
 
   ret = TRUE;
-  ot_transfer_out_value (out_loose_path, &path);
  out:
   return ret;
 }
 
 typedef struct {
-  OstreeRepo               *repo;
   OstreeRepoCheckoutMode    mode;
   OstreeRepoCheckoutOverwriteMode    overwrite_mode;
   GFile                    *destination;
   OstreeRepoFile           *source;
   GFileInfo                *source_info;
-  GCancellable             *cancellable;
-
-  gboolean                  caught_error;
-  GError                   *error;
-
-  GSimpleAsyncResult       *result;
-} CheckoutOneFileAsyncData;
+} CheckoutTreeAsyncData;
 
 static void
-checkout_file_async_data_free (gpointer      data)
+checkout_tree_async_data_free (gpointer      data)
 {
-  CheckoutOneFileAsyncData *checkout_data = data;
+  CheckoutTreeAsyncData *checkout_data = data;
 
-  g_clear_object (&checkout_data->repo);
   g_clear_object (&checkout_data->destination);
   g_clear_object (&checkout_data->source);
   g_clear_object (&checkout_data->source_info);
-  g_clear_object (&checkout_data->cancellable);
   g_free (checkout_data);
 }
 
 static void
-checkout_file_thread (GSimpleAsyncResult     *result,
-                      GObject                *src,
-                      GCancellable           *cancellable)
+checkout_scheduler_init (CheckoutScheduler        *sched,
+                         OstreeRepo               *self,
+                         OstreeRepoCheckoutMode    mode,
+                         OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                         GCancellable             *cancellable)
 {
-  const char *checksum;
-  gboolean hardlink_supported;
-  GError *local_error = NULL;
-  GError **error = &local_error;
-  ot_lobj GFile *loose_path = NULL;
-  ot_lobj GInputStream *input = NULL;
-  ot_lvariant GVariant *xattrs = NULL;
-  CheckoutOneFileAsyncData *checkout_data;
+  guint n_workers = get_n_online_cpus ();
+
+  memset (sched, 0, sizeof (*sched));
+  sched->repo = self;
+  sched->mode = mode;
+  sched->overwrite_mode = overwrite_mode;
+  sched->cancellable = cancellable;
+  sched->batch = g_ptr_array_new_with_free_func ((GDestroyNotify)checkout_file_item_free);
+  sched->max_outstanding = n_workers * CHECKOUT_MAX_OUTSTANDING_PER_WORKER;
+  sched->start_time = g_get_monotonic_time ();
+  g_mutex_init (&sched->lock);
+  g_cond_init (&sched->cond);
+
+  /* Can only fail for exclusive pools */
+  sched->pool = g_thread_pool_new (checkout_scheduler_thread, sched,
+                                   n_workers, FALSE, NULL);
+  g_assert (sched->pool);
+}
 
-  checkout_data = g_simple_async_result_get_op_res_gpointer (result);
+/*
+ * Queue any remaining files, and wait for all of them.  @success
+ * is whether the caller walked the tree without error; if not, @error
+ * is already set.
+ */
+static gboolean
+checkout_scheduler_finish (CheckoutScheduler  *sched,
+                           gboolean            success,
+                           GError            **error)
+{
+  gboolean ret = FALSE;
+  OstreeRepo *self = sched->repo;
 
-  /* Hack to avoid trying to create device files as a user */
-  if (checkout_data->mode == OSTREE_REPO_CHECKOUT_MODE_USER
-      && g_file_info_get_file_type (checkout_data->source_info) == G_FILE_TYPE_SPECIAL)
-    goto out;
+  if (success)
+    success = checkout_scheduler_flush (sched, error);
+
+  /* Wait for queued files even on error, since they reference sched */
+  g_mutex_lock (&sched->lock);
+  while (sched->n_outstanding > 0)
+    g_cond_wait (&sched->cond, &sched->lock);
+  g_mutex_unlock (&sched->lock);
+  g_thread_pool_free (sched->pool, FALSE, TRUE);
 
-  checksum = ostree_repo_file_get_checksum ((OstreeRepoFile*)checkout_data->source);
+  g_ptr_array_unref (sched->batch);
+  g_mutex_clear (&sched->lock);
+  g_cond_clear (&sched->cond);
 
-  if ((checkout_data->repo->mode == OSTREE_REPO_MODE_BARE
-       && checkout_data->mode == OSTREE_REPO_CHECKOUT_MODE_NONE)
-      || (checkout_data->repo->mode == OSTREE_REPO_MODE_ARCHIVE
-          && checkout_data->mode == OSTREE_REPO_CHECKOUT_MODE_USER))
+  g_mutex_lock (&self->cache_lock);
+  self->checkout_n_files = sched->n_files;
+  self->checkout_elapsed_usec = g_get_monotonic_time () - sched->start_time;
+  g_mutex_unlock (&self->cache_lock);
+
+  if (!success)
     {
-      if (!find_loose_for_checkout (checkout_data->repo, checksum, &loose_path,
-                                    cancellable, error))
-        goto out;
+      g_clear_error (&sched->error);
+      goto out;
+    }
+  if (sched->error)
+    {
+      g_propagate_error (error, sched->error);
+      goto out;
     }
 
-  if (loose_path)
-    {
-      /* If we found one, try hardlinking */
-      if (!checkout_file_hardlink (checkout_data->repo, checkout_data->mode,
-                                   checkout_data->overwrite_mode, loose_path,
-                                   checkout_data->destination,
-                                   &hardlink_supported, cancellable, error))
-        goto out;
-    }
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+checkout_tree_thread (GSimpleAsyncResult     *result,
+                      GObject                *src,
+                      GCancellable           *cancellable)
+{
+  gboolean walked;
+  GError *local_error = NULL;
+  CheckoutTreeAsyncData *checkout_data;
+  CheckoutScheduler sched;
+
+  checkout_data = g_simple_async_result_get_op_res_gpointer (result);
 
-  /* Fall back to copy if there's no loose object, or we couldn't hardlink */
-  if (loose_path == NULL || !hardlink_supported)
-    {
-      if (!ostree_repo_load_file (checkout_data->repo, checksum, &input, NULL, &xattrs,
-                                  cancellable, error))
-        goto out;
+  checkout_scheduler_init (&sched, (OstreeRepo*)src, checkout_data->mode,
+                           checkout_data->overwrite_mode, cancellable);
 
-      if (!checkout_file_from_input (checkout_data->destination,
-                                     checkout_data->mode,
-                                     checkout_data->overwrite_mode,
-                                     checkout_data->source_info, xattrs, 
-                                     input, cancellable, error))
-        goto out;
-    }
+  walked = checkout_tree_walk (&sched, checkout_data->destination,
+                               checkout_data->source, checkout_data->source_info,
+                               NULL, NULL, &local_error);
 
- out:
-  if (local_error)
+  if (!checkout_scheduler_finish (&sched, walked, &local_error))
     g_simple_async_result_take_error (result, local_error);
 }
 
-static void
-checkout_one_file_async (OstreeRepo                  *self,
-                         OstreeRepoCheckoutMode    mode,
-                         OstreeRepoCheckoutOverwriteMode    overwrite_mode,
-                         OstreeRepoFile           *source,
-                         GFileInfo                *source_info,
-                         GFile                    *destination,
-                         GCancellable             *cancellable,
-                         GAsyncReadyCallback       callback,
-                         gpointer                  user_data)
+void
+ostree_repo_checkout_tree_async (OstreeRepo               *self,
+                                 OstreeRepoCheckoutMode    mode,
+                                 OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                                 GFile                    *destination,
+                                 OstreeRepoFile           *source,
+                                 GFileInfo                *source_info,
+                                 GCancellable             *cancellable,
+                                 GAsyncReadyCallback       callback,
+                                 gpointer                  user_data)
 {
-  CheckoutOneFileAsyncData *checkout_data;
+  CheckoutTreeAsyncData *checkout_data;
+  GSimpleAsyncResult *result;
 
-  checkout_data = g_new0 (CheckoutOneFileAsyncData, 1);
-  checkout_data->repo = g_object_ref (self);
+  checkout_data = g_new0 (CheckoutTreeAsyncData, 1);
   checkout_data->mode = mode;
   checkout_data->overwrite_mode = overwrite_mode;
   checkout_data->destination = g_object_ref (destination);
   checkout_data->source = g_object_ref (source);
   checkout_data->source_info = g_object_ref (source_info);
-  checkout_data->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
 
-  checkout_data->result = g_simple_async_result_new ((GObject*) self,
-                                                     callback, user_data,
-                                                     checkout_one_file_async);
+  result = g_simple_async_result_new ((GObject*) self,
+                                      callback, user_data,
+                                      ostree_repo_checkout_tree_async);
 
-  g_simple_async_result_set_op_res_gpointer (checkout_data->result, checkout_data,
-                                             checkout_file_async_data_free);
+  g_simple_async_result_set_op_res_gpointer (result, checkout_data,
+                                             checkout_tree_async_data_free);
 
-  g_simple_async_result_run_in_thread (checkout_data->result,
-                                       checkout_file_thread, G_PRIORITY_DEFAULT,
-                                       cancellable);
-  g_object_unref (checkout_data->result);
+  g_simple_async_result_run_in_thread (result, checkout_tree_thread,
+                                       G_PRIORITY_DEFAULT, cancellable);
+  g_object_unref (result);
 }
 
-static gboolean
-checkout_one_file_finish (OstreeRepo               *self,
-                          GAsyncResult             *result,
-                          GError                  **error)
+gboolean
+ostree_repo_checkout_tree_finish (OstreeRepo               *self,
+                                  GAsyncResult             *result,
+                                  GError                  **error)
 {
   GSimpleAsyncResult *simple;
 
-  g_return_val_if_fail (g_simple_async_result_is_valid (result, (GObject*)self, checkout_one_file_async), FALSE);
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, (GObject*)self, ostree_repo_checkout_tree_async), FALSE);
 
   simple = G_SIMPLE_ASYNC_RESULT (result);
   if (g_simple_async_result_propagate_error (simple, error))
@@ -4353,233 +7461,374 @@ checkout_one_file_finish (OstreeRepo               *self,
   return TRUE;
 }
 
-typedef struct {
-  OstreeRepo               *repo;
-  OstreeRepoCheckoutMode    mode;
-  OstreeRepoCheckoutOverwriteMode    overwrite_mode;
-  GFile                    *destination;
-  OstreeRepoFile           *source;
-  GFileInfo                *source_info;
-  GCancellable             *cancellable;
+/**
+ * ostree_repo_get_checkout_stats:
+ * @self: Repo
+ * @out_n_files: (out): Number of non-directory files checked out
+ * @out_elapsed_usec: (out): Wall clock time taken
+ *
+ * Statistics for the most recently completed
+ * ostree_repo_checkout_tree_async().
+ */
+void
+ostree_repo_get_checkout_stats (OstreeRepo     *self,
+                                guint          *out_n_files,
+                                guint64        *out_elapsed_usec)
+{
+  g_mutex_lock (&self->cache_lock);
+  if (out_n_files)
+    *out_n_files = self->checkout_n_files;
+  if (out_elapsed_usec)
+    *out_elapsed_usec = self->checkout_elapsed_usec;
+  g_mutex_unlock (&self->cache_lock);
+}
 
-  gboolean                  caught_error;
-  GError                   *error;
+/**
+ * ostree_repo_checkout_tree_from_reference:
+ * @self: Repo
+ * @mode: Checkout mode
+ * @overwrite_mode: Action for existing files
+ * @destination: Where to check out @source
+ * @source: Directory to check out
+ * @source_info: File information for @source
+ * @reference_checkout: Existing checkout of @reference
+ * @reference: Directory of another commit
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Like ostree_repo_checkout_tree_async(), but for each directory of
+ * @source whose content and metadata match the same path in
+ * @reference, hardlink its files from @reference_checkout rather
+ * than looking up each object in the repository.  Such directories
+ * are copied from @reference_checkout as they are on disk, and files
+ * are shared with it, so it should not be modified in place.
+ */
+gboolean
+ostree_repo_checkout_tree_from_reference (OstreeRepo               *self,
+                                          OstreeRepoCheckoutMode    mode,
+                                          OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                                          GFile                    *destination,
+                                          OstreeRepoFile           *source,
+                                          GFileInfo                *source_info,
+                                          GFile                    *reference_checkout,
+                                          OstreeRepoFile           *reference,
+                                          GCancellable             *cancellable,
+                                          GError                  **error)
+{
+  gboolean ret = FALSE;
+  gboolean walked;
+  CheckoutScheduler sched;
 
-  guint                     pending_ops;
-  GMainLoop                *loop;
-  GSimpleAsyncResult       *result;
-} CheckoutTreeAsyncData;
+  checkout_scheduler_init (&sched, self, mode, overwrite_mode, cancellable);
 
-static void
-checkout_tree_async_data_free (gpointer      data)
-{
-  CheckoutTreeAsyncData *checkout_data = data;
+  walked = checkout_tree_walk (&sched, destination, source, source_info,
+                               reference_checkout, reference, error);
 
-  g_clear_object (&checkout_data->repo);
-  g_clear_object (&checkout_data->destination);
-  g_clear_object (&checkout_data->source);
-  g_clear_object (&checkout_data->source_info);
-  g_clear_object (&checkout_data->cancellable);
-  g_free (checkout_data);
+  if (!checkout_scheduler_finish (&sched, walked, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
 }
 
-static void
-on_tree_async_child_op_complete (CheckoutTreeAsyncData   *data,
-                                 GError                  *local_error)
+static gboolean
+checkout_set_directory_metadata (GFile                    *destination,
+                                 OstreeRepoCheckoutMode    mode,
+                                 GFileInfo                *file_info,
+                                 GVariant                 *xattrs,
+                                 GCancellable             *cancellable,
+                                 GError                  **error)
 {
-  data->pending_ops--;
+  gboolean ret = FALSE;
+  const char *path = ot_gfile_get_path_cached (destination);
+  guint32 file_mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
 
-  if (local_error)
+  if (mode != OSTREE_REPO_CHECKOUT_MODE_USER)
     {
-      if (!data->caught_error)
+      guint32 uid = g_file_info_get_attribute_uint32 (file_info, "unix::uid");
+      guint32 gid = g_file_info_get_attribute_uint32 (file_info, "unix::gid");
+
+      if (lchown (path, uid, gid) < 0)
         {
-          data->caught_error = TRUE;
-          g_propagate_error (&data->error, local_error);
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "lchown(%u, %u) failed: ", uid, gid);
+          goto out;
         }
-      else
-        g_clear_error (&local_error);
     }
 
-  if (data->pending_ops != 0)
-    return;
-
-  if (data->caught_error)
-    g_simple_async_result_take_error (data->result, data->error);
-  g_simple_async_result_complete_in_idle (data->result);
-  g_object_unref (data->result);
-}
-
-static void
-on_one_subdir_checked_out (GObject          *src,
-                           GAsyncResult     *result,
-                           gpointer          user_data)
-{
-  CheckoutTreeAsyncData *data = user_data;
-  GError *local_error = NULL;
+  if (chmod (path, file_mode) < 0)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      g_prefix_error (error, "chmod(%u) failed: ", file_mode);
+      goto out;
+    }
 
-  if (!ostree_repo_checkout_tree_finish ((OstreeRepo*) src, result, &local_error))
-    goto out;
+  if (mode != OSTREE_REPO_CHECKOUT_MODE_USER && xattrs != NULL)
+    {
+      if (!ostree_set_xattrs (destination, xattrs, cancellable, error))
+        goto out;
+    }
 
+  ret = TRUE;
  out:
-  on_tree_async_child_op_complete (data, local_error);
+  return ret;
 }
 
-static void
-on_one_file_checked_out (GObject          *src,
-                         GAsyncResult     *result,
-                         gpointer          user_data)
+/*
+ * Bring @new_dir from a checkout of @from to one of @to.  If
+ * @in_place, @new_dir is the existing checkout; otherwise it is
+ * created, and unchanged files are hardlinked from @old_dir.
+ */
+static gboolean
+checkout_delta_walk (CheckoutScheduler        *sched,
+                     gboolean                  in_place,
+                     GFile                    *old_dir,
+                     OstreeRepoFile           *from,
+                     GFile                    *new_dir,
+                     OstreeRepoFile           *to,
+                     GFileInfo                *to_info,
+                     GError                  **error)
 {
-  CheckoutTreeAsyncData *data = user_data;
-  GError *local_error = NULL;
+  gboolean ret = FALSE;
+  gboolean metadata_changed;
+  gboolean content_changed;
+  gboolean linked = FALSE;
+  GError *temp_error = NULL;
+  GCancellable *cancellable = sched->cancellable;
+  ot_lvariant GVariant *xattrs = NULL;
+  ot_lobj GFileEnumerator *dir_enum = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
 
-  if (!checkout_one_file_finish ((OstreeRepo*) src, result, &local_error))
+  if (!ostree_repo_file_ensure_resolved (from, error))
+    goto out;
+  if (!ostree_repo_file_ensure_resolved (to, error))
     goto out;
 
- out:
-  on_tree_async_child_op_complete (data, local_error);
-}
+  metadata_changed = strcmp (ostree_repo_file_get_checksum (from),
+                             ostree_repo_file_get_checksum (to)) != 0;
+  content_changed = strcmp (ostree_repo_file_tree_get_content_checksum (from),
+                            ostree_repo_file_tree_get_content_checksum (to)) != 0;
 
-static void
-on_got_next_files (GObject          *src,
-                   GAsyncResult     *result,
-                   gpointer          user_data)
-{
-  CheckoutTreeAsyncData *data = user_data;
-  GError *local_error = NULL;
-  GList *files = NULL;
-  GList *iter = NULL;
+  /* Fast path for unmodified directories, as in diff */
+  if (in_place && !metadata_changed && !content_changed)
+    {
+      ret = TRUE;
+      goto out;
+    }
 
-  files = g_file_enumerator_next_files_finish ((GFileEnumerator*) src, result, &local_error);
-  if (local_error)
+  if (!ostree_repo_file_get_xattrs (to, &xattrs, NULL, error))
     goto out;
 
-  if (files)
+  if (!in_place)
+    {
+      if (!checkout_file_from_input (new_dir, sched->mode,
+                                     OSTREE_REPO_CHECKOUT_OVERWRITE_NONE,
+                                     to_info, xattrs, NULL,
+                                     cancellable, error))
+        goto out;
+
+      if (!metadata_changed && !content_changed)
+        {
+          if (!checkout_link_unchanged_tree (sched, new_dir, to, old_dir,
+                                             &linked, error))
+            goto out;
+          if (linked)
+            {
+              ret = TRUE;
+              goto out;
+            }
+        }
+    }
+  else
     {
-      g_file_enumerator_next_files_async ((GFileEnumerator*)src, 50, G_PRIORITY_DEFAULT,
-                                          data->cancellable,
-                                          on_got_next_files, data);
-      data->pending_ops++;
+      if (metadata_changed)
+        {
+          if (!checkout_set_directory_metadata (new_dir, sched->mode, to_info, xattrs,
+                                                cancellable, error))
+            goto out;
+        }
+
+      /* Remove whatever is gone first */
+      dir_enum = g_file_enumerate_children ((GFile*)from, OSTREE_GIO_FAST_QUERYINFO,
+                                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                            cancellable, error);
+      if (!dir_enum)
+        goto out;
+
+      while ((file_info = g_file_enumerator_next_file (dir_enum, cancellable, &temp_error)) != NULL)
+        {
+          const char *name = g_file_info_get_name (file_info);
+          gboolean is_dir;
+
+          if (ostree_repo_file_tree_find_child (to, name, &is_dir, NULL) < 0)
+            {
+              ot_lobj GFile *child = g_file_get_child (new_dir, name);
+
+              if (!ot_gfile_rm_rf (child, cancellable, error))
+                goto out;
+            }
+
+          g_clear_object (&file_info);
+        }
+      if (temp_error != NULL)
+        {
+          g_propagate_error (error, temp_error);
+          goto out;
+        }
+      g_clear_object (&dir_enum);
     }
 
-  for (iter = files; iter; iter = iter->next)
+  dir_enum = g_file_enumerate_children ((GFile*)to, OSTREE_GIO_FAST_QUERYINFO,
+                                        G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                        cancellable, error);
+  if (!dir_enum)
+    goto out;
+
+  while ((file_info = g_file_enumerator_next_file (dir_enum, cancellable, &temp_error)) != NULL)
     {
-      GFileInfo *file_info = iter->data;
       const char *name;
-      guint32 type;
-      ot_lobj GFile *dest_path = NULL;
-      ot_lobj GFile *src_child = NULL;
-
-      name = g_file_info_get_attribute_byte_string (file_info, "standard::name"); 
-      type = g_file_info_get_attribute_uint32 (file_info, "standard::type");
+      gboolean from_exists;
+      gboolean from_is_dir = FALSE;
+      ot_lobj GFile *old_child = NULL;
+      ot_lobj GFile *new_child = NULL;
+      ot_lobj GFile *from_child = NULL;
+      ot_lobj GFile *to_child = NULL;
+
+      if (checkout_scheduler_failed (sched))
+        break;
 
-      dest_path = g_file_get_child (data->destination, name);
-      src_child = g_file_get_child ((GFile*)data->source, name);
+      name = g_file_info_get_name (file_info);
+      old_child = g_file_get_child (old_dir, name);
+      new_child = g_file_get_child (new_dir, name);
+      to_child = g_file_get_child ((GFile*)to, name);
+      from_exists = ostree_repo_file_tree_find_child (from, name, &from_is_dir, NULL) >= 0;
+      if (from_exists)
+        from_child = g_file_get_child ((GFile*)from, name);
 
-      if (type == G_FILE_TYPE_DIRECTORY)
+      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
         {
-          ostree_repo_checkout_tree_async (data->repo,
-                                           data->mode,
-                                           data->overwrite_mode,
-                                           dest_path, (OstreeRepoFile*)src_child, file_info,
-                                           data->cancellable,
-                                           on_one_subdir_checked_out,
-                                           data);
+          if (from_exists && from_is_dir)
+            {
+              if (!checkout_delta_walk (sched, in_place, old_child, (OstreeRepoFile*)from_child,
+                                        new_child, (OstreeRepoFile*)to_child, file_info,
+                                        error))
+                goto out;
+            }
+          else
+            {
+              if (in_place && from_exists)
+                {
+                  if (!ot_gfile_unlink (new_child, cancellable, error))
+                    goto out;
+                }
+              if (!checkout_tree_walk (sched, new_child, (OstreeRepoFile*)to_child,
+                                       file_info, NULL, NULL, error))
+                goto out;
+            }
         }
       else
         {
-          checkout_one_file_async (data->repo, data->mode,
-                                   data->overwrite_mode,
-                                   (OstreeRepoFile*)src_child, file_info, 
-                                   dest_path, data->cancellable,
-                                   on_one_file_checked_out,
-                                   data);
+          gboolean done = FALSE;
+
+          if (from_exists && !from_is_dir
+              && strcmp (ostree_repo_file_get_checksum ((OstreeRepoFile*)from_child),
+                         ostree_repo_file_get_checksum ((OstreeRepoFile*)to_child)) == 0)
+            {
+              if (in_place)
+                done = TRUE;
+              else if (link (ot_gfile_get_path_cached (old_child),
+                             ot_gfile_get_path_cached (new_child)) == 0)
+                done = TRUE;
+              else if (!(errno == ENOENT || errno == EMLINK || errno == EXDEV))
+                {
+                  ot_util_set_error_from_errno (error, errno);
+                  goto out;
+                }
+            }
+          else if (in_place && from_exists && from_is_dir)
+            {
+              if (!ot_gfile_rm_rf (new_child, cancellable, error))
+                goto out;
+            }
+
+          if (!done)
+            {
+              if (!checkout_scheduler_queue (sched, (OstreeRepoFile*)to_child, file_info,
+                                             new_child, error))
+                goto out;
+            }
         }
-      data->pending_ops++;
-      g_object_unref (file_info);
+
+      g_clear_object (&file_info);
+    }
+  if (temp_error != NULL)
+    {
+      g_propagate_error (error, temp_error);
+      goto out;
     }
-  g_list_free (files);
 
+  ret = TRUE;
  out:
-  on_tree_async_child_op_complete (data, local_error);
+  return ret;
 }
 
-void
-ostree_repo_checkout_tree_async (OstreeRepo               *self,
+/**
+ * ostree_repo_checkout_tree_delta:
+ * @self: Repo
+ * @mode: Checkout mode
+ * @old_checkout: Existing checkout of @from
+ * @from: Directory of the old commit
+ * @destination: Where to check out @to
+ * @to: Directory of the new commit
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Check out @to, given an existing checkout of @from.  Only paths
+ * which differ between the two trees are written; subdirectories
+ * whose content and metadata checksums are unchanged are skipped.
+ *
+ * If @destination is @old_checkout, it is updated in place.
+ * Otherwise @destination is created, and unchanged subdirectories
+ * are hardlinked from @old_checkout as they are on disk, without
+ * reading their tree objects; @old_checkout is left intact, and must
+ * not have been modified since it was checked out.
+ */
+gboolean
+ostree_repo_checkout_tree_delta (OstreeRepo               *self,
                                  OstreeRepoCheckoutMode    mode,
-                                 OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                                 GFile                    *old_checkout,
+                                 OstreeRepoFile           *from,
                                  GFile                    *destination,
-                                 OstreeRepoFile           *source,
-                                 GFileInfo                *source_info,
+                                 OstreeRepoFile           *to,
                                  GCancellable             *cancellable,
-                                 GAsyncReadyCallback       callback,
-                                 gpointer                  user_data)
+                                 GError                  **error)
 {
-  CheckoutTreeAsyncData *checkout_data;
-  ot_lobj GFileInfo *file_info = NULL;
-  ot_lvariant GVariant *xattrs = NULL;
-  ot_lobj GFileEnumerator *dir_enum = NULL;
-  GError *local_error = NULL;
-  GError **error = &local_error;
-
-  checkout_data = g_new0 (CheckoutTreeAsyncData, 1);
-  checkout_data->repo = g_object_ref (self);
-  checkout_data->mode = mode;
-  checkout_data->overwrite_mode = overwrite_mode;
-  checkout_data->destination = g_object_ref (destination);
-  checkout_data->source = g_object_ref (source);
-  checkout_data->source_info = g_object_ref (source_info);
-  checkout_data->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
-  checkout_data->pending_ops++; /* Count this function */
-
-  checkout_data->result = g_simple_async_result_new ((GObject*) self,
-                                                     callback, user_data,
-                                                     ostree_repo_checkout_tree_async);
-
-  g_simple_async_result_set_op_res_gpointer (checkout_data->result, checkout_data,
-                                             checkout_tree_async_data_free);
-
-  if (!ostree_repo_file_get_xattrs (checkout_data->source, &xattrs, NULL, error))
+  gboolean ret = FALSE;
+  gboolean walked;
+  CheckoutScheduler sched;
+  ot_lobj GFileInfo *to_info = NULL;
+
+  to_info = g_file_query_info ((GFile*)to, OSTREE_GIO_FAST_QUERYINFO,
+                               G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                               cancellable, error);
+  if (!to_info)
     goto out;
 
-  if (!checkout_file_from_input (checkout_data->destination,
-                                 checkout_data->mode,
-                                 checkout_data->overwrite_mode,
-                                 checkout_data->source_info,
-                                 xattrs, NULL,
-                                 cancellable, error))
-    goto out;
+  /* Changed files replace the old ones */
+  checkout_scheduler_init (&sched, self, mode, OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES,
+                           cancellable);
 
-  g_clear_pointer (&xattrs, (GDestroyNotify) g_variant_unref);
+  walked = checkout_delta_walk (&sched, g_file_equal (old_checkout, destination),
+                                old_checkout, from, destination, to, to_info,
+                                error);
 
-  dir_enum = g_file_enumerate_children ((GFile*)checkout_data->source,
-                                        OSTREE_GIO_FAST_QUERYINFO, 
-                                        G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                        cancellable, 
-                                        error);
-  if (!dir_enum)
+  if (!checkout_scheduler_finish (&sched, walked, error))
     goto out;
 
-  g_file_enumerator_next_files_async (dir_enum, 50, G_PRIORITY_DEFAULT, cancellable,
-                                      on_got_next_files, checkout_data);
-  checkout_data->pending_ops++;
-
+  ret = TRUE;
  out:
-  on_tree_async_child_op_complete (checkout_data, local_error);
-}
-
-gboolean
-ostree_repo_checkout_tree_finish (OstreeRepo               *self,
-                                  GAsyncResult             *result,
-                                  GError                  **error)
-{
-  GSimpleAsyncResult *simple;
-
-  g_return_val_if_fail (g_simple_async_result_is_valid (result, (GObject*)self, ostree_repo_checkout_tree_async), FALSE);
-
-  simple = G_SIMPLE_ASYNC_RESULT (result);
-  if (g_simple_async_result_propagate_error (simple, error))
-    return FALSE;
-  return TRUE;
+  return ret;
 }
 
 gboolean
@@ -120,6 +120,19 @@ gboolean      ostree_repo_stage_file_object_trusted (OstreeRepo   *self,
                                                      GCancellable *cancellable,
                                                      GError      **error);
 
+gboolean      ostree_repo_stage_file_object_from_raw (OstreeRepo       *self,
+                                                      const char       *checksum,
+                                                      GFileInfo        *file_info,
+                                                      GVariant         *xattrs,
+                                                      GFile            *raw_path,
+                                                      GCancellable     *cancellable,
+                                                      GError          **error);
+
+gboolean      ostree_repo_stage_static_delta_part (OstreeRepo       *self,
+                                                   GVariant         *part,
+                                                   GCancellable     *cancellable,
+                                                   GError          **error);
+
 gboolean      ostree_repo_resolve_rev (OstreeRepo  *self,
                                        const char  *rev,
                                        gboolean     allow_noent,
@@ -149,6 +162,10 @@ gboolean      ostree_repo_load_variant (OstreeRepo  *self,
                                         GVariant     **out_variant,
                                         GError       **error);
 
+void          ostree_repo_get_metadata_cache_stats (OstreeRepo     *self,
+                                                    guint          *out_hits,
+                                                    guint          *out_misses);
+
 gboolean      ostree_repo_load_pack_index (OstreeRepo    *self,
                                            const char    *pack_checksum, 
                                            gboolean       is_meta,
@@ -178,6 +195,15 @@ gboolean ostree_repo_load_file (OstreeRepo         *self,
                                 GCancellable       *cancellable,
                                 GError            **error);
 
+gboolean ostree_repo_load_file_content (OstreeRepo         *self,
+                                        const char         *checksum,
+                                        guchar            **out_data,
+                                        gsize              *out_len,
+                                        GFileInfo         **out_file_info,
+                                        GVariant          **out_xattrs,
+                                        GCancellable       *cancellable,
+                                        GError            **error);
+
 typedef enum {
   OSTREE_REPO_COMMIT_FILTER_ALLOW,
   OSTREE_REPO_COMMIT_FILTER_SKIP
@@ -191,19 +217,27 @@ typedef OstreeRepoCommitFilterResult (*OstreeRepoCommitFilter) (OstreeRepo    *r
 typedef struct {
   volatile gint refcount;
 
-  guint reserved_flags : 31;
+  guint reserved_flags : 30;
   guint skip_xattrs : 1;
+  guint use_stat_cache : 1;
 
   OstreeRepoCommitFilter filter;
   gpointer user_data;
 
-  gpointer reserved[3];
+  /* Threads used to stage files; 0 means one per online CPU */
+  guint n_workers;
+
+  gpointer reserved[2];
 } OstreeRepoCommitModifier;
 
 OstreeRepoCommitModifier *ostree_repo_commit_modifier_new (void);
 
 void ostree_repo_commit_modifier_unref (OstreeRepoCommitModifier *modifier);
 
+void ostree_repo_get_stat_cache_stats (OstreeRepo     *self,
+                                       guint          *out_hits,
+                                       guint          *out_misses);
+
 gboolean      ostree_repo_stage_directory_to_mtree (OstreeRepo         *self,
                                                     GFile              *dir,
                                                     OstreeMutableTree  *mtree,
@@ -323,6 +357,32 @@ ostree_repo_checkout_tree_finish (OstreeRepo               *self,
                                   GAsyncResult             *result,
                                   GError                  **error);
 
+gboolean
+ostree_repo_checkout_tree_from_reference (OstreeRepo               *self,
+                                          OstreeRepoCheckoutMode    mode,
+                                          OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                                          GFile                    *destination,
+                                          OstreeRepoFile           *source,
+                                          GFileInfo                *source_info,
+                                          GFile                    *reference_checkout,
+                                          OstreeRepoFile           *reference,
+                                          GCancellable             *cancellable,
+                                          GError                  **error);
+
+gboolean
+ostree_repo_checkout_tree_delta (OstreeRepo               *self,
+                                 OstreeRepoCheckoutMode    mode,
+                                 GFile                    *old_checkout,
+                                 OstreeRepoFile           *from,
+                                 GFile                    *destination,
+                                 OstreeRepoFile           *to,
+                                 GCancellable             *cancellable,
+                                 GError                  **error);
+
+void ostree_repo_get_checkout_stats (OstreeRepo     *self,
+                                     guint          *out_n_files,
+                                     guint64        *out_elapsed_usec);
+
 gboolean       ostree_repo_read_commit (OstreeRepo *self,
                                         const char *rev,
                                         GFile       **out_root,
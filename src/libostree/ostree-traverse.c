@@ -34,17 +34,37 @@ ostree_traverse_new_reachable (void)
                                 (GDestroyNotify)g_variant_unref, NULL);
 }
 
+/* Takes ownership of @key; it is appended to @inout_ordered, if
+ * given, the first time it becomes reachable.
+ */
+static void
+add_reachable (GHashTable      *inout_reachable,
+               GPtrArray       *inout_ordered,
+               GVariant        *key)
+{
+  if (g_hash_table_lookup (inout_reachable, key))
+    {
+      g_variant_unref (key);
+      return;
+    }
+
+  g_hash_table_insert (inout_reachable, key, key);
+  if (inout_ordered)
+    g_ptr_array_add (inout_ordered, g_variant_ref (key));
+}
+
 static gboolean
 traverse_dirtree_internal (OstreeRepo      *repo,
                            const char      *dirtree_checksum,
                            int              recursion_depth,
                            GHashTable      *inout_reachable,
+                           GPtrArray       *inout_ordered,
                            GCancellable    *cancellable,
                            GError         **error)
 {
   gboolean ret = FALSE;
   int n, i;
-  ot_lvariant GVariant *key;
+  ot_lvariant GVariant *key = NULL;
   ot_lvariant GVariant *tree = NULL;
   ot_lvariant GVariant *files_variant = NULL;
   ot_lvariant GVariant *dirs_variant = NULL;
@@ -66,7 +86,7 @@ traverse_dirtree_internal (OstreeRepo      *repo,
   key = ostree_object_name_serialize (dirtree_checksum, OSTREE_OBJECT_TYPE_DIR_TREE);
   if (!g_hash_table_lookup (inout_reachable, key))
     { 
-      g_hash_table_insert (inout_reachable, key, key);
+      add_reachable (inout_reachable, inout_ordered, key);
       key = NULL;
 
       /* PARSE OSTREE_SERIALIZED_TREE_VARIANT */
@@ -80,9 +100,8 @@ traverse_dirtree_internal (OstreeRepo      *repo,
           g_variant_get_child (files_variant, i, "(&s@ay)", &filename, &csum_v);
           g_free (tmp_checksum);
           tmp_checksum = ostree_checksum_from_bytes_v (csum_v);
-          key = ostree_object_name_serialize (tmp_checksum, OSTREE_OBJECT_TYPE_FILE);
-          g_hash_table_replace (inout_reachable, key, key);
-          key = NULL;
+          add_reachable (inout_reachable, inout_ordered,
+                         ostree_object_name_serialize (tmp_checksum, OSTREE_OBJECT_TYPE_FILE));
         }
 
       dirs_variant = g_variant_get_child_value (tree, 1);
@@ -96,17 +115,17 @@ traverse_dirtree_internal (OstreeRepo      *repo,
           g_variant_get_child (dirs_variant, i, "(&s@ay@ay)",
                                &dirname, &content_csum_v, &metadata_csum_v);
       
+          g_free (tmp_checksum);
+          tmp_checksum = ostree_checksum_from_bytes_v (metadata_csum_v);
+          add_reachable (inout_reachable, inout_ordered,
+                         ostree_object_name_serialize (tmp_checksum, OSTREE_OBJECT_TYPE_DIR_META));
+
           g_free (tmp_checksum);
           tmp_checksum = ostree_checksum_from_bytes_v (content_csum_v);
           if (!traverse_dirtree_internal (repo, tmp_checksum, recursion_depth + 1,
-                                          inout_reachable, cancellable, error))
+                                          inout_reachable, inout_ordered,
+                                          cancellable, error))
             goto out;
-
-          g_free (tmp_checksum);
-          tmp_checksum = ostree_checksum_from_bytes_v (metadata_csum_v);
-          key = ostree_object_name_serialize (tmp_checksum, OSTREE_OBJECT_TYPE_DIR_META);
-          g_hash_table_replace (inout_reachable, key, key);
-          key = NULL;
         }
     }
 
@@ -123,16 +142,26 @@ ostree_traverse_dirtree (OstreeRepo      *repo,
                          GError         **error)
 {
   return traverse_dirtree_internal (repo, dirtree_checksum, 0,
-                                    inout_reachable, cancellable, error);
+                                    inout_reachable, NULL, cancellable, error);
 }
 
+/**
+ * ostree_traverse_commit_ordered:
+ * @inout_ordered: Array of serialized object names
+ *
+ * Like ostree_traverse_commit(), but also append each object to
+ * @inout_ordered as it is first reached.  Each commit comes before
+ * its parent, and its tree is walked depth-first, with the files of
+ * a directory ahead of its subdirectories.
+ */
 gboolean
-ostree_traverse_commit (OstreeRepo      *repo,
-                        const char      *commit_checksum,
-                        int              maxdepth,
-                        GHashTable      *inout_reachable,
-                        GCancellable    *cancellable,
-                        GError         **error)
+ostree_traverse_commit_ordered (OstreeRepo      *repo,
+                                const char      *commit_checksum,
+                                int              maxdepth,
+                                GHashTable      *inout_reachable,
+                                GPtrArray       *inout_ordered,
+                                GCancellable    *cancellable,
+                                GError         **error)
 {
   gboolean ret = FALSE;
   ot_lfree char*tmp_checksum = NULL;
@@ -143,28 +172,26 @@ ostree_traverse_commit (OstreeRepo      *repo,
       ot_lvariant GVariant *parent_csum_bytes = NULL;
       ot_lvariant GVariant *meta_csum_bytes = NULL;
       ot_lvariant GVariant *content_csum_bytes = NULL;
-      ot_lvariant GVariant *key = NULL;
       ot_lvariant GVariant *commit = NULL;
 
       /* PARSE OSTREE_SERIALIZED_COMMIT_VARIANT */
       if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, commit_checksum, &commit, error))
         goto out;
   
-      key = ostree_object_name_serialize (commit_checksum, OSTREE_OBJECT_TYPE_COMMIT);
-      g_hash_table_replace (inout_reachable, key, key);
-      key = NULL;
+      add_reachable (inout_reachable, inout_ordered,
+                     ostree_object_name_serialize (commit_checksum, OSTREE_OBJECT_TYPE_COMMIT));
 
       g_variant_get_child (commit, 7, "@ay", &meta_csum_bytes);
       g_free (tmp_checksum);
       tmp_checksum = ostree_checksum_from_bytes_v (meta_csum_bytes);
-      key = ostree_object_name_serialize (tmp_checksum, OSTREE_OBJECT_TYPE_DIR_META);
-      g_hash_table_replace (inout_reachable, key, key);
-      key = NULL;
+      add_reachable (inout_reachable, inout_ordered,
+                     ostree_object_name_serialize (tmp_checksum, OSTREE_OBJECT_TYPE_DIR_META));
 
       g_variant_get_child (commit, 6, "@ay", &content_csum_bytes);
       g_free (tmp_checksum);
       tmp_checksum = ostree_checksum_from_bytes_v (content_csum_bytes);
-      if (!ostree_traverse_dirtree (repo, tmp_checksum, inout_reachable, cancellable, error))
+      if (!traverse_dirtree_internal (repo, tmp_checksum, 0, inout_reachable, inout_ordered,
+                                      cancellable, error))
         goto out;
 
       if (maxdepth == -1 || maxdepth > 0)
@@ -190,3 +217,15 @@ ostree_traverse_commit (OstreeRepo      *repo,
   return ret;
 }
 
+gboolean
+ostree_traverse_commit (OstreeRepo      *repo,
+                        const char      *commit_checksum,
+                        int              maxdepth,
+                        GHashTable      *inout_reachable,
+                        GCancellable    *cancellable,
+                        GError         **error)
+{
+  return ostree_traverse_commit_ordered (repo, commit_checksum, maxdepth,
+                                         inout_reachable, NULL,
+                                         cancellable, error);
+}
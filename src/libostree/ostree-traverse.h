@@ -43,6 +43,14 @@ gboolean ostree_traverse_commit (OstreeRepo         *repo,
                                  GCancellable       *cancellable,
                                  GError            **error);
 
+gboolean ostree_traverse_commit_ordered (OstreeRepo         *repo,
+                                         const char         *commit_checksum,
+                                         int                 maxdepth,
+                                         GHashTable         *inout_reachable,
+                                         GPtrArray          *inout_ordered,
+                                         GCancellable       *cancellable,
+                                         GError            **error);
+
 G_END_DECLS
 
 #endif /* _OSTREE_REPO */
@@ -0,0 +1,344 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The OSTree Authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <zstd.h>
+#include <gio/gio.h>
+#include "ostree-zstd-converter.h"
+
+static void ostree_zstd_converter_iface_init (GConverterIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (OstreeZstdConverter, ostree_zstd_converter, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+                                                ostree_zstd_converter_iface_init))
+
+struct _OstreeZstdDictionary {
+  volatile gint refcount;
+  ZSTD_DDict *ddict;
+};
+
+struct _OstreeZstdConverterPrivate {
+  gboolean compress;
+  int level;
+  GVariant *dictionary;
+  OstreeZstdDictionary *ddictionary;
+
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+};
+
+static void
+ostree_zstd_converter_finalize (GObject *object)
+{
+  OstreeZstdConverter *self = OSTREE_ZSTD_CONVERTER (object);
+
+  if (self->priv->cctx)
+    ZSTD_freeCCtx (self->priv->cctx);
+  if (self->priv->dctx)
+    ZSTD_freeDCtx (self->priv->dctx);
+  if (self->priv->dictionary)
+    g_variant_unref (self->priv->dictionary);
+  if (self->priv->ddictionary)
+    ostree_zstd_dictionary_unref (self->priv->ddictionary);
+
+  G_OBJECT_CLASS (ostree_zstd_converter_parent_class)->finalize (object);
+}
+
+static void
+ostree_zstd_converter_class_init (OstreeZstdConverterClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (OstreeZstdConverterPrivate));
+
+  gobject_class->finalize = ostree_zstd_converter_finalize;
+}
+
+static void
+ostree_zstd_converter_init (OstreeZstdConverter *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+                                            OSTREE_TYPE_ZSTD_CONVERTER,
+                                            OstreeZstdConverterPrivate);
+}
+
+static gboolean
+check_zstd_result (size_t    result,
+                   GError  **error)
+{
+  if (ZSTD_isError (result))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "zstd: %s", ZSTD_getErrorName (result));
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static gboolean
+setup_context (OstreeZstdConverter  *self,
+               GError              **error)
+{
+  gconstpointer dict_data = NULL;
+  gsize dict_len = 0;
+
+  if (self->priv->dictionary)
+    {
+      dict_data = g_variant_get_data (self->priv->dictionary);
+      dict_len = g_variant_get_size (self->priv->dictionary);
+    }
+
+  if (self->priv->compress)
+    {
+      if (self->priv->cctx == NULL)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "zstd: Failed to create compression context");
+          return FALSE;
+        }
+      if (self->priv->level < ZSTD_minCLevel () || self->priv->level > ZSTD_maxCLevel ())
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Invalid zstd compression level %d", self->priv->level);
+          return FALSE;
+        }
+      if (!check_zstd_result (ZSTD_CCtx_setParameter (self->priv->cctx, ZSTD_c_compressionLevel,
+                                                      self->priv->level), error))
+        return FALSE;
+      if (dict_len > 0
+          && !check_zstd_result (ZSTD_CCtx_loadDictionary (self->priv->cctx, dict_data, dict_len),
+                                 error))
+        return FALSE;
+    }
+  else
+    {
+      if (self->priv->dctx == NULL)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "zstd: Failed to create decompression context");
+          return FALSE;
+        }
+      if (self->priv->ddictionary
+          && !check_zstd_result (ZSTD_DCtx_refDDict (self->priv->dctx,
+                                                     self->priv->ddictionary->ddict),
+                                 error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+ostree_zstd_converter_reset (GConverter *converter)
+{
+  OstreeZstdConverter *self = OSTREE_ZSTD_CONVERTER (converter);
+
+  if (self->priv->compress)
+    ZSTD_CCtx_reset (self->priv->cctx, ZSTD_reset_session_only);
+  else
+    ZSTD_DCtx_reset (self->priv->dctx, ZSTD_reset_session_only);
+}
+
+static GConverterResult
+ostree_zstd_converter_convert (GConverter *converter,
+                               const void *inbuf,
+                               gsize       inbuf_size,
+                               void       *outbuf,
+                               gsize       outbuf_size,
+                               GConverterFlags flags,
+                               gsize      *bytes_read,
+                               gsize      *bytes_written,
+                               GError    **error)
+{
+  OstreeZstdConverter *self = OSTREE_ZSTD_CONVERTER (converter);
+  ZSTD_inBuffer input = { inbuf, inbuf_size, 0 };
+  ZSTD_outBuffer output = { outbuf, outbuf_size, 0 };
+  ZSTD_EndDirective directive = ZSTD_e_continue;
+  gsize remaining;
+
+  if (self->priv->compress)
+    {
+      if (flags & G_CONVERTER_INPUT_AT_END)
+        directive = ZSTD_e_end;
+      else if (flags & G_CONVERTER_FLUSH)
+        directive = ZSTD_e_flush;
+
+      remaining = ZSTD_compressStream2 (self->priv->cctx, &output, &input, directive);
+    }
+  else
+    remaining = ZSTD_decompressStream (self->priv->dctx, &output, &input);
+
+  if (ZSTD_isError (remaining))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "zstd: %s", ZSTD_getErrorName (remaining));
+      return G_CONVERTER_ERROR;
+    }
+
+  *bytes_read = input.pos;
+  *bytes_written = output.pos;
+
+  if (self->priv->compress)
+    {
+      if (directive == ZSTD_e_end && remaining == 0)
+        return G_CONVERTER_FINISHED;
+      if (directive == ZSTD_e_flush && remaining == 0)
+        return G_CONVERTER_FLUSHED;
+    }
+  else if (remaining == 0)
+    return G_CONVERTER_FINISHED;
+
+  if (input.pos == 0 && output.pos == 0)
+    {
+      if (outbuf_size == 0 || (remaining > 0 && inbuf_size > 0))
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                             "Need more output space");
+      else
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                             "Need more input");
+      return G_CONVERTER_ERROR;
+    }
+
+  return G_CONVERTER_CONVERTED;
+}
+
+static void
+ostree_zstd_converter_iface_init (GConverterIface *iface)
+{
+  iface->convert = ostree_zstd_converter_convert;
+  iface->reset = ostree_zstd_converter_reset;
+}
+
+/**
+ * ostree_zstd_converter_new_compressor:
+ * @level: zstd compression level
+ * @dictionary: (allow-none): Trained dictionary, of type "ay"
+ *
+ * Returns: (transfer full): A new converter, or %NULL if @level or
+ * @dictionary is invalid
+ */
+GConverter *
+ostree_zstd_converter_new_compressor (int        level,
+                                      GVariant  *dictionary,
+                                      GError   **error)
+{
+  OstreeZstdConverter *self;
+
+  self = g_object_new (OSTREE_TYPE_ZSTD_CONVERTER, NULL);
+  self->priv->compress = TRUE;
+  self->priv->level = level;
+  self->priv->dictionary = dictionary ? g_variant_ref (dictionary) : NULL;
+  self->priv->cctx = ZSTD_createCCtx ();
+  if (!setup_context (self, error))
+    {
+      g_object_unref (self);
+      return NULL;
+    }
+
+  return (GConverter*)self;
+}
+
+/**
+ * ostree_zstd_converter_new_decompressor:
+ * @dictionary: (allow-none): The dictionary the data was compressed with
+ *
+ * Returns: (transfer full): A new converter, or %NULL on error
+ */
+GConverter *
+ostree_zstd_converter_new_decompressor (OstreeZstdDictionary  *dictionary,
+                                        GError               **error)
+{
+  OstreeZstdConverter *self;
+
+  self = g_object_new (OSTREE_TYPE_ZSTD_CONVERTER, NULL);
+  self->priv->compress = FALSE;
+  self->priv->ddictionary = dictionary ? ostree_zstd_dictionary_ref (dictionary) : NULL;
+  self->priv->dctx = ZSTD_createDCtx ();
+  if (!setup_context (self, error))
+    {
+      g_object_unref (self);
+      return NULL;
+    }
+
+  return (GConverter*)self;
+}
+
+/**
+ * ostree_zstd_dictionary_new:
+ * @dictionary: Trained dictionary, of type "ay"
+ *
+ * Digest @dictionary once, so that any number of decompressors can
+ * share it.
+ *
+ * Returns: (transfer full): A new dictionary, or %NULL if @dictionary
+ * is invalid
+ */
+OstreeZstdDictionary *
+ostree_zstd_dictionary_new (GVariant  *dictionary,
+                            GError   **error)
+{
+  OstreeZstdDictionary *ret;
+  ZSTD_DDict *ddict;
+
+  ddict = ZSTD_createDDict (g_variant_get_data (dictionary),
+                            g_variant_get_size (dictionary));
+  if (ddict == NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "zstd: Failed to load dictionary");
+      return NULL;
+    }
+
+  ret = g_new0 (OstreeZstdDictionary, 1);
+  ret->refcount = 1;
+  ret->ddict = ddict;
+  return ret;
+}
+
+OstreeZstdDictionary *
+ostree_zstd_dictionary_ref (OstreeZstdDictionary *dictionary)
+{
+  g_atomic_int_inc (&dictionary->refcount);
+  return dictionary;
+}
+
+void
+ostree_zstd_dictionary_unref (OstreeZstdDictionary *dictionary)
+{
+  if (!g_atomic_int_dec_and_test (&dictionary->refcount))
+    return;
+
+  ZSTD_freeDDict (dictionary->ddict);
+  g_free (dictionary);
+}
+
+/**
+ * ostree_zstd_get_dictionary_id:
+ *
+ * Returns: The id of the dictionary the zstd frame starting at @data
+ * needs, or 0 if none.
+ */
+guint32
+ostree_zstd_get_dictionary_id (const guchar *data,
+                               gsize         len)
+{
+  return ZSTD_getDictID_fromFrame (data, len);
+}
@@ -0,0 +1,73 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The OSTree Authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __OSTREE_ZSTD_CONVERTER_H__
+#define __OSTREE_ZSTD_CONVERTER_H__
+
+#include "ostree-core.h"
+
+G_BEGIN_DECLS
+
+#define OSTREE_TYPE_ZSTD_CONVERTER         (ostree_zstd_converter_get_type ())
+#define OSTREE_ZSTD_CONVERTER(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), OSTREE_TYPE_ZSTD_CONVERTER, OstreeZstdConverter))
+#define OSTREE_ZSTD_CONVERTER_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), OSTREE_TYPE_ZSTD_CONVERTER, OstreeZstdConverterClass))
+#define OSTREE_IS_ZSTD_CONVERTER(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), OSTREE_TYPE_ZSTD_CONVERTER))
+#define OSTREE_IS_ZSTD_CONVERTER_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), OSTREE_TYPE_ZSTD_CONVERTER))
+#define OSTREE_ZSTD_CONVERTER_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), OSTREE_TYPE_ZSTD_CONVERTER, OstreeZstdConverterClass))
+
+typedef struct _OstreeZstdConverter         OstreeZstdConverter;
+typedef struct _OstreeZstdConverterClass    OstreeZstdConverterClass;
+typedef struct _OstreeZstdConverterPrivate  OstreeZstdConverterPrivate;
+
+struct _OstreeZstdConverter
+{
+  GObject parent_instance;
+
+  /*< private >*/
+  OstreeZstdConverterPrivate *priv;
+};
+
+struct _OstreeZstdConverterClass
+{
+  GObjectClass parent_class;
+};
+
+GType         ostree_zstd_converter_get_type         (void) G_GNUC_CONST;
+
+GConverter *  ostree_zstd_converter_new_compressor   (int           level,
+                                                      GVariant     *dictionary,
+                                                      GError      **error);
+
+GConverter *  ostree_zstd_converter_new_decompressor (OstreeZstdDictionary *dictionary,
+                                                      GError      **error);
+
+OstreeZstdDictionary *ostree_zstd_dictionary_new     (GVariant     *dictionary,
+                                                      GError      **error);
+
+OstreeZstdDictionary *ostree_zstd_dictionary_ref     (OstreeZstdDictionary *dictionary);
+
+void          ostree_zstd_dictionary_unref           (OstreeZstdDictionary *dictionary);
+
+guint32       ostree_zstd_get_dictionary_id          (const guchar *data,
+                                                      gsize         len);
+
+G_END_DECLS
+
+#endif /* __OSTREE_ZSTD_CONVERTER_H__ */
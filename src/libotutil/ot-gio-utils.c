@@ -190,6 +190,85 @@ ot_gfile_rename (GFile          *from,
 
 }
 
+/**
+ * ot_gfile_rm_rf:
+ * @path: Path to delete
+ * @cancellable: a #GCancellable
+ * @error: a #GError
+ *
+ * Recursively delete @path, without following symbolic links.  It
+ * is not an error if @path does not exist.
+ *
+ * Returns: %TRUE on success, %FALSE on error
+ */
+gboolean
+ot_gfile_rm_rf (GFile          *path,
+                GCancellable   *cancellable,
+                GError        **error)
+{
+  gboolean ret = FALSE;
+  GError *temp_error = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
+  ot_lobj GFileEnumerator *dir_enum = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  file_info = g_file_query_info (path, G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                 cancellable, &temp_error);
+  if (!file_info)
+    {
+      if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        {
+          g_clear_error (&temp_error);
+          ret = TRUE;
+        }
+      else
+        g_propagate_error (error, temp_error);
+      goto out;
+    }
+
+  if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
+    {
+      dir_enum = g_file_enumerate_children (path, G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                            cancellable, error);
+      if (!dir_enum)
+        goto out;
+
+      g_clear_object (&file_info);
+      while ((file_info = g_file_enumerator_next_file (dir_enum, cancellable, &temp_error)) != NULL)
+        {
+          ot_lobj GFile *child = g_file_get_child (path, g_file_info_get_name (file_info));
+
+          if (!ot_gfile_rm_rf (child, cancellable, error))
+            goto out;
+          g_clear_object (&file_info);
+        }
+      if (temp_error != NULL)
+        {
+          g_propagate_error (error, temp_error);
+          goto out;
+        }
+
+      if (rmdir (ot_gfile_get_path_cached (path)) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+    }
+  else
+    {
+      if (!ot_gfile_unlink (path, cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 gboolean
 ot_gfile_load_contents_utf8 (GFile         *file,
                              char         **out_contents,
@@ -55,6 +55,10 @@ gboolean ot_gfile_unlink (GFile          *path,
                           GCancellable   *cancellable,
                           GError        **error);
 
+gboolean ot_gfile_rm_rf (GFile          *path,
+                         GCancellable   *cancellable,
+                         GError        **error);
+
 gboolean ot_gfile_load_contents_utf8 (GFile         *file,
                                       char         **contents_out,
                                       char         **etag_out,
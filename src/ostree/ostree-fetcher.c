@@ -46,6 +46,32 @@ typedef struct {
 
   guint64 content_length;
 
+  /* Only the byte range [range_start, range_end] is requested when
+   * range_start is not negative; range_end of -1 means to the end.
+   */
+  gint64 range_start;
+  gint64 range_end;
+
+  /* Bytes of a caller-supplied tmpfile that were already present;
+   * the request asks only for what follows them.
+   */
+  guint64 resume_offset;
+
+  /* Set when the body is handed to chunk_func rather than a tmpfile */
+  OstreeFetcherChunkFunc chunk_func;
+  gpointer chunk_data;
+  guint8 *buf;
+  guint64 bytes_read;
+
+  /* Lower values are sent first, as for GIO I/O priorities */
+  int priority;
+
+  /* Monotonic times at which the request was sent and the response
+   * headers arrived.
+   */
+  gint64 start_time;
+  gint64 response_time;
+
   GCancellable *cancellable;
   GSimpleAsyncResult *result;
 } OstreeFetcherPendingURI;
@@ -65,6 +91,7 @@ pending_uri_free (OstreeFetcherPendingURI *pending)
   g_clear_object (&pending->request_body);
   g_clear_object (&pending->out_stream);
   g_clear_object (&pending->cancellable);
+  g_free (pending->buf);
   g_free (pending);
 }
 
@@ -80,10 +107,23 @@ struct OstreeFetcher
   GHashTable *sending_messages; /*  SoupMessage */
 
   GHashTable *message_to_request; /* SoupMessage -> SoupRequest */
-  
+
+  /* Requests not yet handed to the session, in priority order */
+  GQueue pending_queue;
+  guint max_in_flight;
+  guint n_in_flight;
+  guint peak_in_flight;
+
   guint64 total_downloaded;
+
+  /* Timing over all finished requests, in microseconds */
+  guint n_completed;
+  gint64 total_ttfb;
+  gint64 total_transfer_time;
 };
 
+#define OSTREE_FETCHER_DEFAULT_MAX_REQUESTS 8
+
 G_DEFINE_TYPE (OstreeFetcher, ostree_fetcher, G_TYPE_OBJECT)
 
 static void
@@ -97,6 +137,7 @@ ostree_fetcher_finalize (GObject *object)
 
   g_hash_table_destroy (self->sending_messages);
   g_hash_table_destroy (self->message_to_request);
+  g_queue_clear (&self->pending_queue);
 
   G_OBJECT_CLASS (ostree_fetcher_parent_class)->finalize (object);
 }
@@ -135,6 +176,8 @@ ostree_fetcher_init (OstreeFetcher *self)
   self->session = soup_session_async_new_with_options (SOUP_SESSION_USER_AGENT, "ostree ",
                                                        SOUP_SESSION_USE_THREAD_CONTEXT, TRUE,
                                                        SOUP_SESSION_ADD_FEATURE_BY_TYPE, SOUP_TYPE_REQUESTER,
+                                                       SOUP_SESSION_MAX_CONNS, OSTREE_FETCHER_DEFAULT_MAX_REQUESTS,
+                                                       SOUP_SESSION_MAX_CONNS_PER_HOST, OSTREE_FETCHER_DEFAULT_MAX_REQUESTS,
                                                        NULL);
   self->requester = (SoupRequester *)soup_session_get_feature (self->session, SOUP_TYPE_REQUESTER);
 
@@ -147,6 +190,9 @@ ostree_fetcher_init (OstreeFetcher *self)
                                                   (GDestroyNotify)g_object_unref);
   self->message_to_request = g_hash_table_new_full (NULL, NULL, (GDestroyNotify)g_object_unref,
                                                     (GDestroyNotify)pending_uri_free);
+
+  g_queue_init (&self->pending_queue);
+  self->max_in_flight = OSTREE_FETCHER_DEFAULT_MAX_REQUESTS;
 }
 
 OstreeFetcher *
@@ -159,6 +205,57 @@ ostree_fetcher_new (GFile *tmpdir)
   return self;
 }
 
+static void
+dispatch_pending_requests (OstreeFetcher  *self);
+
+/*
+ * Limit the number of requests in flight at once to @max_in_flight,
+ * over at most @max_per_host connections to each server.  Further
+ * requests wait in the fetcher, ordered by priority.
+ */
+void
+ostree_fetcher_set_max_requests (OstreeFetcher  *self,
+                                 guint           max_in_flight,
+                                 guint           max_per_host)
+{
+  g_return_if_fail (max_in_flight > 0 && max_per_host > 0);
+
+  self->max_in_flight = max_in_flight;
+  g_object_set (self->session,
+                SOUP_SESSION_MAX_CONNS, MAX (max_in_flight, max_per_host),
+                SOUP_SESSION_MAX_CONNS_PER_HOST, max_per_host,
+                NULL);
+
+  dispatch_pending_requests (self);
+}
+
+static void
+complete_pending (OstreeFetcherPendingURI  *pending,
+                  GError                   *error)
+{
+  OstreeFetcher *self = pending->self;
+
+  pending->state = OSTREE_FETCHER_STATE_COMPLETE;
+  if (pending->request_body)
+    (void) g_input_stream_close (pending->request_body, NULL, NULL);
+
+  if (pending->response_time > 0)
+    {
+      self->n_completed++;
+      self->total_ttfb += pending->response_time - pending->start_time;
+      self->total_transfer_time += g_get_monotonic_time () - pending->response_time;
+    }
+
+  g_assert (self->n_in_flight > 0);
+  self->n_in_flight--;
+  dispatch_pending_requests (self);
+
+  if (error)
+    g_simple_async_result_take_error (pending->result, error);
+  g_simple_async_result_complete (pending->result);
+  g_object_unref (pending->result);
+}
+
 static void
 on_splice_complete (GObject        *object,
                     GAsyncResult   *result,
@@ -167,17 +264,120 @@ on_splice_complete (GObject        *object,
   OstreeFetcherPendingURI *pending = user_data;
   ot_lobj GFileInfo *file_info = NULL;
 
-  pending->state = OSTREE_FETCHER_STATE_COMPLETE;
   file_info = g_file_query_info (pending->tmpfile, OSTREE_GIO_FAST_QUERYINFO,
                                  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
                                  NULL, NULL);
   if (file_info)
-    pending->self->total_downloaded += g_file_info_get_size (file_info);
+    pending->self->total_downloaded += g_file_info_get_size (file_info) - pending->resume_offset;
 
-  (void) g_input_stream_close (pending->request_body, NULL, NULL);
+  complete_pending (pending, NULL);
+}
 
-  g_simple_async_result_complete (pending->result);
-  g_object_unref (pending->result);
+#define OSTREE_FETCHER_STREAM_BUFSIZE 65536
+
+static guint
+get_status_code (OstreeFetcherPendingURI  *pending)
+{
+  ot_lobj SoupMessage *msg = NULL;
+
+  msg = soup_request_http_get_message ((SoupRequestHTTP*) pending->request);
+  return msg->status_code;
+}
+
+/*
+ * Whether @msg is a 416 reply meaning there is nothing left to fetch
+ * after the bytes the caller already has.
+ */
+static gboolean
+resume_is_complete (OstreeFetcherPendingURI  *pending,
+                    SoupMessage              *msg)
+{
+  goffset start, end, total;
+
+  if (msg->status_code != SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE)
+    return FALSE;
+
+  /* A stale tmpfile may even be longer than the file; callers verify
+   * its checksum and start over if it is wrong.
+   */
+  if (pending->resume_offset > 0)
+    return TRUE;
+
+  if (pending->chunk_func == NULL || pending->range_start <= 0)
+    return FALSE;
+
+  /* The server reports the size of the file in Content-Range */
+  if (soup_message_headers_get_content_range (msg->response_headers, &start, &end, &total)
+      && total >= 0)
+    return total == pending->range_start;
+
+  return TRUE;
+}
+
+static gboolean
+check_request_status (OstreeFetcherPendingURI  *pending,
+                      GError                  **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj SoupMessage *msg = NULL;
+  ot_lfree char *uri_string = NULL;
+
+  msg = soup_request_http_get_message ((SoupRequestHTTP*) pending->request);
+  uri_string = soup_uri_to_string (pending->uri, FALSE);
+
+  /* A resumed download that is already complete */
+  if (resume_is_complete (pending, msg))
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+    {
+      g_set_error (error, G_IO_ERROR,
+                   msg->status_code == SOUP_STATUS_NOT_FOUND ? G_IO_ERROR_NOT_FOUND : G_IO_ERROR_FAILED,
+                   "Server returned status %u for %s", msg->status_code, uri_string);
+      goto out;
+    }
+
+  if (pending->range_start >= 0 && msg->status_code != SOUP_STATUS_PARTIAL_CONTENT)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Server did not honor range request for %s (status %u)",
+                   uri_string, msg->status_code);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+on_stream_read (GObject        *object,
+                GAsyncResult   *result,
+                gpointer        user_data)
+{
+  OstreeFetcherPendingURI *pending = user_data;
+  gssize bytes_read;
+  GError *local_error = NULL;
+
+  bytes_read = g_input_stream_read_finish ((GInputStream*)object, result, &local_error);
+  if (bytes_read > 0)
+    {
+      pending->bytes_read += bytes_read;
+      if (pending->chunk_func (pending->buf, bytes_read, pending->chunk_data, &local_error))
+        {
+          g_input_stream_read_async (pending->request_body, pending->buf,
+                                     OSTREE_FETCHER_STREAM_BUFSIZE, G_PRIORITY_DEFAULT,
+                                     pending->cancellable, on_stream_read, pending);
+          return;
+        }
+    }
+
+  pending->self->total_downloaded += pending->bytes_read;
+
+  complete_pending (pending, local_error);
 }
 
 static void
@@ -191,28 +391,64 @@ on_request_sent (GObject        *object,
   pending->request_body = soup_request_send_finish ((SoupRequest*) object,
                                                    result, &local_error);
   if (!pending->request_body)
+    complete_pending (pending, local_error);
+  else if (!check_request_status (pending, &local_error))
+    {
+      pending->response_time = g_get_monotonic_time ();
+      complete_pending (pending, local_error);
+    }
+  else if (get_status_code (pending) == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE)
     {
-      pending->state = OSTREE_FETCHER_STATE_COMPLETE;
-      g_simple_async_result_take_error (pending->result, local_error);
-      g_simple_async_result_complete (pending->result);
+      pending->response_time = g_get_monotonic_time ();
+      complete_pending (pending, NULL);
+    }
+  else if (pending->chunk_func)
+    {
+      pending->state = OSTREE_FETCHER_STATE_DOWNLOADING;
+      pending->response_time = g_get_monotonic_time ();
+
+      pending->content_length = soup_request_get_content_length (pending->request);
+
+      pending->buf = g_malloc (OSTREE_FETCHER_STREAM_BUFSIZE);
+      g_input_stream_read_async (pending->request_body, pending->buf,
+                                 OSTREE_FETCHER_STREAM_BUFSIZE, G_PRIORITY_DEFAULT,
+                                 pending->cancellable, on_stream_read, pending);
     }
   else
     {
       GOutputStreamSpliceFlags flags = G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET;
 
       pending->state = OSTREE_FETCHER_STATE_DOWNLOADING;
+      pending->response_time = g_get_monotonic_time ();
 
       pending->content_length = soup_request_get_content_length (pending->request);
 
       /* TODO - make this async */
-      if (!ostree_create_temp_regular_file (pending->self->tmpdir,
-                                            NULL, NULL,
-                                            &pending->tmpfile,
-                                            &pending->out_stream,
-                                            NULL, &local_error))
+      if (pending->tmpfile)
+        {
+          /* Appending rather than replacing keeps every byte written
+           * under the final name, in case we are interrupted again.
+           */
+          if (pending->resume_offset > 0
+              && get_status_code (pending) == SOUP_STATUS_PARTIAL_CONTENT)
+            pending->content_length += pending->resume_offset;
+          else
+            {
+              pending->resume_offset = 0;
+              (void) ot_gfile_unlink (pending->tmpfile, NULL, NULL);
+            }
+          pending->out_stream = (GOutputStream*)g_file_append_to (pending->tmpfile, 0,
+                                                                  NULL, &local_error);
+        }
+      else
+        (void) ostree_create_temp_regular_file (pending->self->tmpdir,
+                                                NULL, NULL,
+                                                &pending->tmpfile,
+                                                &pending->out_stream,
+                                                NULL, &local_error);
+      if (!pending->out_stream)
         {
-          g_simple_async_result_take_error (pending->result, local_error);
-          g_simple_async_result_complete (pending->result);
+          complete_pending (pending, local_error);
           return;
         }
 
@@ -221,37 +457,163 @@ on_request_sent (GObject        *object,
     }
 }
 
-void
-ostree_fetcher_request_uri_async (OstreeFetcher         *self,
-                                  SoupURI               *uri,
-                                  GCancellable          *cancellable,
-                                  GAsyncReadyCallback    callback,
-                                  gpointer               user_data)
+static void
+start_pending_request (OstreeFetcherPendingURI  *pending)
 {
-  OstreeFetcherPendingURI *pending;
+  OstreeFetcher *self = pending->self;
   GError *local_error = NULL;
+  ot_lobj SoupMessage *msg = NULL;
+
+  pending->request = soup_requester_request_uri (self->requester, pending->uri, &local_error);
+  g_assert_no_error (local_error);
+  msg = soup_request_http_get_message ((SoupRequestHTTP*) pending->request);
+
+  if (pending->tmpfile)
+    {
+      ot_lobj GFileInfo *file_info = NULL;
+
+      file_info = g_file_query_info (pending->tmpfile, OSTREE_GIO_FAST_QUERYINFO,
+                                     G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                     NULL, NULL);
+      if (file_info)
+        pending->resume_offset = g_file_info_get_size (file_info);
+    }
+
+  if (pending->range_start >= 0)
+    soup_message_headers_set_range (msg->request_headers, pending->range_start, pending->range_end);
+  else if (pending->resume_offset > 0)
+    soup_message_headers_set_range (msg->request_headers, pending->resume_offset, -1);
+
+  pending->refcount++;
+  g_hash_table_insert (self->message_to_request, g_object_ref (msg), pending);
+
+  self->n_in_flight++;
+  self->peak_in_flight = MAX (self->peak_in_flight, self->n_in_flight);
+  pending->start_time = g_get_monotonic_time ();
+  soup_request_send_async (pending->request, pending->cancellable,
+                           on_request_sent, pending);
+}
+
+static void
+dispatch_pending_requests (OstreeFetcher  *self)
+{
+  while (self->n_in_flight < self->max_in_flight
+         && !g_queue_is_empty (&self->pending_queue))
+    start_pending_request (g_queue_pop_head (&self->pending_queue));
+}
+
+static gint
+compare_pending_priority (gconstpointer  a,
+                          gconstpointer  b,
+                          gpointer       user_data)
+{
+  const OstreeFetcherPendingURI *pending_a = a;
+  const OstreeFetcherPendingURI *pending_b = b;
+
+  /* Requests of equal priority keep their order */
+  return pending_a->priority <= pending_b->priority ? -1 : 1;
+}
+
+static void
+request_uri_internal (OstreeFetcher         *self,
+                      SoupURI               *uri,
+                      GFile                 *dest,
+                      gint64                 range_start,
+                      gint64                 range_end,
+                      OstreeFetcherChunkFunc chunk_func,
+                      gpointer               chunk_data,
+                      int                    priority,
+                      GCancellable          *cancellable,
+                      GAsyncReadyCallback    callback,
+                      gpointer               user_data,
+                      gpointer               source_tag)
+{
+  OstreeFetcherPendingURI *pending;
 
   pending = g_new0 (OstreeFetcherPendingURI, 1);
   pending->refcount = 1;
   pending->self = g_object_ref (self);
   pending->uri = soup_uri_copy (uri);
+  pending->tmpfile = dest ? g_object_ref (dest) : NULL;
+  pending->range_start = range_start;
+  pending->range_end = range_end;
+  pending->chunk_func = chunk_func;
+  pending->chunk_data = chunk_data;
+  pending->priority = priority;
   pending->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
-  pending->request = soup_requester_request_uri (self->requester, uri, &local_error);
-  g_assert_no_error (local_error);
-
-  pending->refcount++;
-  g_hash_table_insert (self->message_to_request,
-                       soup_request_http_get_message ((SoupRequestHTTP*)pending->request),
-                       pending);
 
   pending->result = g_simple_async_result_new ((GObject*) self,
                                                callback, user_data,
-                                               ostree_fetcher_request_uri_async);
+                                               source_tag);
   g_simple_async_result_set_op_res_gpointer (pending->result, pending,
                                              (GDestroyNotify) pending_uri_free);
 
-  soup_request_send_async (pending->request, cancellable,
-                           on_request_sent, pending);
+  g_queue_insert_sorted (&self->pending_queue, pending,
+                         compare_pending_priority, NULL);
+  dispatch_pending_requests (self);
+}
+
+/*
+ * Download @uri to a temporary file.  Requests with a lower @priority
+ * value are sent first when more are pending than the fetcher allows
+ * in flight; see ostree_fetcher_set_max_requests().
+ */
+void
+ostree_fetcher_request_uri_async (OstreeFetcher         *self,
+                                  SoupURI               *uri,
+                                  int                    priority,
+                                  GCancellable          *cancellable,
+                                  GAsyncReadyCallback    callback,
+                                  gpointer               user_data)
+{
+  request_uri_internal (self, uri, NULL, -1, -1, NULL, NULL, priority, cancellable,
+                        callback, user_data,
+                        ostree_fetcher_request_uri_async);
+}
+
+/*
+ * Like ostree_fetcher_request_uri_async(), but only fetch the bytes
+ * from @start to @end inclusive; an @end of -1 means the rest of the
+ * file.  Fails with %G_IO_ERROR_NOT_SUPPORTED if the server does not
+ * reply with partial content.  Use ostree_fetcher_request_uri_finish()
+ * to retrieve the result.
+ */
+void
+ostree_fetcher_request_uri_range_async (OstreeFetcher         *self,
+                                        SoupURI               *uri,
+                                        guint64                start,
+                                        gint64                 end,
+                                        int                    priority,
+                                        GCancellable          *cancellable,
+                                        GAsyncReadyCallback    callback,
+                                        gpointer               user_data)
+{
+  request_uri_internal (self, uri, NULL, start, end, NULL, NULL, priority, cancellable,
+                        callback, user_data,
+                        ostree_fetcher_request_uri_async);
+}
+
+/*
+ * Like ostree_fetcher_request_uri_async(), but download into @dest.
+ * If @dest already holds the start of the file from an interrupted
+ * run, only the remainder is requested and appended; servers which
+ * ignore the range cause @dest to be rewritten from the beginning.
+ * Use ostree_fetcher_request_uri_finish() to retrieve the result.
+ */
+void
+ostree_fetcher_request_uri_resumable_async (OstreeFetcher         *self,
+                                            SoupURI               *uri,
+                                            GFile                 *dest,
+                                            int                    priority,
+                                            GCancellable          *cancellable,
+                                            GAsyncReadyCallback    callback,
+                                            gpointer               user_data)
+{
+  g_return_if_fail (dest != NULL);
+
+  request_uri_internal (self, uri, dest, -1, -1, NULL, NULL, priority, cancellable,
+                        callback, user_data,
+                        ostree_fetcher_request_uri_async);
 }
 
 GFile *
@@ -272,6 +634,45 @@ ostree_fetcher_request_uri_finish (OstreeFetcher         *self,
   return g_object_ref (pending->tmpfile);
 }
 
+/*
+ * Like ostree_fetcher_request_uri_async(), but rather than saving the
+ * body to a temporary file, each chunk is passed to @chunk_func as it
+ * arrives.  If @chunk_func returns %FALSE, the request is aborted with
+ * its error.  A nonzero @offset skips the start of the file, as for
+ * ostree_fetcher_request_uri_range_async(); if the file is exactly
+ * @offset bytes long, the request completes without any chunks.
+ */
+void
+ostree_fetcher_stream_uri_async (OstreeFetcher         *self,
+                                 SoupURI               *uri,
+                                 guint64                offset,
+                                 OstreeFetcherChunkFunc chunk_func,
+                                 gpointer               chunk_data,
+                                 int                    priority,
+                                 GCancellable          *cancellable,
+                                 GAsyncReadyCallback    callback,
+                                 gpointer               user_data)
+{
+  g_return_if_fail (chunk_func != NULL);
+
+  request_uri_internal (self, uri, NULL, offset > 0 ? (gint64)offset : -1, -1,
+                        chunk_func, chunk_data, priority, cancellable,
+                        callback, user_data,
+                        ostree_fetcher_stream_uri_async);
+}
+
+gboolean
+ostree_fetcher_stream_uri_finish (OstreeFetcher         *self,
+                                  GAsyncResult          *result,
+                                  GError               **error)
+{
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, (GObject*)self, ostree_fetcher_stream_uri_async), FALSE);
+
+  if (g_simple_async_result_propagate_error ((GSimpleAsyncResult*) result, error))
+    return FALSE;
+  return TRUE;
+}
+
 static char *
 format_size_pair (guint64 start,
                   guint64 max)
@@ -285,21 +686,34 @@ format_size_pair (guint64 start,
                             ((double) max) / 1024);
 }
 
+/*
+ * Returns a one-line summary of the requests in flight: for each, the
+ * bytes received, the time to the first byte of the response, and the
+ * time spent transferring the body so far.
+ */
 char *
 ostree_fetcher_query_state_text (OstreeFetcher              *self)
 {
   guint n_active;
+  guint n_queued;
 
   n_active = g_hash_table_size (self->sending_messages);
+  n_queued = g_queue_get_length (&self->pending_queue);
   if (n_active > 0)
     {
       GHashTableIter hash_iter;
       gpointer key, value;
       GString *buf;
+      gint64 now = g_get_monotonic_time ();
 
       buf = g_string_new ("");
 
       g_string_append_printf (buf, "%u requests", n_active);
+      if (n_queued > 0)
+        g_string_append_printf (buf, ", %u queued", n_queued);
+      if (self->n_completed > 0)
+        g_string_append_printf (buf, ", avg TTFB %u ms",
+                                (guint) (self->total_ttfb / self->n_completed / 1000));
 
       g_hash_table_iter_init (&hash_iter, self->sending_messages);
       while (g_hash_table_iter_next (&hash_iter, &key, &value))
@@ -309,19 +723,26 @@ ostree_fetcher_query_state_text (OstreeFetcher              *self)
           active = g_hash_table_lookup (self->message_to_request, key);
           g_assert (active != NULL);
 
-          if (active->tmpfile)
+          if (active->state == OSTREE_FETCHER_STATE_DOWNLOADING)
             {
-              ot_lobj GFileInfo *file_info = NULL;
+              guint64 bytes = active->bytes_read;
+              ot_lfree char *size = NULL;
 
-              file_info = g_file_query_info (active->tmpfile, OSTREE_GIO_FAST_QUERYINFO,
-                                             G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                             NULL, NULL);
-              if (file_info)
+              if (active->tmpfile)
                 {
-                  ot_lfree char *size = format_size_pair (g_file_info_get_size (file_info),
-                                                          active->content_length);
-                  g_string_append_printf (buf, " [%s]", size);
+                  ot_lobj GFileInfo *file_info = NULL;
+
+                  file_info = g_file_query_info (active->tmpfile, OSTREE_GIO_FAST_QUERYINFO,
+                                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                                 NULL, NULL);
+                  if (file_info)
+                    bytes = g_file_info_get_size (file_info);
                 }
+
+              size = format_size_pair (bytes, active->content_length);
+              g_string_append_printf (buf, " [%s, TTFB %u ms, %.1f s]", size,
+                                      (guint) ((active->response_time - active->start_time) / 1000),
+                                      (now - active->response_time) / (double) G_USEC_PER_SEC);
             }
           else
             {
@@ -331,6 +752,8 @@ ostree_fetcher_query_state_text (OstreeFetcher              *self)
 
       return g_string_free (buf, FALSE);
     }
+  else if (n_queued > 0)
+    return g_strdup_printf ("%u queued", n_queued);
   else
     return g_strdup_printf ("Idle");
 }
@@ -340,3 +763,12 @@ ostree_fetcher_bytes_transferred (OstreeFetcher       *self)
 {
   return self->total_downloaded;
 }
+
+/*
+ * The largest number of requests that have been in flight at once.
+ */
+guint
+ostree_fetcher_peak_requests (OstreeFetcher       *self)
+{
+  return self->peak_in_flight;
+}
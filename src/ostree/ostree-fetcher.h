@@ -47,20 +47,63 @@ GType   ostree_fetcher_get_type (void) G_GNUC_CONST;
 
 OstreeFetcher *ostree_fetcher_new (GFile *tmpdir);
 
+void ostree_fetcher_set_max_requests (OstreeFetcher  *self,
+                                      guint           max_in_flight,
+                                      guint           max_per_host);
+
 char * ostree_fetcher_query_state_text (OstreeFetcher              *self);
 
 guint64 ostree_fetcher_bytes_transferred (OstreeFetcher       *self);
 
+guint ostree_fetcher_peak_requests (OstreeFetcher       *self);
+
 void ostree_fetcher_request_uri_async (OstreeFetcher         *self,
                                        SoupURI               *uri,
+                                       int                    priority,
                                        GCancellable          *cancellable,
                                        GAsyncReadyCallback    callback,
                                        gpointer               user_data);
 
+void ostree_fetcher_request_uri_range_async (OstreeFetcher         *self,
+                                             SoupURI               *uri,
+                                             guint64                start,
+                                             gint64                 end,
+                                             int                    priority,
+                                             GCancellable          *cancellable,
+                                             GAsyncReadyCallback    callback,
+                                             gpointer               user_data);
+
+void ostree_fetcher_request_uri_resumable_async (OstreeFetcher         *self,
+                                                 SoupURI               *uri,
+                                                 GFile                 *dest,
+                                                 int                    priority,
+                                                 GCancellable          *cancellable,
+                                                 GAsyncReadyCallback    callback,
+                                                 gpointer               user_data);
+
 GFile *ostree_fetcher_request_uri_finish (OstreeFetcher         *self,
                                           GAsyncResult          *result,
                                           GError               **error);
 
+typedef gboolean (*OstreeFetcherChunkFunc) (const guint8  *buf,
+                                            gsize          len,
+                                            gpointer       user_data,
+                                            GError       **error);
+
+void ostree_fetcher_stream_uri_async (OstreeFetcher         *self,
+                                      SoupURI               *uri,
+                                      guint64                offset,
+                                      OstreeFetcherChunkFunc chunk_func,
+                                      gpointer               chunk_data,
+                                      int                    priority,
+                                      GCancellable          *cancellable,
+                                      GAsyncReadyCallback    callback,
+                                      gpointer               user_data);
+
+gboolean ostree_fetcher_stream_uri_finish (OstreeFetcher         *self,
+                                           GAsyncResult          *result,
+                                           GError               **error);
+
 G_END_DECLS
 
 #endif
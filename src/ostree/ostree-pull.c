@@ -34,6 +34,7 @@
  *    Traverse and queue dirtree/dirmeta
  * 
  * Pull dirtrees:
+ *  Breadth-first, with up to --metadata-requests in flight:
  *  For each dirtree:
  *    Verify checksum
  *    Import
@@ -62,17 +63,26 @@
 #include "ot-main.h"
 
 #include "ostree-fetcher.h"
+#ifdef HAVE_ZSTD
+#include "ostree-zstd-converter.h"
+#endif
 
 gboolean verbose;
 gboolean opt_prefer_loose;
 gboolean opt_related;
 gint opt_depth;
+gint opt_metadata_requests = 16;
+gint opt_partial_pack_threshold = 25;
+gboolean opt_disable_static_deltas;
 
 static GOptionEntry options[] = {
   { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Show more information", NULL },
   { "prefer-loose", 0, 0, G_OPTION_ARG_NONE, &opt_prefer_loose, "Download loose objects by default", NULL },
   { "related", 0, 0, G_OPTION_ARG_NONE, &opt_related, "Download related commits", NULL },
   { "depth", 0, 0, G_OPTION_ARG_INT, &opt_depth, "Download parent commits up to this depth (default: 0)", NULL },
+  { "metadata-requests", 0, 0, G_OPTION_ARG_INT, &opt_metadata_requests, "Maximum concurrent metadata requests (default: 16)", "N" },
+  { "disable-static-deltas", 0, 0, G_OPTION_ARG_NONE, &opt_disable_static_deltas, "Do not use static deltas", NULL },
+  { "partial-pack-threshold", 0, 0, G_OPTION_ARG_INT, &opt_partial_pack_threshold, "Fetch only needed byte ranges of a content pack when at most PERCENT of its objects are needed (default: 25, 0 disables)", "PERCENT" },
   { NULL },
 };
 
@@ -83,6 +93,12 @@ typedef struct {
   SoupURI      *base_uri;
 
   gboolean      fetched_packs;
+  gboolean      range_unsupported;
+
+  /* Partial downloads, named by their expected checksum, which a
+   * later pull can continue after an interruption.
+   */
+  GFile        *resume_dir;
   GPtrArray    *cached_meta_pack_indexes;
   GPtrArray    *cached_data_pack_indexes;
 
@@ -93,11 +109,14 @@ typedef struct {
   /* Used in meta fetch phase */
   guint         outstanding_uri_requests;
   guint         outstanding_meta_requests;
+  GQueue        meta_scan_queue;
+  GHashTable   *meta_scan_seen;
+  GHashTable   *meta_packs_pending;
+  guint         n_meta_scanned;
 
   /* Used in content fetch phase */
   guint         outstanding_filemeta_requests;
   guint         outstanding_filecontent_requests;
-  guint         outstanding_checksum_requests;
   GHashTable   *loose_files;
 
   GError      **async_error;
@@ -160,9 +179,11 @@ uri_fetch_update_status (gpointer user_data)
                             + pull_data->outstanding_filemeta_requests
                             + pull_data->outstanding_filecontent_requests);
 
-  if (pull_data->outstanding_checksum_requests > 0)
-    g_string_append_printf (status, "Calculating %u checksums; ",
-                            pull_data->outstanding_checksum_requests);
+  if (pull_data->outstanding_meta_requests > 0)
+    g_string_append_printf (status, "%u metadata objects scanned, %u queued: ",
+                            pull_data->n_meta_scanned,
+                            g_queue_get_length (&pull_data->meta_scan_queue)
+                            + pull_data->outstanding_meta_requests);
 
   fetcher_status = ostree_fetcher_query_state_text (pull_data->fetcher);
   g_string_append (status, fetcher_status);
@@ -192,7 +213,6 @@ check_outstanding_requests_handle_error (OtPullData          *pull_data,
       pull_data->outstanding_meta_requests == 0 &&
       pull_data->outstanding_filemeta_requests == 0 &&
       pull_data->outstanding_filecontent_requests == 0 &&
-      pull_data->outstanding_checksum_requests == 0 &&
       (pull_data->loose_files == NULL || g_hash_table_size (pull_data->loose_files) == 0))
     g_main_loop_quit (pull_data->loop);
   if (error)
@@ -234,6 +254,7 @@ run_mainloop_monitor_fetcher (OtPullData   *pull_data)
 
 typedef struct {
   OtPullData     *pull_data;
+  gboolean        allow_noent;
   GFile          *result_file;
 } OstreeFetchUriData;
 
@@ -247,17 +268,21 @@ uri_fetch_on_complete (GObject        *object,
 
   data->result_file = ostree_fetcher_request_uri_finish ((OstreeFetcher*)object,
                                                          result, &local_error);
+  if (data->allow_noent
+      && g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    g_clear_error (&local_error);
   data->pull_data->outstanding_uri_requests--;
   check_outstanding_requests_handle_error (data->pull_data, local_error);
 }
 
 static gboolean
-fetch_uri (OtPullData  *pull_data,
-           SoupURI     *uri,
-           const char  *tmp_prefix,
-           GFile      **out_temp_filename,
-           GCancellable  *cancellable,
-           GError     **error)
+fetch_uri_internal (OtPullData  *pull_data,
+                    SoupURI     *uri,
+                    gboolean     allow_noent,
+                    GFile       *resume_path,
+                    GFile      **out_temp_filename,
+                    GCancellable  *cancellable,
+                    GError     **error)
 {
   gboolean ret = FALSE;
   ot_lfree char *uri_string = NULL;
@@ -269,13 +294,19 @@ fetch_uri (OtPullData  *pull_data,
 
   memset (&fetch_data, 0, sizeof (fetch_data));
   fetch_data.pull_data = pull_data;
+  fetch_data.allow_noent = allow_noent;
 
   uri_string = soup_uri_to_string (uri, FALSE);
   g_print ("Fetching %s\n", uri_string);
 
   pull_data->outstanding_uri_requests++;
-  ostree_fetcher_request_uri_async (pull_data->fetcher, uri, cancellable,
-                                    uri_fetch_on_complete, &fetch_data);
+  if (resume_path)
+    ostree_fetcher_request_uri_resumable_async (pull_data->fetcher, uri, resume_path,
+                                                G_PRIORITY_DEFAULT, cancellable,
+                                                uri_fetch_on_complete, &fetch_data);
+  else
+    ostree_fetcher_request_uri_async (pull_data->fetcher, uri, G_PRIORITY_DEFAULT, cancellable,
+                                      uri_fetch_on_complete, &fetch_data);
 
   run_mainloop_monitor_fetcher (pull_data);
 
@@ -288,6 +319,93 @@ fetch_uri (OtPullData  *pull_data,
   return ret;
 }
 
+static gboolean
+fetch_uri (OtPullData  *pull_data,
+           SoupURI     *uri,
+           const char  *tmp_prefix,
+           GFile      **out_temp_filename,
+           GCancellable  *cancellable,
+           GError     **error)
+{
+  return fetch_uri_internal (pull_data, uri, FALSE, NULL, out_temp_filename,
+                             cancellable, error);
+}
+
+/* Like fetch_uri(), but @out_temp_filename is %NULL if the server has
+ * no such file.
+ */
+static gboolean
+fetch_uri_allow_noent (OtPullData  *pull_data,
+                       SoupURI     *uri,
+                       GFile      **out_temp_filename,
+                       GCancellable  *cancellable,
+                       GError     **error)
+{
+  return fetch_uri_internal (pull_data, uri, TRUE, NULL, out_temp_filename,
+                             cancellable, error);
+}
+
+/* Return the path in which to download @name, continuing any
+ * partial copy left by an interrupted pull.
+ */
+static GFile *
+get_resume_path (OtPullData  *pull_data,
+                 const char  *name)
+{
+  GFile *ret;
+  ot_lobj GFileInfo *file_info = NULL;
+
+  ret = g_file_get_child (pull_data->resume_dir, name);
+  file_info = g_file_query_info (ret, OSTREE_GIO_FAST_QUERYINFO,
+                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                 NULL, NULL);
+  if (file_info && g_file_info_get_size (file_info) > 0)
+    g_print ("Resuming %s from %" G_GUINT64_FORMAT " bytes\n", name,
+             (guint64) g_file_info_get_size (file_info));
+  return ret;
+}
+
+/*
+ * Check that the downloaded pack at @path has the checksum it is
+ * named by.  If not, e.g. because a resumed download was appended to a
+ * stale partial file, @path is deleted so it can be fetched again.
+ */
+static gboolean
+check_fetched_pack (GFile         *path,
+                    const char    *pack_checksum,
+                    gboolean      *out_valid,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  gboolean ret = FALSE;
+  gboolean ret_valid;
+  ot_lobj GInputStream *in = NULL;
+  ot_lfree guchar *csum = NULL;
+  ot_lfree char *actual_checksum = NULL;
+
+  in = (GInputStream*)g_file_read (path, cancellable, error);
+  if (!in)
+    goto out;
+
+  if (!ot_gio_checksum_stream (in, &csum, cancellable, error))
+    goto out;
+
+  actual_checksum = ostree_checksum_from_bytes (csum);
+  ret_valid = strcmp (actual_checksum, pack_checksum) == 0;
+  if (!ret_valid)
+    {
+      g_print ("Pack %s is corrupted (actual checksum is %s); fetching it again\n",
+               pack_checksum, actual_checksum);
+      if (!ot_gfile_unlink (path, cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+  *out_valid = ret_valid;
+ out:
+  return ret;
+}
+
 static gboolean
 fetch_uri_contents_utf8 (OtPullData  *pull_data,
                          SoupURI     *uri,
@@ -330,8 +448,10 @@ fetch_one_pack_file (OtPullData            *pull_data,
                      GError               **error)
 {
   gboolean ret = FALSE;
+  gboolean valid;
   ot_lobj GFile *ret_cached_path = NULL;
   ot_lobj GFile *tmp_path = NULL;
+  ot_lobj GFile *resume_path = NULL;
   ot_lfree char *pack_name = NULL;
   SoupURI *pack_uri = NULL;
 
@@ -344,10 +464,33 @@ fetch_one_pack_file (OtPullData            *pull_data,
     {
       pack_name = ostree_get_pack_data_name (is_meta, pack_checksum);
       pack_uri = suburi_new (pull_data->base_uri, "objects", "pack", pack_name, NULL);
+      resume_path = get_resume_path (pull_data, pack_name);
       
-      if (!fetch_uri (pull_data, pack_uri, "packdata-", &tmp_path, cancellable, error))
+      if (!fetch_uri_internal (pull_data, pack_uri, FALSE, resume_path, &tmp_path,
+                               cancellable, error))
+        goto out;
+
+      if (!check_fetched_pack (tmp_path, pack_checksum, &valid, cancellable, error))
         goto out;
 
+      if (!valid)
+        {
+          g_clear_object (&tmp_path);
+          if (!fetch_uri_internal (pull_data, pack_uri, FALSE, resume_path, &tmp_path,
+                                   cancellable, error))
+            goto out;
+
+          if (!check_fetched_pack (tmp_path, pack_checksum, &valid, cancellable, error))
+            goto out;
+
+          if (!valid)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Corrupted pack %s", pack_checksum);
+              goto out;
+            }
+        }
+
       if (!ostree_repo_take_cached_remote_pack_data (pull_data->repo, pull_data->remote_name,
                                                      pack_checksum, is_meta, tmp_path,
                                                      cancellable, error))
@@ -577,6 +720,28 @@ fetch_loose_object (OtPullData  *pull_data,
   return ret;
 }
 
+static gboolean
+ensure_remote_pack_indexes (OtPullData            *pull_data,
+                            GCancellable          *cancellable,
+                            GError               **error)
+{
+  gboolean ret = FALSE;
+
+  if (!pull_data->fetched_packs)
+    {
+      pull_data->fetched_packs = TRUE;
+      pull_data->cached_meta_pack_indexes = g_ptr_array_new_with_free_func (g_free);
+      pull_data->cached_data_pack_indexes = g_ptr_array_new_with_free_func (g_free);
+
+      if (!fetch_and_cache_pack_indexes (pull_data, cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 static gboolean
 find_object_ensure_indexes (OtPullData            *pull_data,
                             const char            *checksum,
@@ -597,15 +762,8 @@ find_object_ensure_indexes (OtPullData            *pull_data,
 
   if (!ret_is_stored)
     {
-      if (!pull_data->fetched_packs)
-        {
-          pull_data->fetched_packs = TRUE;
-          pull_data->cached_meta_pack_indexes = g_ptr_array_new_with_free_func (g_free);
-          pull_data->cached_data_pack_indexes = g_ptr_array_new_with_free_func (g_free);
-
-          if (!fetch_and_cache_pack_indexes (pull_data, cancellable, error))
-            goto out;
-        }
+      if (!ensure_remote_pack_indexes (pull_data, cancellable, error))
+        goto out;
 
       if (!find_object_in_remote_packs (pull_data, checksum, objtype, 
                                         &ret_remote_pack_checksum, out_remote_pack_offset,
@@ -660,6 +818,50 @@ find_object_ensure_pack_data (OtPullData            *pull_data,
   return ret;
 }
 
+static gboolean
+stage_metadata_from_pack (OtPullData          *pull_data,
+                          const char          *checksum,
+                          OstreeObjectType     objtype,
+                          GFile               *pack_path,
+                          guint64              pack_offset,
+                          GCancellable        *cancellable,
+                          GError             **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GInputStream *input = NULL;
+  ot_lvariant GVariant *pack_entry = NULL;
+  ot_lvariant GVariant *metadata = NULL;
+  GMappedFile *pack_map = NULL;
+
+  pack_map = g_mapped_file_new (ot_gfile_get_path_cached (pack_path), FALSE, error);
+  if (!pack_map)
+    goto out;
+
+  if (!ostree_read_pack_entry_raw ((guchar*)g_mapped_file_get_contents (pack_map),
+                                   g_mapped_file_get_length (pack_map),
+                                   pack_offset, FALSE, TRUE, &pack_entry,
+                                   cancellable, error))
+    goto out;
+
+  if (!ostree_parse_meta_pack_entry (pack_entry,
+                                     (guchar*)g_mapped_file_get_contents (pack_map),
+                                     g_mapped_file_get_length (pack_map),
+                                     &metadata, error))
+    goto out;
+      
+  input = ot_variant_read (metadata);
+
+  if (!ostree_repo_stage_object (pull_data->repo, objtype, checksum, input,
+                                 cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (pack_map)
+    g_mapped_file_unref (pack_map);
+  return ret;
+}
+
 static gboolean
 fetch_and_store_metadata (OtPullData          *pull_data,
                           const char          *checksum,
@@ -675,9 +877,6 @@ fetch_and_store_metadata (OtPullData          *pull_data,
   ot_lobj GFile *remote_pack_path = NULL;
   ot_lobj GFile *temp_path = NULL;
   ot_lobj GInputStream *input = NULL;
-  ot_lvariant GVariant *pack_entry = NULL;
-  ot_lvariant GVariant *metadata = NULL;
-  GMappedFile *pack_map = NULL;
 
   g_assert (OSTREE_OBJECT_TYPE_IS_META (objtype));
 
@@ -690,19 +889,10 @@ fetch_and_store_metadata (OtPullData          *pull_data,
     {
       g_assert (!is_stored);
 
-      pack_map = g_mapped_file_new (ot_gfile_get_path_cached (remote_pack_path), FALSE, error);
-      if (!pack_map)
-        goto out;
-
-      if (!ostree_read_pack_entry_raw ((guchar*)g_mapped_file_get_contents (pack_map),
-                                       g_mapped_file_get_length (pack_map),
-                                       pack_offset, FALSE, TRUE, &pack_entry,
-                                       cancellable, error))
+      if (!stage_metadata_from_pack (pull_data, checksum, objtype,
+                                     remote_pack_path, pack_offset,
+                                     cancellable, error))
         goto out;
-
-      g_variant_get_child (pack_entry, 2, "v", &metadata);
-      
-      input = ot_variant_read (metadata);
     }
   else if (!is_stored)
     {
@@ -712,11 +902,7 @@ fetch_and_store_metadata (OtPullData          *pull_data,
       input = (GInputStream*)g_file_read (temp_path, cancellable, error);
       if (!input)
         goto out;
-    }
 
-  if (input)
-    {
-      g_assert (remote_pack_path != NULL || !is_stored);
       if (!ostree_repo_stage_object (pull_data->repo, objtype, checksum, input,
                                      cancellable, error))
         goto out;
@@ -731,35 +917,98 @@ fetch_and_store_metadata (OtPullData          *pull_data,
  out:
   if (temp_path)
     (void) ot_gfile_unlink (temp_path, NULL, NULL);
-  if (pack_map)
-    g_mapped_file_unref (pack_map);
   return ret;
 }
 
+/*
+ * The dirtrees and dirmetas of commits are scanned breadth-first.
+ * Objects found locally are parsed right away; up to
+ * --metadata-requests loose objects or metadata packs are downloaded
+ * at once, and their children are queued as each one arrives.
+ */
+typedef struct {
+  OtPullData       *pull_data;
+  char             *checksum;
+  OstreeObjectType  objtype;
+  int               depth;
+  guint64           pack_offset;
+} OtMetaScanItem;
+
+typedef struct {
+  OtPullData       *pull_data;
+  char             *pack_checksum;
+  gboolean          refetched;
+} OtMetaPackFetchData;
+
+static void
+meta_scan_item_free (OtMetaScanItem *item)
+{
+  g_free (item->checksum);
+  g_free (item);
+}
+
+static gboolean
+queue_metadata_scan (OtPullData        *pull_data,
+                     const char        *checksum,
+                     OstreeObjectType   objtype,
+                     int                depth,
+                     GError           **error)
+{
+  gboolean ret = FALSE;
+  OtMetaScanItem *item;
+  char *objname;
+
+  if (depth > OSTREE_MAX_RECURSION)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Exceeded maximum recursion");
+      goto out;
+    }
+
+  objname = ostree_object_to_string (checksum, objtype);
+  if (g_hash_table_lookup (pull_data->meta_scan_seen, objname))
+    {
+      g_free (objname);
+    }
+  else
+    {
+      g_hash_table_insert (pull_data->meta_scan_seen, objname, objname);
+
+      item = g_new0 (OtMetaScanItem, 1);
+      item->pull_data = pull_data;
+      item->checksum = g_strdup (checksum);
+      item->objtype = objtype;
+      item->depth = depth;
+      g_queue_push_tail (&pull_data->meta_scan_queue, item);
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/* Parse a stored object, queueing what it references */
 static gboolean
-fetch_and_store_tree_metadata_recurse (OtPullData   *pull_data,
-                                       int           depth,
-                                       const char   *rev,
-                                       GCancellable *cancellable,
-                                       GError      **error)
+scan_stored_metadata (OtPullData      *pull_data,
+                      OtMetaScanItem  *item,
+                      GError         **error)
 {
   gboolean ret = FALSE;
   int i, n;
   ot_lvariant GVariant *tree = NULL;
   ot_lvariant GVariant *files_variant = NULL;
   ot_lvariant GVariant *dirs_variant = NULL;
-  ot_lobj GFile *stored_path = NULL;
-  ot_lfree char *pack_checksum = NULL;
 
-  if (depth > OSTREE_MAX_RECURSION)
+  pull_data->n_meta_scanned++;
+
+  if (item->objtype != OSTREE_OBJECT_TYPE_DIR_TREE)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "Exceeded maximum recursion");
+      ret = TRUE;
       goto out;
     }
 
-  if (!fetch_and_store_metadata (pull_data, rev, OSTREE_OBJECT_TYPE_DIR_TREE,
-                                 &tree, cancellable, error))
+  if (!ostree_repo_load_variant (pull_data->repo, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                 item->checksum, &tree, error))
     goto out;
 
   /* PARSE OSTREE_SERIALIZED_TREE_VARIANT */
@@ -800,13 +1049,14 @@ fetch_and_store_tree_metadata_recurse (OtPullData   *pull_data,
 
       g_free (tmp_checksum);
       tmp_checksum = ostree_checksum_from_bytes_v (meta_csum);
-      if (!fetch_and_store_metadata (pull_data, tmp_checksum, OSTREE_OBJECT_TYPE_DIR_META,
-                                     NULL, cancellable, error))
+      if (!queue_metadata_scan (pull_data, tmp_checksum, OSTREE_OBJECT_TYPE_DIR_META,
+                                item->depth + 1, error))
         goto out;
 
       g_free (tmp_checksum);
       tmp_checksum = ostree_checksum_from_bytes_v (tree_csum);
-      if (!fetch_and_store_tree_metadata_recurse (pull_data, depth+1, tmp_checksum, cancellable, error))
+      if (!queue_metadata_scan (pull_data, tmp_checksum, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                item->depth + 1, error))
         goto out;
     }
 
@@ -815,79 +1065,368 @@ fetch_and_store_tree_metadata_recurse (OtPullData   *pull_data,
   return ret;
 }
 
-static gboolean
-fetch_and_store_commit_metadata_recurse (OtPullData   *pull_data,
-                                         int           parent_depth,
-                                         int           related_depth,
-                                         const char   *rev,
-                                         GCancellable *cancellable,
-                                         GError      **error)
+static void
+pump_metadata_scan (OtPullData   *pull_data);
+
+static void
+meta_scan_on_object_fetched (GObject        *object,
+                             GAsyncResult   *result,
+                             gpointer        user_data)
 {
-  gboolean ret = FALSE;
-  ot_lvariant GVariant *commit = NULL;
-  ot_lvariant GVariant *related_objects = NULL;
-  ot_lvariant GVariant *tree_contents_csum = NULL;
-  ot_lvariant GVariant *tree_meta_csum = NULL;
-  ot_lfree char *tmp_checksum = NULL;
-  GVariantIter *iter = NULL;
+  OtMetaScanItem *item = user_data;
+  OtPullData *pull_data = item->pull_data;
+  GError *local_error = NULL;
+  GError **error = &local_error;
+  GCancellable *cancellable = NULL;
+  ot_lobj GFile *temp_path = NULL;
+  ot_lobj GInputStream *input = NULL;
 
-  if (!fetch_and_store_metadata (pull_data, rev, OSTREE_OBJECT_TYPE_COMMIT,
-                                 &commit, cancellable, error))
+  temp_path = ostree_fetcher_request_uri_finish ((OstreeFetcher*)object, result, error);
+  if (!temp_path)
     goto out;
 
-  /* PARSE OSTREE_SERIALIZED_COMMIT_VARIANT */
-  g_variant_get_child (commit, 6, "@ay", &tree_contents_csum);
-  g_variant_get_child (commit, 7, "@ay", &tree_meta_csum);
+  input = (GInputStream*)g_file_read (temp_path, cancellable, error);
+  if (!input)
+    goto out;
 
-  g_free (tmp_checksum);
-  tmp_checksum = ostree_checksum_from_bytes_v (tree_meta_csum);
-  if (!fetch_and_store_metadata (pull_data, tmp_checksum, OSTREE_OBJECT_TYPE_DIR_META,
-                                 NULL, cancellable, error))
+  if (!ostree_repo_stage_object (pull_data->repo, item->objtype, item->checksum, input,
+                                 cancellable, error))
     goto out;
-  
-  g_free (tmp_checksum);
-  tmp_checksum = ostree_checksum_from_bytes_v (tree_contents_csum);
-  if (!fetch_and_store_tree_metadata_recurse (pull_data, 0, tmp_checksum,
-                                              cancellable, error))
+
+  if (!scan_stored_metadata (pull_data, item, error))
     goto out;
 
-  if (opt_related)
-    {
-      const char *name;
-      ot_lvariant GVariant *csum_v = NULL;
+ out:
+  if (temp_path)
+    (void) ot_gfile_unlink (temp_path, NULL, NULL);
+  meta_scan_item_free (item);
+  pull_data->outstanding_meta_requests--;
+  if (local_error == NULL)
+    pump_metadata_scan (pull_data);
+  check_outstanding_requests_handle_error (pull_data, local_error);
+}
 
-      if (parent_depth > OSTREE_MAX_RECURSION
-          || related_depth > OSTREE_MAX_RECURSION)
-        {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "Exceeded maximum recursion");
-          goto out;
-        }
+static void
+meta_scan_on_pack_fetched (GObject        *object,
+                           GAsyncResult   *result,
+                           gpointer        user_data)
+{
+  OtMetaPackFetchData *data = user_data;
+  OtPullData *pull_data = data->pull_data;
+  GError *local_error = NULL;
+  GError **error = &local_error;
+  GCancellable *cancellable = NULL;
+  guint i;
+  gboolean valid;
+  gboolean need_refetch = FALSE;
+  GPtrArray *waiting;
+  ot_lobj GFile *temp_path = NULL;
+  ot_lobj GFile *pack_path = NULL;
 
-      related_objects = g_variant_get_child_value (commit, 2);
-      iter = g_variant_iter_new (related_objects);
+  waiting = g_hash_table_lookup (pull_data->meta_packs_pending, data->pack_checksum);
+  g_assert (waiting != NULL);
 
-      while (g_variant_iter_loop (iter, "(&s@ay)", &name, &csum_v))
-        {
-          ot_lfree char *checksum = ostree_checksum_from_bytes_v (csum_v);
+  temp_path = ostree_fetcher_request_uri_finish ((OstreeFetcher*)object, result, error);
+  if (!temp_path)
+    goto out;
 
-          /* Pass opt_depth here to ensure we aren't fetching parents of related */
-          if (!fetch_and_store_commit_metadata_recurse (pull_data, opt_depth,
-                                                        related_depth + 1, checksum,
-                                                        cancellable, error))
-            goto out;
-        }
-    }
+  if (!check_fetched_pack (temp_path, data->pack_checksum, &valid, cancellable, error))
+    goto out;
 
-  if (parent_depth < opt_depth)
+  if (!valid && !data->refetched)
     {
-      ot_lvariant GVariant *parent_csum_v = NULL;
+      ot_lfree char *pack_name = ostree_get_pack_data_name (TRUE, data->pack_checksum);
+      SoupURI *pack_uri = suburi_new (pull_data->base_uri, "objects", "pack", pack_name, NULL);
+
+      /* The stale file is gone, so this starts from the beginning */
+      data->refetched = TRUE;
+      ostree_fetcher_request_uri_resumable_async (pull_data->fetcher, pack_uri,
+                                                  temp_path, G_PRIORITY_HIGH,
+                                                  cancellable,
+                                                  meta_scan_on_pack_fetched, data);
+      soup_uri_free (pack_uri);
+      need_refetch = TRUE;
+      goto out;
+    }
+  else if (!valid)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Corrupted pack %s", data->pack_checksum);
+      goto out;
+    }
 
-      parent_csum_v = g_variant_get_child_value (commit, 1);
+  if (!ostree_repo_take_cached_remote_pack_data (pull_data->repo, pull_data->remote_name,
+                                                 data->pack_checksum, TRUE, temp_path,
+                                                 cancellable, error))
+    goto out;
 
-      if (g_variant_n_children (parent_csum_v) > 0)
-        {
-          ot_lfree char *checksum = ostree_checksum_from_bytes_v (parent_csum_v);
+  if (!ostree_repo_get_cached_remote_pack_data (pull_data->repo, pull_data->remote_name,
+                                                data->pack_checksum, TRUE, &pack_path,
+                                                cancellable, error))
+    goto out;
+  g_assert (pack_path != NULL);
+
+  for (i = 0; i < waiting->len; i++)
+    {
+      OtMetaScanItem *item = waiting->pdata[i];
+
+      if (!stage_metadata_from_pack (pull_data, item->checksum, item->objtype,
+                                     pack_path, item->pack_offset,
+                                     cancellable, error))
+        goto out;
+
+      if (!scan_stored_metadata (pull_data, item, error))
+        goto out;
+    }
+
+ out:
+  if (need_refetch)
+    return;
+  g_hash_table_remove (pull_data->meta_packs_pending, data->pack_checksum);
+  g_free (data->pack_checksum);
+  g_free (data);
+  pull_data->outstanding_meta_requests--;
+  if (local_error == NULL)
+    pump_metadata_scan (pull_data);
+  check_outstanding_requests_handle_error (pull_data, local_error);
+}
+
+/*
+ * Takes ownership of @item, unless @out_deferred is set because the
+ * remote pack indexes have not been fetched yet; that has to be done
+ * outside of the main loop.
+ */
+static gboolean
+scan_one_metadata (OtPullData      *pull_data,
+                   OtMetaScanItem  *item,
+                   gboolean        *out_deferred,
+                   GError         **error)
+{
+  gboolean ret = FALSE;
+  gboolean is_stored;
+  gboolean ret_deferred = FALSE;
+  GCancellable *cancellable = NULL;
+  GPtrArray *waiting;
+  ot_lfree char *pack_checksum = NULL;
+  ot_lobj GFile *pack_path = NULL;
+
+  if (!ostree_repo_has_object (pull_data->repo, item->objtype, item->checksum, &is_stored,
+                               cancellable, error))
+    goto out;
+
+  if (is_stored)
+    {
+      if (!scan_stored_metadata (pull_data, item, error))
+        goto out;
+      meta_scan_item_free (item);
+    }
+  else if (!pull_data->fetched_packs)
+    {
+      ret_deferred = TRUE;
+    }
+  else
+    {
+      if (!find_object_in_remote_packs (pull_data, item->checksum, item->objtype,
+                                        &pack_checksum, &item->pack_offset,
+                                        cancellable, error))
+        goto out;
+
+      if (pack_checksum)
+        {
+          if (!ostree_repo_get_cached_remote_pack_data (pull_data->repo, pull_data->remote_name,
+                                                        pack_checksum, TRUE, &pack_path,
+                                                        cancellable, error))
+            goto out;
+        }
+
+      if (pack_path)
+        {
+          if (!stage_metadata_from_pack (pull_data, item->checksum, item->objtype,
+                                         pack_path, item->pack_offset,
+                                         cancellable, error))
+            goto out;
+          if (!scan_stored_metadata (pull_data, item, error))
+            goto out;
+          meta_scan_item_free (item);
+        }
+      else if (pack_checksum)
+        {
+          waiting = g_hash_table_lookup (pull_data->meta_packs_pending, pack_checksum);
+          if (waiting == NULL)
+            {
+              ot_lfree char *pack_name = ostree_get_pack_data_name (TRUE, pack_checksum);
+              SoupURI *pack_uri = suburi_new (pull_data->base_uri, "objects", "pack", pack_name, NULL);
+              OtMetaPackFetchData *fetch_data = g_new0 (OtMetaPackFetchData, 1);
+              ot_lobj GFile *resume_path = get_resume_path (pull_data, pack_name);
+
+              waiting = g_ptr_array_new_with_free_func ((GDestroyNotify)meta_scan_item_free);
+              g_hash_table_insert (pull_data->meta_packs_pending, g_strdup (pack_checksum), waiting);
+
+              fetch_data->pull_data = pull_data;
+              fetch_data->pack_checksum = g_strdup (pack_checksum);
+              pull_data->outstanding_meta_requests++;
+              ostree_fetcher_request_uri_resumable_async (pull_data->fetcher, pack_uri,
+                                                          resume_path, G_PRIORITY_HIGH,
+                                                          cancellable,
+                                                          meta_scan_on_pack_fetched, fetch_data);
+              soup_uri_free (pack_uri);
+            }
+          g_ptr_array_add (waiting, item);
+        }
+      else
+        {
+          ot_lfree char *objpath = ostree_get_relative_object_path (item->checksum, item->objtype);
+          SoupURI *obj_uri = suburi_new (pull_data->base_uri, objpath, NULL);
+
+          pull_data->outstanding_meta_requests++;
+          ostree_fetcher_request_uri_async (pull_data->fetcher, obj_uri,
+                                            G_PRIORITY_HIGH, cancellable,
+                                            meta_scan_on_object_fetched, item);
+          soup_uri_free (obj_uri);
+        }
+    }
+
+  ret = TRUE;
+  if (out_deferred)
+    *out_deferred = ret_deferred;
+ out:
+  if (!ret)
+    meta_scan_item_free (item);
+  return ret;
+}
+
+static void
+pump_metadata_scan (OtPullData   *pull_data)
+{
+  GError *local_error = NULL;
+
+  while (!pull_data->caught_error
+         && pull_data->outstanding_meta_requests < (guint) MAX (opt_metadata_requests, 1))
+    {
+      OtMetaScanItem *item = g_queue_pop_head (&pull_data->meta_scan_queue);
+      gboolean deferred;
+
+      if (item == NULL)
+        break;
+
+      if (!scan_one_metadata (pull_data, item, &deferred, &local_error))
+        {
+          check_outstanding_requests_handle_error (pull_data, local_error);
+          break;
+        }
+
+      if (deferred)
+        {
+          g_queue_push_head (&pull_data->meta_scan_queue, item);
+          break;
+        }
+    }
+}
+
+static gboolean
+scan_queued_metadata (OtPullData   *pull_data,
+                      GCancellable *cancellable,
+                      GError      **error)
+{
+  gboolean ret = FALSE;
+
+  while (TRUE)
+    {
+      pump_metadata_scan (pull_data);
+
+      if (pull_data->outstanding_meta_requests > 0)
+        run_mainloop_monitor_fetcher (pull_data);
+
+      if (pull_data->caught_error)
+        goto out;
+
+      if (g_queue_is_empty (&pull_data->meta_scan_queue))
+        break;
+
+      /* Something wasn't stored locally */
+      g_assert (!pull_data->fetched_packs);
+      if (!ensure_remote_pack_indexes (pull_data, cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+fetch_and_store_commit_metadata_recurse (OtPullData   *pull_data,
+                                         int           parent_depth,
+                                         int           related_depth,
+                                         const char   *rev,
+                                         GCancellable *cancellable,
+                                         GError      **error)
+{
+  gboolean ret = FALSE;
+  ot_lvariant GVariant *commit = NULL;
+  ot_lvariant GVariant *related_objects = NULL;
+  ot_lvariant GVariant *tree_contents_csum = NULL;
+  ot_lvariant GVariant *tree_meta_csum = NULL;
+  ot_lfree char *tmp_checksum = NULL;
+  GVariantIter *iter = NULL;
+
+  if (!fetch_and_store_metadata (pull_data, rev, OSTREE_OBJECT_TYPE_COMMIT,
+                                 &commit, cancellable, error))
+    goto out;
+
+  /* PARSE OSTREE_SERIALIZED_COMMIT_VARIANT */
+  g_variant_get_child (commit, 6, "@ay", &tree_contents_csum);
+  g_variant_get_child (commit, 7, "@ay", &tree_meta_csum);
+
+  g_free (tmp_checksum);
+  tmp_checksum = ostree_checksum_from_bytes_v (tree_meta_csum);
+  if (!queue_metadata_scan (pull_data, tmp_checksum, OSTREE_OBJECT_TYPE_DIR_META,
+                            0, error))
+    goto out;
+  
+  g_free (tmp_checksum);
+  tmp_checksum = ostree_checksum_from_bytes_v (tree_contents_csum);
+  if (!queue_metadata_scan (pull_data, tmp_checksum, OSTREE_OBJECT_TYPE_DIR_TREE,
+                            0, error))
+    goto out;
+
+  if (opt_related)
+    {
+      const char *name;
+      ot_lvariant GVariant *csum_v = NULL;
+
+      if (parent_depth > OSTREE_MAX_RECURSION
+          || related_depth > OSTREE_MAX_RECURSION)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Exceeded maximum recursion");
+          goto out;
+        }
+
+      related_objects = g_variant_get_child_value (commit, 2);
+      iter = g_variant_iter_new (related_objects);
+
+      while (g_variant_iter_loop (iter, "(&s@ay)", &name, &csum_v))
+        {
+          ot_lfree char *checksum = ostree_checksum_from_bytes_v (csum_v);
+
+          /* Pass opt_depth here to ensure we aren't fetching parents of related */
+          if (!fetch_and_store_commit_metadata_recurse (pull_data, opt_depth,
+                                                        related_depth + 1, checksum,
+                                                        cancellable, error))
+            goto out;
+        }
+    }
+
+  if (parent_depth < opt_depth)
+    {
+      ot_lvariant GVariant *parent_csum_v = NULL;
+
+      parent_csum_v = g_variant_get_child_value (commit, 1);
+
+      if (g_variant_n_children (parent_csum_v) > 0)
+        {
+          ot_lfree char *checksum = ostree_checksum_from_bytes_v (parent_csum_v);
 
           if (!fetch_and_store_commit_metadata_recurse (pull_data, parent_depth + 1,
                                                         0, checksum,
@@ -933,46 +1472,28 @@ fetch_ref_contents (OtPullData    *pull_data,
 }
 
 static gboolean
-store_file_from_pack (OtPullData          *pull_data,
-                      const char          *checksum,
-                      const char          *pack_checksum,
-                      GFile               *pack_file,
-                      GCancellable        *cancellable,
-                      GError             **error)
+store_file_from_pack_data (OtPullData          *pull_data,
+                           const char          *checksum,
+                           guchar              *pack_data,
+                           guint64              pack_len,
+                           OstreeZstdDictionary *zstd_dictionary,
+                           guint64              offset,
+                           GCancellable        *cancellable,
+                           GError             **error)
 {
   gboolean ret = FALSE;
-  gboolean exists;
-  guint64 pack_offset;
-  ot_lobj GFile *remote_pack_path = NULL;
-  ot_lobj GFile *temp_path = NULL;
   ot_lvariant GVariant *pack_entry = NULL;
   ot_lobj GInputStream *input = NULL;
   ot_lobj GInputStream *file_object_input = NULL;
   ot_lobj GFileInfo *file_info = NULL;
   ot_lvariant GVariant *xattrs = NULL;
-  ot_lvariant GVariant *csum_bytes_v = NULL;
-  GMappedFile *pack_map = NULL;
 
-  csum_bytes_v = ostree_checksum_to_bytes_v (checksum);
-
-  if (!find_object_in_one_remote_pack (pull_data, csum_bytes_v, OSTREE_OBJECT_TYPE_FILE,
-                                       pack_checksum, &exists, &pack_offset,
-                                       cancellable, error))
-    goto out;
-
-  g_assert (exists);
-
-  pack_map = g_mapped_file_new (ot_gfile_get_path_cached (pack_file), FALSE, error);
-  if (!pack_map)
-    goto out;
-  
-  if (!ostree_read_pack_entry_raw ((guchar*)g_mapped_file_get_contents (pack_map),
-                                   g_mapped_file_get_length (pack_map),
-                                   pack_offset, FALSE, FALSE, &pack_entry,
-                                   cancellable, error))
+  if (!ostree_read_pack_entry_raw (pack_data, pack_len, offset, FALSE, FALSE,
+                                   &pack_entry, cancellable, error))
     goto out;
   
-  if (!ostree_parse_file_pack_entry (pack_entry, &input, &file_info, &xattrs,
+  if (!ostree_parse_file_pack_entry (pack_entry, pack_data, pack_len, zstd_dictionary,
+                                     &input, &file_info, &xattrs,
                                      cancellable, error))
     goto out;
 
@@ -987,8 +1508,379 @@ store_file_from_pack (OtPullData          *pull_data,
 
   ret = TRUE;
  out:
-  if (pack_map)
-    g_mapped_file_unref (pack_map);
+  return ret;
+}
+
+static gboolean
+store_files_from_pack (OtPullData          *pull_data,
+                       GPtrArray           *file_checksums,
+                       const char          *pack_checksum,
+                       GFile               *pack_file,
+                       GCancellable        *cancellable,
+                       GError             **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+  GMappedFile *pack_map = NULL;
+  OstreeZstdDictionary *zstd_dictionary = NULL;
+
+  pack_map = g_mapped_file_new (ot_gfile_get_path_cached (pack_file), FALSE, error);
+  if (!pack_map)
+    goto out;
+
+  if (!ostree_read_pack_zstd_dictionary ((guchar*)g_mapped_file_get_contents (pack_map),
+                                         g_mapped_file_get_length (pack_map),
+                                         &zstd_dictionary, error))
+    goto out;
+
+  for (i = 0; i < file_checksums->len; i++)
+    {
+      const char *checksum = file_checksums->pdata[i];
+      gboolean exists;
+      guint64 pack_offset;
+      ot_lvariant GVariant *csum_bytes_v = NULL;
+
+      csum_bytes_v = ostree_checksum_to_bytes_v (checksum);
+
+      if (!find_object_in_one_remote_pack (pull_data, csum_bytes_v, OSTREE_OBJECT_TYPE_FILE,
+                                           pack_checksum, &exists, &pack_offset,
+                                           cancellable, error))
+        goto out;
+
+      g_assert (exists);
+
+      if (!store_file_from_pack_data (pull_data, checksum,
+                                      (guchar*)g_mapped_file_get_contents (pack_map),
+                                      g_mapped_file_get_length (pack_map),
+                                      zstd_dictionary, pack_offset, cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+#ifdef HAVE_ZSTD
+  if (zstd_dictionary)
+    ostree_zstd_dictionary_unref (zstd_dictionary);
+#endif
+  if (pack_map)
+    g_mapped_file_unref (pack_map);
+  return ret;
+}
+
+/* Ranges separated by less than this are fetched as one request */
+#define OT_PULL_RANGE_MERGE_GAP (16 * 1024)
+
+typedef struct {
+  const char *checksum;
+  guint64     offset;
+} OtPackRangeObject;
+
+typedef struct {
+  OtPullData *pull_data;
+
+  guint64     start;
+  gint64      end; /* Inclusive; -1 for the end of the pack */
+
+  GPtrArray  *checksums;
+  GArray     *offsets;
+
+  GFile      *result_file;
+  GError     *error;
+} OtPackRange;
+
+static void
+pack_range_free (OtPackRange *range)
+{
+  g_ptr_array_unref (range->checksums);
+  g_array_unref (range->offsets);
+  if (range->result_file)
+    (void) ot_gfile_unlink (range->result_file, NULL, NULL);
+  g_clear_object (&range->result_file);
+  g_clear_error (&range->error);
+  g_free (range);
+}
+
+static int
+compare_offsets (gconstpointer  a,
+                 gconstpointer  b)
+{
+  guint64 offset_a = *((guint64*)a);
+  guint64 offset_b = *((guint64*)b);
+
+  if (offset_a < offset_b)
+    return -1;
+  else if (offset_a > offset_b)
+    return 1;
+  return 0;
+}
+
+static int
+compare_pack_range_objects (gconstpointer  a,
+                            gconstpointer  b)
+{
+  return compare_offsets (&((OtPackRangeObject*)a)->offset,
+                          &((OtPackRangeObject*)b)->offset);
+}
+
+/*
+ * Find the offset of the entry following @offset in @sorted_offsets,
+ * which is where the entry at @offset ends.
+ */
+static gboolean
+find_next_offset (GArray   *sorted_offsets,
+                  guint64   offset,
+                  guint64  *out_next)
+{
+  guint lo = 0;
+  guint hi = sorted_offsets->len;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      if (g_array_index (sorted_offsets, guint64, mid) <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (lo == sorted_offsets->len)
+    return FALSE;
+  *out_next = g_array_index (sorted_offsets, guint64, lo);
+  return TRUE;
+}
+
+/*
+ * If few enough of the objects in @pack_checksum are needed, compute
+ * coalesced byte ranges covering just their entries.  @out_ranges is
+ * set to %NULL if the whole pack should be fetched instead.
+ */
+static gboolean
+plan_pack_ranges (OtPullData          *pull_data,
+                  const char          *pack_checksum,
+                  GPtrArray           *file_checksums,
+                  GPtrArray          **out_ranges,
+                  GCancellable        *cancellable,
+                  GError             **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+  guint64 offset;
+  OstreePackIndexIter index_iter;
+  GArray *all_offsets = NULL;
+  GArray *objects = NULL;
+  ot_lvariant GVariant *index_variant = NULL;
+  ot_lptrarray GPtrArray *ret_ranges = NULL;
+
+  if (pull_data->range_unsupported || opt_partial_pack_threshold <= 0)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!ostree_repo_map_cached_remote_pack_index (pull_data->repo, pull_data->remote_name,
+                                                 pack_checksum, FALSE, &index_variant,
+                                                 cancellable, error))
+    goto out;
+
+  all_offsets = g_array_new (FALSE, FALSE, sizeof (guint64));
+  ostree_pack_index_iter_init (&index_iter, index_variant);
+  while (ostree_pack_index_iter_next (&index_iter, NULL, NULL, &offset))
+    g_array_append_val (all_offsets, offset);
+  ostree_pack_index_iter_clear (&index_iter);
+
+  if ((guint64)file_checksums->len * 100
+      > (guint64)all_offsets->len * opt_partial_pack_threshold)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  g_array_sort (all_offsets, compare_offsets);
+
+  objects = g_array_new (FALSE, FALSE, sizeof (OtPackRangeObject));
+  for (i = 0; i < file_checksums->len; i++)
+    {
+      OtPackRangeObject obj;
+      gboolean exists;
+      ot_lvariant GVariant *csum_bytes_v = NULL;
+
+      obj.checksum = file_checksums->pdata[i];
+      csum_bytes_v = ostree_checksum_to_bytes_v (obj.checksum);
+      if (!find_object_in_one_remote_pack (pull_data, csum_bytes_v, OSTREE_OBJECT_TYPE_FILE,
+                                           pack_checksum, &exists, &obj.offset,
+                                           cancellable, error))
+        goto out;
+      g_assert (exists);
+      g_array_append_val (objects, obj);
+    }
+  g_array_sort (objects, compare_pack_range_objects);
+
+  ret_ranges = g_ptr_array_new_with_free_func ((GDestroyNotify) pack_range_free);
+  for (i = 0; i < objects->len; i++)
+    {
+      OtPackRangeObject *obj = &g_array_index (objects, OtPackRangeObject, i);
+      OtPackRange *range = NULL;
+      guint64 start;
+      guint64 next;
+      gint64 end;
+
+      /* Keep the 8 byte alignment of entry data relative to the range */
+      start = obj->offset & ~((guint64)7);
+      if (find_next_offset (all_offsets, obj->offset, &next))
+        end = next - 1;
+      else
+        end = -1;
+
+      if (ret_ranges->len > 0)
+        {
+          OtPackRange *last = ret_ranges->pdata[ret_ranges->len - 1];
+          if (last->end >= 0
+              && start <= (guint64)last->end + 1 + OT_PULL_RANGE_MERGE_GAP)
+            range = last;
+        }
+
+      if (range == NULL)
+        {
+          range = g_new0 (OtPackRange, 1);
+          range->pull_data = pull_data;
+          range->start = start;
+          range->checksums = g_ptr_array_new ();
+          range->offsets = g_array_new (FALSE, FALSE, sizeof (guint64));
+          g_ptr_array_add (ret_ranges, range);
+        }
+
+      range->end = end;
+      g_ptr_array_add (range->checksums, (char*)obj->checksum);
+      g_array_append_val (range->offsets, obj->offset);
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_ranges, &ret_ranges);
+ out:
+  if (all_offsets)
+    g_array_unref (all_offsets);
+  if (objects)
+    g_array_unref (objects);
+  return ret;
+}
+
+static void
+pack_range_on_fetched (GObject        *object,
+                       GAsyncResult   *result,
+                       gpointer        user_data) 
+{
+  OtPackRange *range = user_data;
+
+  range->result_file = ostree_fetcher_request_uri_finish ((OstreeFetcher*)object,
+                                                          result, &range->error);
+  range->pull_data->outstanding_uri_requests--;
+  check_outstanding_requests_handle_error (range->pull_data, NULL);
+}
+
+/*
+ * Fetch @ranges of the content pack @pack_checksum concurrently, and
+ * store the objects they contain.  Fails with %G_IO_ERROR_NOT_SUPPORTED
+ * if the server does not support range requests.  If an object needs
+ * other parts of the pack, such as the base of a delta, which may lie
+ * outside the fetched ranges, @out_needs_whole_pack is set and the
+ * remaining objects are not stored.
+ */
+static gboolean
+fetch_and_store_pack_ranges (OtPullData          *pull_data,
+                             const char          *pack_checksum,
+                             GPtrArray           *ranges,
+                             gboolean            *out_needs_whole_pack,
+                             GCancellable        *cancellable,
+                             GError             **error)
+{
+  gboolean ret = FALSE;
+  guint i, j;
+  gboolean ret_needs_whole_pack = FALSE;
+  ot_lfree char *pack_name = NULL;
+  SoupURI *pack_uri = NULL;
+
+  pack_name = ostree_get_pack_data_name (FALSE, pack_checksum);
+  pack_uri = suburi_new (pull_data->base_uri, "objects", "pack", pack_name, NULL);
+
+  for (i = 0; i < ranges->len; i++)
+    {
+      OtPackRange *range = ranges->pdata[i];
+
+      pull_data->outstanding_uri_requests++;
+      ostree_fetcher_request_uri_range_async (pull_data->fetcher, pack_uri,
+                                              range->start, range->end,
+                                              G_PRIORITY_DEFAULT, cancellable,
+                                              pack_range_on_fetched, range);
+    }
+
+  run_mainloop_monitor_fetcher (pull_data);
+
+  if (pull_data->caught_error)
+    goto out;
+
+  for (i = 0; i < ranges->len; i++)
+    {
+      OtPackRange *range = ranges->pdata[i];
+      if (range->error)
+        {
+          g_propagate_error (error, range->error);
+          range->error = NULL;
+          goto out;
+        }
+    }
+
+  for (i = 0; i < ranges->len; i++)
+    {
+      OtPackRange *range = ranges->pdata[i];
+      GMappedFile *range_map;
+
+      range_map = g_mapped_file_new (ot_gfile_get_path_cached (range->result_file), FALSE, error);
+      if (!range_map)
+        goto out;
+
+      for (j = 0; j < range->checksums->len && !ret_needs_whole_pack; j++)
+        {
+          const char *checksum = range->checksums->pdata[j];
+          guint64 offset = g_array_index (range->offsets, guint64, j);
+          ot_lvariant GVariant *pack_entry = NULL;
+
+          if (!ostree_read_pack_entry_raw ((guchar*)g_mapped_file_get_contents (range_map),
+                                           g_mapped_file_get_length (range_map),
+                                           offset - range->start, FALSE, FALSE,
+                                           &pack_entry, cancellable, error))
+            {
+              g_mapped_file_unref (range_map);
+              goto out;
+            }
+
+          if (!ostree_pack_entry_is_self_contained (pack_entry))
+            {
+              ret_needs_whole_pack = TRUE;
+              break;
+            }
+
+          if (!store_file_from_pack_data (pull_data, checksum,
+                                          (guchar*)g_mapped_file_get_contents (range_map),
+                                          g_mapped_file_get_length (range_map),
+                                          NULL, offset - range->start,
+                                          cancellable, error))
+            {
+              g_mapped_file_unref (range_map);
+              goto out;
+            }
+        }
+
+      g_mapped_file_unref (range_map);
+      if (ret_needs_whole_pack)
+        break;
+    }
+
+  ret = TRUE;
+  if (out_needs_whole_pack)
+    *out_needs_whole_pack = ret_needs_whole_pack;
+ out:
+  if (pack_uri)
+    soup_uri_free (pack_uri);
   return ret;
 }
 
@@ -997,8 +1889,18 @@ typedef struct {
 
   gboolean fetching_content;
 
-  GFile *meta_path;
+  /* The .filemeta is small, so it is collected in memory, up to
+   * OSTREE_MAX_METADATA_SIZE
+   */
+  GOutputStream *meta_out;
+  GFileInfo *file_info;
+  GVariant *xattrs;
+
+  /* The .filecontent is checksummed as it is written out */
+  GChecksum *content_checksum;
   GFile *content_path;
+  GOutputStream *content_out;
+  guint64 resume_offset;
 
   char *checksum;
 } OtFetchOneContentItemData;
@@ -1006,177 +1908,255 @@ typedef struct {
 static void
 destroy_fetch_one_content_item_data (OtFetchOneContentItemData *data)
 {
-  if (data->meta_path)
-    (void) ot_gfile_unlink (data->meta_path, NULL, NULL);
-  g_clear_object (&data->meta_path);
-  if (data->content_path)
-    (void) ot_gfile_unlink (data->content_path, NULL, NULL);
+  g_clear_object (&data->meta_out);
+  g_clear_object (&data->file_info);
+  g_clear_pointer (&data->xattrs, (GDestroyNotify) g_variant_unref);
+  g_clear_pointer (&data->content_checksum, (GDestroyNotify) g_checksum_free);
+  g_clear_object (&data->content_out);
+  /* A partial content_path is kept so the next pull can resume it */
   g_clear_object (&data->content_path);
   g_free (data->checksum);
   g_free (data);
 }
 
-static void
-content_fetch_on_checksum_complete (GObject        *object,
-                                    GAsyncResult   *result,
-                                    gpointer        user_data)
+static gboolean
+content_fetch_on_chunk (const guint8  *buf,
+                        gsize          len,
+                        gpointer       user_data,
+                        GError       **error)
 {
   OtFetchOneContentItemData *data = user_data;
-  GError *local_error = NULL;
-  GError **error = &local_error;
-  guint64 length;
-  GCancellable *cancellable = NULL;
-  ot_lfree guchar *csum;
+  gsize bytes_written;
+
+  if (!data->fetching_content)
+    {
+      gsize meta_size = g_memory_output_stream_get_data_size ((GMemoryOutputStream*) data->meta_out);
+
+      if (len > OSTREE_MAX_METADATA_SIZE - meta_size)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Metadata of file object %s exceeds maximum size %u",
+                       data->checksum, OSTREE_MAX_METADATA_SIZE);
+          return FALSE;
+        }
+      return g_output_stream_write_all (data->meta_out, buf, len, &bytes_written,
+                                        NULL, error);
+    }
+
+  g_checksum_update (data->content_checksum, buf, len);
+  return g_output_stream_write_all (data->content_out, buf, len, &bytes_written,
+                                    NULL, error);
+}
+
+static gboolean
+content_fetch_parse_meta (OtFetchOneContentItemData  *data,
+                          GCancellable               *cancellable,
+                          GError                    **error)
+{
+  gboolean ret = FALSE;
+  gsize meta_size;
+  gpointer meta_data;
   ot_lvariant GVariant *file_meta = NULL;
-  ot_lobj GFileInfo *file_info = NULL;
-  ot_lvariant GVariant *xattrs = NULL;
-  ot_lobj GInputStream *content_input = NULL;
-  ot_lobj GInputStream *file_object_input = NULL;
-  ot_lfree char *checksum;
 
-  csum = ot_gio_checksum_stream_finish ((GInputStream*)object, result, error);
-  if (!csum)
+  if (!g_output_stream_close (data->meta_out, cancellable, error))
     goto out;
 
-  if (!ot_util_variant_map (data->meta_path, OSTREE_FILE_HEADER_GVARIANT_FORMAT, FALSE,
-                            &file_meta, error))
+  meta_size = g_memory_output_stream_get_data_size ((GMemoryOutputStream*) data->meta_out);
+  meta_data = g_memory_output_stream_steal_data ((GMemoryOutputStream*) data->meta_out);
+  file_meta = g_variant_new_from_data (OSTREE_FILE_HEADER_GVARIANT_FORMAT,
+                                       meta_data, meta_size, FALSE,
+                                       g_free, meta_data);
+  g_variant_ref_sink (file_meta);
+
+  if (!ostree_file_header_parse (file_meta, &data->file_info, &data->xattrs, error))
     goto out;
-  
-  if (!ostree_file_header_parse (file_meta, &file_info, &xattrs, error))
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+enqueue_loose_meta_requests (OtPullData   *pull_data);
+
+static void
+content_fetch_on_complete (GObject        *object,
+                           GAsyncResult   *result,
+                           gpointer        user_data);
+
+static gboolean
+content_fetch_start (OtFetchOneContentItemData  *data,
+                     gboolean                    resume,
+                     GCancellable               *cancellable,
+                     GError                    **error)
+{
+  gboolean ret = FALSE;
+  OtPullData *pull_data = data->pull_data;
+  ot_lfree char *content_path = NULL;
+  ot_lfree char *resume_name = NULL;
+  ot_lvariant GVariant *file_header = NULL;
+  ot_lobj GFileInfo *resume_info = NULL;
+  ot_lobj GInputStream *resume_in = NULL;
+  SoupURI *content_uri;
+
+  /* Seed the checksum with the header, so the content can be
+   * verified as it arrives and written straight into the
+   * repository's temporary directory.
+   */
+  file_header = ostree_file_header_new (data->file_info, data->xattrs);
+  g_clear_pointer (&data->content_checksum, (GDestroyNotify) g_checksum_free);
+  data->content_checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  if (!ostree_write_file_header_update_checksum (NULL, file_header,
+                                                 data->content_checksum,
+                                                 cancellable, error))
     goto out;
 
-  if (data->content_path)
+  if (data->content_path == NULL)
     {
-      content_input = (GInputStream*)g_file_read (data->content_path, cancellable, error);
-      if (!content_input)
+      resume_name = g_strconcat (data->checksum, ".filecontent", NULL);
+      data->content_path = get_resume_path (pull_data, resume_name);
+    }
+  g_clear_object (&data->content_out);
+  data->resume_offset = 0;
+
+  if (resume)
+    resume_info = g_file_query_info (data->content_path, OSTREE_GIO_FAST_QUERYINFO,
+                                     G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                     cancellable, NULL);
+  if (resume_info && g_file_info_get_size (resume_info) > 0)
+    {
+      resume_in = (GInputStream*)g_file_read (data->content_path, cancellable, error);
+      if (!resume_in)
+        goto out;
+      if (!ot_gio_splice_update_checksum (NULL, resume_in, data->content_checksum,
+                                          cancellable, error))
         goto out;
+      data->resume_offset = g_file_info_get_size (resume_info);
     }
+  else
+    (void) ot_gfile_unlink (data->content_path, NULL, NULL);
 
-  if (!ostree_raw_file_to_content_stream (content_input, file_info, xattrs,
-                                          &file_object_input, &length,
-                                          cancellable, error))
+  data->content_out = (GOutputStream*)g_file_append_to (data->content_path, 0,
+                                                        cancellable, error);
+  if (!data->content_out)
     goto out;
 
-  checksum = ostree_checksum_from_bytes (csum);
+  content_path = ostree_get_relative_archive_content_path (data->checksum);
+  content_uri = suburi_new (pull_data->base_uri, content_path, NULL);
 
-  if (strcmp (checksum, data->checksum) != 0)
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "Corrupted object %s (actual checksum is %s)",
-                   data->checksum, checksum);
-      goto out;
-    }
+  pull_data->outstanding_filecontent_requests++;
+  data->fetching_content = TRUE;
 
-  if (!ostree_repo_stage_file_object_trusted (data->pull_data->repo, checksum,
-                                              FALSE, file_object_input, length,
-                                              cancellable, error))
-    goto out;
+  ostree_fetcher_stream_uri_async (pull_data->fetcher, content_uri, data->resume_offset,
+                                   content_fetch_on_chunk, data, G_PRIORITY_DEFAULT,
+                                   cancellable,
+                                   content_fetch_on_complete, data);
+  soup_uri_free (content_uri);
 
+  ret = TRUE;
  out:
-  data->pull_data->outstanding_checksum_requests--;
-  check_outstanding_requests_handle_error (data->pull_data, local_error);
-  destroy_fetch_one_content_item_data (data);
+  return ret;
 }
 
-static void
-enqueue_loose_meta_requests (OtPullData   *pull_data);
-
 static void
 content_fetch_on_complete (GObject        *object,
                            GAsyncResult   *result,
                            gpointer        user_data) 
 {
   OtFetchOneContentItemData *data = user_data;
+  OtPullData *pull_data = data->pull_data;
   GError *local_error = NULL;
   GError **error = &local_error;
   GCancellable *cancellable = NULL;
   gboolean was_content_fetch = FALSE;
   gboolean need_content_fetch = FALSE;
-  ot_lvariant GVariant *file_meta = NULL;
-  ot_lobj GFileInfo *file_info = NULL;
-  ot_lobj GInputStream *content_input = NULL;
-  ot_lobj GInputStream *file_object_input = NULL;
-  ot_lvariant GVariant *xattrs = NULL;
 
   was_content_fetch = data->fetching_content;
 
-  if (was_content_fetch)
+  if (!ostree_fetcher_stream_uri_finish ((OstreeFetcher*)object, result, error))
     {
-      data->content_path = ostree_fetcher_request_uri_finish ((OstreeFetcher*)object, result, error);
-      if (!data->content_path)
-        goto out;
-    }
-  else
-    {
-      data->meta_path = ostree_fetcher_request_uri_finish ((OstreeFetcher*)object, result, error);
-      if (!data->meta_path)
-        goto out;
+      /* If continuing a partial download failed, start over once */
+      if (was_content_fetch && data->resume_offset > 0
+          && !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_clear_error (&local_error);
+          if (!content_fetch_start (data, FALSE, cancellable, error))
+            goto out;
+          need_content_fetch = TRUE;
+        }
+      goto out;
     }
 
   if (!was_content_fetch)
     {
-      if (!ot_util_variant_map (data->meta_path, OSTREE_FILE_HEADER_GVARIANT_FORMAT, FALSE,
-                                &file_meta, error))
-        goto out;
-
-      if (!ostree_file_header_parse (file_meta, &file_info, &xattrs, error))
+      if (!content_fetch_parse_meta (data, cancellable, error))
         goto out;
 
-      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
+      if (g_file_info_get_file_type (data->file_info) == G_FILE_TYPE_REGULAR)
         {
-          ot_lfree char *content_path = ostree_get_relative_archive_content_path (data->checksum);
-          SoupURI *content_uri;
-
-          content_uri = suburi_new (data->pull_data->base_uri, content_path, NULL);
-
-          data->pull_data->outstanding_filecontent_requests++;
+          if (!content_fetch_start (data, TRUE, cancellable, error))
+            goto out;
           need_content_fetch = TRUE;
-          data->fetching_content = TRUE;
+        }
+      else
+        {
+          guint64 length;
+          ot_lobj GInputStream *file_object_input = NULL;
+
+          if (!ostree_raw_file_to_content_stream (NULL, data->file_info, data->xattrs,
+                                                  &file_object_input, &length,
+                                                  cancellable, error))
+            goto out;
 
-          ostree_fetcher_request_uri_async (data->pull_data->fetcher, content_uri, cancellable,
-                                            content_fetch_on_complete, data);
-          soup_uri_free (content_uri);
+          if (!ostree_repo_stage_file_object (pull_data->repo, data->checksum,
+                                              file_object_input, length,
+                                              cancellable, error))
+            goto out;
         }
     }
-
-  if (!need_content_fetch)
+  else
     {
-      if (data->content_path)
+      const char *actual_checksum;
+
+      if (!g_output_stream_close (data->content_out, cancellable, error))
+        goto out;
+
+      actual_checksum = g_checksum_get_string (data->content_checksum);
+      if (strcmp (actual_checksum, data->checksum) != 0 && data->resume_offset > 0)
         {
-          content_input = (GInputStream*)g_file_read (data->content_path, cancellable, error);
-          if (!content_input)
+          if (!content_fetch_start (data, FALSE, cancellable, error))
             goto out;
+          need_content_fetch = TRUE;
+          goto out;
         }
-
-      if (file_meta == NULL)
+      else if (strcmp (actual_checksum, data->checksum) != 0)
         {
-          if (!ot_util_variant_map (data->meta_path, OSTREE_FILE_HEADER_GVARIANT_FORMAT, FALSE,
-                                    &file_meta, error))
-            goto out;
-
-          if (!ostree_file_header_parse (file_meta, &file_info, &xattrs, error))
-            goto out;
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Corrupted object %s (actual checksum is %s)",
+                       data->checksum, actual_checksum);
+          (void) ot_gfile_unlink (data->content_path, NULL, NULL);
+          goto out;
         }
 
-      if (!ostree_raw_file_to_content_stream (content_input, file_info, xattrs,
-                                              &file_object_input, NULL,
-                                              cancellable, error))
+      if (!ostree_repo_stage_file_object_from_raw (pull_data->repo, data->checksum,
+                                                   data->file_info, data->xattrs,
+                                                   data->content_path,
+                                                   cancellable, error))
         goto out;
-
-      data->pull_data->outstanding_checksum_requests++;
-      ot_gio_checksum_stream_async (file_object_input, G_PRIORITY_DEFAULT, NULL,
-                                    content_fetch_on_checksum_complete, data);
+      g_clear_object (&data->content_path);
     }
 
  out:
   if (was_content_fetch)
-    data->pull_data->outstanding_filecontent_requests--;
+    pull_data->outstanding_filecontent_requests--;
   else
     {
-      data->pull_data->outstanding_filemeta_requests--;
-      enqueue_loose_meta_requests (data->pull_data);
+      pull_data->outstanding_filemeta_requests--;
+      enqueue_loose_meta_requests (pull_data);
     }
-  check_outstanding_requests_handle_error (data->pull_data, local_error);
+  if (!need_content_fetch)
+    destroy_fetch_one_content_item_data (data);
+  check_outstanding_requests_handle_error (pull_data, local_error);
 }
 
 static void
@@ -1198,12 +2178,19 @@ enqueue_loose_meta_requests (OtPullData *pull_data)
       one_item_data->pull_data = pull_data;
       one_item_data->checksum = g_strdup (checksum);
       one_item_data->fetching_content = FALSE;
+      one_item_data->meta_out = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
           
       objpath = ostree_get_relative_object_path (checksum, OSTREE_OBJECT_TYPE_FILE);
       obj_uri = suburi_new (pull_data->base_uri, objpath, NULL);
 
-      ostree_fetcher_request_uri_async (pull_data->fetcher, obj_uri, cancellable,
-                                        content_fetch_on_complete, one_item_data);
+      /* The fetcher limits how many requests are in flight; give
+       * the content of objects already started precedence over
+       * starting new ones.
+       */
+      ostree_fetcher_stream_uri_async (pull_data->fetcher, obj_uri, 0,
+                                       content_fetch_on_chunk, one_item_data,
+                                       G_PRIORITY_LOW, cancellable,
+                                       content_fetch_on_complete, one_item_data);
       soup_uri_free (obj_uri);
 
       pull_data->outstanding_filemeta_requests++;
@@ -1282,20 +2269,59 @@ fetch_content (OtPullData           *pull_data,
     {
       const char *pack_checksum = key;
       GPtrArray *file_checksums = value;
-      guint i;
+      GError *temp_error = NULL;
+      gboolean needs_whole_pack = FALSE;
       ot_lobj GFile *pack_path = NULL;
+      ot_lptrarray GPtrArray *ranges = NULL;
 
-      if (!fetch_one_pack_file (pull_data, pack_checksum, FALSE,
-                                &pack_path, cancellable, error))
+      if (!ostree_repo_get_cached_remote_pack_data (pull_data->repo, pull_data->remote_name,
+                                                    pack_checksum, FALSE, &pack_path,
+                                                    cancellable, error))
         goto out;
 
-      g_print ("Storing %u objects from content pack %s\n", file_checksums->len,
-               pack_checksum);
-      for (i = 0; i < file_checksums->len; i++)
+      if (pack_path == NULL)
         {
-          const char *checksum = file_checksums->pdata[i];
-          if (!store_file_from_pack (pull_data, checksum, pack_checksum, pack_path,
-                                     cancellable, error))
+          if (!plan_pack_ranges (pull_data, pack_checksum, file_checksums,
+                                 &ranges, cancellable, error))
+            goto out;
+        }
+
+      if (ranges != NULL)
+        {
+          g_print ("Fetching %u objects from content pack %s in %u ranges\n",
+                   file_checksums->len, pack_checksum, ranges->len);
+          if (!fetch_and_store_pack_ranges (pull_data, pack_checksum, ranges,
+                                            &needs_whole_pack, cancellable, &temp_error))
+            {
+              if (!g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+                {
+                  g_propagate_error (error, temp_error);
+                  goto out;
+                }
+              g_print ("%s; fetching whole packs\n", temp_error->message);
+              g_clear_error (&temp_error);
+              pull_data->range_unsupported = TRUE;
+              g_clear_pointer (&ranges, (GDestroyNotify) g_ptr_array_unref);
+            }
+          else if (needs_whole_pack)
+            {
+              g_print ("Content pack %s has entries depending on the rest of the pack; fetching whole pack\n",
+                       pack_checksum);
+              g_clear_pointer (&ranges, (GDestroyNotify) g_ptr_array_unref);
+            }
+        }
+
+      if (ranges == NULL)
+        {
+          g_clear_object (&pack_path);
+          if (!fetch_one_pack_file (pull_data, pack_checksum, FALSE,
+                                    &pack_path, cancellable, error))
+            goto out;
+
+          g_print ("Storing %u objects from content pack %s\n", file_checksums->len,
+                   pack_checksum);
+          if (!store_files_from_pack (pull_data, file_checksums, pack_checksum, pack_path,
+                                      cancellable, error))
             goto out;
         }
 
@@ -1425,6 +2451,261 @@ repo_get_string_key_inherit (OstreeRepo          *repo,
   return ret;
 }
 
+static gboolean
+keyfile_get_integer_with_default (GKeyFile      *keyfile,
+                                  const char    *section,
+                                  const char    *key,
+                                  gint           default_value,
+                                  gint          *out_value,
+                                  GError       **error)
+{
+  gboolean ret = FALSE;
+  GError *temp_error = NULL;
+  gint ret_value;
+
+  ret_value = g_key_file_get_integer (keyfile, section, key, &temp_error);
+  if (temp_error)
+    {
+      if (g_error_matches (temp_error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND)
+          || g_error_matches (temp_error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND))
+        {
+          g_clear_error (&temp_error);
+          ret_value = default_value;
+        }
+      else
+        {
+          g_propagate_error (error, temp_error);
+          goto out;
+        }
+    }
+
+  if (ret_value <= 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid value %d for %s in [%s]", ret_value, key, section);
+      goto out;
+    }
+
+  ret = TRUE;
+  *out_value = ret_value;
+ out:
+  return ret;
+}
+
+static gboolean
+fetch_and_stage_static_delta_part (OtPullData          *pull_data,
+                                   const char          *delta_name,
+                                   guint                part_index,
+                                   GVariant            *part_info,
+                                   GCancellable        *cancellable,
+                                   GError             **error)
+{
+  gboolean ret = FALSE;
+  guint64 expected_size;
+  gsize compressed_len;
+  gsize part_len;
+  gssize bytes_read;
+  gsize bytes_written;
+  gpointer part_data;
+  guint8 buf[8192];
+  char *compressed_data = NULL;
+  ot_lfree char *part_name = NULL;
+  ot_lfree char *expected_checksum = NULL;
+  ot_lfree char *actual_checksum = NULL;
+  ot_lobj GFile *part_path = NULL;
+  ot_lobj GInputStream *compressed_in = NULL;
+  ot_lobj GInputStream *part_in = NULL;
+  ot_lobj GOutputStream *part_out = NULL;
+  ot_lobj GConverter *decompressor = NULL;
+  ot_lvariant GVariant *csum_v = NULL;
+  ot_lvariant GVariant *part = NULL;
+  SoupURI *part_uri = NULL;
+
+  g_variant_get (part_info, "(@ayt)", &csum_v, &expected_size);
+  if (!ostree_validate_structureof_csum_v (csum_v, error))
+    goto out;
+  expected_checksum = ostree_checksum_from_bytes_v (csum_v);
+
+  part_name = g_strdup_printf ("%u", part_index);
+  part_uri = suburi_new (pull_data->base_uri, "deltas", delta_name, part_name, NULL);
+
+  if (!fetch_uri (pull_data, part_uri, "delta-", &part_path, cancellable, error))
+    goto out;
+
+  if (!g_file_load_contents (part_path, cancellable, &compressed_data, &compressed_len,
+                             NULL, error))
+    goto out;
+
+  actual_checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (guchar*)compressed_data,
+                                                 compressed_len);
+  if (strcmp (actual_checksum, expected_checksum) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Corrupted static delta part %s/%u (actual checksum is %s)",
+                   delta_name, part_index, actual_checksum);
+      goto out;
+    }
+
+  compressed_in = g_memory_input_stream_new_from_data (compressed_data, compressed_len, g_free);
+  compressed_data = NULL;
+  decompressor = (GConverter*)g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+  part_in = g_converter_input_stream_new (compressed_in, decompressor);
+  part_out = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+
+  /* Stop as soon as the part is larger than it claims to be, rather
+   * than decompressing all of it first.
+   */
+  part_len = 0;
+  while (TRUE)
+    {
+      bytes_read = g_input_stream_read (part_in, buf, sizeof (buf), cancellable, error);
+      if (bytes_read < 0)
+        goto out;
+      if (bytes_read == 0)
+        break;
+      if (part_len + bytes_read > expected_size)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Static delta part %s/%u is larger than the expected %" G_GUINT64_FORMAT " bytes",
+                       delta_name, part_index, expected_size);
+          goto out;
+        }
+      if (!g_output_stream_write_all (part_out, buf, bytes_read, &bytes_written,
+                                      cancellable, error))
+        goto out;
+      part_len += bytes_read;
+    }
+
+  if (!g_output_stream_close (part_out, cancellable, error))
+    goto out;
+
+  part_data = g_memory_output_stream_steal_data ((GMemoryOutputStream*) part_out);
+  part = g_variant_new_from_data (OSTREE_STATIC_DELTA_PART_FORMAT, part_data, part_len,
+                                  FALSE, g_free, part_data);
+  g_variant_ref_sink (part);
+
+  if (part_len != expected_size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Static delta part %s/%u has size %" G_GSIZE_FORMAT ", expected %" G_GUINT64_FORMAT,
+                   delta_name, part_index, part_len, expected_size);
+      goto out;
+    }
+
+  if (!ostree_repo_stage_static_delta_part (pull_data->repo, part, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  g_free (compressed_data);
+  if (part_path)
+    (void) ot_gfile_unlink (part_path, NULL, NULL);
+  if (part_uri)
+    soup_uri_free (part_uri);
+  return ret;
+}
+
+/*
+ * If the remote has a static delta from @from to @to, stage every
+ * object it contains.  The regular metadata traversal afterwards then
+ * finds nothing left to fetch.  If a part is missing, or a rollsum
+ * base object is not in the local repository, stop there and leave
+ * the remaining objects to the regular traversal.
+ */
+static gboolean
+fetch_and_stage_static_delta (OtPullData          *pull_data,
+                              const char          *from,
+                              const char          *to,
+                              GCancellable        *cancellable,
+                              GError             **error)
+{
+  gboolean ret = FALSE;
+  guint i, n;
+  gboolean have_from;
+  GError *temp_error = NULL;
+  ot_lfree char *delta_name = NULL;
+  ot_lfree char *superblock_from = NULL;
+  ot_lfree char *superblock_to = NULL;
+  ot_lobj GFile *superblock_path = NULL;
+  ot_lvariant GVariant *superblock = NULL;
+  ot_lvariant GVariant *from_csum_v = NULL;
+  ot_lvariant GVariant *to_csum_v = NULL;
+  ot_lvariant GVariant *parts = NULL;
+  SoupURI *superblock_uri = NULL;
+
+  /* Rollsum encoded objects need the old commit's content */
+  if (!ostree_repo_has_object (pull_data->repo, OSTREE_OBJECT_TYPE_COMMIT, from,
+                               &have_from, cancellable, error))
+    goto out;
+  if (!have_from)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  delta_name = ostree_get_static_delta_name (from, to);
+  superblock_uri = suburi_new (pull_data->base_uri, "deltas", delta_name, "superblock", NULL);
+
+  if (!fetch_uri_allow_noent (pull_data, superblock_uri, &superblock_path,
+                              cancellable, error))
+    goto out;
+  if (!superblock_path)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!ot_util_variant_map (superblock_path, OSTREE_STATIC_DELTA_SUPERBLOCK_FORMAT, FALSE,
+                            &superblock, error))
+    goto out;
+
+  g_variant_get_child (superblock, 1, "@ay", &from_csum_v);
+  g_variant_get_child (superblock, 2, "@ay", &to_csum_v);
+  if (!ostree_validate_structureof_csum_v (from_csum_v, error))
+    goto out;
+  if (!ostree_validate_structureof_csum_v (to_csum_v, error))
+    goto out;
+  superblock_from = ostree_checksum_from_bytes_v (from_csum_v);
+  superblock_to = ostree_checksum_from_bytes_v (to_csum_v);
+  if (strcmp (superblock_from, from) != 0 || strcmp (superblock_to, to) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Static delta %s is for %s-%s", delta_name,
+                   superblock_from, superblock_to);
+      goto out;
+    }
+
+  parts = g_variant_get_child_value (superblock, 3);
+  n = g_variant_n_children (parts);
+  g_print ("Using static delta %s (%u parts)\n", delta_name, n);
+
+  for (i = 0; i < n; i++)
+    {
+      ot_lvariant GVariant *part_info = g_variant_get_child_value (parts, i);
+
+      if (!fetch_and_stage_static_delta_part (pull_data, delta_name, i, part_info,
+                                              cancellable, &temp_error))
+        {
+          if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            {
+              g_print ("Not using static delta %s: %s\n", delta_name, temp_error->message);
+              g_clear_error (&temp_error);
+              break;
+            }
+          g_propagate_error (error, temp_error);
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+ out:
+  if (superblock_path)
+    (void) ot_gfile_unlink (superblock_path, NULL, NULL);
+  if (superblock_uri)
+    soup_uri_free (superblock_uri);
+  return ret;
+}
+
 static gboolean
 ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
 {
@@ -1449,6 +2730,8 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
   GKeyFile *config = NULL;
   char **configured_branches = NULL;
   guint64 bytes_transferred;
+  gint max_connections;
+  gint max_connections_per_host;
 
   memset (pull_data, 0, sizeof (*pull_data));
 
@@ -1467,6 +2750,10 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
 
   pull_data->repo = repo;
   pull_data->file_checksums_to_fetch = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  pull_data->meta_scan_seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  pull_data->meta_packs_pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                         (GDestroyNotify)g_ptr_array_unref);
+  g_queue_init (&pull_data->meta_scan_queue);
 
   if (argc < 2)
     {
@@ -1492,6 +2779,15 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
       goto out;
     }
 
+  if (!keyfile_get_integer_with_default (config, remote_key, "max-connections",
+                                         8, &max_connections, error))
+    goto out;
+  if (!keyfile_get_integer_with_default (config, remote_key, "max-connections-per-host",
+                                         max_connections, &max_connections_per_host, error))
+    goto out;
+  ostree_fetcher_set_max_requests (pull_data->fetcher, max_connections,
+                                   max_connections_per_host);
+
   requested_refs_to_fetch = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
   updated_refs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
   commits_to_fetch = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
@@ -1575,6 +2871,11 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
   if (!ostree_repo_prepare_transaction (pull_data->repo, NULL, error))
     goto out;
 
+  pull_data->resume_dir = ot_gfile_get_child_strconcat (ostree_repo_get_tmpdir (pull_data->repo),
+                                                        "pull-resume-", pull_data->remote_name, NULL);
+  if (!ot_gfile_ensure_directory (pull_data->resume_dir, FALSE, error))
+    goto out;
+
   g_print ("Analyzing objects needed...\n");
 
   g_hash_table_iter_init (&hash_iter, commits_to_fetch);
@@ -1615,6 +2916,13 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
           if (!ostree_validate_checksum_string (sha256, error))
             goto out;
 
+          if (original_rev && !opt_disable_static_deltas)
+            {
+              if (!fetch_and_stage_static_delta (pull_data, original_rev, sha256,
+                                                 cancellable, error))
+                goto out;
+            }
+
           if (!fetch_and_store_commit_metadata_recurse (pull_data, 0, 0, sha256, cancellable, error))
             goto out;
          
@@ -1622,6 +2930,9 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
         }
     }
 
+  if (!scan_queued_metadata (pull_data, cancellable, error))
+    goto out;
+
   if (!fetch_content (pull_data, cancellable, error))
     goto out;
 
@@ -1647,10 +2958,16 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
                                                   cancellable, error))
     goto out;
 
+  if (!ot_gfile_rm_rf (pull_data->resume_dir, cancellable, error))
+    goto out;
+
   bytes_transferred = ostree_fetcher_bytes_transferred (pull_data->fetcher);
   if (bytes_transferred > 0)
     {
       g_print ("%" G_GUINT64_FORMAT " KiB transferred\n", (guint64)(bytes_transferred / 1024.0));
+      if (verbose)
+        g_print ("At most %u requests in flight\n",
+                 ostree_fetcher_peak_requests (pull_data->fetcher));
     }
 
   ret = TRUE;
@@ -1661,10 +2978,15 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
   if (context)
     g_option_context_free (context);
   g_clear_object (&pull_data->fetcher);
+  g_clear_object (&pull_data->resume_dir);
   g_free (pull_data->remote_name);
   if (pull_data->base_uri)
     soup_uri_free (pull_data->base_uri);
   g_clear_pointer (&pull_data->file_checksums_to_fetch, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&pull_data->meta_scan_seen, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&pull_data->meta_packs_pending, (GDestroyNotify) g_hash_table_unref);
+  g_queue_foreach (&pull_data->meta_scan_queue, (GFunc) meta_scan_item_free, NULL);
+  g_queue_clear (&pull_data->meta_scan_queue);
   g_clear_pointer (&pull_data->cached_meta_pack_indexes, (GDestroyNotify) g_ptr_array_unref);
   g_clear_pointer (&pull_data->cached_data_pack_indexes, (GDestroyNotify) g_ptr_array_unref);
   if (summary_uri)
@@ -36,6 +36,8 @@ static char *opt_subpath;
 static gboolean opt_union;
 static gboolean opt_from_stdin;
 static char *opt_from_file;
+static gboolean opt_stats;
+static char *opt_reference_checkout;
 
 static GOptionEntry options[] = {
   { "user-mode", 'U', 0, G_OPTION_ARG_NONE, &opt_user_mode, "Do not change file ownership or initialize extended attributes", NULL },
@@ -45,6 +47,8 @@ static GOptionEntry options[] = {
   { "no-triggers", 0, 0, G_OPTION_ARG_NONE, &opt_no_triggers, "Don't run triggers", NULL },
   { "from-stdin", 0, 0, G_OPTION_ARG_NONE, &opt_from_stdin, "Process many checkouts from standard input", NULL },
   { "from-file", 0, 0, G_OPTION_ARG_STRING, &opt_from_file, "Process many checkouts from input file", NULL },
+  { "stats", 0, 0, G_OPTION_ARG_NONE, &opt_stats, "Print the number of files checked out and throughput", NULL },
+  { "reference-checkout", 0, 0, G_OPTION_ARG_STRING, &opt_reference_checkout, "Hardlink unchanged directories from PATH, an --atomic-retarget checkout", "PATH" },
   { NULL }
 };
 
@@ -77,6 +81,36 @@ atomic_symlink_swap (GFile          *dest,
   return ret;
 }
 
+static gboolean
+parse_commit_from_name (const char   *name,
+                        char        **out_commit,
+                        GError      **error)
+{
+  gboolean ret = FALSE;
+  const char *last_dash;
+  const char *checksum;
+  ot_lfree char *ret_commit = NULL;
+
+  last_dash = strrchr (name, '-');
+  if (last_dash == NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid checkout name %s; no trailing dash", name);
+      goto out;
+    }
+  checksum = last_dash + 1;
+
+  if (!ostree_validate_structureof_checksum_string (checksum, error))
+    goto out;
+  
+  ret_commit = g_strdup (checksum);
+
+  ret = TRUE;
+  ot_transfer_out_value (out_commit, &ret_commit);
+ out:
+  return ret;
+}
+
 static gboolean
 parse_commit_from_symlink (GFile        *symlink,
                            char        **out_commit,
@@ -85,8 +119,6 @@ parse_commit_from_symlink (GFile        *symlink,
 {
   gboolean ret = FALSE;
   const char *target;
-  const char *last_dash;
-  const char *checksum;
   ot_lobj GFileInfo *file_info = NULL;
   ot_lfree char *ret_commit = NULL;
 
@@ -104,26 +136,76 @@ parse_commit_from_symlink (GFile        *symlink,
       goto out;
     }
 
-  last_dash = strrchr (target, '-');
-  if (last_dash == NULL)
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "Invalid existing symlink target; no trailing dash");
-      goto out;
-    }
-  checksum = last_dash + 1;
+  if (!parse_commit_from_name (target, &ret_commit, error))
+    goto out;
 
-  if (!ostree_validate_structureof_checksum_string (checksum, error))
+  ret = TRUE;
+  ot_transfer_out_value (out_commit, &ret_commit);
+ out:
+  return ret;
+}
+
+/*
+ * Find the commit of @path, which is either a directory created by
+ * --atomic-retarget, or the symbolic link pointing to one.
+ */
+static gboolean
+parse_reference_checkout (const char    *path,
+                          char         **out_commit,
+                          GFile        **out_dir,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  gboolean ret = FALSE;
+  const char *target;
+  ot_lobj GFile *f = NULL;
+  ot_lobj GFile *parent = NULL;
+  ot_lobj GFile *ret_dir = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
+  ot_lfree char *ret_commit = NULL;
+
+  f = g_file_new_for_path (path);
+  file_info = g_file_query_info (f, OSTREE_GIO_FAST_QUERYINFO,
+                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                 cancellable, error);
+  if (!file_info)
     goto out;
-  
-  ret_commit = g_strdup (checksum);
+
+  target = g_file_info_get_symlink_target (file_info);
+  if (target != NULL)
+    {
+      if (!parse_commit_from_name (target, &ret_commit, error))
+        goto out;
+      parent = g_file_get_parent (f);
+      ret_dir = g_file_resolve_relative_path (parent, target);
+    }
+  else
+    {
+      if (!parse_commit_from_name (ot_gfile_get_basename_cached (f), &ret_commit, error))
+        goto out;
+      ret_dir = g_object_ref (f);
+    }
 
   ret = TRUE;
   ot_transfer_out_value (out_commit, &ret_commit);
+  ot_transfer_out_value (out_dir, &ret_dir);
  out:
   return ret;
 }
 
+static void
+print_checkout_stats (OstreeRepo *repo)
+{
+  guint n_files;
+  guint64 elapsed_usec;
+  double elapsed_secs;
+
+  ostree_repo_get_checkout_stats (repo, &n_files, &elapsed_usec);
+  elapsed_secs = MAX (elapsed_usec, 1) / (double) G_USEC_PER_SEC;
+  g_print ("Checked out %u files in %.2f seconds (%.0f files/s)\n",
+           n_files, elapsed_secs, n_files / elapsed_secs);
+}
+
 typedef struct {
   gboolean caught_error;
   GError **error;
@@ -170,6 +252,10 @@ process_one_checkout (OstreeRepo           *repo,
   ot_lobj OstreeRepoFile *root = NULL;
   ot_lobj OstreeRepoFile *subtree = NULL;
   ot_lobj GFileInfo *file_info = NULL;
+  ot_lobj GFile *reference_dir = NULL;
+  ot_lobj OstreeRepoFile *reference_root = NULL;
+  ot_lobj OstreeRepoFile *reference_subtree = NULL;
+  ot_lfree char *reference_commit = NULL;
 
   memset (&data, 0, sizeof (data));
   
@@ -188,18 +274,47 @@ process_one_checkout (OstreeRepo           *repo,
   if (!file_info)
     goto out;
 
-  data.loop = g_main_loop_new (NULL, TRUE);
-  data.error = error;
+  if (opt_reference_checkout)
+    {
+      if (!parse_reference_checkout (opt_reference_checkout, &reference_commit, &reference_dir,
+                                     cancellable, error))
+        goto out;
 
-  ostree_repo_checkout_tree_async (repo, opt_user_mode ? OSTREE_REPO_CHECKOUT_MODE_USER : 0,
-                                   opt_union ? OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES : 0,
-                                   target, subtree, file_info, cancellable,
-                                   on_checkout_complete, &data);
+      reference_root = (OstreeRepoFile*)ostree_repo_file_new_root (repo, reference_commit);
+      if (!ostree_repo_file_ensure_resolved (reference_root, error))
+        goto out;
 
-  g_main_loop_run (data.loop);
+      /* The reference is assumed to be a checkout of the same subpath */
+      if (subpath)
+        reference_subtree = (OstreeRepoFile*)g_file_resolve_relative_path ((GFile*)reference_root, subpath);
+      else
+        reference_subtree = g_object_ref (reference_root);
 
-  if (data.caught_error)
-    goto out;
+      if (!ostree_repo_checkout_tree_from_reference (repo, opt_user_mode ? OSTREE_REPO_CHECKOUT_MODE_USER : 0,
+                                                     opt_union ? OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES : 0,
+                                                     target, subtree, file_info,
+                                                     reference_dir, reference_subtree,
+                                                     cancellable, error))
+        goto out;
+    }
+  else
+    {
+      data.loop = g_main_loop_new (NULL, TRUE);
+      data.error = error;
+
+      ostree_repo_checkout_tree_async (repo, opt_user_mode ? OSTREE_REPO_CHECKOUT_MODE_USER : 0,
+                                       opt_union ? OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES : 0,
+                                       target, subtree, file_info, cancellable,
+                                       on_checkout_complete, &data);
+
+      g_main_loop_run (data.loop);
+
+      if (data.caught_error)
+        goto out;
+    }
+
+  if (opt_stats)
+    print_checkout_stats (repo);
                       
   ret = TRUE;
  out:
@@ -208,6 +323,53 @@ process_one_checkout (OstreeRepo           *repo,
   return ret;
 }
 
+static gboolean
+process_delta_checkout (OstreeRepo           *repo,
+                        const char           *old_commit,
+                        const char           *resolved_commit,
+                        const char           *subpath,
+                        GFile                *old_checkout,
+                        GFile                *target,
+                        GCancellable         *cancellable,
+                        GError              **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj OstreeRepoFile *old_root = NULL;
+  ot_lobj OstreeRepoFile *new_root = NULL;
+  ot_lobj OstreeRepoFile *old_subtree = NULL;
+  ot_lobj OstreeRepoFile *new_subtree = NULL;
+
+  old_root = (OstreeRepoFile*)ostree_repo_file_new_root (repo, old_commit);
+  if (!ostree_repo_file_ensure_resolved (old_root, error))
+    goto out;
+  new_root = (OstreeRepoFile*)ostree_repo_file_new_root (repo, resolved_commit);
+  if (!ostree_repo_file_ensure_resolved (new_root, error))
+    goto out;
+
+  if (subpath)
+    {
+      old_subtree = (OstreeRepoFile*)g_file_resolve_relative_path ((GFile*)old_root, subpath);
+      new_subtree = (OstreeRepoFile*)g_file_resolve_relative_path ((GFile*)new_root, subpath);
+    }
+  else
+    {
+      old_subtree = g_object_ref (old_root);
+      new_subtree = g_object_ref (new_root);
+    }
+
+  if (!ostree_repo_checkout_tree_delta (repo, opt_user_mode ? OSTREE_REPO_CHECKOUT_MODE_USER : 0,
+                                        old_checkout, old_subtree, target, new_subtree,
+                                        cancellable, error))
+    goto out;
+
+  if (opt_stats)
+    print_checkout_stats (repo);
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 static gboolean
 process_many_checkouts (OstreeRepo         *repo,
                         GFile              *target,
@@ -292,10 +454,12 @@ ostree_builtin_checkout (int argc, char **argv, GFile *repo_path, GError **error
   ot_lfree char *resolved_commit = NULL;
   ot_lfree char *suffixed_destination = NULL;
   ot_lfree char *tmp_destination = NULL;
+  ot_lfree char *old_destination = NULL;
   ot_lobj GFileInfo *symlink_file_info = NULL;
   ot_lobj GFile *checkout_target = NULL;
   ot_lobj GFile *checkout_target_tmp = NULL;
   ot_lobj GFile *symlink_target = NULL;
+  ot_lobj GFile *old_checkout = NULL;
 
   context = g_option_context_new ("COMMIT DESTINATION - Check out a commit into a filesystem tree");
   g_option_context_add_main_entries (context, options, NULL);
@@ -376,6 +540,14 @@ ostree_builtin_checkout (int argc, char **argv, GFile *repo_path, GError **error
           else
             {
               skip_checkout = strcmp (existing_commit, resolved_commit) == 0;
+              if (!skip_checkout)
+                {
+                  /* Reuse the previous checkout, writing only what changed */
+                  old_destination = g_strconcat (destination, "-", existing_commit, NULL);
+                  old_checkout = g_file_new_for_path (old_destination);
+                  if (!g_file_query_exists (old_checkout, cancellable))
+                    g_clear_object (&old_checkout);
+                }
             }
         }
       else
@@ -390,10 +562,20 @@ ostree_builtin_checkout (int argc, char **argv, GFile *repo_path, GError **error
         }
       else
         {
-          if (!process_one_checkout (repo, resolved_commit, opt_subpath,
-                                     checkout_target_tmp ? checkout_target_tmp : checkout_target,
-                                     cancellable, error))
-            goto out;
+          if (old_checkout)
+            {
+              if (!process_delta_checkout (repo, existing_commit, resolved_commit, opt_subpath,
+                                           old_checkout, checkout_target_tmp,
+                                           cancellable, error))
+                goto out;
+            }
+          else
+            {
+              if (!process_one_checkout (repo, resolved_commit, opt_subpath,
+                                         checkout_target_tmp ? checkout_target_tmp : checkout_target,
+                                         cancellable, error))
+                goto out;
+            }
 
           if (!opt_no_triggers)
             {
@@ -41,9 +41,11 @@ static char *opt_related_objects_file;
 static gboolean skip_if_unchanged;
 static gboolean tar_autocreate_parents;
 static gboolean no_xattrs;
+static gboolean use_stat_cache;
 static char **trees;
 static gint owner_uid = -1;
 static gint owner_gid = -1;
+static gint n_workers = 0;
 
 static GOptionEntry options[] = {
   { "subject", 's', 0, G_OPTION_ARG_STRING, &subject, "One line subject", "subject" },
@@ -57,6 +59,8 @@ static GOptionEntry options[] = {
   { "owner-uid", 0, 0, G_OPTION_ARG_INT, &owner_uid, "Set file ownership user id", "UID" },
   { "owner-gid", 0, 0, G_OPTION_ARG_INT, &owner_gid, "Set file ownership group id", "GID" },
   { "no-xattrs", 0, 0, G_OPTION_ARG_NONE, &no_xattrs, "Do not import extended attributes", NULL },
+  { "workers", 0, 0, G_OPTION_ARG_INT, &n_workers, "Number of threads used to stage files (default: number of CPUs)", "N" },
+  { "use-stat-cache", 0, 0, G_OPTION_ARG_NONE, &use_stat_cache, "Reuse checksums of files whose stat data is unchanged since the last commit", NULL },
   { "tar-autocreate-parents", 0, 0, G_OPTION_ARG_NONE, &tar_autocreate_parents, "When loading tar archives, automatically create parent directories as needed", NULL },
   { "skip-if-unchanged", 0, 0, G_OPTION_ARG_NONE, &skip_if_unchanged, "If the contents are unchanged from previous commit, do nothing", NULL },
   { "statoverride", 0, 0, G_OPTION_ARG_FILENAME, &statoverride_file, "File containing list of modifications to make to permissions", "path" },
@@ -333,10 +337,12 @@ ostree_builtin_commit (int argc, char **argv, GFile *repo_path, GError **error)
     }
 
   if (owner_uid >= 0 || owner_gid >= 0 || statoverride_file != NULL
-      || no_xattrs)
+      || no_xattrs || use_stat_cache || n_workers > 0)
     {
       modifier = ostree_repo_commit_modifier_new ();
       modifier->skip_xattrs = no_xattrs;
+      modifier->use_stat_cache = use_stat_cache;
+      modifier->n_workers = n_workers;
       modifier->filter = commit_filter;
       modifier->user_data = mode_adds;
     }
@@ -442,6 +448,14 @@ ostree_builtin_commit (int argc, char **argv, GFile *repo_path, GError **error)
   if (!ostree_repo_stage_mtree (repo, mtree, &contents_checksum, cancellable, error))
     goto out;
 
+  if (use_stat_cache)
+    {
+      guint stat_cache_hits, stat_cache_misses;
+
+      ostree_repo_get_stat_cache_stats (repo, &stat_cache_hits, &stat_cache_misses);
+      g_printerr ("Stat cache: %u hits, %u misses\n", stat_cache_hits, stat_cache_misses);
+    }
+
   if (skip_if_unchanged && parent_commit)
     {
       g_variant_get_child (parent_commit, 6, "@ay", &parent_content_csum_v);
@@ -29,10 +29,12 @@
 #include <glib/gprintf.h>
 
 static gboolean quiet;
+static gboolean verbose;
 static gboolean delete;
 
 static GOptionEntry options[] = {
   { "quiet", 'q', 0, G_OPTION_ARG_NONE, &quiet, "Don't display informational messages", NULL },
+  { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Show metadata cache statistics", NULL },
   { "delete", 0, 0, G_OPTION_ARG_NONE, &delete, "Remove corrupted objects", NULL },
   { NULL }
 };
@@ -50,7 +52,6 @@ fsck_one_pack_file (OtFsckData        *data,
                     GError           **error)
 {
   gboolean ret = FALSE;
-  guchar objtype_u8;
   guint64 offset;
   guint64 pack_size;
   ot_lfree char *path = NULL;
@@ -61,15 +62,14 @@ fsck_one_pack_file (OtFsckData        *data,
   ot_lobj GFile *pack_data_path = NULL;
   ot_lfree guchar *pack_content_csum = NULL;
   ot_lfree char *tmp_checksum = NULL;
-  GVariantIter *index_content_iter = NULL;
+  OstreePackIndexIter index_iter;
+  gboolean index_iter_initialized = FALSE;
 
   g_free (path);
   path = ostree_get_relative_pack_index_path (is_meta, pack_checksum);
   pack_index_path = g_file_resolve_relative_path (ostree_repo_get_path (data->repo), path);
 
-  if (!ot_util_variant_map (pack_index_path,
-                            OSTREE_PACK_INDEX_VARIANT_FORMAT, FALSE,
-                            &index_variant, error))
+  if (!ostree_map_pack_index (pack_index_path, FALSE, &index_variant, error))
     goto out;
       
   if (!ostree_validate_structureof_pack_index (index_variant, error))
@@ -101,12 +101,11 @@ fsck_one_pack_file (OtFsckData        *data,
       goto out;
     }
 
-  g_variant_get_child (index_variant, 2, "a(yayt)", &index_content_iter);
+  ostree_pack_index_iter_init (&index_iter, index_variant);
+  index_iter_initialized = TRUE;
 
-  while (g_variant_iter_loop (index_content_iter, "(y@ayt)",
-                              &objtype_u8, NULL, &offset))
+  while (ostree_pack_index_iter_next (&index_iter, NULL, NULL, &offset))
     {
-      offset = GUINT64_FROM_BE (offset);
       if (offset > pack_size)
         {
           g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -119,8 +118,8 @@ fsck_one_pack_file (OtFsckData        *data,
 
   ret = TRUE;
  out:
-  if (index_content_iter)
-    g_variant_iter_free (index_content_iter);
+  if (index_iter_initialized)
+    ostree_pack_index_iter_clear (&index_iter);
   return ret;
 }
 
@@ -307,6 +306,8 @@ ostree_builtin_fsck (int argc, char **argv, GFile *repo_path, GError **error)
   GCancellable *cancellable = NULL;
   GHashTableIter hash_iter;
   gpointer key, value;
+  guint cache_hits;
+  guint cache_misses;
   ot_lobj OstreeRepo *repo = NULL;
   ot_lhash GHashTable *objects = NULL;
   ot_lhash GHashTable *commits = NULL;
@@ -360,6 +361,12 @@ ostree_builtin_fsck (int argc, char **argv, GFile *repo_path, GError **error)
   if (!fsck_pack_files (&data, cancellable, error))
     goto out;
 
+  if (verbose)
+    {
+      ostree_repo_get_metadata_cache_stats (repo, &cache_hits, &cache_misses);
+      g_print ("Metadata cache: %u hits, %u misses\n", cache_hits, cache_misses);
+    }
+
   ret = TRUE;
  out:
   if (context)
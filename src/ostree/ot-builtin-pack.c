@@ -33,6 +33,9 @@
 
 #define OT_DEFAULT_PACK_SIZE_BYTES (50*1024*1024)
 #define OT_GZIP_COMPRESSION_LEVEL (8)
+#define OT_ZSTD_COMPRESSION_LEVEL (3)
+#define OT_LZ4_COMPRESSION_LEVEL (0)
+#define OT_DELTA_MIN_SIZE (4*1024)
 
 static gboolean opt_analyze_only;
 static gboolean opt_metadata_only;
@@ -42,17 +45,29 @@ static gboolean opt_keep_all_loose;
 static char* opt_pack_size;
 static char* opt_int_compression;
 static char* opt_ext_compression;
+static char* opt_zstd_dictionary;
+static char* opt_cluster;
+static gboolean opt_deltas;
+static int opt_metadata_pack_version;
+static int opt_jobs = 1;
 
 typedef enum {
   OT_COMPRESSION_NONE,
   OT_COMPRESSION_GZIP,
-  OT_COMPRESSION_XZ
+  OT_COMPRESSION_XZ,
+  OT_COMPRESSION_ZSTD,
+  OT_COMPRESSION_LZ4
 } OtCompressionType;
 
 static GOptionEntry options[] = {
   { "pack-size", 0, 0, G_OPTION_ARG_STRING, &opt_pack_size, "Maximum uncompressed size of packfiles in bytes; may be suffixed with k, m, or g", "BYTES" },
-  { "internal-compression", 0, 0, G_OPTION_ARG_STRING, &opt_int_compression, "Compress objects using COMPRESSION", "COMPRESSION" },
-  { "external-compression", 0, 0, G_OPTION_ARG_STRING, &opt_ext_compression, "Compress entire packfiles using COMPRESSION", "COMPRESSION" },
+  { "internal-compression", 0, 0, G_OPTION_ARG_STRING, &opt_int_compression, "Compress objects using COMPRESSION (gzip, zstd or lz4), optionally suffixed with :LEVEL", "COMPRESSION" },
+  { "external-compression", 0, 0, G_OPTION_ARG_STRING, &opt_ext_compression, "Deprecated alias of --internal-compression", "COMPRESSION" },
+  { "zstd-dictionary", 0, 0, G_OPTION_ARG_STRING, &opt_zstd_dictionary, "Compress objects with the trained zstd dictionary in FILE", "FILE" },
+  { "cluster", 0, 0, G_OPTION_ARG_STRING, &opt_cluster, "Group objects into packs by MODE: commit (traversal order of the newest commits, default) or size", "MODE" },
+  { "deltas", 0, 0, G_OPTION_ARG_NONE, &opt_deltas, "Store file objects as deltas against similar objects in the same pack", NULL },
+  { "metadata-pack-version", 0, 0, G_OPTION_ARG_INT, &opt_metadata_pack_version, "Write metadata packs in format VERSION: 0 (default) or 1, with a dictionary of names and checksums", "VERSION" },
+  { "jobs", 0, 0, G_OPTION_ARG_INT, &opt_jobs, "Build up to N packs concurrently (default 1); each pack is compressed by a single thread, so this only helps when --pack-size yields several packs", "N" },
   { "metadata-only", 0, 0, G_OPTION_ARG_NONE, &opt_metadata_only, "Only pack metadata objects", NULL },
   { "analyze-only", 0, 0, G_OPTION_ARG_NONE, &opt_analyze_only, "Just analyze current state", NULL },
   { "reindex-only", 0, 0, G_OPTION_ARG_NONE, &opt_reindex_only, "Regenerate pack index", NULL },
@@ -65,8 +80,25 @@ typedef struct {
   OstreeRepo *repo;
 
   guint64 pack_size;
+  gboolean cluster_by_size;
+  gboolean deltas;
   OtCompressionType int_compression;
+  int int_compression_level;
   OtCompressionType ext_compression;
+  GVariant *zstd_dictionary;
+  int metadata_pack_version;
+  guint n_jobs;
+
+  /* Protects repository updates and the progress counters */
+  GMutex lock;
+  volatile gint failed;
+  guint n_packs_done;
+  guint n_packs_total;
+  guint64 bytes_packed;
+  gint64 start_time;
+
+  /* Map from file checksum to get_delta_key() of its newest name */
+  GHashTable *delta_keys;
 
   gboolean had_error;
   GError **error;
@@ -78,6 +110,36 @@ typedef struct {
   GPid compress_child_pid;
 } OtBuildRepackFile;
 
+typedef struct {
+  char *checksum;
+  guint64 size;
+  guint64 offset;
+  guint depth;
+} OtDeltaBase;
+
+/* Dictionary of a version 1 metadata pack */
+typedef struct {
+  GHashTable *name_indexes;
+  GHashTable *checksum_indexes;
+  GVariant *names;
+  GVariant *checksums;
+} OtMetaPackDictionary;
+
+typedef struct {
+  OtRepackData *data;
+  gboolean is_meta;
+  GPtrArray *objects;
+  GCancellable *cancellable;
+  GError *error;
+} OtPackJob;
+
+static void
+delta_base_free (OtDeltaBase *base)
+{
+  g_free (base->checksum);
+  g_free (base);
+}
+
 static gint
 compare_object_data_by_size (gconstpointer    ap,
                              gconstpointer    bp)
@@ -89,9 +151,9 @@ compare_object_data_by_size (gconstpointer    ap,
 
   g_variant_get_child (a, 2, "t", &a_size);
   g_variant_get_child (b, 2, "t", &b_size);
-  if (a == b)
+  if (a_size == b_size)
     return 0;
-  else if (a > b)
+  else if (a_size > b_size)
     return 1;
   else
     return -1;
@@ -268,17 +330,286 @@ delete_loose_object (OtRepackData     *data,
   return ret;
 }
 
+static void
+meta_pack_dictionary_free (OtMetaPackDictionary *dict)
+{
+  g_hash_table_unref (dict->name_indexes);
+  g_hash_table_unref (dict->checksum_indexes);
+  g_variant_unref (dict->names);
+  g_variant_unref (dict->checksums);
+  g_free (dict);
+}
+
+static void
+count_string (GHashTable   *counts,
+              const char   *str)
+{
+  guint count = GPOINTER_TO_UINT (g_hash_table_lookup (counts, str));
+
+  if (count == 0)
+    g_hash_table_insert (counts, g_strdup (str), GUINT_TO_POINTER (1));
+  else
+    g_hash_table_replace (counts, g_strdup (str), GUINT_TO_POINTER (count + 1));
+}
+
+static void
+count_checksum (GHashTable   *counts,
+                GVariant     *csum_v)
+{
+  ot_lfree char *checksum = ostree_checksum_from_bytes_v (csum_v);
+  count_string (counts, checksum);
+}
+
+static gint
+compare_by_count (gconstpointer  ap,
+                  gconstpointer  bp,
+                  gpointer       user_data)
+{
+  GHashTable *counts = user_data;
+  const char *a = *(const char **)ap;
+  const char *b = *(const char **)bp;
+  guint a_count = GPOINTER_TO_UINT (g_hash_table_lookup (counts, a));
+  guint b_count = GPOINTER_TO_UINT (g_hash_table_lookup (counts, b));
+
+  if (a_count != b_count)
+    return a_count > b_count ? -1 : 1;
+  return strcmp (a, b);
+}
+
+/*
+ * Order the keys of @counts most frequent first, and map each to its
+ * index plus one.
+ */
+static GPtrArray *
+index_by_count (GHashTable   *counts,
+                GHashTable  **out_indexes)
+{
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  guint i;
+  GPtrArray *ret_keys;
+  GHashTable *ret_indexes;
+
+  ret_keys = g_ptr_array_new ();
+  g_hash_table_iter_init (&hash_iter, counts);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    g_ptr_array_add (ret_keys, key);
+  g_ptr_array_sort_with_data (ret_keys, compare_by_count, counts);
+
+  ret_indexes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (i = 0; i < ret_keys->len; i++)
+    g_hash_table_insert (ret_indexes, g_strdup (ret_keys->pdata[i]),
+                         GUINT_TO_POINTER (i + 1));
+
+  *out_indexes = ret_indexes;
+  return ret_keys;
+}
+
+/*
+ * Collect the names and checksums used by the dirtrees in @objects,
+ * most frequent first, so they get the shortest varints.
+ */
 static gboolean
-pack_one_meta_object (OtRepackData        *data,
-                      const char          *checksum,
-                      OstreeObjectType     objtype,
-                      GVariant           **out_packed_object,
-                      GCancellable        *cancellable,
-                      GError             **error)
+build_meta_pack_dictionary (OtRepackData          *data,
+                            GPtrArray             *objects,
+                            OtMetaPackDictionary **out_dict,
+                            GCancellable          *cancellable,
+                            GError               **error)
+{
+  gboolean ret = FALSE;
+  guint i, j;
+  GVariantBuilder names_builder;
+  ot_lhash GHashTable *name_counts = NULL;
+  ot_lhash GHashTable *checksum_counts = NULL;
+  ot_lptrarray GPtrArray *names = NULL;
+  ot_lptrarray GPtrArray *checksums = NULL;
+  GByteArray *checksum_bytes = NULL;
+  OtMetaPackDictionary *ret_dict = NULL;
+
+  name_counts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  checksum_counts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; i < objects->len; i++)
+    {
+      const char *checksum;
+      guint32 objtype_u32;
+      ot_lvariant GVariant *tree = NULL;
+      ot_lvariant GVariant *files_variant = NULL;
+      ot_lvariant GVariant *dirs_variant = NULL;
+
+      g_variant_get (objects->pdata[i], "(&sut)", &checksum, &objtype_u32, NULL);
+      if ((OstreeObjectType)objtype_u32 != OSTREE_OBJECT_TYPE_DIR_TREE)
+        continue;
+
+      if (!ostree_repo_load_variant (data->repo, OSTREE_OBJECT_TYPE_DIR_TREE, checksum,
+                                     &tree, error))
+        goto out;
+
+      files_variant = g_variant_get_child_value (tree, 0);
+      for (j = 0; j < g_variant_n_children (files_variant); j++)
+        {
+          const char *filename;
+          ot_lvariant GVariant *csum_v = NULL;
+
+          g_variant_get_child (files_variant, j, "(&s@ay)", &filename, &csum_v);
+          count_string (name_counts, filename);
+          count_checksum (checksum_counts, csum_v);
+        }
+
+      dirs_variant = g_variant_get_child_value (tree, 1);
+      for (j = 0; j < g_variant_n_children (dirs_variant); j++)
+        {
+          const char *dirname;
+          ot_lvariant GVariant *tree_csum_v = NULL;
+          ot_lvariant GVariant *meta_csum_v = NULL;
+
+          g_variant_get_child (dirs_variant, j, "(&s@ay@ay)",
+                               &dirname, &tree_csum_v, &meta_csum_v);
+          count_string (name_counts, dirname);
+          count_checksum (checksum_counts, tree_csum_v);
+          count_checksum (checksum_counts, meta_csum_v);
+        }
+    }
+
+  ret_dict = g_new0 (OtMetaPackDictionary, 1);
+  names = index_by_count (name_counts, &ret_dict->name_indexes);
+  checksums = index_by_count (checksum_counts, &ret_dict->checksum_indexes);
+
+  g_variant_builder_init (&names_builder, G_VARIANT_TYPE ("as"));
+  for (i = 0; i < names->len; i++)
+    g_variant_builder_add (&names_builder, "s", names->pdata[i]);
+  ret_dict->names = g_variant_ref_sink (g_variant_builder_end (&names_builder));
+
+  checksum_bytes = g_byte_array_new ();
+  for (i = 0; i < checksums->len; i++)
+    {
+      ot_lfree guchar *csum = ostree_checksum_to_bytes (checksums->pdata[i]);
+      g_byte_array_append (checksum_bytes, csum, 32);
+    }
+  ret_dict->checksums = g_variant_ref_sink (ot_gvariant_new_bytearray (checksum_bytes->data,
+                                                                       checksum_bytes->len));
+
+  ret = TRUE;
+  ot_transfer_out_value (out_dict, &ret_dict);
+ out:
+  if (checksum_bytes)
+    g_byte_array_free (checksum_bytes, TRUE);
+  return ret;
+}
+
+static void
+append_varint (GByteArray   *buf,
+               guint64       value)
+{
+  do
+    {
+      guint8 c = value & 0x7F;
+      value >>= 7;
+      if (value)
+        c |= 0x80;
+      g_byte_array_append (buf, &c, 1);
+    }
+  while (value);
+}
+
+static void
+append_dictionary_index (GByteArray   *buf,
+                         GHashTable   *indexes,
+                         const char   *key)
+{
+  guint idx = GPOINTER_TO_UINT (g_hash_table_lookup (indexes, key));
+
+  g_assert (idx > 0);
+  append_varint (buf, idx - 1);
+}
+
+static void
+append_checksum_index (GByteArray   *buf,
+                       GHashTable   *indexes,
+                       GVariant     *csum_v)
+{
+  ot_lfree char *checksum = ostree_checksum_from_bytes_v (csum_v);
+  append_dictionary_index (buf, indexes, checksum);
+}
+
+/*
+ * Encode @tree against @dict, or return %NULL if the compact form
+ * would not expand back to the same bytes.
+ */
+static GVariant *
+compact_dirtree (GVariant             *tree,
+                 OtMetaPackDictionary *dict)
+{
+  guint i, n;
+  GByteArray *buf;
+  GVariant *ret_compact;
+  ot_lvariant GVariant *files_variant = NULL;
+  ot_lvariant GVariant *dirs_variant = NULL;
+  ot_lvariant GVariant *expanded = NULL;
+
+  buf = g_byte_array_new ();
+
+  files_variant = g_variant_get_child_value (tree, 0);
+  n = g_variant_n_children (files_variant);
+  append_varint (buf, n);
+  for (i = 0; i < n; i++)
+    {
+      const char *filename;
+      ot_lvariant GVariant *csum_v = NULL;
+
+      g_variant_get_child (files_variant, i, "(&s@ay)", &filename, &csum_v);
+      append_dictionary_index (buf, dict->name_indexes, filename);
+      append_checksum_index (buf, dict->checksum_indexes, csum_v);
+    }
+
+  dirs_variant = g_variant_get_child_value (tree, 1);
+  n = g_variant_n_children (dirs_variant);
+  append_varint (buf, n);
+  for (i = 0; i < n; i++)
+    {
+      const char *dirname;
+      ot_lvariant GVariant *tree_csum_v = NULL;
+      ot_lvariant GVariant *meta_csum_v = NULL;
+
+      g_variant_get_child (dirs_variant, i, "(&s@ay@ay)",
+                           &dirname, &tree_csum_v, &meta_csum_v);
+      append_dictionary_index (buf, dict->name_indexes, dirname);
+      append_checksum_index (buf, dict->checksum_indexes, tree_csum_v);
+      append_checksum_index (buf, dict->checksum_indexes, meta_csum_v);
+    }
+
+  ret_compact = g_variant_ref_sink (ot_gvariant_new_bytearray (buf->data, buf->len));
+  g_byte_array_free (buf, TRUE);
+
+  /* The object checksum covers the canonical bytes, so only use the
+   * compact form if it reproduces them exactly.
+   */
+  expanded = ostree_expand_compact_dirtree (ret_compact, dict->names, dict->checksums, NULL);
+  if (expanded == NULL
+      || g_variant_get_size (expanded) != g_variant_get_size (tree)
+      || memcmp (g_variant_get_data (expanded), g_variant_get_data (tree),
+                 g_variant_get_size (tree)) != 0)
+    {
+      g_variant_unref (ret_compact);
+      return NULL;
+    }
+
+  return ret_compact;
+}
+
+static gboolean
+pack_one_meta_object (OtRepackData          *data,
+                      const char            *checksum,
+                      OstreeObjectType       objtype,
+                      OtMetaPackDictionary  *dict,
+                      GVariant             **out_packed_object,
+                      GCancellable          *cancellable,
+                      GError               **error)
 {
   gboolean ret = FALSE;
   ot_lobj GFile *object_path = NULL;
   ot_lvariant GVariant *metadata_v = NULL;
+  ot_lvariant GVariant *compact_v = NULL;
   ot_lvariant GVariant *ret_packed_object = NULL;
 
   object_path = ostree_repo_get_object_path (data->repo, checksum, objtype);
@@ -287,27 +618,123 @@ pack_one_meta_object (OtRepackData        *data,
                             TRUE, &metadata_v, error))
     goto out;
 
+  if (dict && objtype == OSTREE_OBJECT_TYPE_DIR_TREE)
+    compact_v = compact_dirtree (metadata_v, dict);
+
   ret_packed_object = g_variant_new ("(y@ayv)", (guchar) objtype,
                                      ostree_checksum_to_bytes_v (checksum),
-                                     metadata_v);
-      
+                                     compact_v ? compact_v : metadata_v);
+
   ret = TRUE;
   ot_transfer_out_value (out_packed_object, &ret_packed_object);
  out:
   return ret;
 }
 
+/*
+ * Read all of @input, of @len bytes, and encode it as a delta against
+ * @base_checksum, stored at @base_offset in the pack.  @out_input is
+ * either the delta, or the plain content if the delta would not save
+ * enough space.
+ */
+static gboolean
+compute_delta_input (OtRepackData        *data,
+                     GInputStream        *input,
+                     gsize                len,
+                     const char          *base_checksum,
+                     guint64              base_offset,
+                     GInputStream       **out_input,
+                     gboolean            *out_is_delta,
+                     GCancellable        *cancellable,
+                     GError             **error)
+{
+  gboolean ret = FALSE;
+  gsize bytes_read;
+  gsize base_len;
+  guint64 header_be[2];
+  GByteArray *ops = NULL;
+  ot_lfree guchar *base_data = NULL;
+  ot_lfree guchar *content = NULL;
+  ot_lobj GInputStream *ret_input = NULL;
+  gboolean ret_is_delta = FALSE;
+
+  content = g_malloc (MAX (len, 1));
+  if (!g_input_stream_read_all (input, content, len, &bytes_read, cancellable, error))
+    goto out;
+  if (bytes_read != len)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Short read of object content");
+      goto out;
+    }
+
+  if (!ostree_repo_load_file_content (data->repo, base_checksum, &base_data, &base_len,
+                                      NULL, NULL, cancellable, error))
+    goto out;
+
+  ops = ostree_static_delta_compute_rollsum (base_data, base_len, content, len);
+
+  /* Only worth it if it saves at least a quarter */
+  if (sizeof (header_be) + ops->len <= len - len / 4)
+    {
+      guchar *delta;
+      gsize delta_len = sizeof (header_be) + ops->len;
+
+      header_be[0] = GUINT64_TO_BE (base_offset);
+      header_be[1] = GUINT64_TO_BE ((guint64) len);
+      delta = g_malloc (delta_len);
+      memcpy (delta, header_be, sizeof (header_be));
+      memcpy (delta + sizeof (header_be), ops->data, ops->len);
+      ret_input = g_memory_input_stream_new_from_data (delta, delta_len, g_free);
+      ret_is_delta = TRUE;
+    }
+  else
+    {
+      ret_input = g_memory_input_stream_new_from_data (content, len, g_free);
+      content = NULL;
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_input, &ret_input);
+  *out_is_delta = ret_is_delta;
+ out:
+  if (ops)
+    g_byte_array_free (ops, TRUE);
+  return ret;
+}
+
+static guchar
+get_entry_compression_flag (OtCompressionType  comptype)
+{
+  switch (comptype)
+    {
+    case OT_COMPRESSION_GZIP:
+      return OSTREE_PACK_FILE_ENTRY_FLAG_GZIP;
+    case OT_COMPRESSION_ZSTD:
+      return OSTREE_PACK_FILE_ENTRY_FLAG_ZSTD;
+    case OT_COMPRESSION_LZ4:
+      return OSTREE_PACK_FILE_ENTRY_FLAG_LZ4;
+    default:
+      g_assert_not_reached ();
+    }
+  return 0;
+}
+
 static gboolean
 pack_one_data_object (OtRepackData        *data,
                       const char          *checksum,
                       OstreeObjectType     objtype,
                       guint64              expected_objsize,
+                      const char          *base_checksum,
+                      guint64              base_offset,
                       GVariant           **out_packed_object,
+                      gboolean            *out_is_delta,
                       GCancellable        *cancellable,
                       GError             **error)
 {
   gboolean ret = FALSE;
   guchar entry_flags = 0;
+  gboolean is_delta = FALSE;
   GInputStream *read_object_in; /* nofree */
   ot_lobj GInputStream *input = NULL;
   ot_lobj GFileInfo *file_info = NULL;
@@ -318,31 +745,39 @@ pack_one_data_object (OtRepackData        *data,
   ot_lvariant GVariant *file_header = NULL;
   ot_lvariant GVariant *ret_packed_object = NULL;
 
-  switch (data->int_compression)
-    {
-    case OT_COMPRESSION_GZIP:
-      {
-        entry_flags |= OSTREE_PACK_FILE_ENTRY_FLAG_GZIP;
-        break;
-      }
-    default:
-      {
-        g_assert_not_reached ();
-      }
-    }
+  entry_flags |= get_entry_compression_flag (data->int_compression);
 
   if (!ostree_repo_load_file (data->repo, checksum, &input, &file_info, &xattrs,
                               cancellable, error))
     goto out;
 
   file_header = ostree_file_header_new (file_info, xattrs);
+
+  if (base_checksum != NULL && g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
+    {
+      GInputStream *delta_input;
+
+      if (!compute_delta_input (data, input, g_file_info_get_size (file_info),
+                                base_checksum, base_offset, &delta_input, &is_delta,
+                                cancellable, error))
+        goto out;
+
+      g_object_unref (input);
+      input = delta_input;
+      if (is_delta)
+        entry_flags |= OSTREE_PACK_FILE_ENTRY_FLAG_DELTA;
+    }
       
   object_data_stream = (GMemoryOutputStream*)g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
   if (input != NULL)
     {
-      if (entry_flags & OSTREE_PACK_FILE_ENTRY_FLAG_GZIP)
+      if (entry_flags & OSTREE_PACK_FILE_ENTRY_COMPRESSION_MASK)
         {
-          compressor = (GConverter*)g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, OT_GZIP_COMPRESSION_LEVEL);
+          compressor = ostree_pack_entry_compressor_new (entry_flags & OSTREE_PACK_FILE_ENTRY_COMPRESSION_MASK,
+                                                         data->int_compression_level,
+                                                         data->zstd_dictionary, error);
+          if (!compressor)
+            goto out;
           compressed_object_input = (GConverterInputStream*)g_object_new (G_TYPE_CONVERTER_INPUT_STREAM,
                                                                           "converter", compressor,
                                                                           "base-stream", input,
@@ -373,10 +808,102 @@ pack_one_data_object (OtRepackData        *data,
 
   ret = TRUE;
   ot_transfer_out_value (out_packed_object, &ret_packed_object);
+  *out_is_delta = is_delta;
  out:
   return ret;
 }
 
+/* Objects whose names only differ by version numbers are delta candidates */
+static char *
+get_delta_key (const char *name)
+{
+  GString *key = g_string_new ("");
+  const char *p;
+
+  for (p = name; *p; p++)
+    {
+      if (!g_ascii_isdigit (*p))
+        g_string_append_c (key, *p);
+    }
+  return g_string_free (key, FALSE);
+}
+
+/*
+ * Choose an earlier entry of this pack to store @objdata as a delta
+ * against: the last one with the same delta key and a similar size.
+ */
+static OtDeltaBase *
+find_delta_base (OtRepackData     *data,
+                 GHashTable       *delta_bases,
+                 GVariant         *objdata)
+{
+  const char *checksum;
+  const char *key;
+  guint64 size;
+  OtDeltaBase *base;
+
+  g_variant_get (objdata, "(&sut)", &checksum, NULL, &size);
+
+  if (size < OT_DELTA_MIN_SIZE || size > OSTREE_ROLLSUM_MAX_SIZE)
+    return NULL;
+  key = g_hash_table_lookup (data->delta_keys, checksum);
+  if (key == NULL)
+    return NULL;
+
+  base = g_hash_table_lookup (delta_bases, key);
+  if (base == NULL
+      || base->depth >= OSTREE_PACK_MAX_DELTA_DEPTH
+      || size > base->size * 2 || base->size > size * 2)
+    return NULL;
+
+  return base;
+}
+
+static void
+add_delta_base (OtRepackData     *data,
+                GHashTable       *delta_bases,
+                GVariant         *objdata,
+                guint64           offset,
+                guint             depth)
+{
+  const char *checksum;
+  const char *key;
+  guint64 size;
+  OtDeltaBase *base;
+
+  g_variant_get (objdata, "(&sut)", &checksum, NULL, &size);
+
+  if (size < OT_DELTA_MIN_SIZE || size > OSTREE_ROLLSUM_MAX_SIZE)
+    return;
+  key = g_hash_table_lookup (data->delta_keys, checksum);
+  if (key == NULL)
+    return;
+
+  base = g_new0 (OtDeltaBase, 1);
+  base->checksum = g_strdup (checksum);
+  base->size = size;
+  base->offset = offset;
+  base->depth = depth;
+  g_hash_table_replace (delta_bases, g_strdup (key), base);
+}
+
+/* Called with data->lock held */
+static void
+report_progress (OtRepackData     *data,
+                 guint64           pack_size)
+{
+  double elapsed;
+
+  data->n_packs_done++;
+  data->bytes_packed += pack_size;
+
+  elapsed = (double)(g_get_monotonic_time () - data->start_time) / G_USEC_PER_SEC;
+  g_print ("Packed %u/%u: %.1f MB in %.1f seconds (%.1f MB/s)\n",
+           data->n_packs_done, data->n_packs_total,
+           (double)data->bytes_packed / 1000000, elapsed,
+           elapsed > 0 ? (double)data->bytes_packed / 1000000 / elapsed : 0.0);
+}
+
 static gboolean
 create_pack_file (OtRepackData        *data,
                   gboolean             is_meta,
@@ -386,6 +913,8 @@ create_pack_file (OtRepackData        *data,
 {
   gboolean ret = FALSE;
   guint i;
+  guint n_deltas = 0;
+  gboolean added;
   guint64 offset;
   gsize bytes_written;
   ot_lobj GFile *pack_dir = NULL;
@@ -395,10 +924,14 @@ create_pack_file (OtRepackData        *data,
   ot_lobj GOutputStream *pack_out = NULL;
   ot_lptrarray GPtrArray *index_content_list = NULL;
   ot_lvariant GVariant *pack_header = NULL;
+  ot_lvariant GVariant *index_v0 = NULL;
   ot_lvariant GVariant *index_content = NULL;
   ot_lfree char *pack_name = NULL;
   ot_lobj GFile *pack_file_path = NULL;
   ot_lobj GFile *pack_index_path = NULL;
+  ot_lhash GHashTable *delta_bases = NULL;
+  OtMetaPackDictionary *dict = NULL;
+  GVariantBuilder pack_metadata_builder;
   GVariantBuilder index_content_builder;
   GChecksum *pack_checksum = NULL;
 
@@ -420,13 +953,29 @@ create_pack_file (OtRepackData        *data,
     goto out;
 
   index_content_list = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  if (!is_meta && data->delta_keys)
+    delta_bases = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, (GDestroyNotify)delta_base_free);
 
   offset = 0;
   pack_checksum = g_checksum_new (G_CHECKSUM_SHA256);
 
+  g_variant_builder_init (&pack_metadata_builder, G_VARIANT_TYPE ("a{sv}"));
+  /* Readers need the dictionary for entries compressed with it */
+  if (!is_meta && data->zstd_dictionary)
+    g_variant_builder_add (&pack_metadata_builder, "{sv}", "zstd-dictionary",
+                           data->zstd_dictionary);
+  if (is_meta && data->metadata_pack_version == 1)
+    {
+      if (!build_meta_pack_dictionary (data, objects, &dict, cancellable, error))
+        goto out;
+      g_variant_builder_add (&pack_metadata_builder, "{sv}", "names", dict->names);
+      g_variant_builder_add (&pack_metadata_builder, "{sv}", "checksums", dict->checksums);
+    }
   pack_header = g_variant_new ("(s@a{sv}t)",
-                               is_meta ? "OSTv0PACKMETAFILE" : "OSTv0PACKDATAFILE",
-                               g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0),
+                               !is_meta ? "OSTv0PACKDATAFILE"
+                               : (dict ? "OSTv1PACKMETAFILE" : "OSTv0PACKMETAFILE"),
+                               g_variant_builder_end (&pack_metadata_builder),
                                (guint64)objects->len);
 
   if (!ostree_write_variant_with_size (pack_out, pack_header, offset, &bytes_written, pack_checksum,
@@ -441,6 +990,9 @@ create_pack_file (OtRepackData        *data,
       guint32 objtype_u32;
       OstreeObjectType objtype;
       guint64 expected_objsize;
+      OtDeltaBase *base = NULL;
+      guint depth = 0;
+      gboolean is_delta = FALSE;
       ot_lvariant GVariant *packed_object = NULL;
       ot_lvariant GVariant *index_entry = NULL;
 
@@ -450,15 +1002,24 @@ create_pack_file (OtRepackData        *data,
 
       if (is_meta)
         {
-          if (!pack_one_meta_object (data, checksum, objtype, &packed_object,
+          if (!pack_one_meta_object (data, checksum, objtype, dict, &packed_object,
                                      cancellable, error))
             goto out;
         }
       else
         {
+          if (delta_bases)
+            base = find_delta_base (data, delta_bases, object_data);
           if (!pack_one_data_object (data, checksum, objtype, expected_objsize,
-                                     &packed_object, cancellable, error))
+                                     base ? base->checksum : NULL,
+                                     base ? base->offset : 0,
+                                     &packed_object, &is_delta, cancellable, error))
             goto out;
+          if (is_delta)
+            {
+              depth = base->depth + 1;
+              n_deltas++;
+            }
         }
 
       if (!write_padding (pack_out, 4, pack_checksum, &offset, cancellable, error))
@@ -471,6 +1032,9 @@ create_pack_file (OtRepackData        *data,
                                    GUINT64_TO_BE (offset));
       g_ptr_array_add (index_content_list, g_variant_ref_sink (index_entry));
       index_entry = NULL;
+
+      if (delta_bases)
+        add_delta_base (data, delta_bases, object_data, offset, depth);
       
       bytes_written = 0;
       if (!ostree_write_variant_with_size (pack_out, packed_object, offset, &bytes_written, 
@@ -489,10 +1053,12 @@ create_pack_file (OtRepackData        *data,
       GVariant *index_item = index_content_list->pdata[i];
       g_variant_builder_add_value (&index_content_builder, index_item);
     }
-  index_content = g_variant_new ("(s@a{sv}@a(yayt))",
-                                 "OSTv0PACKINDEX",
-                                 g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0),
-                                 g_variant_builder_end (&index_content_builder));
+  index_v0 = g_variant_new ("(s@a{sv}@a(yayt))",
+                            "OSTv0PACKINDEX",
+                            g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0),
+                            g_variant_builder_end (&index_content_builder));
+  g_variant_ref_sink (index_v0);
+  index_content = ostree_pack_index_to_v1 (index_v0);
 
   if (!g_output_stream_write_all (index_out,
                                   g_variant_get_data (index_content),
@@ -505,20 +1071,26 @@ create_pack_file (OtRepackData        *data,
   if (!g_output_stream_close (index_out, cancellable, error))
     goto out;
 
-  if (!ostree_repo_add_pack_file (data->repo,
-                                  g_checksum_get_string (pack_checksum),
-                                  is_meta,
-                                  index_temppath,
-                                  pack_temppath,
-                                  cancellable,
-                                  error))
-    goto out;
-
-  if (!ostree_repo_regenerate_pack_index (data->repo, cancellable, error))
+  g_mutex_lock (&data->lock);
+  added = ostree_repo_add_pack_file (data->repo,
+                                     g_checksum_get_string (pack_checksum),
+                                     is_meta,
+                                     index_temppath,
+                                     pack_temppath,
+                                     cancellable,
+                                     error)
+    && ostree_repo_regenerate_pack_index (data->repo, cancellable, error);
+  if (added)
+    {
+      g_print ("Created pack file '%s' with %u objects\n", g_checksum_get_string (pack_checksum), objects->len);
+      if (n_deltas > 0)
+        g_print ("Stored %u objects as deltas\n", n_deltas);
+      report_progress (data, offset);
+    }
+  g_mutex_unlock (&data->lock);
+  if (!added)
     goto out;
 
-  g_print ("Created pack file '%s' with %u objects\n", g_checksum_get_string (pack_checksum), objects->len);
-
   if (!opt_keep_all_loose)
     {
       for (i = 0; i < objects->len; i++)
@@ -546,6 +1118,8 @@ create_pack_file (OtRepackData        *data,
     (void) unlink (ot_gfile_get_path_cached (pack_temppath));
   if (pack_checksum)
     g_checksum_free (pack_checksum);
+  if (dict)
+    meta_pack_dictionary_free (dict);
   return ret;
 }
 
@@ -595,6 +1169,61 @@ cluster_one_object_chain (OtRepackData     *data,
     }
 }
 
+static gboolean
+get_object_data (OtRepackData      *data,
+                 GVariant          *serialized_key,
+                 GVariant         **out_objdata,
+                 GCancellable      *cancellable,
+                 GError           **error)
+{
+  gboolean ret = FALSE;
+  const char *checksum;
+  OstreeObjectType objtype;
+  guint64 size;
+  ot_lobj GFile *object_path = NULL;
+  ot_lobj GFileInfo *object_info = NULL;
+
+  ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+
+  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+    {
+      object_path = ostree_repo_get_object_path (data->repo, checksum, objtype);
+
+      object_info = g_file_query_info (object_path, OSTREE_GIO_FAST_QUERYINFO,
+                                       G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                       cancellable, error);
+      if (!object_info)
+        goto out;
+    }
+  else
+    {
+      if (!ostree_repo_load_file (data->repo, checksum, NULL, &object_info, NULL,
+                                  cancellable, error))
+        goto out;
+    }
+
+  size = g_file_info_get_attribute_uint64 (object_info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+
+  ret = TRUE;
+  *out_objdata = g_variant_ref_sink (g_variant_new ("(sut)", checksum, (guint32)objtype, size));
+ out:
+  return ret;
+}
+
+static void
+add_object_data (GPtrArray         *meta_object_list,
+                 GPtrArray         *data_object_list,
+                 GVariant          *objdata)
+{
+  guint32 objtype_u32;
+
+  g_variant_get_child (objdata, 1, "u", &objtype_u32);
+  if (OSTREE_OBJECT_TYPE_IS_META ((OstreeObjectType) objtype_u32))
+    g_ptr_array_add (meta_object_list, objdata);
+  else
+    g_ptr_array_add (data_object_list, objdata);
+}
+
 /**
  * cluster_objects_stupidly:
  * @objects: Map from serialized object name to objdata
@@ -626,40 +1255,11 @@ cluster_objects_stupidly (OtRepackData      *data,
   g_hash_table_iter_init (&hash_iter, objects);
   while (g_hash_table_iter_next (&hash_iter, &key, &value))
     {
-      GVariant *serialized_key = key;
-      const char *checksum;
-      OstreeObjectType objtype;
-      guint64 size;
       GVariant *v;
-      ot_lobj GFile *object_path = NULL;
-      ot_lobj GFileInfo *object_info = NULL;
-
-      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
-
-      if (OSTREE_OBJECT_TYPE_IS_META (objtype))
-        {
-          object_path = ostree_repo_get_object_path (data->repo, checksum, objtype);
-
-          object_info = g_file_query_info (object_path, OSTREE_GIO_FAST_QUERYINFO,
-                                           G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                           cancellable, error);
-          if (!object_info)
-            goto out;
-        }
-      else
-        {
-          if (!ostree_repo_load_file (data->repo, checksum, NULL, &object_info, NULL,
-                                      cancellable, error))
-            goto out;
-        }
-
-      size = g_file_info_get_attribute_uint64 (object_info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
 
-      v = g_variant_ref_sink (g_variant_new ("(sut)", checksum, (guint32)objtype, size));
-      if (OSTREE_OBJECT_TYPE_IS_META (objtype))
-        g_ptr_array_add (meta_object_list, v);
-      else
-        g_ptr_array_add (data_object_list, v);
+      if (!get_object_data (data, key, &v, cancellable, error))
+        goto out;
+      add_object_data (meta_object_list, data_object_list, v);
     }
 
   g_ptr_array_sort (meta_object_list, compare_object_data_by_size);
@@ -679,36 +1279,361 @@ cluster_objects_stupidly (OtRepackData      *data,
 }
 
 static gboolean
-parse_size_spec_with_suffix (const char *spec,
-                             guint64     default_value,
-                             guint64    *out_size,
-                             GError    **error)
+add_commit_to_frontier (OtRepackData      *data,
+                        const char        *checksum,
+                        GHashTable        *seen,
+                        GPtrArray         *frontier,
+                        GError           **error)
 {
   gboolean ret = FALSE;
-  char *endptr = NULL;
-  guint64 ret_size;
+  char *copy;
+  guint64 timestamp;
+  ot_lvariant GVariant *commit = NULL;
+  ot_lvariant GVariant *parent_csum_bytes = NULL;
 
-  if (spec == NULL)
+  if (g_hash_table_lookup (seen, checksum))
     {
-      ret_size = default_value;
-      endptr = NULL;
+      ret = TRUE;
+      goto out;
     }
-  else
-    {
-      ret_size = g_ascii_strtoull (spec, &endptr, 10);
-  
-      if (endptr && *endptr)
-        {
-          char suffix = *endptr;
-      
-          switch (suffix)
-            {
-            case 'k':
-            case 'K':
-              {
-                ret_size *= 1024;
-                break;
-              }
+  copy = g_strdup (checksum);
+  g_hash_table_insert (seen, copy, copy);
+
+  if (!ostree_repo_load_variant (data->repo, OSTREE_OBJECT_TYPE_COMMIT, checksum,
+                                 &commit, error))
+    goto out;
+  g_variant_get_child (commit, 1, "@ay", &parent_csum_bytes);
+  g_variant_get_child (commit, 5, "t", &timestamp);
+  g_ptr_array_add (frontier, g_variant_ref_sink (g_variant_new ("(ts@ay)", GUINT64_FROM_BE (timestamp),
+                                                                checksum, parent_csum_bytes)));
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/*
+ * Append the objects reachable from all refs to @ordered, walking
+ * the newest commit first and following parents where present.
+ */
+static gboolean
+traverse_refs_newest_first (OtRepackData      *data,
+                            GHashTable        *reachable,
+                            GPtrArray         *ordered,
+                            GCancellable      *cancellable,
+                            GError           **error)
+{
+  gboolean ret = FALSE;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  ot_lhash GHashTable *all_refs = NULL;
+  ot_lhash GHashTable *seen = NULL;
+  ot_lptrarray GPtrArray *frontier = NULL;
+
+  if (!ostree_repo_list_all_refs (data->repo, &all_refs, cancellable, error))
+    goto out;
+
+  seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  /* Array of (timestamp, checksum, parent checksum bytes) */
+  frontier = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+
+  g_hash_table_iter_init (&hash_iter, all_refs);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      if (!add_commit_to_frontier (data, value, seen, frontier, error))
+        goto out;
+    }
+
+  while (frontier->len > 0)
+    {
+      guint i;
+      guint newest = 0;
+      guint64 newest_timestamp = 0;
+      const char *checksum;
+      gboolean have_parent;
+      ot_lvariant GVariant *entry = NULL;
+      ot_lvariant GVariant *parent_csum_bytes = NULL;
+      ot_lfree char *parent = NULL;
+
+      for (i = 0; i < frontier->len; i++)
+        {
+          guint64 timestamp;
+
+          g_variant_get_child (frontier->pdata[i], 0, "t", &timestamp);
+          if (i == 0 || timestamp > newest_timestamp)
+            {
+              newest = i;
+              newest_timestamp = timestamp;
+            }
+        }
+      entry = g_variant_ref (frontier->pdata[newest]);
+      g_ptr_array_remove_index (frontier, newest);
+      g_variant_get_child (entry, 1, "&s", &checksum);
+      g_variant_get_child (entry, 2, "@ay", &parent_csum_bytes);
+
+      if (!ostree_traverse_commit_ordered (data->repo, checksum, 0, reachable, ordered,
+                                           cancellable, error))
+        goto out;
+
+      if (g_variant_n_children (parent_csum_bytes) == 0)
+        continue;
+
+      parent = ostree_checksum_from_bytes_v (parent_csum_bytes);
+      if (!ostree_repo_has_object (data->repo, OSTREE_OBJECT_TYPE_COMMIT, parent,
+                                   &have_parent, cancellable, error))
+        goto out;
+      if (have_parent
+          && !add_commit_to_frontier (data, parent, seen, frontier, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/*
+ * Record the delta key of each file in the dirtrees of @ordered; as
+ * the newest commits come first, a file keeps its newest name.
+ */
+static gboolean
+collect_delta_keys (OtRepackData      *data,
+                    GPtrArray         *ordered,
+                    GCancellable      *cancellable,
+                    GError           **error)
+{
+  gboolean ret = FALSE;
+  guint i, j;
+
+  data->delta_keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  for (i = 0; i < ordered->len; i++)
+    {
+      const char *checksum;
+      OstreeObjectType objtype;
+      ot_lvariant GVariant *tree = NULL;
+      ot_lvariant GVariant *files_variant = NULL;
+
+      ostree_object_name_deserialize (ordered->pdata[i], &checksum, &objtype);
+      if (objtype != OSTREE_OBJECT_TYPE_DIR_TREE)
+        continue;
+
+      if (!ostree_repo_load_variant (data->repo, OSTREE_OBJECT_TYPE_DIR_TREE, checksum,
+                                     &tree, error))
+        goto out;
+
+      files_variant = g_variant_get_child_value (tree, 0);
+      for (j = 0; j < g_variant_n_children (files_variant); j++)
+        {
+          const char *filename;
+          char *file_checksum;
+          ot_lvariant GVariant *csum_v = NULL;
+
+          g_variant_get_child (files_variant, j, "(&s@ay)", &filename, &csum_v);
+          file_checksum = ostree_checksum_from_bytes_v (csum_v);
+          if (g_hash_table_lookup (data->delta_keys, file_checksum))
+            g_free (file_checksum);
+          else
+            g_hash_table_insert (data->delta_keys, file_checksum, get_delta_key (filename));
+        }
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/*
+ * Move each file object next to the first object sharing its delta
+ * key, so that it can be stored as a delta in the same pack.
+ */
+static GPtrArray *
+group_delta_candidates (OtRepackData      *data,
+                        GPtrArray         *object_list)
+{
+  guint i, j;
+  GPtrArray *ret_list;
+  ot_lhash GHashTable *groups = NULL;
+
+  groups = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                  (GDestroyNotify)g_ptr_array_unref);
+
+  for (i = 0; i < object_list->len; i++)
+    {
+      GVariant *objdata = object_list->pdata[i];
+      const char *checksum;
+      const char *key;
+      GPtrArray *group;
+
+      g_variant_get_child (objdata, 0, "&s", &checksum);
+      key = g_hash_table_lookup (data->delta_keys, checksum);
+      if (key == NULL)
+        continue;
+
+      group = g_hash_table_lookup (groups, key);
+      if (group == NULL)
+        {
+          group = g_ptr_array_new ();
+          g_hash_table_insert (groups, (char*)key, group);
+        }
+      g_ptr_array_add (group, objdata);
+    }
+
+  ret_list = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  for (i = 0; i < object_list->len; i++)
+    {
+      GVariant *objdata = object_list->pdata[i];
+      const char *checksum;
+      const char *key;
+      GPtrArray *group;
+
+      g_variant_get_child (objdata, 0, "&s", &checksum);
+      key = g_hash_table_lookup (data->delta_keys, checksum);
+      if (key == NULL)
+        {
+          g_ptr_array_add (ret_list, g_variant_ref (objdata));
+          continue;
+        }
+
+      /* The group is emitted at its first member, then dropped */
+      group = g_hash_table_lookup (groups, key);
+      if (group == NULL)
+        continue;
+      for (j = 0; j < group->len; j++)
+        g_ptr_array_add (ret_list, g_variant_ref (group->pdata[j]));
+      g_hash_table_remove (groups, key);
+    }
+
+  return ret_list;
+}
+
+/*
+ * Like cluster_objects_stupidly(), but order objects as they are
+ * reached from the newest commits, so that each pack holds a
+ * contiguous part of a tree.  Objects not reachable from any ref go
+ * last, sorted by size.
+ */
+static gboolean
+cluster_objects_by_commit (OtRepackData      *data,
+                           GHashTable        *objects,
+                           GPtrArray        **out_meta_clusters,
+                           GPtrArray        **out_data_clusters,
+                           GCancellable      *cancellable,
+                           GError           **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  ot_lhash GHashTable *reachable = NULL;
+  ot_lptrarray GPtrArray *ordered = NULL;
+  ot_lptrarray GPtrArray *ret_meta_clusters = NULL;
+  ot_lptrarray GPtrArray *ret_data_clusters = NULL;
+  ot_lptrarray GPtrArray *meta_object_list = NULL;
+  ot_lptrarray GPtrArray *data_object_list = NULL;
+  ot_lptrarray GPtrArray *meta_unreachable_list = NULL;
+  ot_lptrarray GPtrArray *data_unreachable_list = NULL;
+
+  reachable = ostree_traverse_new_reachable ();
+  ordered = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+
+  if (!traverse_refs_newest_first (data, reachable, ordered, cancellable, error))
+    goto out;
+
+  meta_object_list = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  data_object_list = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  meta_unreachable_list = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  data_unreachable_list = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+
+  for (i = 0; i < ordered->len; i++)
+    {
+      GVariant *serialized_key = ordered->pdata[i];
+      GVariant *v;
+
+      if (!g_hash_table_lookup (objects, serialized_key))
+        continue;
+
+      if (!get_object_data (data, serialized_key, &v, cancellable, error))
+        goto out;
+      add_object_data (meta_object_list, data_object_list, v);
+    }
+
+  g_hash_table_iter_init (&hash_iter, objects);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      GVariant *v;
+
+      if (g_hash_table_lookup (reachable, key))
+        continue;
+
+      if (!get_object_data (data, key, &v, cancellable, error))
+        goto out;
+      add_object_data (meta_unreachable_list, data_unreachable_list, v);
+    }
+
+  g_ptr_array_sort (meta_unreachable_list, compare_object_data_by_size);
+  g_ptr_array_sort (data_unreachable_list, compare_object_data_by_size);
+  for (i = 0; i < meta_unreachable_list->len; i++)
+    g_ptr_array_add (meta_object_list, g_variant_ref (meta_unreachable_list->pdata[i]));
+  for (i = 0; i < data_unreachable_list->len; i++)
+    g_ptr_array_add (data_object_list, g_variant_ref (data_unreachable_list->pdata[i]));
+
+  if (data->deltas)
+    {
+      GPtrArray *grouped;
+
+      if (!collect_delta_keys (data, ordered, cancellable, error))
+        goto out;
+
+      grouped = group_delta_candidates (data, data_object_list);
+      g_ptr_array_unref (data_object_list);
+      data_object_list = grouped;
+    }
+
+  ret_meta_clusters = g_ptr_array_new_with_free_func ((GDestroyNotify)g_ptr_array_unref);
+  ret_data_clusters = g_ptr_array_new_with_free_func ((GDestroyNotify)g_ptr_array_unref);
+
+  cluster_one_object_chain (data, meta_object_list, ret_meta_clusters);
+  cluster_one_object_chain (data, data_object_list, ret_data_clusters);
+
+  ret = TRUE;
+  ot_transfer_out_value (out_meta_clusters, &ret_meta_clusters);
+  ot_transfer_out_value (out_data_clusters, &ret_data_clusters);
+ out:
+  return ret;
+}
+
+static gboolean
+parse_size_spec_with_suffix (const char *spec,
+                             guint64     default_value,
+                             guint64    *out_size,
+                             GError    **error)
+{
+  gboolean ret = FALSE;
+  char *endptr = NULL;
+  guint64 ret_size;
+
+  if (spec == NULL)
+    {
+      ret_size = default_value;
+      endptr = NULL;
+    }
+  else
+    {
+      ret_size = g_ascii_strtoull (spec, &endptr, 10);
+  
+      if (endptr && *endptr)
+        {
+          char suffix = *endptr;
+      
+          switch (suffix)
+            {
+            case 'k':
+            case 'K':
+              {
+                ret_size *= 1024;
+                break;
+              }
             case 'm':
             case 'M':
               {
@@ -735,20 +1660,50 @@ parse_size_spec_with_suffix (const char *spec,
   return ret;
 }
 
+/*
+ * Parse COMPRESSION[:LEVEL]; the level defaults to one suited to
+ * each codec.
+ */
 static gboolean
 parse_compression_string (const char *compstr,
                           OtCompressionType *out_comptype,
+                          int              *out_level,
                           GError           **error)
 {
   gboolean ret = FALSE;
   OtCompressionType ret_comptype;
+  int ret_level = 0;
+  const char *level_str = NULL;
+  ot_lfree char *name = NULL;
   
-  if (compstr == NULL)
+  if (compstr != NULL)
+    {
+      level_str = strchr (compstr, ':');
+      if (level_str)
+        name = g_strndup (compstr, level_str - compstr);
+      else
+        name = g_strdup (compstr);
+    }
+
+  if (name == NULL)
     ret_comptype = OT_COMPRESSION_NONE;
-  else if (strcmp (compstr, "gzip") == 0)
-    ret_comptype = OT_COMPRESSION_GZIP;
-  else if (strcmp (compstr, "xz") == 0)
+  else if (strcmp (name, "gzip") == 0)
+    {
+      ret_comptype = OT_COMPRESSION_GZIP;
+      ret_level = OT_GZIP_COMPRESSION_LEVEL;
+    }
+  else if (strcmp (name, "xz") == 0)
     ret_comptype = OT_COMPRESSION_XZ;
+  else if (strcmp (name, "zstd") == 0)
+    {
+      ret_comptype = OT_COMPRESSION_ZSTD;
+      ret_level = OT_ZSTD_COMPRESSION_LEVEL;
+    }
+  else if (strcmp (name, "lz4") == 0)
+    {
+      ret_comptype = OT_COMPRESSION_LZ4;
+      ret_level = OT_LZ4_COMPRESSION_LEVEL;
+    }
   else
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -756,8 +1711,23 @@ parse_compression_string (const char *compstr,
       goto out;
     }
 
+  if (level_str)
+    {
+      char *endptr;
+
+      ret_level = (int) g_ascii_strtoll (level_str + 1, &endptr, 10);
+      if (*endptr != '\0' || endptr == level_str + 1)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Invalid compression level in '%s'", compstr);
+          goto out;
+        }
+    }
+
   ret = TRUE;
   *out_comptype = ret_comptype;
+  if (out_level)
+    *out_level = ret_level;
  out:
   return ret;
 }
@@ -861,13 +1831,133 @@ do_stats_gather_loose (OtRepackData  *data,
   return ret;
 }
 
+static void
+create_pack_file_thread (gpointer   job_data,
+                         gpointer   user_data)
+{
+  OtPackJob *job = job_data;
+  GAsyncQueue *completed = user_data;
+
+  /* Once anything has failed, just hand the remaining jobs back */
+  if (!g_atomic_int_get (&job->data->failed))
+    {
+      if (!create_pack_file (job->data, job->is_meta, job->objects,
+                             job->cancellable, &job->error))
+        g_atomic_int_set (&job->data->failed, 1);
+    }
+
+  g_async_queue_push (completed, job);
+}
+
+static void
+add_pack_jobs (OtRepackData     *data,
+               gboolean          is_meta,
+               GPtrArray        *clusters,
+               GPtrArray        *jobs,
+               GCancellable     *cancellable)
+{
+  guint i;
+
+  for (i = 0; i < clusters->len; i++)
+    {
+      OtPackJob *job = g_new0 (OtPackJob, 1);
+
+      job->data = data;
+      job->is_meta = is_meta;
+      job->objects = clusters->pdata[i];
+      job->cancellable = cancellable;
+      g_ptr_array_add (jobs, job);
+    }
+}
+
+static void
+pack_job_free (OtPackJob *job)
+{
+  g_clear_error (&job->error);
+  g_free (job);
+}
+
+/*
+ * Each pack is written by a single worker, in cluster order, so its
+ * bytes do not depend on the number of jobs.  Entries within a pack
+ * are not compressed in parallel, as delta entries need the offsets
+ * of the entries before them.
+ */
+static gboolean
+create_pack_files (OtRepackData     *data,
+                   GPtrArray        *meta_clusters,
+                   GPtrArray        *data_clusters,
+                   GCancellable     *cancellable,
+                   GError          **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+  guint n_pushed = 0;
+  GError *temp_error = NULL;
+  GThreadPool *pool = NULL;
+  GAsyncQueue *completed = NULL;
+  ot_lptrarray GPtrArray *jobs = NULL;
+
+  jobs = g_ptr_array_new_with_free_func ((GDestroyNotify)pack_job_free);
+  add_pack_jobs (data, TRUE, meta_clusters, jobs, cancellable);
+  add_pack_jobs (data, FALSE, data_clusters, jobs, cancellable);
+
+  data->n_packs_done = 0;
+  data->n_packs_total = jobs->len;
+  data->bytes_packed = 0;
+  data->start_time = g_get_monotonic_time ();
+
+  /* Cached lazily; do it before any worker can race on it */
+  (void) ot_gfile_get_path_cached (ostree_repo_get_tmpdir (data->repo));
+
+  completed = g_async_queue_new ();
+  pool = g_thread_pool_new (create_pack_file_thread, completed,
+                            data->n_jobs, FALSE, error);
+  if (!pool)
+    goto out;
+
+  for (i = 0; i < jobs->len; i++)
+    {
+      if (!g_thread_pool_push (pool, jobs->pdata[i], &temp_error))
+        {
+          g_atomic_int_set (&data->failed, 1);
+          break;
+        }
+      n_pushed++;
+    }
+
+  for (i = 0; i < n_pushed; i++)
+    {
+      OtPackJob *job = g_async_queue_pop (completed);
+
+      if (job->error && temp_error == NULL)
+        {
+          temp_error = job->error;
+          job->error = NULL;
+        }
+    }
+
+  if (temp_error)
+    {
+      g_propagate_error (error, temp_error);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  if (pool)
+    g_thread_pool_free (pool, FALSE, TRUE);
+  if (completed)
+    g_async_queue_unref (completed);
+  return ret;
+}
+
 static gboolean
 do_incremental_pack (OtRepackData          *data,
                      GCancellable          *cancellable,
                      GError               **error)
 {
   gboolean ret = FALSE;
-  guint i;
   ot_lhash GHashTable *objects = NULL;
   ot_lptrarray GPtrArray *meta_clusters = NULL;
   ot_lptrarray GPtrArray *data_clusters = NULL;
@@ -883,9 +1973,18 @@ do_incremental_pack (OtRepackData          *data,
   g_print ("\n");
   g_print ("Using pack size: %" G_GUINT64_FORMAT "\n", data->pack_size);
 
-  if (!cluster_objects_stupidly (data, loose_objects, &meta_clusters, &data_clusters,
-                                 cancellable, error))
-    goto out;
+  if (data->cluster_by_size)
+    {
+      if (!cluster_objects_stupidly (data, loose_objects, &meta_clusters, &data_clusters,
+                                     cancellable, error))
+        goto out;
+    }
+  else
+    {
+      if (!cluster_objects_by_commit (data, loose_objects, &meta_clusters, &data_clusters,
+                                      cancellable, error))
+        goto out;
+    }
   
   if (meta_clusters->len > 0 || data_clusters->len > 0)
     g_print ("Going to create %u meta packfiles, %u data packfiles\n",
@@ -895,20 +1994,48 @@ do_incremental_pack (OtRepackData          *data,
 
   if (!opt_analyze_only)
     {
-      for (i = 0; i < meta_clusters->len; i++)
-        {
-          GPtrArray *cluster = meta_clusters->pdata[i];
-          
-          if (!create_pack_file (data, TRUE, cluster, cancellable, error))
-            goto out;
-        }
-      for (i = 0; i < data_clusters->len; i++)
-        {
-          GPtrArray *cluster = data_clusters->pdata[i];
-          
-          if (!create_pack_file (data, FALSE, cluster, cancellable, error))
-            goto out;
-        }
+      if (!create_pack_files (data, meta_clusters, data_clusters, cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+upgrade_pack_indexes_of_type (OtRepackData     *data,
+                              gboolean          is_meta,
+                              GPtrArray        *pack_indexes,
+                              GCancellable     *cancellable,
+                              GError          **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+
+  for (i = 0; i < pack_indexes->len; i++)
+    {
+      const char *pack_checksum = pack_indexes->pdata[i];
+      ot_lfree char *path = NULL;
+      ot_lobj GFile *index_path = NULL;
+      ot_lvariant GVariant *index_variant = NULL;
+      ot_lvariant GVariant *new_index_variant = NULL;
+
+      if (!ostree_repo_load_pack_index (data->repo, pack_checksum, is_meta,
+                                        &index_variant, cancellable, error))
+        goto out;
+
+      if (g_variant_is_of_type (index_variant, OSTREE_PACK_INDEX_V1_VARIANT_FORMAT))
+        continue;
+
+      new_index_variant = ostree_pack_index_to_v1 (index_variant);
+
+      path = ostree_get_relative_pack_index_path (is_meta, pack_checksum);
+      index_path = g_file_resolve_relative_path (ostree_repo_get_path (data->repo), path);
+      if (!ot_util_variant_save (index_path, new_index_variant, cancellable, error))
+        goto out;
+
+      g_print ("Converted index of pack '%s'\n", pack_checksum);
     }
 
   ret = TRUE;
@@ -916,6 +2043,33 @@ do_incremental_pack (OtRepackData          *data,
   return ret;
 }
 
+/*
+ * Rewrite any pack indexes still in the version 0 format.  The pack
+ * checksum covers only the data, so the superindex doesn't change.
+ */
+static gboolean
+upgrade_pack_indexes (OtRepackData     *data,
+                      GCancellable     *cancellable,
+                      GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lptrarray GPtrArray *meta_pack_indexes = NULL;
+  ot_lptrarray GPtrArray *data_pack_indexes = NULL;
+
+  if (!ostree_repo_list_pack_indexes (data->repo, &meta_pack_indexes, &data_pack_indexes,
+                                      cancellable, error))
+    goto out;
+
+  if (!upgrade_pack_indexes_of_type (data, TRUE, meta_pack_indexes, cancellable, error))
+    goto out;
+  if (!upgrade_pack_indexes_of_type (data, FALSE, data_pack_indexes, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 gboolean
 ostree_builtin_pack (int argc, char **argv, GFile *repo_path, GError **error)
 {
@@ -924,8 +2078,10 @@ ostree_builtin_pack (int argc, char **argv, GFile *repo_path, GError **error)
   GCancellable *cancellable = NULL;
   OtRepackData data;
   ot_lobj OstreeRepo *repo = NULL;
+  ot_lobj GFile *dictionary_path = NULL;
 
   memset (&data, 0, sizeof (data));
+  g_mutex_init (&data.lock);
 
   context = g_option_context_new ("- Recompress objects");
   g_option_context_add_main_entries (context, options, NULL);
@@ -942,16 +2098,93 @@ ostree_builtin_pack (int argc, char **argv, GFile *repo_path, GError **error)
 
   if (!parse_size_spec_with_suffix (opt_pack_size, OT_DEFAULT_PACK_SIZE_BYTES, &data.pack_size, error))
     goto out;
-  /* Default internal compression to gzip */
-  if (!parse_compression_string (opt_int_compression ? opt_int_compression : "gzip", &data.int_compression, error))
+  if (!parse_compression_string (opt_ext_compression, &data.ext_compression,
+                                 NULL, error))
     goto out;
-  if (!parse_compression_string (opt_ext_compression, &data.ext_compression, error))
+  /* Whole-pack compression was never implemented; use the codec for
+   * the entries instead, unless they have one already.
+   */
+  if (data.ext_compression != OT_COMPRESSION_NONE)
+    {
+      if (opt_int_compression == NULL && data.ext_compression != OT_COMPRESSION_XZ)
+        {
+          g_printerr ("--external-compression is deprecated, use --internal-compression=%s\n",
+                      opt_ext_compression);
+          opt_int_compression = opt_ext_compression;
+        }
+      else
+        g_printerr ("--external-compression is deprecated and ignored\n");
+    }
+  /* Default internal compression to gzip */
+  if (!parse_compression_string (opt_int_compression ? opt_int_compression : "gzip",
+                                 &data.int_compression, &data.int_compression_level, error))
     goto out;
+  if (opt_zstd_dictionary)
+    {
+      if (data.int_compression != OT_COMPRESSION_ZSTD)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "--zstd-dictionary requires --internal-compression=zstd");
+          goto out;
+        }
+      dictionary_path = g_file_new_for_path (opt_zstd_dictionary);
+      if (!ot_util_variant_map (dictionary_path, G_VARIANT_TYPE ("ay"), FALSE,
+                                &data.zstd_dictionary, error))
+        goto out;
+    }
+  /* Fail early if this build lacks the codec, or the level or
+   * dictionary is invalid
+   */
+  if (data.int_compression == OT_COMPRESSION_GZIP
+      || data.int_compression == OT_COMPRESSION_ZSTD
+      || data.int_compression == OT_COMPRESSION_LZ4)
+    {
+      ot_lobj GConverter *compressor = NULL;
+
+      compressor = ostree_pack_entry_compressor_new (get_entry_compression_flag (data.int_compression),
+                                                     data.int_compression_level,
+                                                     data.zstd_dictionary, error);
+      if (!compressor)
+        goto out;
+    }
+  data.deltas = opt_deltas;
+  if (opt_cluster == NULL || strcmp (opt_cluster, "commit") == 0)
+    data.cluster_by_size = FALSE;
+  else if (strcmp (opt_cluster, "size") == 0)
+    data.cluster_by_size = TRUE;
+  else
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid cluster mode '%s'", opt_cluster);
+      goto out;
+    }
+  if (data.deltas && data.cluster_by_size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "--deltas requires --cluster=commit");
+      goto out;
+    }
+  if (opt_metadata_pack_version != 0 && opt_metadata_pack_version != 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid metadata pack version %d", opt_metadata_pack_version);
+      goto out;
+    }
+  data.metadata_pack_version = opt_metadata_pack_version;
+  if (opt_jobs < 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid number of jobs %d", opt_jobs);
+      goto out;
+    }
+  data.n_jobs = opt_jobs;
 
   if (opt_reindex_only)
     {
       if (!ostree_repo_regenerate_pack_index (repo, cancellable, error))
         goto out;
+      if (!upgrade_pack_indexes (&data, cancellable, error))
+        goto out;
     }
   else
     {
@@ -963,5 +2196,10 @@ ostree_builtin_pack (int argc, char **argv, GFile *repo_path, GError **error)
  out:
   if (context)
     g_option_context_free (context);
+  if (data.delta_keys)
+    g_hash_table_unref (data.delta_keys);
+  if (data.zstd_dictionary)
+    g_variant_unref (data.zstd_dictionary);
+  g_mutex_clear (&data.lock);
   return ret;
 }
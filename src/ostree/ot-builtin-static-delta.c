@@ -0,0 +1,598 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The OSTree Authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "ot-builtins.h"
+#include "ostree.h"
+
+#include <string.h>
+#include <glib/gi18n.h>
+
+/* Maximum uncompressed size of a delta part */
+#define OT_STATIC_DELTA_PART_SIZE (16 * 1024 * 1024)
+#define OT_STATIC_DELTA_COMPRESSION_LEVEL (8)
+
+/* Only files in this size range are considered for rollsum encoding */
+#define OT_ROLLSUM_MIN_SIZE (4096)
+
+static char *opt_from;
+static char *opt_to;
+
+static GOptionEntry options[] = {
+  { "from", 0, 0, G_OPTION_ARG_STRING, &opt_from, "Create delta from revision REV", "REV" },
+  { "to", 0, 0, G_OPTION_ARG_STRING, &opt_to, "Create delta to revision REV", "REV" },
+  { NULL }
+};
+
+typedef struct {
+  OstreeRepo *repo;
+  GFile      *delta_dir;
+
+  GPtrArray  *part_objects;
+  guint64     part_size;
+  GPtrArray  *parts;
+
+  guint       n_objects;
+  guint       n_rollsum;
+} OtStaticDeltaBuilder;
+
+static void
+usage_error (GOptionContext *context, const char *message, GError **error)
+{
+  gchar *help = g_option_context_get_help (context, TRUE, NULL);
+  g_printerr ("%s\n", help);
+  g_free (help);
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       message);
+}
+
+/*
+ * Record the path of every file in the tree @dirtree_checksum.  Either
+ * map may be %NULL; @checksum_to_path keeps the first path seen.
+ */
+static gboolean
+collect_file_paths (OstreeRepo    *repo,
+                    const char    *dirtree_checksum,
+                    const char    *path,
+                    int            recursion_depth,
+                    GHashTable    *path_to_checksum,
+                    GHashTable    *checksum_to_path,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  gboolean ret = FALSE;
+  int n, i;
+  ot_lvariant GVariant *tree = NULL;
+  ot_lvariant GVariant *files_variant = NULL;
+  ot_lvariant GVariant *dirs_variant = NULL;
+
+  if (recursion_depth > OSTREE_MAX_RECURSION)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Maximum recursion limit reached during traversal");
+      goto out;
+    }
+
+  if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_DIR_TREE, dirtree_checksum, &tree, error))
+    goto out;
+
+  files_variant = g_variant_get_child_value (tree, 0);
+  n = g_variant_n_children (files_variant);
+  for (i = 0; i < n; i++)
+    {
+      const char *filename;
+      char *child_path;
+      char *checksum;
+      ot_lvariant GVariant *csum_v = NULL;
+
+      g_variant_get_child (files_variant, i, "(&s@ay)", &filename, &csum_v);
+      child_path = g_strconcat (path, "/", filename, NULL);
+      checksum = ostree_checksum_from_bytes_v (csum_v);
+
+      if (checksum_to_path && !g_hash_table_lookup (checksum_to_path, checksum))
+        g_hash_table_insert (checksum_to_path, g_strdup (checksum), g_strdup (child_path));
+      if (path_to_checksum)
+        {
+          g_hash_table_insert (path_to_checksum, child_path, checksum);
+          child_path = checksum = NULL;
+        }
+      g_free (child_path);
+      g_free (checksum);
+    }
+
+  dirs_variant = g_variant_get_child_value (tree, 1);
+  n = g_variant_n_children (dirs_variant);
+  for (i = 0; i < n; i++)
+    {
+      const char *dirname;
+      ot_lfree char *child_path = NULL;
+      ot_lfree char *tree_checksum = NULL;
+      ot_lvariant GVariant *content_csum_v = NULL;
+      ot_lvariant GVariant *metadata_csum_v = NULL;
+
+      g_variant_get_child (dirs_variant, i, "(&s@ay@ay)",
+                           &dirname, &content_csum_v, &metadata_csum_v);
+      child_path = g_strconcat (path, "/", dirname, NULL);
+      tree_checksum = ostree_checksum_from_bytes_v (content_csum_v);
+
+      if (!collect_file_paths (repo, tree_checksum, child_path, recursion_depth + 1,
+                               path_to_checksum, checksum_to_path,
+                               cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+collect_commit_file_paths (OstreeRepo    *repo,
+                           const char    *commit_checksum,
+                           GHashTable    *path_to_checksum,
+                           GHashTable    *checksum_to_path,
+                           GCancellable  *cancellable,
+                           GError       **error)
+{
+  gboolean ret = FALSE;
+  ot_lfree char *tree_checksum = NULL;
+  ot_lvariant GVariant *commit = NULL;
+  ot_lvariant GVariant *tree_csum_v = NULL;
+
+  if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, commit_checksum, &commit, error))
+    goto out;
+
+  g_variant_get_child (commit, 6, "@ay", &tree_csum_v);
+  tree_checksum = ostree_checksum_from_bytes_v (tree_csum_v);
+
+  if (!collect_file_paths (repo, tree_checksum, "", 0, path_to_checksum, checksum_to_path,
+                           cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/*
+ * Try to encode @checksum as a rollsum delta against @base_checksum,
+ * the object at the same path in the old commit.  Sets @out_payload to
+ * %NULL if that would not be worthwhile.
+ */
+static gboolean
+compute_rollsum_payload (OstreeRepo     *repo,
+                         const char     *checksum,
+                         const char     *base_checksum,
+                         GVariant      **out_payload,
+                         GCancellable   *cancellable,
+                         GError        **error)
+{
+  gboolean ret = FALSE;
+  gsize base_len;
+  gsize len;
+  GByteArray *ops = NULL;
+  ot_lfree guchar *base_data = NULL;
+  ot_lfree guchar *data = NULL;
+  ot_lobj GFileInfo *base_file_info = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
+  ot_lvariant GVariant *xattrs = NULL;
+  ot_lvariant GVariant *file_header = NULL;
+  ot_lvariant GVariant *ret_payload = NULL;
+
+  if (!ostree_repo_load_file (repo, base_checksum, NULL, &base_file_info, NULL,
+                              cancellable, error))
+    goto out;
+  if (!ostree_repo_load_file (repo, checksum, NULL, &file_info, NULL,
+                              cancellable, error))
+    goto out;
+
+  if (g_file_info_get_file_type (base_file_info) != G_FILE_TYPE_REGULAR
+      || g_file_info_get_file_type (file_info) != G_FILE_TYPE_REGULAR
+      || g_file_info_get_size (file_info) < OT_ROLLSUM_MIN_SIZE
+      || g_file_info_get_size (file_info) > OSTREE_ROLLSUM_MAX_SIZE
+      || g_file_info_get_size (base_file_info) > OSTREE_ROLLSUM_MAX_SIZE)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  g_clear_object (&file_info);
+  if (!ostree_repo_load_file_content (repo, base_checksum, &base_data, &base_len,
+                                      NULL, NULL, cancellable, error))
+    goto out;
+  if (!ostree_repo_load_file_content (repo, checksum, &data, &len,
+                                      &file_info, &xattrs, cancellable, error))
+    goto out;
+
+  ops = ostree_static_delta_compute_rollsum (base_data, base_len, data, len);
+
+  /* Not worth it unless it saves a quarter of the file */
+  if (ops->len < len - len / 4)
+    {
+      file_header = ostree_file_header_new (file_info, xattrs);
+      ret_payload = g_variant_new ("(@ay@ayt@ay)",
+                                   ostree_checksum_to_bytes_v (base_checksum),
+                                   ot_gvariant_new_bytearray (g_variant_get_data (file_header),
+                                                              g_variant_get_size (file_header)),
+                                   GUINT64_TO_BE ((guint64) len),
+                                   ot_gvariant_new_bytearray (ops->data, ops->len));
+      g_variant_ref_sink (ret_payload);
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_payload, &ret_payload);
+ out:
+  if (ops)
+    g_byte_array_free (ops, TRUE);
+  return ret;
+}
+
+static gboolean
+compute_raw_payload (OstreeRepo       *repo,
+                     OstreeObjectType  objtype,
+                     const char       *checksum,
+                     GVariant        **out_payload,
+                     GCancellable     *cancellable,
+                     GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lvariant GVariant *ret_payload = NULL;
+
+  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+    {
+      ot_lvariant GVariant *metadata = NULL;
+
+      if (!ostree_repo_load_variant (repo, objtype, checksum, &metadata, error))
+        goto out;
+
+      ret_payload = ot_gvariant_new_bytearray (g_variant_get_data (metadata),
+                                               g_variant_get_size (metadata));
+    }
+  else
+    {
+      gsize len;
+      gpointer data;
+      ot_lobj GInputStream *input = NULL;
+      ot_lobj GInputStream *object_input = NULL;
+      ot_lobj GFileInfo *file_info = NULL;
+      ot_lvariant GVariant *xattrs = NULL;
+      ot_lobj GOutputStream *mem_out = NULL;
+
+      if (!ostree_repo_load_file (repo, checksum, &input, &file_info, &xattrs,
+                                  cancellable, error))
+        goto out;
+
+      if (!ostree_raw_file_to_content_stream (input, file_info, xattrs,
+                                              &object_input, NULL,
+                                              cancellable, error))
+        goto out;
+
+      mem_out = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+      if (g_output_stream_splice (mem_out, object_input,
+                                  G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                  cancellable, error) < 0)
+        goto out;
+
+      len = g_memory_output_stream_get_data_size ((GMemoryOutputStream*) mem_out);
+      data = g_memory_output_stream_steal_data ((GMemoryOutputStream*) mem_out);
+      ret_payload = g_variant_new_from_data (G_VARIANT_TYPE ("ay"), data, len,
+                                             TRUE, g_free, data);
+    }
+
+  g_variant_ref_sink (ret_payload);
+
+  ret = TRUE;
+  ot_transfer_out_value (out_payload, &ret_payload);
+ out:
+  return ret;
+}
+
+static gboolean
+flush_part (OtStaticDeltaBuilder  *builder,
+            GCancellable          *cancellable,
+            GError               **error)
+{
+  gboolean ret = FALSE;
+  gsize bytes_written;
+  gsize compressed_len;
+  gconstpointer compressed_data;
+  ot_lfree char *part_name = NULL;
+  ot_lfree char *part_checksum = NULL;
+  ot_lobj GFile *part_path = NULL;
+  ot_lobj GOutputStream *mem_out = NULL;
+  ot_lobj GOutputStream *compressed_out = NULL;
+  ot_lobj GConverter *compressor = NULL;
+  ot_lvariant GVariant *part = NULL;
+
+  if (builder->part_objects->len == 0)
+    return TRUE;
+
+  part = g_variant_new_array (G_VARIANT_TYPE ("(yayyay)"),
+                              (GVariant**)builder->part_objects->pdata,
+                              builder->part_objects->len);
+  g_variant_ref_sink (part);
+
+  mem_out = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  compressor = (GConverter*)g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP,
+                                                   OT_STATIC_DELTA_COMPRESSION_LEVEL);
+  compressed_out = g_converter_output_stream_new (mem_out, compressor);
+
+  if (!g_output_stream_write_all (compressed_out, g_variant_get_data (part),
+                                  g_variant_get_size (part), &bytes_written,
+                                  cancellable, error))
+    goto out;
+  if (!g_output_stream_close (compressed_out, cancellable, error))
+    goto out;
+
+  compressed_data = g_memory_output_stream_get_data ((GMemoryOutputStream*) mem_out);
+  compressed_len = g_memory_output_stream_get_data_size ((GMemoryOutputStream*) mem_out);
+  part_checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256, compressed_data,
+                                               compressed_len);
+
+  part_name = g_strdup_printf ("%u", builder->parts->len);
+  part_path = g_file_get_child (builder->delta_dir, part_name);
+  if (!g_file_replace_contents (part_path, compressed_data, compressed_len,
+                                NULL, FALSE, 0, NULL, cancellable, error))
+    goto out;
+
+  g_ptr_array_add (builder->parts,
+                   g_variant_ref_sink (g_variant_new ("(@ayt)",
+                                                      ostree_checksum_to_bytes_v (part_checksum),
+                                                      (guint64) g_variant_get_size (part))));
+
+  g_ptr_array_set_size (builder->part_objects, 0);
+  builder->part_size = 0;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+add_object (OtStaticDeltaBuilder  *builder,
+            OstreeObjectType       objtype,
+            const char            *checksum,
+            const char            *base_checksum,
+            GCancellable          *cancellable,
+            GError               **error)
+{
+  gboolean ret = FALSE;
+  OstreeStaticDeltaEncoding encoding = OSTREE_STATIC_DELTA_ENCODING_RAW;
+  ot_lvariant GVariant *payload = NULL;
+
+  if (base_checksum)
+    {
+      if (!compute_rollsum_payload (builder->repo, checksum, base_checksum, &payload,
+                                    cancellable, error))
+        goto out;
+      if (payload)
+        {
+          encoding = OSTREE_STATIC_DELTA_ENCODING_ROLLSUM;
+          builder->n_rollsum++;
+        }
+    }
+
+  if (!payload)
+    {
+      if (!compute_raw_payload (builder->repo, objtype, checksum, &payload,
+                                cancellable, error))
+        goto out;
+    }
+
+  if (builder->part_size > 0
+      && builder->part_size + g_variant_get_size (payload) > OT_STATIC_DELTA_PART_SIZE)
+    {
+      if (!flush_part (builder, cancellable, error))
+        goto out;
+    }
+
+  g_ptr_array_add (builder->part_objects,
+                   g_variant_ref_sink (g_variant_new ("(y@ayy@ay)", (guchar) objtype,
+                                                      ostree_checksum_to_bytes_v (checksum),
+                                                      (guchar) encoding, payload)));
+  builder->part_size += g_variant_get_size (payload);
+  builder->n_objects++;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static int
+compare_object_names_by_type (gconstpointer  a,
+                              gconstpointer  b)
+{
+  const char *checksum_a;
+  const char *checksum_b;
+  OstreeObjectType objtype_a;
+  OstreeObjectType objtype_b;
+
+  ostree_object_name_deserialize (*((GVariant**)a), &checksum_a, &objtype_a);
+  ostree_object_name_deserialize (*((GVariant**)b), &checksum_b, &objtype_b);
+
+  /* Content first and the commit last, so objects arrive bottom up */
+  if (objtype_a != objtype_b)
+    return objtype_a < objtype_b ? -1 : 1;
+  return strcmp (checksum_a, checksum_b);
+}
+
+static gboolean
+generate_static_delta (OstreeRepo     *repo,
+                       const char     *from,
+                       const char     *to,
+                       GCancellable   *cancellable,
+                       GError        **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  OtStaticDeltaBuilder builder;
+  ot_lfree char *delta_name = NULL;
+  ot_lobj GFile *deltas_dir = NULL;
+  ot_lobj GFile *superblock_path = NULL;
+  ot_lhash GHashTable *from_reachable = NULL;
+  ot_lhash GHashTable *to_reachable = NULL;
+  ot_lhash GHashTable *from_paths = NULL;
+  ot_lhash GHashTable *to_paths = NULL;
+  ot_lptrarray GPtrArray *new_objects = NULL;
+  ot_lvariant GVariant *superblock = NULL;
+
+  memset (&builder, 0, sizeof (builder));
+  builder.repo = repo;
+  builder.part_objects = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  builder.parts = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+
+  from_reachable = ostree_traverse_new_reachable ();
+  if (!ostree_traverse_commit (repo, from, 0, from_reachable, cancellable, error))
+    goto out;
+  to_reachable = ostree_traverse_new_reachable ();
+  if (!ostree_traverse_commit (repo, to, 0, to_reachable, cancellable, error))
+    goto out;
+
+  new_objects = g_ptr_array_new ();
+  g_hash_table_iter_init (&hash_iter, to_reachable);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      GVariant *serialized_key = key;
+      if (!g_hash_table_lookup (from_reachable, serialized_key))
+        g_ptr_array_add (new_objects, serialized_key);
+    }
+  g_ptr_array_sort (new_objects, compare_object_names_by_type);
+
+  from_paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  if (!collect_commit_file_paths (repo, from, from_paths, NULL, cancellable, error))
+    goto out;
+  to_paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  if (!collect_commit_file_paths (repo, to, NULL, to_paths, cancellable, error))
+    goto out;
+
+  delta_name = ostree_get_static_delta_name (from, to);
+  deltas_dir = g_file_get_child (ostree_repo_get_path (repo), "deltas");
+  builder.delta_dir = g_file_get_child (deltas_dir, delta_name);
+  if (!ot_gfile_ensure_directory (builder.delta_dir, TRUE, error))
+    goto out;
+
+  for (i = 0; i < new_objects->len; i++)
+    {
+      const char *checksum;
+      const char *base_checksum = NULL;
+      OstreeObjectType objtype;
+
+      ostree_object_name_deserialize (new_objects->pdata[i], &checksum, &objtype);
+
+      if (objtype == OSTREE_OBJECT_TYPE_FILE)
+        {
+          const char *path = g_hash_table_lookup (to_paths, checksum);
+          if (path)
+            base_checksum = g_hash_table_lookup (from_paths, path);
+        }
+
+      if (!add_object (&builder, objtype, checksum, base_checksum,
+                       cancellable, error))
+        goto out;
+    }
+
+  if (!flush_part (&builder, cancellable, error))
+    goto out;
+
+  /* Written last, so a delta is only visible once complete */
+  superblock = g_variant_new ("(@a{sv}@ay@ay@a(ayt))",
+                              g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0),
+                              ostree_checksum_to_bytes_v (from),
+                              ostree_checksum_to_bytes_v (to),
+                              g_variant_new_array (G_VARIANT_TYPE ("(ayt)"),
+                                                   (GVariant**)builder.parts->pdata,
+                                                   builder.parts->len));
+  g_variant_ref_sink (superblock);
+
+  superblock_path = g_file_get_child (builder.delta_dir, "superblock");
+  if (!ot_util_variant_save (superblock_path, superblock, cancellable, error))
+    goto out;
+
+  g_print ("Generated static delta %s: %u objects (%u rollsum encoded) in %u parts\n",
+           delta_name, builder.n_objects, builder.n_rollsum, builder.parts->len);
+
+  ret = TRUE;
+ out:
+  g_clear_object (&builder.delta_dir);
+  g_ptr_array_unref (builder.part_objects);
+  g_ptr_array_unref (builder.parts);
+  return ret;
+}
+
+gboolean
+ostree_builtin_static_delta (int argc, char **argv, GFile *repo_path, GError **error)
+{
+  GOptionContext *context;
+  gboolean ret = FALSE;
+  const char *op;
+  GCancellable *cancellable = NULL;
+  ot_lobj OstreeRepo *repo = NULL;
+  ot_lfree char *from_checksum = NULL;
+  ot_lfree char *to_checksum = NULL;
+
+  context = g_option_context_new ("OPERATION - Manage static deltas");
+  g_option_context_add_main_entries (context, options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, error))
+    goto out;
+
+  repo = ostree_repo_new (repo_path);
+  if (!ostree_repo_check (repo, error))
+    goto out;
+
+  if (argc < 2)
+    {
+      usage_error (context, "OPERATION must be specified", error);
+      goto out;
+    }
+
+  op = argv[1];
+
+  if (!strcmp (op, "generate"))
+    {
+      if (!opt_from || !opt_to)
+        {
+          usage_error (context, "--from and --to must be specified", error);
+          goto out;
+        }
+
+      if (!ostree_repo_resolve_rev (repo, opt_from, FALSE, &from_checksum, error))
+        goto out;
+      if (!ostree_repo_resolve_rev (repo, opt_to, FALSE, &to_checksum, error))
+        goto out;
+
+      if (!generate_static_delta (repo, from_checksum, to_checksum, cancellable, error))
+        goto out;
+    }
+  else
+    {
+      usage_error (context, "Unknown operation", error);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  if (context)
+    g_option_context_free (context);
+  return ret;
+}
@@ -0,0 +1,77 @@
+#!/bin/bash
+#
+# Copyright (C) 2026 The OSTree Authors
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+# Compare pack, checkout and unpack throughput of the pack entry
+# compression codecs.
+#
+# Usage: bench-pack-compression.sh [SOURCE-DIRECTORY] [CODEC...]
+#
+# SOURCE-DIRECTORY defaults to /usr/share; each CODEC may carry a
+# level as for --internal-compression, e.g. zstd:19.
+
+set -e
+
+srcdir=${1:-/usr/share}
+test $# -gt 0 && shift
+codecs="$*"
+test -n "${codecs}" || codecs="gzip zstd lz4"
+
+benchdir=`mktemp -d "${TMPDIR:-/tmp}/ostree-bench.XXXXXXXXXX"`
+trap 'rm -rf ${benchdir}' EXIT
+
+now () {
+    date +%s.%N
+}
+
+report () {
+    # NAME BYTES START END
+    echo "$1 $2 $3 $4" | awk '{ secs = $4 - $3; if (secs <= 0) secs = 0.001;
+        printf "  %-10s %8.2f s %10.1f MB/s\n", $1, secs, $2 / secs / (1024 * 1024) }'
+}
+
+cd ${benchdir}
+ostree --repo=source init --archive
+(cd ${srcdir} && ostree --repo=${benchdir}/source commit -b bench -s 'Benchmark' >/dev/null)
+content_bytes=`du -sb --apparent-size ${srcdir} 2>/dev/null | cut -f 1`
+
+echo "Content: ${srcdir}, ${content_bytes} bytes"
+for codec in ${codecs}; do
+    rm -rf repo checkout
+    ostree --repo=repo init --archive
+    ostree --repo=repo pull-local source >/dev/null
+
+    echo "${codec}:"
+    if ! ostree --repo=repo pack --analyze-only --internal-compression=${codec} >/dev/null 2>&1; then
+        echo "  not supported by this build"
+        continue
+    fi
+
+    start=`now`
+    ostree --repo=repo pack --internal-compression=${codec} >/dev/null
+    report pack ${content_bytes} ${start} `now`
+    echo "  pack size  `du -sb repo/objects/pack | cut -f 1` bytes"
+
+    start=`now`
+    ostree --repo=repo checkout bench checkout
+    report checkout ${content_bytes} ${start} `now`
+
+    start=`now`
+    ostree --repo=repo unpack >/dev/null
+    report unpack ${content_bytes} ${start} `now`
+done
@@ -19,7 +19,7 @@
 
 set -e
 
-echo "1..30"
+echo "1..37"
 
 . libtest.sh
 
@@ -221,3 +221,83 @@ rm -rf test2-checkout
 parent_rev_test2=$(ostree --repo=repo rev-parse test2)
 ${CMD_PREFIX} ostree --repo=shadow-repo checkout "${parent_rev_test2}" test2-checkout
 echo "ok checkout from shadow repo"
+
+cd ${test_tmpdir}
+rm -rf checkout-test2-devino
+$OSTREE checkout test2 checkout-test2-devino
+cd checkout-test2-devino
+$OSTREE commit -b test2-devino -s "From hardlinked checkout"
+assert_has_file ${test_tmpdir}/repo/devino-cache
+$OSTREE commit -b test2-devino -s "From hardlinked checkout, cached"
+echo "ok commit with devino cache"
+
+cd ${test_tmpdir}
+rm -rf stat-cache-files
+mkdir stat-cache-files
+echo one > stat-cache-files/a
+echo two > stat-cache-files/b
+# Recently modified files are never cached
+sleep 2
+cd stat-cache-files
+$OSTREE commit -b test2-statcache -s "Stat cache" --use-stat-cache 2>${test_tmpdir}/stat-cache-out
+assert_file_has_content ${test_tmpdir}/stat-cache-out "0 hits, 2 misses"
+assert_has_file ${test_tmpdir}/repo/stat-cache
+$OSTREE commit -b test2-statcache -s "Stat cache, cached" --use-stat-cache 2>${test_tmpdir}/stat-cache-out
+assert_file_has_content ${test_tmpdir}/stat-cache-out "2 hits, 0 misses"
+echo "ok commit with stat cache"
+
+cd ${test_tmpdir}/checkout-test2-4
+$OSTREE commit -b test2-workers -s "Serial" --workers=1
+serial_rev=$($OSTREE rev-parse test2-workers)
+$OSTREE commit --skip-if-unchanged -b test2-workers -s "Parallel" --workers=4
+assert_streq "${serial_rev}" "$($OSTREE rev-parse test2-workers)"
+echo "ok commit with parallel staging"
+
+cd ${test_tmpdir}
+rm -rf checkout-test2-stats
+$OSTREE checkout --stats test2 checkout-test2-stats > checkout-stats-out
+assert_file_has_content checkout-stats-out "files/s"
+echo "ok checkout --stats"
+
+cd ${test_tmpdir}
+rm -rf checkout-delta-src
+$OSTREE checkout test2 checkout-delta-src
+cd checkout-delta-src
+echo changed > yet/message
+rm another/whee
+mkdir -p newdir
+echo new > newdir/file
+$OSTREE commit -b test2-delta -s "For delta checkout"
+cd ${test_tmpdir}
+$OSTREE checkout --atomic-retarget test2 checkout-delta
+old_rev=$($OSTREE rev-parse test2)
+$OSTREE checkout --atomic-retarget test2-delta checkout-delta
+cd checkout-delta
+assert_file_has_content yet/message changed
+assert_file_has_content newdir/file new
+assert_not_has_file another/whee
+assert_file_has_content yet/another/tree/green "leaf"
+assert_streq "$(stat -c '%i' yet/another/tree/green)" "$(stat -c '%i' ../checkout-delta-${old_rev}/yet/another/tree/green)"
+assert_file_has_content ../checkout-delta-${old_rev}/yet/message helloworld
+echo "ok checkout atomic-retarget delta"
+
+cd ${test_tmpdir}
+rm -rf checkout-ref
+$OSTREE checkout --reference-checkout=checkout-delta test2 checkout-ref
+cd checkout-ref
+assert_file_has_content yet/message helloworld
+assert_file_has_content another/whee whee2
+assert_not_has_file newdir/file
+assert_streq "$(stat -c '%i' yet/another/tree/green)" "$(stat -c '%i' ../checkout-delta/yet/another/tree/green)"
+echo "ok checkout --reference-checkout"
+
+cd ${test_tmpdir}
+cp repo/config repo/config.orig
+sed -i -e 's/^\[core\]$/[core]\ncheckout-reflink=true/' repo/config
+rm -rf checkout-reflink
+# Falls back to linking or copying where reflinks are unsupported
+$OSTREE checkout --user-mode test2 checkout-reflink
+mv repo/config.orig repo/config
+cd checkout-reflink
+assert_file_has_content yet/another/tree/green "leaf"
+echo "ok checkout with checkout-reflink"
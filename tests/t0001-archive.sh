@@ -21,7 +21,7 @@ set -e
 
 . libtest.sh
 
-echo '1..22'
+echo '1..32'
 
 setup_test_repository "archive"
 echo "ok setup"
@@ -72,6 +72,14 @@ cd ${test_tmpdir}
 $OSTREE pack
 echo "ok pack"
 
+cd ${test_tmpdir}
+assert_has_file repo/objects/pack/multi-index
+rm repo/objects/pack/multi-index
+$OSTREE checkout test2 checkout-test2-no-multi-index
+$OSTREE pack --reindex-only
+assert_has_file repo/objects/pack/multi-index
+echo "ok pack multi-index"
+
 cd ${test_tmpdir}
 $OSTREE fsck
 echo "ok fsck"
@@ -110,3 +118,189 @@ echo "ok checkout metadata-packed"
 
 $OSTREE unpack
 echo "ok unpack"
+
+cd ${test_tmpdir}
+$OSTREE pack --cluster=size
+$OSTREE fsck
+rm -rf checkout-test2
+$OSTREE checkout test2 checkout-test2
+$OSTREE unpack
+echo "ok pack clustered by size"
+
+cd ${test_tmpdir}
+rm -rf repo-cluster cluster-files
+mkdir repo-cluster cluster-files
+${CMD_PREFIX} ostree --repo=repo-cluster init --archive
+for i in $(seq 10 19); do seq ${i} 1${i} > cluster-files/z-${i}; done
+${CMD_PREFIX} ostree --repo=repo-cluster commit -b cluster -s 'Cluster old' --tree=dir=cluster-files
+rm cluster-files/z-*
+for i in $(seq 10 19); do seq 2${i} 3${i} > cluster-files/a-${i}; done
+${CMD_PREFIX} ostree --repo=repo-cluster commit -b cluster -s 'Cluster new' --tree=dir=cluster-files
+${CMD_PREFIX} ostree --repo=repo-cluster pack --pack-size=1k --delete-all-loose > pack-cluster.txt
+first_data_pack=
+for pack in $(sed -n -e "s/^Created pack file '\(.*\)' with .*/\1/p" pack-cluster.txt); do
+    if test -f repo-cluster/objects/pack/ostdatapack-${pack}.data; then
+        first_data_pack=${pack}
+        break
+    fi
+done
+test -n "${first_data_pack}" || (echo 1>&2 "no data pack created"; exit 1)
+mkdir first-data-pack
+mv repo-cluster/objects/pack/ostdatapack-${first_data_pack}.* first-data-pack
+${CMD_PREFIX} ostree --repo=repo-cluster pack --reindex-only
+${CMD_PREFIX} ostree --repo=repo-cluster cat cluster /a-10 >/dev/null 2>&1 && (echo 1>&2 "newest commit's first file not in the first data pack"; exit 1)
+${CMD_PREFIX} ostree --repo=repo-cluster cat cluster^ /z-19 > cluster-cat.txt
+assert_file_has_content cluster-cat.txt 119
+mv first-data-pack/* repo-cluster/objects/pack
+${CMD_PREFIX} ostree --repo=repo-cluster pack --reindex-only
+${CMD_PREFIX} ostree --repo=repo-cluster fsck
+echo "ok pack clustered by commit"
+
+cd ${test_tmpdir}
+mkdir delta-files
+cd delta-files
+seq 1 20000 > libfoo.so.1.0
+$OSTREE commit -b test-delta -s 'Delta base'
+rm libfoo.so.1.0
+(seq 1 10000; echo changed; seq 10001 20000) > libfoo.so.1.1
+$OSTREE commit -b test-delta -s 'Delta target'
+cd ${test_tmpdir}
+$OSTREE pack --deltas > pack-deltas.txt
+assert_file_has_content pack-deltas.txt "Stored 1 objects as deltas"
+$OSTREE fsck
+rm -rf checkout-delta
+$OSTREE checkout test-delta checkout-delta
+cmp checkout-delta/libfoo.so.1.1 delta-files/libfoo.so.1.1
+$OSTREE checkout test-delta^ checkout-delta-base
+seq 1 20000 | cmp checkout-delta-base/libfoo.so.1.0 -
+$OSTREE unpack
+echo "ok pack deltas"
+
+cd ${test_tmpdir}
+$OSTREE pack --external-compression=gzip 2>pack-external.txt
+assert_file_has_content pack-external.txt "external-compression is deprecated"
+$OSTREE fsck
+$OSTREE unpack
+$OSTREE pack --internal-compression=gzip:42 2>/dev/null && (echo 1>&2 "pack --internal-compression=gzip:42 unexpectedly succeeded"; exit 1)
+codecs=""
+for codec in zstd lz4; do
+    if $OSTREE pack --analyze-only --internal-compression=${codec} >/dev/null 2>&1; then
+        codecs="${codecs} ${codec}"
+        $OSTREE pack --internal-compression=${codec}:1000 2>/dev/null && (echo 1>&2 "pack --internal-compression=${codec}:1000 unexpectedly succeeded"; exit 1)
+        $OSTREE pack --internal-compression=${codec}
+        $OSTREE fsck
+        rm -rf checkout-${codec}
+        $OSTREE checkout test2 checkout-${codec}
+        assert_file_has_content checkout-${codec}/baz/cow moo
+        $OSTREE unpack
+    fi
+done
+if test -n "${codecs}"; then
+    echo "ok pack zstd and lz4"
+else
+    echo "ok pack zstd and lz4 # SKIP built without zstd and lz4"
+fi
+
+cd ${test_tmpdir}
+case "${codecs}" in
+    *zstd*)
+        # Any content works as a raw zstd dictionary
+        (seq 1 1000; echo moo) > zstd-dict
+        $OSTREE pack --internal-compression=zstd:19 --zstd-dictionary=zstd-dict
+        $OSTREE fsck
+        rm -rf checkout-zstd-dict
+        $OSTREE checkout test2 checkout-zstd-dict
+        assert_file_has_content checkout-zstd-dict/baz/cow moo
+        $OSTREE unpack
+        $OSTREE pack --internal-compression=gzip --zstd-dictionary=zstd-dict 2>/dev/null && (echo 1>&2 "pack --zstd-dictionary with gzip unexpectedly succeeded"; exit 1)
+        echo "ok pack zstd dictionary"
+        ;;
+    *)
+        echo "ok pack zstd dictionary # SKIP built without zstd"
+        ;;
+esac
+
+cd ${test_tmpdir}
+$OSTREE pack --metadata-pack-version=2 2>/dev/null && (echo 1>&2 "pack --metadata-pack-version=2 unexpectedly succeeded"; exit 1)
+$OSTREE pack --metadata-only --metadata-pack-version=0
+grep -q OSTv0PACKMETAFILE repo/objects/pack/ostmetapack-*.data
+v0_size=`cat repo/objects/pack/ostmetapack-*.data | wc -c`
+$OSTREE unpack
+$OSTREE pack --metadata-only --metadata-pack-version=1
+grep -q OSTv1PACKMETAFILE repo/objects/pack/ostmetapack-*.data
+v1_size=`cat repo/objects/pack/ostmetapack-*.data | wc -c`
+if test ${v1_size} -ge ${v0_size}; then
+    echo 1>&2 "metadata pack v1 (${v1_size} bytes) not smaller than v0 (${v0_size} bytes)"; exit 1
+fi
+$OSTREE fsck
+rm -rf checkout-meta-v1
+$OSTREE checkout test2 checkout-meta-v1
+assert_file_has_content checkout-meta-v1/baz/cow moo
+$OSTREE unpack
+echo "ok pack metadata v1"
+
+cd ${test_tmpdir}
+$OSTREE pack --jobs=0 2>/dev/null && (echo 1>&2 "pack --jobs=0 unexpectedly succeeded"; exit 1)
+$OSTREE pack --pack-size=4k
+(cd repo/objects/pack && ls *.data) > packs-jobs-1.txt
+$OSTREE unpack
+$OSTREE pack --pack-size=4k --jobs=4 > pack-jobs.txt
+assert_file_has_content pack-jobs.txt "MB/s"
+(cd repo/objects/pack && ls *.data) > packs-jobs-4.txt
+cmp packs-jobs-1.txt packs-jobs-4.txt
+$OSTREE fsck
+rm -rf checkout-jobs
+$OSTREE checkout test2 checkout-jobs
+assert_file_has_content checkout-jobs/baz/cow moo
+$OSTREE unpack
+echo "ok pack jobs"
+
+cd ${test_tmpdir}
+$OSTREE fsck > fsck-output.txt
+grep -q 'Metadata cache' fsck-output.txt && (echo 1>&2 "fsck printed cache statistics without --verbose"; exit 1)
+$OSTREE fsck --verbose > fsck-output.txt
+assert_file_has_content fsck-output.txt 'Metadata cache: [1-9][0-9]* hits'
+$OSTREE config set core.metadata-cache-size 0
+$OSTREE fsck --verbose > fsck-output.txt
+assert_file_has_content fsck-output.txt 'Metadata cache: 0 hits, 0 misses'
+$OSTREE config set core.metadata-cache-size 16777216
+echo "ok metadata cache"
+
+cd ${test_tmpdir}
+rm -rf checkout-bloom
+$OSTREE checkout test2 checkout-bloom
+echo "bloom 1" > checkout-bloom/bloom-file-1
+$OSTREE commit -b test-bloom -s 'Bloom 1' --tree=dir=checkout-bloom
+$OSTREE pack --pack-size=1k --keep-all-loose
+echo "bloom 2" > checkout-bloom/bloom-file-2
+$OSTREE commit -b test-bloom -s 'Bloom 2' --tree=dir=checkout-bloom
+$OSTREE pack --pack-size=1k --keep-all-loose
+npacks=$(ls repo/objects/pack/*.data | wc -l)
+test ${npacks} -gt 2 || (echo 1>&2 "expected several packs, found ${npacks}"; exit 1)
+for loose in keep delete; do
+    if test ${loose} = delete; then
+        echo "bloom 3" > checkout-bloom/bloom-file-3
+        $OSTREE commit -b test-bloom -s 'Bloom 3' --tree=dir=checkout-bloom
+        $OSTREE pack --pack-size=1k --delete-all-loose
+        find repo/objects -name '*.file' > loose-files.txt
+        test ! -s loose-files.txt || (echo 1>&2 "loose objects left after --delete-all-loose"; exit 1)
+    fi
+    $OSTREE fsck
+    for rev in test2 test-bloom^ test-bloom; do
+        $OSTREE ls -R ${rev} > /dev/null
+        $OSTREE cat ${rev} /baz/cow > bloom-cow.txt
+        assert_file_has_content bloom-cow.txt moo
+    done
+    $OSTREE cat test-bloom /bloom-file-1 > bloom-cat.txt
+    assert_file_has_content bloom-cat.txt "bloom 1"
+    $OSTREE cat test-bloom /bloom-file-2 > bloom-cat.txt
+    assert_file_has_content bloom-cat.txt "bloom 2"
+    rm -rf checkout-bloom-${loose}
+    $OSTREE checkout test-bloom checkout-bloom-${loose}
+    cmp checkout-bloom/bloom-file-1 checkout-bloom-${loose}/bloom-file-1
+    cmp checkout-bloom/bloom-file-2 checkout-bloom-${loose}/bloom-file-2
+    assert_file_has_content checkout-bloom-${loose}/baz/cow moo
+done
+assert_file_has_content checkout-bloom-delete/bloom-file-3 "bloom 3"
+$OSTREE unpack
+echo "ok pack bloom filters"
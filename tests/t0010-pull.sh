@@ -21,7 +21,7 @@ set -e
 
 . libtest.sh
 
-echo '1..4'
+echo '1..15'
 
 setup_fake_remote_repo1
 cd ${test_tmpdir}
@@ -39,6 +39,15 @@ assert_file_has_content firstfile '^first$'
 assert_file_has_content baz/cow '^moo$'
 echo "ok pull contents"
 
+cd ${test_tmpdir}
+rm -rf repo
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo remote add origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree-pull --repo=repo --metadata-requests=1 origin main
+${CMD_PREFIX} ostree --repo=repo fsck
+echo "ok pull serial metadata"
+
 cd ${test_tmpdir}
 ostree --repo=$(pwd)/ostree-srv/gnomerepo pack
 rm -rf repo
@@ -56,3 +65,173 @@ cd checkout-origin-main
 assert_file_has_content firstfile '^first$'
 assert_file_has_content baz/cow '^moo$'
 echo "ok pull contents packed"
+
+cd ${test_tmpdir}
+rm -rf repo
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo remote add origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree-pull --repo=repo --partial-pack-threshold=100 origin main > pull-output.txt
+assert_file_has_content pull-output.txt 'ranges'
+grep -q 'whole pack' pull-output.txt && (echo 1>&2 "pull fell back to whole packs"; exit 1)
+${CMD_PREFIX} ostree --repo=repo fsck
+rm -rf checkout-origin-main
+$OSTREE checkout origin/main checkout-origin-main
+assert_file_has_content checkout-origin-main/baz/cow '^moo$'
+echo "ok pull packed partial"
+
+cd ${test_tmpdir}
+rm -rf srv-files
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo checkout -U main srv-files
+echo partial > srv-files/baz/partial
+cd srv-files
+${CMD_PREFIX} ostree --repo=${test_tmpdir}/ostree-srv/gnomerepo commit -b main -s "Add partial"
+cd ${test_tmpdir}
+# One pack holding every object; only the new file is needed
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo unpack
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo pack
+${CMD_PREFIX} ostree-pull --repo=repo origin main > pull-output.txt
+assert_file_has_content pull-output.txt 'Fetching 1 objects from content pack .* in 1 ranges'
+grep -q 'whole pack' pull-output.txt && (echo 1>&2 "pull fell back to whole packs"; exit 1)
+grep -q 'Storing .* objects from content pack' pull-output.txt && (echo 1>&2 "pull fetched a whole pack"; exit 1)
+${CMD_PREFIX} ostree --repo=repo fsck
+rm -rf checkout-origin-main
+$OSTREE checkout origin/main checkout-origin-main
+assert_file_has_content checkout-origin-main/baz/partial '^partial$'
+echo "ok pull packed partial incremental"
+
+cd ${test_tmpdir}
+rm -rf repo srv-files
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo remote add origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo checkout -U main srv-files
+cd srv-files
+seq 1 5000 > bigfile
+${CMD_PREFIX} ostree --repo=${test_tmpdir}/ostree-srv/gnomerepo commit -b main -s "Add bigfile"
+cd ${test_tmpdir}
+${CMD_PREFIX} ostree-pull --repo=repo origin main
+cd srv-files
+sed -i -e 's/^2500$/changed/' bigfile
+echo new > newfile
+${CMD_PREFIX} ostree --repo=${test_tmpdir}/ostree-srv/gnomerepo commit -b main -s "Modify bigfile"
+cd ${test_tmpdir}
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo static-delta generate --from=main^ --to=main > delta-output.txt
+assert_file_has_content delta-output.txt '1 rollsum encoded'
+${CMD_PREFIX} ostree-pull --repo=repo origin main > pull-output.txt
+assert_file_has_content pull-output.txt 'Using static delta'
+${CMD_PREFIX} ostree --repo=repo fsck
+rm -rf checkout-origin-main
+$OSTREE checkout origin/main checkout-origin-main
+assert_file_has_content checkout-origin-main/bigfile '^changed$'
+assert_file_has_content checkout-origin-main/newfile '^new$'
+echo "ok pull static delta"
+
+cd ${test_tmpdir}/srv-files
+sed -i -e 's/^1000$/changed again/' bigfile
+${CMD_PREFIX} ostree --repo=${test_tmpdir}/ostree-srv/gnomerepo commit -b main -s "Modify bigfile again"
+cd ${test_tmpdir}
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo static-delta generate --from=main^ --to=main > delta-output.txt
+assert_file_has_content delta-output.txt '1 rollsum encoded'
+# Drop the rollsum base; the pull must fall back to fetching objects
+base=$(${CMD_PREFIX} ostree --repo=repo ls -C origin/main /bigfile | awk '{ print $5 }')
+rm repo/objects/${base:0:2}/${base:2}.file
+${CMD_PREFIX} ostree-pull --repo=repo origin main > pull-output.txt
+assert_file_has_content pull-output.txt 'Not using static delta'
+rm -rf checkout-origin-main
+$OSTREE checkout origin/main checkout-origin-main
+assert_file_has_content checkout-origin-main/bigfile '^changed again$'
+echo "ok pull static delta missing base"
+
+cd ${test_tmpdir}
+rm -rf repo
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo remote add origin $(cat httpd-address)/ostree/gnomerepo
+mkdir repo/tmp/pull-resume-origin
+for pack in ostree-srv/gnomerepo/objects/pack/*.data; do
+    head -c 64 ${pack} > repo/tmp/pull-resume-origin/$(basename ${pack})
+done
+${CMD_PREFIX} ostree-pull --repo=repo origin main > pull-output.txt
+assert_file_has_content pull-output.txt 'Resuming'
+assert_not_has_file repo/tmp/pull-resume-origin
+${CMD_PREFIX} ostree --repo=repo fsck
+echo "ok pull resume"
+
+cd ${test_tmpdir}
+rm -rf repo
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo remote add origin $(cat httpd-address)/ostree/gnomerepo
+mkdir repo/tmp/pull-resume-origin
+for pack in ostree-srv/gnomerepo/objects/pack/*.data; do
+    head -c 64 /dev/zero > repo/tmp/pull-resume-origin/$(basename ${pack})
+done
+${CMD_PREFIX} ostree-pull --repo=repo origin main > pull-output.txt
+assert_file_has_content pull-output.txt 'is corrupted'
+${CMD_PREFIX} ostree --repo=repo fsck
+echo "ok pull resume corrupted"
+
+cd ${test_tmpdir}
+rm -rf repo
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo remote add origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=repo config set 'remote "origin".max-connections' 1
+${CMD_PREFIX} ostree-pull --repo=repo --verbose --prefer-loose origin main > pull-output.txt
+assert_file_has_content pull-output.txt 'At most 1 requests in flight'
+${CMD_PREFIX} ostree --repo=repo fsck
+echo "ok pull single connection"
+
+cd ${test_tmpdir}
+rm -rf repo
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo remote add origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=repo config set 'remote "origin".max-connections' 3
+${CMD_PREFIX} ostree-pull --repo=repo --prefer-loose origin main > pull-output.txt
+grep -q 'requests in flight' pull-output.txt && (echo 1>&2 "peak requests printed without --verbose"; exit 1)
+rm -rf repo
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo remote add origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=repo config set 'remote "origin".max-connections' 3
+${CMD_PREFIX} ostree-pull --repo=repo --verbose --prefer-loose origin main > pull-output.txt
+peak=$(sed -n -e 's/^At most \([0-9]*\) requests in flight$/\1/p' pull-output.txt)
+test "${peak}" -ge 1 -a "${peak}" -le 3 || (echo 1>&2 "peak of '${peak}' requests outside 1..3"; exit 1)
+${CMD_PREFIX} ostree --repo=repo fsck
+echo "ok pull multiple connections"
+
+cd ${test_tmpdir}
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo unpack
+rm -rf repo
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo remote add origin $(cat httpd-address)/ostree/gnomerepo
+mkdir repo/tmp/pull-resume-origin
+# Complete files: the server has nothing left to send for them
+for content in ostree-srv/gnomerepo/objects/*/*.filecontent; do
+    prefix=$(basename $(dirname ${content}))
+    cp ${content} repo/tmp/pull-resume-origin/${prefix}$(basename ${content})
+done
+${CMD_PREFIX} ostree-pull --repo=repo --prefer-loose origin main > pull-output.txt
+assert_file_has_content pull-output.txt 'Resuming'
+${CMD_PREFIX} ostree --repo=repo fsck
+rm -rf checkout-origin-main
+$OSTREE checkout origin/main checkout-origin-main
+assert_file_has_content checkout-origin-main/baz/cow '^moo$'
+echo "ok pull resume loose"
+
+cd ${test_tmpdir}
+cow=$(${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo ls -C main /baz/cow | awk '{ print $5 }')
+cow_meta=ostree-srv/gnomerepo/objects/${cow:0:2}/${cow:2}.file
+mv ${cow_meta} cow.file
+truncate -s 65M ${cow_meta}
+rm -rf repo
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo remote add origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree-pull --repo=repo --prefer-loose origin main > pull-output.txt 2>&1 && (echo 1>&2 "pull of oversized file metadata unexpectedly succeeded"; exit 1)
+assert_file_has_content pull-output.txt "Metadata of file object ${cow} exceeds maximum size"
+mv cow.file ${cow_meta}
+echo "ok pull oversized file metadata"